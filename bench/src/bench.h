@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: MIT */
+/**
+ * Copyright 2022 Martin Schröder <info@swedishembedded.com>
+ * Consulting: https://swedishembedded.com/consulting
+ * Simulation: https://swedishembedded.com/simulation
+ * Training: https://swedishembedded.com/training
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define BENCH_MAX_SIZE 256
+
+/*
+ * One benchmarked library function.
+ * setup() creates the input data once for every size.
+ * prepare() restores the inputs that run() overwrites. It is timed separately and
+ * subtracted from the result, so it may be NULL for functions that leave their inputs intact.
+ * flops() returns the nominal flop count of the textbook algorithm for size n, so that
+ * GFLOP/s is an effective rate that can be compared between implementations.
+ * It is NULL when no meaningful flop count exists.
+ */
+struct bench_kernel {
+	const char *name;
+	uint16_t min_size;
+	uint16_t max_size;
+	void (*setup)(uint16_t n);
+	void (*prepare)(uint16_t n);
+	void (*run)(uint16_t n);
+	double (*flops)(double n);
+};
+
+extern const struct bench_kernel bench_kernels[];
+extern const uint16_t bench_kernel_count;
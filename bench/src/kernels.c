@@ -0,0 +1,1194 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Copyright 2022 Martin Schröder <info@swedishembedded.com>
+ * Consulting: https://swedishembedded.com/consulting
+ * Simulation: https://swedishembedded.com/simulation
+ * Training: https://swedishembedded.com/training
+ */
+
+#include <math.h>
+#include <string.h>
+#include <control/ai.h>
+#include <control/linalg.h>
+#include <control/controller.h>
+#include <control/filter.h>
+#include <control/optimization.h>
+#include <control/sysid.h>
+
+#include "bench.h"
+
+/*
+ * Buffers are large enough for a 2n*2n matrix at the largest size.
+ * in_* hold the inputs created by setup(), the rest is scratch for the kernels.
+ */
+#define BENCH_BUFFER (4 * BENCH_MAX_SIZE * BENCH_MAX_SIZE)
+
+static float in_a[BENCH_BUFFER];
+static float in_b[BENCH_BUFFER];
+static float in_c[BENCH_BUFFER];
+static float in_d[BENCH_BUFFER];
+static float a[BENCH_BUFFER];
+static float b[BENCH_BUFFER];
+static float c[BENCH_BUFFER];
+static float d[BENCH_BUFFER];
+static float e[BENCH_BUFFER];
+static uint16_t P[BENCH_MAX_SIZE];
+static uint8_t count;
+
+/* Static pool for the *_ws kernels, which then run without growing the stack */
+static uint8_t pool[4 * BENCH_BUFFER * sizeof(float)];
+static struct ctl_workspace ws;
+
+static uint32_t seed;
+
+/*
+ * Deterministic uniform random number in [-1, 1] so that every run sees the same data
+ */
+static float uniform(void)
+{
+	seed = seed * 1664525u + 1013904223u;
+	return (float)(seed >> 8) / (float)(1u << 23) - 1.0f;
+}
+
+static void fill_random(float A[], uint32_t length)
+{
+	for (uint32_t i = 0; i < length; i++)
+		A[i] = uniform();
+}
+
+/*
+ * A = R + n*I, diagonally dominant and therefore well conditioned
+ */
+static void fill_nonsingular(float A[], uint16_t n)
+{
+	fill_random(A, n * n);
+	for (uint16_t i = 0; i < n; i++)
+		A[i * n + i] += n;
+}
+
+/*
+ * A = R'*R + n*I, symmetric positive definite
+ */
+static void fill_spd(float A[], uint16_t n)
+{
+	fill_random(e, n * n);
+	for (uint16_t i = 0; i < n; i++)
+		for (uint16_t j = 0; j <= i; j++) {
+			float s = 0;
+
+			for (uint16_t k = 0; k < n; k++)
+				s += e[k * n + i] * e[k * n + j];
+			A[i * n + j] = s;
+			A[j * n + i] = s;
+		}
+	for (uint16_t i = 0; i < n; i++)
+		A[i * n + i] += n;
+}
+
+/*
+ * Random matrix scaled so the spectral radius stays well below one
+ */
+static void fill_stable(float A[], uint16_t n)
+{
+	fill_random(A, n * n);
+	for (uint32_t i = 0; i < (uint32_t)n * n; i++)
+		A[i] *= 0.5f / sqrtf(n);
+}
+
+static void setup_random(uint16_t n)
+{
+	seed = n;
+	fill_random(in_a, n * n);
+	fill_random(in_b, n * n);
+	fill_random(in_c, n);
+}
+
+static void setup_nonsingular(uint16_t n)
+{
+	setup_random(n);
+	fill_nonsingular(in_a, n);
+}
+
+static void setup_spd(uint16_t n)
+{
+	setup_random(n);
+	fill_spd(in_a, n);
+}
+
+static void setup_triangular(uint16_t n)
+{
+	setup_nonsingular(n);
+	memcpy(in_b, in_a, n * n * sizeof(float));
+	for (uint16_t i = 0; i < n; i++)
+		for (uint16_t j = 0; j < n; j++) {
+			if (j > i)
+				in_a[i * n + j] = 0; // Lower
+			if (j < i)
+				in_b[i * n + j] = 0; // Upper
+		}
+}
+
+static void setup_stable(uint16_t n)
+{
+	setup_random(n);
+	fill_stable(in_a, n);
+	fill_spd(in_b, n);
+}
+
+static void prepare_a(uint16_t n)
+{
+	memcpy(a, in_a, n * n * sizeof(float));
+}
+
+static void prepare_ab(uint16_t n)
+{
+	memcpy(a, in_a, n * n * sizeof(float));
+	memcpy(b, in_c, n * sizeof(float));
+}
+
+/* Nominal flop counts */
+static double flops_n2(double n)
+{
+	return n * n;
+}
+
+static double flops_3n2(double n)
+{
+	return 3 * n * n;
+}
+
+static double flops_4n2(double n)
+{
+	return 4 * n * n;
+}
+
+static double flops_6n2(double n)
+{
+	return 6 * n * n;
+}
+
+static double flops_10n2(double n)
+{
+	return 10 * n * n;
+}
+
+static double flops_n3(double n)
+{
+	return n * n * n;
+}
+
+static double flops_n3_3(double n)
+{
+	return n * n * n / 3;
+}
+
+static double flops_2n3_3(double n)
+{
+	return 2 * n * n * n / 3;
+}
+
+static double flops_4n3_3(double n)
+{
+	return 4 * n * n * n / 3;
+}
+
+static double flops_2n3(double n)
+{
+	return 2 * n * n * n;
+}
+
+static double flops_8n3_3(double n)
+{
+	return 8 * n * n * n / 3;
+}
+
+static double flops_qr_r(double n)
+{
+	// Householder R of a 3n*n matrix: 2mn^2 - 2n^3/3
+	return 2 * 3 * n * n * n - 2 * n * n * n / 3;
+}
+
+static double flops_eig(double n)
+{
+	return 10 * n * n * n;
+}
+
+static double flops_eig_sym(double n)
+{
+	return 9 * n * n * n;
+}
+
+static double flops_svd(double n)
+{
+	return 22 * n * n * n;
+}
+
+static double flops_pinv(double n)
+{
+	return 24 * n * n * n;
+}
+
+static double flops_expm(double n)
+{
+	// Pade(13): six products and one solve
+	return 6 * 2 * n * n * n + 8 * n * n * n / 3;
+}
+
+static double flops_c2d(double n)
+{
+	// Pade(13) on the top block row [n*2n] of the augmented matrix
+	return 6 * 2 * n * n * 2 * n + 2 * n * n * n / 3 + 2 * n * n * 2 * n;
+}
+
+static double flops_dlyap(double n)
+{
+	// Smith doubling: about 8 steps of two products and a half one for a random stable A
+	return 8 * 5 * n * n * n;
+}
+
+/* Linear algebra */
+static void run_mul(uint16_t n)
+{
+	mul(in_a, in_b, c, n, n, n);
+}
+
+static void run_tran(uint16_t n)
+{
+	tran(a, n, n);
+}
+
+static void run_inv(uint16_t n)
+{
+	inv(a, n);
+}
+
+static void run_lup(uint16_t n)
+{
+	lup(in_a, c, P, n);
+}
+
+static void run_det(uint16_t n)
+{
+	d[0] = det(in_a, n);
+}
+
+static void run_linsolve_lup(uint16_t n)
+{
+	linsolve_lup(in_a, c, in_c, n);
+}
+
+static void run_lu_factor(uint16_t n)
+{
+	lu_factor(a, P, n);
+}
+
+/*
+ * in_d holds the factors of in_a, every run solves for the n columns of in_b
+ */
+static void setup_lu_solve(uint16_t n)
+{
+	setup_nonsingular(n);
+	memcpy(in_d, in_a, n * n * sizeof(float));
+	lu_factor(in_d, P, n);
+}
+
+static void prepare_lu_solve(uint16_t n)
+{
+	memcpy(b, in_b, n * n * sizeof(float));
+}
+
+static void run_lu_solve_multi(uint16_t n)
+{
+	lu_solve_multi(in_d, P, b, n, n);
+}
+
+static void run_linsolve_gauss(uint16_t n)
+{
+	linsolve_gauss(a, c, b, n, n, 0.1f);
+}
+
+static void run_linsolve_qr(uint16_t n)
+{
+	linsolve_qr(in_a, c, in_c, n, n);
+}
+
+static void run_linsolve_chol(uint16_t n)
+{
+	linsolve_chol(in_a, c, in_c, n);
+}
+
+static void run_linsolve_lower_triangular(uint16_t n)
+{
+	linsolve_lower_triangular(in_a, c, in_c, n);
+}
+
+static void run_linsolve_upper_triangular(uint16_t n)
+{
+	linsolve_upper_triangular(in_b, c, in_c, n);
+}
+
+/*
+ * Upper triangular in_b with n right hand sides in in_d
+ */
+static void setup_trsm(uint16_t n)
+{
+	setup_triangular(n);
+	fill_random(in_d, n * n);
+}
+
+static void prepare_trsm(uint16_t n)
+{
+	memcpy(b, in_d, n * n * sizeof(float));
+}
+
+static void run_trsm(uint16_t n)
+{
+	trsm(true, true, false, in_b, b, n, n);
+}
+
+static void run_qr(uint16_t n)
+{
+	qr(in_a, c, d, n, n, false);
+}
+
+static void setup_qr_r(uint16_t n)
+{
+	seed = n;
+	fill_random(in_a, 3 * n * n);
+}
+
+static void run_qr_r(uint16_t n)
+{
+	// The tall, R only decomposition used by the SR-UKF
+	qr(in_a, c, d, 3 * n, n, true);
+}
+
+static void run_chol(uint16_t n)
+{
+	chol(in_a, c, n);
+}
+
+static void run_chol_factor(uint16_t n)
+{
+	chol_factor(a, n);
+}
+
+static void run_ldl_factor(uint16_t n)
+{
+	ldl_factor(a, d, n);
+}
+
+/*
+ * in_d holds the lower triangular factor of in_a, the updates are the rows of in_b
+ */
+static void setup_cholupdate(uint16_t n)
+{
+	setup_spd(n);
+	chol(in_a, in_d, n);
+	for (uint16_t i = 0; i < n; i++)
+		in_c[i] *= 0.5f;
+}
+
+static void prepare_cholupdate(uint16_t n)
+{
+	memcpy(a, in_d, n * n * sizeof(float));
+	memcpy(b, in_c, n * sizeof(float));
+}
+
+static void run_cholupdate(uint16_t n)
+{
+	cholupdate(a, b, n, true);
+}
+
+static void prepare_cholupdate_k(uint16_t n)
+{
+	memcpy(a, in_d, n * n * sizeof(float));
+	memcpy(b, in_b, n * n * sizeof(float));
+}
+
+static void run_cholupdate_k(uint16_t n)
+{
+	cholupdate_k(a, b, n, n, true);
+}
+
+// in_d holds the upper triangular factor instead
+static void setup_cholupdate_upper(uint16_t n)
+{
+	setup_cholupdate(n);
+	tran(in_d, n, n);
+}
+
+static void run_cholupdate_k_upper(uint16_t n)
+{
+	cholupdate_k_upper(a, b, n, n, true);
+}
+
+static void run_svd_golub_reinsch(uint16_t n)
+{
+	svd_golub_reinsch(a, n, n, c, d, e);
+}
+
+static void run_svd_jacobi_one_sided(uint16_t n)
+{
+	svd_jacobi_one_sided(a, n, MAX_ITERATION_COUNT_SVD, c, d, e);
+}
+
+static void run_eig(uint16_t n)
+{
+	eig(a, c, d, n);
+}
+
+static void run_eig_sym(uint16_t n)
+{
+	eig_sym(a, n, c);
+}
+
+static void run_pinv(uint16_t n)
+{
+	pinv(a, n, n);
+}
+
+static void setup_expm(uint16_t n)
+{
+	setup_random(n);
+	for (uint32_t i = 0; i < (uint32_t)n * n; i++)
+		in_a[i] /= n;
+}
+
+static void run_expm(uint16_t n)
+{
+	expm(a, n);
+}
+
+static void run_dlyap(uint16_t n)
+{
+	dlyap(in_a, c, in_b, n);
+}
+
+static void run_balance(uint16_t n)
+{
+	balance(a, n);
+}
+
+static void run_norm1(uint16_t n)
+{
+	d[0] = norm(a, n, n, 1);
+}
+
+static void run_norm2(uint16_t n)
+{
+	d[0] = norm(a, n, n, 2);
+}
+
+static void run_sum(uint16_t n)
+{
+	sum(a, n, n, 1);
+}
+
+/* Controllers */
+#define MPC_ADIM 2
+
+static void setup_mpc(uint16_t n)
+{
+	// The integrating model from the controller tests, n is the horizon
+	const float A[MPC_ADIM * MPC_ADIM] = { 1.71653, 1.00000, -0.71653, 0.00000 };
+	const float B[MPC_ADIM] = { 0.18699, 0.16734 };
+	const float C[MPC_ADIM] = { 1, 0 };
+
+	(void)n;
+	memcpy(in_a, A, sizeof(A));
+	memcpy(in_b, B, sizeof(B));
+	memcpy(in_c, C, sizeof(C));
+	memset(in_d, 0, MPC_ADIM * sizeof(float));
+}
+
+static void run_mpc(uint16_t n)
+{
+	float r[1] = { 12.5f };
+
+	mpc(in_a, in_b, in_c, in_d, d, r, MPC_ADIM, 1, 1, n, 200, true);
+}
+
+static void setup_mpc_ws(uint16_t n)
+{
+	setup_mpc(n);
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+}
+
+static void run_mpc_ws(uint16_t n)
+{
+	float r[1] = { 12.5f };
+
+	mpc_ws(in_a, in_b, in_c, in_d, d, r, MPC_ADIM, 1, 1, n, 200, true, &ws);
+}
+
+static struct mpc_ctx mpc_context;
+
+static void setup_mpc_step(uint16_t n)
+{
+	setup_mpc_ws(n);
+	mpc_init(&mpc_context, in_a, in_b, in_c, MPC_ADIM, 1, 1, n, 200, true, &ws);
+}
+
+static void run_mpc_step(uint16_t n)
+{
+	float r[1] = { 12.5f };
+
+	(void)n;
+	mpc_step(&mpc_context, in_d, d, r, &ws);
+}
+
+static void setup_mpc_qp(uint16_t n)
+{
+	float umin[1] = { -1.0f };
+	float umax[1] = { 1.0f };
+	float du_max[1] = { 0.2f };
+
+	setup_mpc_step(n);
+	mpc_constrain(&mpc_context, umin, umax, du_max, 0.1f, &ws);
+}
+
+static struct mpc_riccati_ctx mpc_riccati_context;
+
+static void setup_mpc_riccati(uint16_t n)
+{
+	float umin[1] = { -1.0f };
+	float umax[1] = { 1.0f };
+	float du_max[1] = { 0.2f };
+
+	setup_mpc_ws(n);
+	mpc_riccati_init(&mpc_riccati_context, in_a, in_b, in_c, MPC_ADIM, 1, 1, n, 0.1f, umin,
+			 umax, du_max, 1.0f, 200, &ws);
+}
+
+static void run_mpc_riccati(uint16_t n)
+{
+	float r[1] = { 12.5f };
+
+	(void)n;
+	mpc_riccati_step(&mpc_riccati_context, in_d, d, r, &ws);
+}
+
+static void setup_kalman(uint16_t n)
+{
+	setup_stable(n);
+	fill_random(in_c, n * n); // C
+	fill_random(in_d, n * n); // K
+	for (uint32_t i = 0; i < (uint32_t)n * n; i++)
+		in_d[i] *= 0.1f / n;
+	fill_random(a, n);
+	fill_random(b, n);
+	fill_random(c, n);
+}
+
+static void run_kalman(uint16_t n)
+{
+	// x is fed back, A - KC is stable so it stays bounded
+	kalman(in_a, in_b, in_c, in_d, b, a, c, n, n, n);
+}
+
+static void setup_lqi(uint16_t n)
+{
+	setup_random(n);
+	fill_random(in_d, n * n);
+	fill_random(a, n);
+	memset(b, 0, n * sizeof(float));
+	fill_random(c, n);
+}
+
+static void run_lqi(uint16_t n)
+{
+	lqi(c, d, 0.1f, in_c, in_a, in_d, a, b, n, n, n, 2);
+}
+
+static struct kalman_ctx kalman_context;
+static struct lqi_ctx lqi_context;
+
+static void setup_kalman_step(uint16_t n)
+{
+	setup_kalman(n);
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	kalman_init(&kalman_context, in_a, in_b, in_c, in_d, n, n, n, &ws);
+}
+
+static void run_kalman_step(uint16_t n)
+{
+	(void)n;
+	kalman_step(&kalman_context, b, a, c);
+}
+
+static void setup_lqi_step(uint16_t n)
+{
+	setup_lqi(n);
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	lqi_init(&lqi_context, in_a, in_d, 0.1f, n, n, n, 2, &ws);
+}
+
+static void run_lqi_step(uint16_t n)
+{
+	(void)n;
+	lqi_step(&lqi_context, c, d, in_c, a);
+}
+
+static void setup_lqi_kalman(uint16_t n)
+{
+	setup_kalman_step(n);
+	fill_random(e, n * n); // L
+	for (uint32_t i = 0; i < (uint32_t)n * n; i++)
+		e[i] *= 0.1f / n;
+	lqi_init(&lqi_context, e, in_d, 0.1f, n, n, n, 2, &ws);
+}
+
+static void run_lqi_kalman(uint16_t n)
+{
+	(void)n;
+	// The measurement c stays fixed, the loop is closed through the estimate a only
+	lqi_kalman_step(&lqi_context, &kalman_context, c, b, in_c, a);
+}
+
+static void setup_c2d(uint16_t n)
+{
+	setup_expm(n);
+	fill_random(in_b, n * n);
+}
+
+static void prepare_c2d(uint16_t n)
+{
+	memcpy(a, in_a, n * n * sizeof(float));
+	memcpy(b, in_b, n * n * sizeof(float));
+}
+
+static void run_c2d(uint16_t n)
+{
+	c2d(a, b, n, n, 0.5f);
+}
+
+static void run_stability(uint16_t n)
+{
+	d[0] = stability(a, n);
+}
+
+static void setup_mrac(uint16_t n)
+{
+	setup_random(n);
+	memset(a, 0, n * sizeof(float));
+	memset(b, 0, n * sizeof(float));
+}
+
+static void run_mrac(uint16_t n)
+{
+	mrac(1, 0.001f, in_b, c, in_c, a, b, n);
+}
+
+/* Filters and system identification */
+static uint16_t ukf_length;
+
+static void transition(float dx[], float x[], float u[])
+{
+	dx[0] = 0.9f * x[0] + u[0];
+	for (uint16_t i = 1; i < ukf_length; i++)
+		dx[i] = 0.9f * x[i] + 0.05f * x[i - 1] + u[i];
+}
+
+static void parameter_model(float dw[], float x[], float w[])
+{
+	for (uint16_t i = 0; i < ukf_length; i++)
+		dw[i] = w[i] * x[i];
+}
+
+static void setup_ukf(uint16_t n)
+{
+	setup_random(n);
+	ukf_length = n;
+
+	// Rn and Rv diagonal, S = 0.1*I
+	memset(in_a, 0, n * n * sizeof(float));
+	memset(in_b, 0, n * n * sizeof(float));
+	memset(in_d, 0, n * n * sizeof(float));
+	for (uint16_t i = 0; i < n; i++) {
+		in_a[i * n + i] = 0.01f;
+		in_b[i * n + i] = 0.01f;
+		in_d[i * n + i] = 0.1f;
+	}
+	fill_random(e, n); // u and x
+	fill_random(d, n); // y and d
+}
+
+static void prepare_ukf(uint16_t n)
+{
+	memcpy(a, in_d, n * n * sizeof(float));
+	memcpy(b, in_c, n * sizeof(float));
+}
+
+static void run_sr_ukf_state_estimation(uint16_t n)
+{
+	sr_ukf_state_estimation(d, b, in_a, in_b, e, transition, a, 0.1f, 2.0f, n);
+}
+
+static void setup_ukf_ws(uint16_t n)
+{
+	setup_ukf(n);
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+}
+
+static void run_sr_ukf_state_estimation_ws(uint16_t n)
+{
+	sr_ukf_state_estimation_ws(d, b, in_a, in_b, e, transition, a, 0.1f, 2.0f, n, &ws);
+}
+
+static void run_sr_ukf_parameter_estimation(uint16_t n)
+{
+	sr_ukf_parameter_estimation(d, b, in_a, e, parameter_model, 0.995f, a, 0.1f, 2.0f, n);
+}
+
+static void setup_rls(uint16_t n)
+{
+	setup_random(n);
+	count = 0;
+	rls(n / 3, n / 3, n - 2 * (n / 3), a, 0, 0, &count, &d[0], &d[1], &d[2], b, c, 1000.0f,
+	    1.0f);
+}
+
+static void run_rls(uint16_t n)
+{
+	rls(n / 3, n / 3, n - 2 * (n / 3), a, uniform(), uniform(), &count, &d[0], &d[1], &d[2], b,
+	    c, 1000.0f, 1.0f);
+}
+
+static void setup_rls_ud(uint16_t n)
+{
+	setup_random(n);
+	count = 0;
+	rls_ud(n / 3, n / 3, n - 2 * (n / 3), a, 0, 0, &count, &d[0], &d[1], &d[2], b, c, 1000.0f,
+	       1.0f);
+}
+
+static void run_rls_ud(uint16_t n)
+{
+	rls_ud(n / 3, n / 3, n - 2 * (n / 3), a, uniform(), uniform(), &count, &d[0], &d[1], &d[2],
+	       b, c, 1000.0f, 1.0f);
+}
+
+static void setup_rls_packed(uint16_t n)
+{
+	setup_random(n);
+	count = 0;
+	rls_packed(n / 3, n / 3, n - 2 * (n / 3), a, 0, 0, &count, &d[0], &d[1], &d[2], b, c,
+		   1000.0f, 1.0f);
+}
+
+static void run_rls_packed(uint16_t n)
+{
+	rls_packed(n / 3, n / 3, n - 2 * (n / 3), a, uniform(), uniform(), &count, &d[0], &d[1],
+		   &d[2], b, c, 1000.0f, 1.0f);
+}
+
+/* n channels of order (2, 2, 2), one rls_packed per channel against one bank */
+#define RLS_BANK_ORDER 6
+
+static struct rls_bank rls_bank_context;
+static uint8_t rls_counts[BENCH_MAX_SIZE];
+
+static void setup_rls_channels(uint16_t n)
+{
+	setup_random(n);
+	memset(rls_counts, 0, sizeof(rls_counts));
+	fill_random(e, n);
+}
+
+static void run_rls_channels(uint16_t n)
+{
+	for (uint16_t i = 0; i < n; i++) {
+		float *state = &c[i * 64];
+
+		rls_packed(2, 2, 2, &state[0], e[i], uniform(), &rls_counts[i], &state[6],
+			   &state[7], &state[8], &state[9], &state[15], 1000.0f, 1.0f);
+	}
+}
+
+static void setup_rls_bank(uint16_t n)
+{
+	setup_random(n);
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	rls_bank_init(&rls_bank_context, 2, 2, 2, n, 1000.0f, 1.0f, &ws);
+	fill_random(e, n);
+}
+
+static void run_rls_bank(uint16_t n)
+{
+	for (uint16_t i = 0; i < n; i++)
+		d[i] = uniform();
+	rls_bank_update(&rls_bank_context, e, d);
+}
+
+static double flops_rls_bank(double n)
+{
+	// Per channel: phi'*theta, P*phi, phi'*P*phi, the packed update and theta
+	double order = RLS_BANK_ORDER;
+
+	return n * (2 * order + 2 * order * order + 2 * order + 1.5 * order * (order + 1) +
+		    2 * order);
+}
+
+/* An FIR model of n taps, rls_packed would be O(n^2) for it */
+static struct rls_ftf rls_ftf_context;
+
+static void setup_rls_ftf(uint16_t n)
+{
+	setup_random(n);
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	rls_ftf_init(&rls_ftf_context, n, 1000.0f, 1.0f - 1.0f / (4.0f * n), &ws);
+}
+
+static void run_rls_ftf(uint16_t n)
+{
+	(void)n;
+	rls_ftf_update(&rls_ftf_context, uniform(), uniform());
+}
+
+static double flops_rls_ftf(double n)
+{
+	// Three dot products and five axpy like loops over n
+	return 16 * n;
+}
+
+static void setup_okid(uint16_t n)
+{
+	// n is the number of samples divided by 16
+	seed = n;
+	fill_random(in_a, 16 * n);
+	fill_random(in_b, 16 * n);
+	for (uint16_t i = 0; i < 16 * n; i++)
+		in_a[i] *= 0.1f;
+	in_a[0] = 1.0f;
+}
+
+static void run_okid(uint16_t n)
+{
+	okid(in_a, in_b, c, 1, 16 * n);
+}
+
+static void setup_okid_ws(uint16_t n)
+{
+	setup_okid(n);
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+}
+
+static void run_okid_ws(uint16_t n)
+{
+	okid_ws(in_a, in_b, c, 1, 16 * n, &ws);
+}
+
+static void run_okid_fft(uint16_t n)
+{
+	okid_fft(in_a, in_b, c, 1, 16 * n, 1e-3f);
+}
+
+static void run_okid_observer(uint16_t n)
+{
+	okid_observer(in_a, in_b, c, 1, 16 * n, 8);
+}
+
+static double flops_okid(double n)
+{
+	return 16 * n * 16 * n;
+}
+
+static void setup_era(uint16_t n)
+{
+	seed = n;
+	fill_random(in_a, n);
+	fill_random(in_b, n);
+	for (uint16_t i = 0; i < n; i++)
+		in_a[i] *= 0.1f;
+	in_a[0] = 1.0f;
+}
+
+static void run_era(uint16_t n)
+{
+	era(in_a, in_b, 1, n, c, d, e, 2, 1);
+}
+
+static void setup_filtfilt(uint16_t n)
+{
+	// n is the number of samples divided by 16
+	seed = n;
+	fill_random(in_a, 16 * n);
+	for (uint16_t i = 0; i < 16 * n; i++)
+		in_b[i] = 0.01f * i;
+}
+
+static void prepare_filtfilt(uint16_t n)
+{
+	memcpy(a, in_a, 16 * n * sizeof(float));
+}
+
+static void run_filtfilt(uint16_t n)
+{
+	filtfilt(a, in_b, 16 * n, 0.1f);
+}
+
+/* Optimization */
+static void setup_linprog(uint16_t n)
+{
+	setup_random(n);
+	for (uint32_t i = 0; i < (uint32_t)n * n; i++)
+		in_a[i] = fabsf(in_a[i]) + 0.1f;
+	for (uint16_t i = 0; i < n; i++) {
+		in_c[i] = fabsf(in_c[i]) + 0.1f;
+		in_d[i] = 1.0f;
+	}
+}
+
+static void run_linprog(uint16_t n)
+{
+	linprog(in_c, in_a, in_d, c, n, n, 0, 200);
+}
+
+static void setup_simplex(uint16_t n)
+{
+	setup_linprog(n);
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+}
+
+static void run_simplex(uint16_t n)
+{
+	simplex_ws(in_c, in_a, in_d, c, n, n, 1000, &ws);
+}
+
+/* n*n grid with 20 % obstacles, from one corner to the other with 8-connectivity */
+static int grid[BENCH_MAX_SIZE * BENCH_MAX_SIZE];
+static int path_x[BENCH_MAX_SIZE * BENCH_MAX_SIZE];
+static int path_y[BENCH_MAX_SIZE * BENCH_MAX_SIZE];
+
+static void setup_astar(uint16_t n)
+{
+	seed = n;
+	for (uint32_t i = 0; i < (uint32_t)n * n; i++)
+		grid[i] = uniform() < -0.6f ? -1 : 0;
+	grid[0] = 0;
+	grid[n * n - 1] = 0;
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+}
+
+static void run_astar(uint16_t n)
+{
+	int steps;
+
+	astar_ws(grid, path_x, path_y, 0, 0, n - 1, n - 1, n, n, 8, &steps, &ws);
+}
+
+/* Rows of shelves 2 cells deep and 12 long with aisles between them, like a warehouse */
+static void setup_warehouse(uint16_t n)
+{
+	memset(grid, 0, (size_t)n * n * sizeof(int));
+	for (uint16_t y = 4; y + 5 < n; y += 5)
+		for (uint16_t x = 4; x + 4 < n; x++)
+			if (x % 16 < 12) {
+				grid[y * n + x] = -1;
+				grid[(y + 1) * n + x] = -1;
+			}
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+}
+
+static void run_jps(uint16_t n)
+{
+	int steps;
+
+	jps_ws(grid, path_x, path_y, 0, 0, n - 1, n - 1, n, n, &steps, &ws);
+}
+
+/* A pallet that comes and goes in the middle of the planned path through the warehouse */
+static struct dstar_lite dstar_lite_context;
+static int pallet_x;
+static int pallet_y;
+
+static void setup_dstar_lite(uint16_t n)
+{
+	int steps;
+
+	setup_warehouse(n);
+	dstar_lite_init(&dstar_lite_context, grid, n, n, 8, 0, 0, n - 1, n - 1, &ws);
+	dstar_lite_plan(&dstar_lite_context, path_x, path_y, &steps);
+	pallet_x = path_x[steps / 2];
+	pallet_y = path_y[steps / 2];
+}
+
+static void run_dstar_lite(uint16_t n)
+{
+	int steps;
+
+	grid[pallet_y * n + pallet_x] = grid[pallet_y * n + pallet_x] == -1 ? 0 : -1;
+	dstar_lite_update_cell(&dstar_lite_context, pallet_x, pallet_y);
+	dstar_lite_plan(&dstar_lite_context, path_x, path_y, &steps);
+}
+
+/* 4096 points against a ragged circle of n points */
+#define POLYGON_QUERIES 4096
+static struct polygon polygon;
+static uint8_t inside[POLYGON_QUERIES];
+
+static void setup_polygon(uint16_t n)
+{
+	setup_random(n);
+	for (uint16_t i = 0; i < n; i++) {
+		float r = 1.0f + 0.2f * in_a[i];
+
+		in_c[i] = r * cosf(2 * (float)M_PI * i / n);
+		in_d[i] = r * sinf(2 * (float)M_PI * i / n);
+	}
+	for (uint16_t i = 0; i < POLYGON_QUERIES; i++) {
+		a[i] = 1.2f * uniform();
+		b[i] = 1.2f * uniform();
+	}
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	polygon_prepare(&polygon, in_c, in_d, n, &ws);
+}
+
+static void run_inpolygon(uint16_t n)
+{
+	for (uint16_t i = 0; i < POLYGON_QUERIES; i++)
+		inside[i] = inpolygon(a[i], b[i], in_c, in_d, n);
+}
+
+static void run_inpolygon_many(uint16_t n)
+{
+	(void)n;
+	inpolygon_many(&polygon, a, b, inside, POLYGON_QUERIES);
+}
+
+/* 4096 positions against n hexagonal zones that together cover about half of the area */
+static struct geofence *geofence;
+static uint32_t zone_points[BENCH_MAX_SIZE];
+
+static void setup_geofence(uint16_t n)
+{
+	float r = 0.5f / sqrtf(n);
+	uint16_t side = 1;
+
+	setup_random(n);
+	for (uint16_t z = 0; z < n; z++) {
+		float cx = uniform();
+		float cy = uniform();
+
+		zone_points[z] = 6;
+		for (uint16_t i = 0; i < 6; i++) {
+			in_c[z * 6 + i] = cx + r * cosf((float)M_PI * i / 3);
+			in_d[z * 6 + i] = cy + r * sinf((float)M_PI * i / 3);
+		}
+	}
+	for (uint16_t i = 0; i < POLYGON_QUERIES; i++) {
+		a[i] = uniform();
+		b[i] = uniform();
+	}
+	while (side * side < n)
+		side++;
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	geofence_build(&geofence, in_c, in_d, zone_points, n, 2 * side, 2 * side, &ws);
+}
+
+static void run_geofence_scan(uint16_t n)
+{
+	for (uint16_t i = 0; i < POLYGON_QUERIES; i++)
+		for (uint16_t z = 0; z < n; z++)
+			if (inpolygon(a[i], b[i], &in_c[z * 6], &in_d[z * 6], 6))
+				break;
+}
+
+static void run_geofence(uint16_t n)
+{
+	uint32_t zone;
+
+	(void)n;
+	for (uint16_t i = 0; i < POLYGON_QUERIES; i++)
+		geofence_query(geofence, a[i], b[i], &zone, 1);
+}
+
+/*
+ * Sizes are capped where the current implementation would take seconds per call
+ * or exceed the dimension limits of its interface (uint8_t sizes).
+ */
+const struct bench_kernel bench_kernels[] = {
+	{ "mul", 2, 256, setup_random, NULL, run_mul, flops_2n3 },
+	{ "tran", 2, 256, setup_random, prepare_a, run_tran, NULL },
+	{ "inv", 2, 256, setup_nonsingular, prepare_a, run_inv, flops_2n3 },
+	{ "lup", 2, 256, setup_nonsingular, NULL, run_lup, flops_2n3_3 },
+	{ "det", 2, 256, setup_nonsingular, NULL, run_det, flops_2n3_3 },
+	{ "linsolve_lup", 2, 256, setup_nonsingular, NULL, run_linsolve_lup, flops_2n3_3 },
+	{ "lu_factor", 2, 256, setup_nonsingular, prepare_a, run_lu_factor, flops_2n3_3 },
+	{ "lu_solve_multi", 2, 256, setup_lu_solve, prepare_lu_solve, run_lu_solve_multi,
+	  flops_2n3 },
+	{ "linsolve_gauss", 2, 256, setup_nonsingular, prepare_ab, run_linsolve_gauss, flops_8n3_3 },
+	{ "linsolve_qr", 2, 128, setup_nonsingular, NULL, run_linsolve_qr, flops_4n3_3 },
+	{ "linsolve_chol", 2, 256, setup_spd, NULL, run_linsolve_chol, flops_n3_3 },
+	{ "linsolve_lower_triangular", 2, 256, setup_triangular, NULL,
+	  run_linsolve_lower_triangular, flops_n2 },
+	{ "linsolve_upper_triangular", 2, 256, setup_triangular, NULL,
+	  run_linsolve_upper_triangular, flops_n2 },
+	{ "trsm", 2, 256, setup_trsm, prepare_trsm, run_trsm, flops_n3 },
+	{ "qr", 2, 128, setup_random, NULL, run_qr, flops_8n3_3 },
+	{ "qr_r", 2, 64, setup_qr_r, NULL, run_qr_r, flops_qr_r },
+	{ "chol", 2, 256, setup_spd, NULL, run_chol, flops_n3_3 },
+	{ "chol_factor", 2, 256, setup_spd, prepare_a, run_chol_factor, flops_n3_3 },
+	{ "ldl_factor", 2, 256, setup_spd, prepare_a, run_ldl_factor, flops_n3_3 },
+	{ "cholupdate", 2, 128, setup_cholupdate, prepare_cholupdate, run_cholupdate, flops_4n2 },
+	{ "cholupdate_k", 2, 128, setup_cholupdate, prepare_cholupdate_k, run_cholupdate_k,
+	  flops_2n3 },
+	{ "cholupdate_k_upper", 2, 128, setup_cholupdate_upper, prepare_cholupdate_k,
+	  run_cholupdate_k_upper, flops_2n3 },
+	{ "svd_golub_reinsch", 2, 256, setup_random, prepare_a, run_svd_golub_reinsch, flops_svd },
+	{ "svd_jacobi_one_sided", 2, 128, setup_random, prepare_a, run_svd_jacobi_one_sided,
+	  flops_svd },
+	{ "eig", 2, 256, setup_random, prepare_a, run_eig, flops_eig },
+	{ "eig_sym", 2, 256, setup_spd, prepare_a, run_eig_sym, flops_eig_sym },
+	{ "pinv", 2, 128, setup_random, prepare_a, run_pinv, flops_pinv },
+	{ "expm", 2, 128, setup_expm, prepare_a, run_expm, flops_expm },
+	{ "dlyap", 2, 256, setup_stable, NULL, run_dlyap, flops_dlyap },
+	{ "balance", 2, 256, setup_random, prepare_a, run_balance, NULL },
+	{ "norm1", 2, 256, setup_random, prepare_a, run_norm1, flops_n2 },
+	{ "norm2", 2, 128, setup_random, prepare_a, run_norm2, flops_svd },
+	{ "sum", 2, 256, setup_random, prepare_a, run_sum, flops_n2 },
+	{ "mpc", 2, 64, setup_mpc, NULL, run_mpc, NULL },
+	{ "mpc_ws", 2, 64, setup_mpc_ws, NULL, run_mpc_ws, NULL },
+	{ "mpc_step", 2, 64, setup_mpc_step, NULL, run_mpc_step, NULL },
+	{ "mpc_qp", 2, 64, setup_mpc_qp, NULL, run_mpc_step, NULL },
+	{ "mpc_riccati", 2, 256, setup_mpc_riccati, NULL, run_mpc_riccati, NULL },
+	{ "kalman", 2, 128, setup_kalman, NULL, run_kalman, flops_10n2 },
+	{ "lqi", 2, 128, setup_lqi, NULL, run_lqi, flops_4n2 },
+	{ "kalman_step", 2, 128, setup_kalman_step, NULL, run_kalman_step, flops_6n2 },
+	{ "lqi_step", 2, 128, setup_lqi_step, NULL, run_lqi_step, flops_4n2 },
+	{ "lqi_kalman", 2, 128, setup_lqi_kalman, NULL, run_lqi_kalman, flops_10n2 },
+	{ "c2d", 2, 64, setup_c2d, prepare_c2d, run_c2d, flops_c2d },
+	{ "stability", 2, 128, setup_random, prepare_a, run_stability, flops_eig },
+	{ "mrac", 2, 128, setup_mrac, NULL, run_mrac, NULL },
+	{ "sr_ukf_state_estimation", 2, 64, setup_ukf, prepare_ukf, run_sr_ukf_state_estimation,
+	  NULL },
+	{ "sr_ukf_state_estimation_ws", 2, 64, setup_ukf_ws, prepare_ukf,
+	  run_sr_ukf_state_estimation_ws, NULL },
+	{ "sr_ukf_parameter_estimation", 2, 64, setup_ukf, prepare_ukf,
+	  run_sr_ukf_parameter_estimation, NULL },
+	{ "rls", 6, 128, setup_rls, NULL, run_rls, flops_4n2 },
+	{ "rls_ud", 6, 128, setup_rls_ud, NULL, run_rls_ud, flops_3n2 },
+	{ "rls_packed", 6, 128, setup_rls_packed, NULL, run_rls_packed, flops_3n2 },
+	{ "rls_channels", 2, 256, setup_rls_channels, NULL, run_rls_channels, flops_rls_bank },
+	{ "rls_bank", 2, 256, setup_rls_bank, NULL, run_rls_bank, flops_rls_bank },
+	{ "rls_ftf", 8, 256, setup_rls_ftf, NULL, run_rls_ftf, flops_rls_ftf },
+	{ "okid", 2, 256, setup_okid, NULL, run_okid, flops_okid },
+	{ "okid_ws", 2, 256, setup_okid_ws, NULL, run_okid_ws, flops_okid },
+	{ "okid_fft", 2, 256, setup_okid, NULL, run_okid_fft, NULL },
+	{ "okid_observer", 2, 256, setup_okid, NULL, run_okid_observer, NULL },
+	{ "era", 8, 128, setup_era, NULL, run_era, NULL },
+	{ "filtfilt", 2, 256, setup_filtfilt, prepare_filtfilt, run_filtfilt, NULL },
+	{ "linprog", 2, 64, setup_linprog, NULL, run_linprog, NULL },
+	{ "simplex", 2, 256, setup_simplex, NULL, run_simplex, NULL },
+	{ "astar", 16, 256, setup_astar, NULL, run_astar, NULL },
+	{ "astar_warehouse", 16, 256, setup_warehouse, NULL, run_astar, NULL },
+	{ "jps_warehouse", 16, 256, setup_warehouse, NULL, run_jps, NULL },
+	{ "dstar_lite_replan", 16, 256, setup_dstar_lite, NULL, run_dstar_lite, NULL },
+	{ "inpolygon", 4, 128, setup_polygon, NULL, run_inpolygon, NULL },
+	{ "inpolygon_many", 4, 256, setup_polygon, NULL, run_inpolygon_many, NULL },
+	{ "geofence_scan", 4, 256, setup_geofence, NULL, run_geofence_scan, NULL },
+	{ "geofence", 4, 256, setup_geofence, NULL, run_geofence, NULL },
+};
+
+const uint16_t bench_kernel_count = sizeof(bench_kernels) / sizeof(bench_kernels[0]);
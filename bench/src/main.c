@@ -0,0 +1,283 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Copyright 2022 Martin Schröder <info@swedishembedded.com>
+ * Consulting: https://swedishembedded.com/consulting
+ * Simulation: https://swedishembedded.com/simulation
+ * Training: https://swedishembedded.com/training
+ */
+
+/*
+ * Host benchmark for the control library.
+ * Every kernel is swept over the sizes 2, 4, 8 ... 256 and reported with
+ * time per call, effective GFLOP/s and the stack bytes used by one call.
+ *
+ * control_bench [--json] [--quick] [--filter name] [--min-size n] [--max-size n] [--time-ms t]
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+/* Stack the kernels run on when measuring their stack usage */
+#define STACK_PROBE_SIZE (32 * 1024 * 1024)
+#define STACK_PAINT 0xa5
+
+struct bench_options {
+	bool json;
+	const char *filter;
+	uint16_t min_size;
+	uint16_t max_size;
+	double min_time;
+};
+
+struct bench_result {
+	double ns_per_call;
+	double gflops;
+	size_t stack_bytes;
+	uint32_t repetitions;
+};
+
+struct stack_probe {
+	const struct bench_kernel *kernel;
+	uint16_t n;
+};
+
+static uint8_t *probe_stack;
+static size_t probe_dirty;
+static size_t probe_overhead;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *stack_probe_thread(void *arg)
+{
+	struct stack_probe *probe = arg;
+
+	if (probe->kernel) {
+		if (probe->kernel->prepare)
+			probe->kernel->prepare(probe->n);
+		probe->kernel->run(probe->n);
+	}
+	return NULL;
+}
+
+/*
+ * Run the kernel once on a painted stack and return the number of bytes it touched.
+ * Stacks grow downwards, so the first byte that is not paint marks the high water mark.
+ */
+static size_t stack_usage(const struct bench_kernel *kernel, uint16_t n)
+{
+	struct stack_probe probe = { kernel, n };
+	pthread_attr_t attr;
+	pthread_t thread;
+	size_t untouched = 0;
+
+	// Only repaint what the previous run touched
+	memset(probe_stack + STACK_PROBE_SIZE - probe_dirty, STACK_PAINT, probe_dirty);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstack(&attr, probe_stack, STACK_PROBE_SIZE);
+	if (pthread_create(&thread, &attr, stack_probe_thread, &probe) != 0) {
+		pthread_attr_destroy(&attr);
+		return 0;
+	}
+	pthread_join(thread, NULL);
+	pthread_attr_destroy(&attr);
+
+	while (untouched < STACK_PROBE_SIZE && probe_stack[untouched] == STACK_PAINT)
+		untouched++;
+	probe_dirty = STACK_PROBE_SIZE - untouched;
+
+	return probe_dirty > probe_overhead ? probe_dirty - probe_overhead : 0;
+}
+
+static double time_batch(const struct bench_kernel *kernel, uint16_t n, uint32_t repetitions,
+			 bool run)
+{
+	double start = now();
+
+	for (uint32_t i = 0; i < repetitions; i++) {
+		if (kernel->prepare)
+			kernel->prepare(n);
+		if (run)
+			kernel->run(n);
+	}
+	return now() - start;
+}
+
+/*
+ * Find a repetition count that runs for at least min_time, then keep the best of three
+ * batches. The time spent in prepare() is measured on its own and subtracted.
+ */
+static void measure(const struct bench_kernel *kernel, uint16_t n, double min_time,
+		    struct bench_result *result)
+{
+	uint32_t repetitions = 1;
+	double elapsed = time_batch(kernel, n, repetitions, true);
+
+	while (elapsed < min_time && repetitions < (1u << 24)) {
+		double scale = elapsed > 0 ? 1.5 * min_time / elapsed : 16;
+
+		if (scale < 2)
+			scale = 2;
+		if (scale > 16)
+			scale = 16;
+		repetitions = (uint32_t)(repetitions * scale);
+		elapsed = time_batch(kernel, n, repetitions, true);
+	}
+
+	for (uint8_t i = 0; i < 2; i++) {
+		double t = time_batch(kernel, n, repetitions, true);
+
+		if (t < elapsed)
+			elapsed = t;
+	}
+
+	if (kernel->prepare) {
+		double overhead = time_batch(kernel, n, repetitions, false);
+
+		for (uint8_t i = 0; i < 2; i++) {
+			double t = time_batch(kernel, n, repetitions, false);
+
+			if (t < overhead)
+				overhead = t;
+		}
+		elapsed = elapsed > overhead ? elapsed - overhead : 0;
+	}
+
+	result->repetitions = repetitions;
+	result->ns_per_call = elapsed * 1e9 / repetitions;
+	result->gflops = kernel->flops && result->ns_per_call > 0 ?
+				 kernel->flops(n) / result->ns_per_call :
+				 -1;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [--json] [--quick] [--filter name] [--min-size n] [--max-size n]"
+		" [--time-ms t]\n",
+		name);
+}
+
+static bool parse(int argc, char *argv[], struct bench_options *options)
+{
+	options->json = false;
+	options->filter = NULL;
+	options->min_size = 2;
+	options->max_size = BENCH_MAX_SIZE;
+	options->min_time = 0.02;
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (!strcmp(arg, "--json")) {
+			options->json = true;
+		} else if (!strcmp(arg, "--quick")) {
+			options->max_size = 16;
+			options->min_time = 0.001;
+		} else if (!strcmp(arg, "--filter") && has_value) {
+			options->filter = argv[++i];
+		} else if (!strcmp(arg, "--min-size") && has_value) {
+			options->min_size = atoi(argv[++i]);
+		} else if (!strcmp(arg, "--max-size") && has_value) {
+			options->max_size = atoi(argv[++i]);
+		} else if (!strcmp(arg, "--time-ms") && has_value) {
+			options->min_time = atof(argv[++i]) * 1e-3;
+		} else {
+			usage(argv[0]);
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_options options;
+	bool first = true;
+
+	if (!parse(argc, argv, &options))
+		return 1;
+
+	probe_stack = aligned_alloc(4096, STACK_PROBE_SIZE);
+	if (!probe_stack) {
+		fprintf(stderr, "Cannot allocate the stack probe\n");
+		return 1;
+	}
+	probe_dirty = STACK_PROBE_SIZE;
+	probe_overhead = 0;
+	probe_overhead = stack_usage(NULL, 0);
+
+	if (options.json)
+		printf("{\n\t\"library\": \"control\",\n\t\"compiler\": \"%s\",\n\t\"results\": [",
+		       __VERSION__);
+	else
+		printf("%-30s %6s %14s %10s %12s\n", "kernel", "size", "ns/call", "GFLOP/s",
+		       "stack bytes");
+
+	for (uint16_t k = 0; k < bench_kernel_count; k++) {
+		const struct bench_kernel *kernel = &bench_kernels[k];
+
+		if (options.filter && !strstr(kernel->name, options.filter))
+			continue;
+
+		for (uint16_t n = 2; n <= BENCH_MAX_SIZE; n *= 2) {
+			struct bench_result result;
+
+			if (n < kernel->min_size || n > kernel->max_size || n < options.min_size ||
+			    n > options.max_size)
+				continue;
+
+			// Warm up first so that lazy symbol binding is not counted as stack usage
+			kernel->setup(n);
+			if (kernel->prepare)
+				kernel->prepare(n);
+			kernel->run(n);
+
+			kernel->setup(n);
+			result.stack_bytes = stack_usage(kernel, n);
+
+			kernel->setup(n);
+			measure(kernel, n, options.min_time, &result);
+
+			if (options.json) {
+				printf("%s\n\t\t{ \"kernel\": \"%s\", \"size\": %u, "
+				       "\"ns_per_call\": %.1f, \"gflops\": ",
+				       first ? "" : ",", kernel->name, n, result.ns_per_call);
+				if (result.gflops < 0)
+					printf("null");
+				else
+					printf("%.4f", result.gflops);
+				printf(", \"stack_bytes\": %zu, \"repetitions\": %u }",
+				       result.stack_bytes, result.repetitions);
+			} else {
+				printf("%-30s %6u %14.1f ", kernel->name, n, result.ns_per_call);
+				if (result.gflops < 0)
+					printf("%10s", "-");
+				else
+					printf("%10.4f", result.gflops);
+				printf(" %12zu\n", result.stack_bytes);
+			}
+			fflush(stdout);
+			first = false;
+		}
+	}
+
+	if (options.json)
+		printf("\n\t]\n}\n");
+
+	free(probe_stack);
+	return 0;
+}
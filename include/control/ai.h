@@ -8,8 +8,112 @@
  */
 
 #pragma once
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include <control/workspace.h>
+
 void Astar(int map[], int path_x[], int path_y[], int x_start, int y_start, int x_stop, int y_stop,
 	   int height, int width, uint8_t norm_mode, int *steps);
+
+/* A* with the open and closed sets in a caller supplied workspace, connectivity 4 or 8 */
+size_t astar_workspace_size(int height, int width);
+uint8_t astar_ws(const int map[], int path_x[], int path_y[], int x_start, int y_start,
+		 int x_stop, int y_stop, int height, int width, uint8_t connectivity, int *steps,
+		 struct ctl_workspace *ws);
+
+/* Jump Point Search, the same paths as astar_ws with 8-connectivity */
+size_t jps_workspace_size(int height, int width);
+uint8_t jps(const int map[], int path_x[], int path_y[], int x_start, int y_start, int x_stop,
+	    int y_stop, int height, int width, int *steps);
+uint8_t jps_ws(const int map[], int path_x[], int path_y[], int x_start, int y_start,
+	       int x_stop, int y_stop, int height, int width, int *steps,
+	       struct ctl_workspace *ws);
+/*
+ * Incremental planner on the same maps, which repairs its path when cells change, see
+ * dstar_lite.c
+ */
+struct dstar_lite {
+	const int *map; // [height*width], -1 is an obstacle
+	uint32_t *g; // Distance to the stop [height*width]
+	uint32_t *rhs; // Distance to the stop through the best neighbour [height*width]
+	uint32_t *key; // First key of the queued cells [height*width]
+	uint32_t *heap; // Queue of the inconsistent cells [height*width]
+	uint32_t *index; // Position in heap [height*width]
+	uint32_t *queued; // Bitmap of the cells in heap
+	uint32_t length; // Cells in heap
+	uint32_t km; // Sum of the heuristic over the moves of the start
+	uint32_t start;
+	uint32_t goal;
+	int height;
+	int width;
+	uint8_t connectivity;
+};
+
+size_t dstar_lite_workspace_size(int height, int width);
+uint8_t dstar_lite_init(struct dstar_lite *ctx, const int map[], int height, int width,
+			uint8_t connectivity, int x_start, int y_start, int x_stop, int y_stop,
+			struct ctl_workspace *ws);
+void dstar_lite_move(struct dstar_lite *ctx, int x, int y);
+void dstar_lite_update_cell(struct dstar_lite *ctx, int x, int y);
+uint8_t dstar_lite_plan(struct dstar_lite *ctx, int path_x[], int path_y[], int *steps);
+
 uint8_t inpolygon(float x, float y, float px[], float py[], uint8_t p);
+
+/* Polygon with its edge table precomputed, for many queries and more than 255 points */
+struct polygon {
+	float *lo; // Smallest x of every edge [edges]
+	float *hi; // Largest x of every edge [edges]
+	float *y_lo; // y at lo [edges]
+	float *slope; // dy/dx of every edge [edges]
+	float min_x;
+	float max_x;
+	float min_y;
+	float max_y;
+	uint32_t edges;
+};
+
+size_t polygon_workspace_size(uint32_t p);
+uint8_t polygon_prepare(struct polygon *polygon, const float px[], const float py[], uint32_t p,
+			struct ctl_workspace *ws);
+uint8_t inpolygon_prepared(const struct polygon *polygon, float x, float y);
+void inpolygon_many(const struct polygon *polygon, const float x[], const float y[],
+		    uint8_t inside[], uint32_t n);
+
+/*
+ * Index over many polygons that finds the ones containing a point, see geofence.c. All
+ * references inside it are byte offsets from the header, so it can be copied as it is.
+ */
+struct geofence_zone {
+	float min_x;
+	float max_x;
+	float min_y;
+	float max_y;
+	uint32_t edges;
+	uint32_t offset; // Edge table in the layout of polygon_prepare
+};
+
+struct geofence {
+	uint32_t size; // Bytes of the whole index
+	uint32_t zones;
+	uint32_t columns;
+	uint32_t rows;
+	float min_x;
+	float max_x;
+	float min_y;
+	float max_y;
+	float scale_x; // Columns per unit of x
+	float scale_y; // Rows per unit of y
+	uint32_t zone_offset; // struct geofence_zone [zones]
+	uint32_t cell_offset; // First entry of every cell [columns*rows + 1]
+	uint32_t entry_offset; // Zones of every cell
+};
+
+size_t geofence_workspace_size(const float px[], const float py[], const uint32_t points[],
+			       uint32_t zones, uint32_t columns, uint32_t rows);
+uint8_t geofence_build(struct geofence **index, const float px[], const float py[],
+		       const uint32_t points[], uint32_t zones, uint32_t columns, uint32_t rows,
+		       struct ctl_workspace *ws);
+uint32_t geofence_query(const struct geofence *index, float x, float y, uint32_t zones[],
+			uint32_t max);
@@ -6,9 +6,15 @@
  * Simulation: https://swedishembedded.com/simulation
  * Training: https://swedishembedded.com/training
  */
+#pragma once
+
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include <control/optimization.h>
+#include <control/workspace.h>
+
 void mpc(float A[], float B[], float C[], float x[], float u[], float r[], uint8_t ADIM,
 	 uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON, uint8_t ITERATION_LIMIT,
 	 bool has_integration);
@@ -22,3 +28,133 @@ void theta2ss(float A[], float B[], float C[], float theta[], float K[], uint8_t
 	      uint8_t NZ, uint8_t NZE, bool integral_action);
 bool stability(float A[], uint8_t ADIM);
 void c2d(float A[], float B[], uint8_t ADIM, uint8_t RDIM, float sampleTime);
+
+/*
+ * Model predictive control with the prediction matrices built once by mpc_init.
+ * The matrices live in the workspace given to mpc_init, mpc_step only reads them.
+ * After mpc_constrain, mpc_step solves a constrained QP instead of the linear program.
+ */
+struct mpc_ctx {
+	float *PHI; // Extended observability matrix [HORIZON*YDIM * ADIM]
+	float *GAMMA; // Lower triangular toeplitz of C*A^i*B [HORIZON*YDIM * HORIZON*RDIM]
+	float *H; // GAMMA'*GAMMA [HORIZON*RDIM * HORIZON*RDIM]
+	float *lb; // Input bounds over the horizon [HORIZON*RDIM] or NULL
+	float *ub;
+	float *D; // Rate of change constraints D*U <= d [2*HORIZON*RDIM * HORIZON*RDIM] or NULL
+	float *du_max; // Largest change of every input per step [RDIM]
+	float *u_last; // Input of the last step [RDIM]
+	struct qp_ctx qp;
+	bool constrained;
+	uint8_t ADIM;
+	uint8_t YDIM;
+	uint8_t RDIM;
+	uint8_t HORIZON;
+	uint8_t ITERATION_LIMIT;
+	bool has_integration;
+};
+
+size_t mpc_init_workspace_size(uint8_t ADIM, uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON);
+uint8_t mpc_init(struct mpc_ctx *ctx, float A[], float B[], float C[], uint8_t ADIM,
+		 uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON, uint8_t ITERATION_LIMIT,
+		 bool has_integration, struct ctl_workspace *ws);
+size_t mpc_constrain_workspace_size(uint8_t RDIM, uint8_t HORIZON);
+uint8_t mpc_constrain(struct mpc_ctx *ctx, float umin[], float umax[], float du_max[],
+		      float lambda, struct ctl_workspace *ws);
+size_t mpc_step_workspace_size(uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON);
+uint8_t mpc_step(struct mpc_ctx *ctx, float x[], float u[], float r[], struct ctl_workspace *ws);
+
+/*
+ * The same constrained MPC solved stage by stage with a Riccati recursion and ADMM,
+ * linear in HORIZON. The gains of all stages live in the workspace given to the init.
+ */
+struct mpc_riccati_ctx {
+	float *A; // [ADIM*ADIM]
+	float *B; // [ADIM*RDIM]
+	float *C; // [YDIM*ADIM]
+	float *K; // Feedback gain of every stage [HORIZON * RDIM*(ADIM + RDIM)]
+	float *Ruu_inv; // Inverse input Hessian of every stage [HORIZON * RDIM*RDIM]
+	float *umin; // [RDIM]
+	float *umax;
+	float *du_max;
+	float *u_last; // Input of the last step [RDIM]
+	float *z; // ADMM split variables for the bounds and the rates [2 * HORIZON*RDIM]
+	float *w; // Their scaled dual variables [2 * HORIZON*RDIM]
+	float rho_box;
+	float rho_rate;
+	uint16_t HORIZON;
+	uint16_t ITERATION_LIMIT;
+	uint16_t iterations; // ADMM iterations of the last step
+	uint8_t ADIM;
+	uint8_t YDIM;
+	uint8_t RDIM;
+};
+
+size_t mpc_riccati_init_workspace_size(uint8_t ADIM, uint8_t YDIM, uint8_t RDIM,
+				       uint16_t HORIZON);
+uint8_t mpc_riccati_init(struct mpc_riccati_ctx *ctx, float A[], float B[], float C[],
+			 uint8_t ADIM, uint8_t YDIM, uint8_t RDIM, uint16_t HORIZON, float lambda,
+			 float umin[], float umax[], float du_max[], float rho,
+			 uint16_t ITERATION_LIMIT, struct ctl_workspace *ws);
+size_t mpc_riccati_step_workspace_size(uint8_t ADIM, uint8_t RDIM, uint16_t HORIZON);
+uint8_t mpc_riccati_step(struct mpc_riccati_ctx *ctx, float x[], float u[], float r[],
+			 struct ctl_workspace *ws);
+
+/*
+ * Kalman filter state update with [A - KC | B | K] fused once by kalman_init
+ */
+struct kalman_ctx {
+	float *M; // [A - K*C | B | K] [ADIM * (ADIM + RDIM + YDIM)]
+	float *v; // [x; u; y] [ADIM + RDIM + YDIM]
+	uint8_t ADIM;
+	uint8_t YDIM;
+	uint8_t RDIM;
+};
+
+size_t kalman_init_workspace_size(uint8_t ADIM, uint8_t YDIM, uint8_t RDIM);
+uint8_t kalman_init(struct kalman_ctx *ctx, float A[], float B[], float C[], float K[],
+		    uint8_t ADIM, uint8_t YDIM, uint8_t RDIM, struct ctl_workspace *ws);
+void kalman_step(struct kalman_ctx *ctx, float u[], float x[], float y[]);
+
+/*
+ * LQI with [-L | Li] fused once by lqi_init. The integral state xi is kept in the ctx.
+ */
+struct lqi_ctx {
+	float *M; // [-L | Li] [RDIM * (ADIM + YDIM)]
+	float *gain; // Reference gain Li(i, 0)/(1 - qi) [RDIM]
+	float *v; // [x; xi] [ADIM + YDIM]
+	uint8_t ADIM;
+	uint8_t YDIM;
+	uint8_t RDIM;
+	uint8_t ANTI_WINDUP;
+};
+
+size_t lqi_init_workspace_size(uint8_t ADIM, uint8_t YDIM, uint8_t RDIM);
+uint8_t lqi_init(struct lqi_ctx *ctx, float L[], float Li[], float qi, uint8_t ADIM,
+		 uint8_t YDIM, uint8_t RDIM, uint8_t ANTI_WINDUP, struct ctl_workspace *ws);
+void lqi_step(struct lqi_ctx *ctx, float y[], float u[], float r[], float x[]);
+void lqi_kalman_step(struct lqi_ctx *regulator, struct kalman_ctx *observer, float y[],
+		     float u[], float r[], float x[]);
+
+/*
+ * Variants that take their scratch memory from a caller supplied workspace instead of the stack.
+ * The *_workspace_size() functions return the number of bytes the matching *_ws function needs.
+ */
+size_t mpc_workspace_size(uint8_t ADIM, uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON);
+uint8_t mpc_ws(float A[], float B[], float C[], float x[], float u[], float r[], uint8_t ADIM,
+	       uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON, uint8_t ITERATION_LIMIT,
+	       bool has_integration, struct ctl_workspace *ws);
+size_t kalman_workspace_size(uint8_t ADIM, uint8_t YDIM, uint8_t RDIM);
+uint8_t kalman_ws(float A[], float B[], float C[], float K[], float u[], float x[], float y[],
+		  uint8_t ADIM, uint8_t YDIM, uint8_t RDIM, struct ctl_workspace *ws);
+size_t lqi_workspace_size(uint8_t RDIM);
+uint8_t lqi_ws(float y[], float u[], float qi, float r[], float L[], float Li[], float x[],
+	       float xi[], uint8_t ADIM, uint8_t YDIM, uint8_t RDIM, uint8_t ANTI_WINDUP,
+	       struct ctl_workspace *ws);
+size_t mrac_workspace_size(uint8_t RDIM);
+uint8_t mrac_ws(float limit, float gain, float y[], float u[], float r[], float I1[], float I2[],
+		uint8_t RDIM, struct ctl_workspace *ws);
+size_t stability_workspace_size(uint8_t ADIM);
+bool stability_ws(float A[], uint8_t ADIM, struct ctl_workspace *ws);
+size_t c2d_workspace_size(uint8_t ADIM, uint8_t RDIM);
+uint8_t c2d_ws(float A[], float B[], uint8_t ADIM, uint8_t RDIM, float sampleTime,
+	       struct ctl_workspace *ws);
@@ -9,8 +9,11 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <control/workspace.h>
+
 void filtfilt(float y[], float t[], uint16_t l, float K);
 void mcs_collect(float P[], uint16_t column_p, float x[], uint8_t row_x, float index_factor);
 void mcs_estimate(float P[], uint16_t column_p, float x[], uint8_t row_x);
@@ -18,3 +21,12 @@ void mcs_clean(float P[], uint16_t column_p, uint8_t row_x);
 void sr_ukf_state_estimation(float y[], float xhat[], float Rn[], float Rv[], float u[],
 			     void (*F)(float[], float[], float[]), float S[], float alpha,
 			     float beta, uint8_t L);
+
+/*
+ * Variants that take their scratch memory from a caller supplied workspace instead of the stack.
+ * The *_workspace_size() functions return the number of bytes the matching *_ws function needs.
+ */
+size_t sr_ukf_state_estimation_workspace_size(uint8_t L);
+uint8_t sr_ukf_state_estimation_ws(float y[], float xhat[], float Rn[], float Rv[], float u[],
+				   void (*F)(float[], float[], float[]), float S[], float alpha,
+				   float beta, uint8_t L, struct ctl_workspace *ws);
@@ -10,27 +10,54 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include <control/workspace.h>
+
 #define MAX_ITERATION_COUNT_SVD 30 // Maximum number of iterations for svd_jacobi_one_sided.c
 
 uint8_t inv(float *A, uint16_t row);
 void linsolve_upper_triangular(float *A, float *x, float *b, uint16_t column);
 void tran(float A[], uint16_t row, uint16_t column);
 void mul(float A[], float B[], float C[], uint16_t row_a, uint16_t column_a, uint16_t column_b);
+void gemm(bool transpose_a, bool transpose_b, float alpha, const float A[], const float B[],
+	  float beta, float C[], uint16_t row_c, uint16_t column_c, uint16_t inner);
+void trsm(bool left, bool upper, bool transpose, const float A[], float B[], uint16_t row,
+	  uint16_t column);
+void syrk(float alpha, const float A[], float beta, float C[], uint16_t row, uint16_t inner,
+	  uint16_t stride);
 void svd_jacobi_one_sided(float A[], uint16_t row, uint8_t max_iterations, float U[], float S[],
 			  float V[]);
 void dlyap(float A[], float P[], float Q[], uint16_t row);
 uint8_t svd_golub_reinsch(float A[], uint16_t row, uint16_t column, float U[], float S[],
 			  float V[]);
 uint8_t qr(float A[], float Q[], float R[], uint16_t row_a, uint16_t column_a, bool only_compute_R);
+void qr_factor(float A[], float tau[], uint16_t row, uint16_t column);
+void qr_q(const float QR[], const float tau[], float Q[], uint16_t row, uint16_t column);
+void qr_apply_qt(const float QR[], const float tau[], float B[], uint16_t row, uint16_t column,
+		 uint16_t column_b);
 void linsolve_qr(float A[], float x[], float b[], uint16_t row, uint16_t column);
 void linsolve_lower_triangular(float A[], float x[], float b[], uint16_t row);
-uint8_t lup(float A[], float LU[], uint8_t P[], uint16_t row);
+uint8_t lup(float A[], float LU[], uint16_t P[], uint16_t row);
 float det(float A[], uint16_t row);
 uint8_t linsolve_lup(float A[], float x[], float b[], uint16_t row);
-void chol(float A[], float L[], uint16_t row);
+uint8_t lu_factor(float LU[], uint16_t P[], uint16_t row);
+void lu_solve(const float LU[], const uint16_t P[], float b[], uint16_t row);
+void lu_solve_multi(const float LU[], const uint16_t P[], float B[], uint16_t row,
+		    uint16_t column);
+/* A = L*L^T with L lower triangular, the convention of cholupdate too */
+uint8_t chol(float A[], float L[], uint16_t row);
+uint8_t chol_factor(float A[], uint16_t row);
+void chol_solve_multi(const float L[], float B[], uint16_t row, uint16_t column);
+uint8_t ldl_factor(float A[], float d[], uint16_t row);
+void ldl_solve_multi(const float L[], const float d[], float B[], uint16_t row,
+		     uint16_t column);
 void cholupdate(float L[], float x[], uint16_t row, bool rank_one_update);
+uint8_t cholupdate_k(float L[], float X[], uint16_t row, uint16_t k, bool rank_k_update);
+/* The same updates for an upper triangular factor A = R^T*R, as qr gives it */
+uint8_t cholupdate_upper(float R[], float x[], uint16_t row, bool rank_one_update);
+uint8_t cholupdate_k_upper(float R[], float X[], uint16_t row, uint16_t k, bool rank_k_update);
 void linsolve_chol(float A[], float x[], float b[], uint16_t row);
 void pinv(float A[], uint16_t row, uint16_t column);
 void hankel(float V[], float H[], uint16_t row_v, uint16_t column_v, uint16_t row_h,
@@ -41,7 +68,55 @@ void eig_sym(float A[], uint16_t row, float d[]);
 void sum(float A[], uint16_t row, uint16_t column, uint8_t l);
 float norm(float A[], uint16_t row, uint16_t column, uint8_t l);
 void expm(float A[], uint16_t row);
+void expm_augmented(float A[], float B[], uint16_t row, uint16_t column);
 void nonlinsolve(void (*nonlinear_equation_system)(float[], float[], float[]), float b[], float x[],
 		 uint8_t elements, float alpha, float max_value, float min_value,
 		 bool random_guess_active);
 void linsolve_gauss(float *A, float *x, float *b, uint16_t row, uint16_t column, float alpha);
+
+/*
+ * Variants that take their scratch memory from a caller supplied workspace instead of the stack.
+ * The *_workspace_size() functions return the number of bytes the matching *_ws function needs.
+ */
+size_t inv_workspace_size(uint16_t row);
+uint8_t inv_ws(float A[], uint16_t row, struct ctl_workspace *ws);
+size_t det_workspace_size(uint16_t row);
+float det_ws(float A[], uint16_t row, struct ctl_workspace *ws);
+size_t linsolve_lup_workspace_size(uint16_t row);
+uint8_t linsolve_lup_ws(float A[], float x[], float b[], uint16_t row, struct ctl_workspace *ws);
+size_t linsolve_chol_workspace_size(uint16_t row);
+uint8_t linsolve_chol_ws(float A[], float x[], float b[], uint16_t row, struct ctl_workspace *ws);
+size_t linsolve_gauss_workspace_size(uint16_t row, uint16_t column, float alpha);
+uint8_t linsolve_gauss_ws(float *A, float *x, float *b, uint16_t row, uint16_t column, float alpha,
+			  struct ctl_workspace *ws);
+size_t qr_workspace_size(uint16_t row_a, uint16_t column_a, bool only_compute_R);
+uint8_t qr_ws(float A[], float Q[], float R[], uint16_t row_a, uint16_t column_a,
+	      bool only_compute_R, struct ctl_workspace *ws);
+size_t qr_factor_workspace_size(uint16_t row, uint16_t column);
+uint8_t qr_factor_ws(float A[], float tau[], uint16_t row, uint16_t column,
+		     struct ctl_workspace *ws);
+size_t qr_q_workspace_size(uint16_t row);
+uint8_t qr_q_ws(const float QR[], const float tau[], float Q[], uint16_t row, uint16_t column,
+		struct ctl_workspace *ws);
+size_t linsolve_qr_workspace_size(uint16_t row, uint16_t column);
+uint8_t linsolve_qr_ws(float A[], float x[], float b[], uint16_t row, uint16_t column,
+		       struct ctl_workspace *ws);
+size_t svd_golub_reinsch_workspace_size(uint16_t row, uint16_t column);
+uint8_t svd_golub_reinsch_ws(float A[], uint16_t row, uint16_t column, float U[], float S[],
+			     float V[], struct ctl_workspace *ws);
+size_t pinv_workspace_size(uint16_t row, uint16_t column);
+uint8_t pinv_ws(float A[], uint16_t row, uint16_t column, struct ctl_workspace *ws);
+size_t norm_workspace_size(uint16_t row, uint16_t column, uint8_t l);
+float norm_ws(float A[], uint16_t row, uint16_t column, uint8_t l, struct ctl_workspace *ws);
+size_t eig_sym_workspace_size(uint16_t row);
+uint8_t eig_sym_ws(float A[], uint16_t row, float d[], struct ctl_workspace *ws);
+size_t dlyap_workspace_size(uint16_t row);
+uint8_t dlyap_ws(float A[], float P[], float Q[], uint16_t row, struct ctl_workspace *ws);
+size_t expm_workspace_size(uint16_t row);
+uint8_t expm_ws(float A[], uint16_t row, struct ctl_workspace *ws);
+size_t expm_augmented_workspace_size(uint16_t row, uint16_t column);
+uint8_t expm_augmented_ws(float A[], float B[], uint16_t row, uint16_t column,
+			  struct ctl_workspace *ws);
+size_t cholupdate_workspace_size(uint16_t row);
+uint8_t cholupdate_ws(float L[], float x[], uint16_t row, bool rank_one_update,
+		      struct ctl_workspace *ws);
@@ -8,7 +8,51 @@
  */
 
 #pragma once
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include <control/workspace.h>
+
 void linprog(float c[], float A[], float b[], float x[], uint8_t row_a, uint8_t column_a,
 	     uint8_t max_or_min, uint8_t iteration_limit);
+
+/* linprog with the tableau taken from a caller supplied workspace instead of the stack */
+size_t linprog_workspace_size(uint8_t row_a, uint8_t column_a, uint8_t max_or_min);
+uint8_t linprog_ws(float c[], float A[], float b[], float x[], uint8_t row_a, uint8_t column_a,
+		   uint8_t max_or_min, uint8_t iteration_limit, struct ctl_workspace *ws);
+
+/*
+ * Revised simplex for max c'*x, A*x <= b, x >= 0 with b of any sign and 16-bit sizes,
+ * which keeps a factorized basis instead of the tableau of linprog
+ */
+uint8_t simplex(const float c[], const float A[], const float b[], float x[], uint16_t m,
+		uint16_t n, uint16_t iteration_limit);
+size_t simplex_workspace_size(uint16_t m, uint16_t n);
+uint8_t simplex_ws(const float c[], const float A[], const float b[], float x[], uint16_t m,
+		   uint16_t n, uint16_t iteration_limit, struct ctl_workspace *ws);
+
+uint8_t quadprog(float H[], float f[], float A[], float b[], float lb[], float ub[], float x[],
+		 uint16_t m, uint16_t n, uint16_t iteration_limit);
+size_t quadprog_workspace_size(uint16_t m, uint16_t n);
+uint8_t quadprog_ws(float H[], float f[], float A[], float b[], float lb[], float ub[],
+		    float x[], uint16_t m, uint16_t n, uint16_t iteration_limit,
+		    struct ctl_workspace *ws);
+
+/*
+ * quadprog split in a factorization of H that is done once and solves that reuse it.
+ * The solves are warm started from the active set of the previous one.
+ */
+struct qp_ctx {
+	float *J; // inv(L') where H = L*L' [n*n]
+	uint16_t *active; // Active set of the last solve [n]
+	uint16_t active_count;
+	uint16_t iterations; // Changes of the active set in the last solve
+	uint16_t n;
+};
+
+size_t qp_init_workspace_size(uint16_t n);
+uint8_t qp_init(struct qp_ctx *ctx, float H[], uint16_t n, struct ctl_workspace *ws);
+size_t qp_solve_workspace_size(uint16_t m, uint16_t n);
+uint8_t qp_solve(struct qp_ctx *ctx, float f[], float A[], float b[], float lb[], float ub[],
+		 float x[], uint16_t m, uint16_t iteration_limit, struct ctl_workspace *ws);
@@ -8,14 +8,116 @@
  */
 
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 
+#include <control/workspace.h>
+
 void rls(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], float u, float y, uint8_t *count,
 	 float *past_e, float *past_y, float *past_u, float phi[], float P[], float Pq,
 	 float forgetting);
+void rls_ud(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], float u, float y, uint8_t *count,
+	    float *past_e, float *past_y, float *past_u, float phi[], float UD[], float Pq,
+	    float forgetting);
+void rls_packed(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], float u, float y,
+		uint8_t *count, float *past_e, float *past_y, float *past_u, float phi[], float P[],
+		float Pq, float forgetting);
 void okid(float u[], float y[], float g[], uint16_t row, uint16_t column);
+
+/*
+ * OKID for long experiments and for lightly damped systems, g has the layout of okid
+ */
+uint8_t okid_fft(float u[], float y[], float g[], uint16_t row, uint16_t column, float alpha);
+size_t okid_fft_workspace_size(uint16_t row, uint16_t column);
+uint8_t okid_fft_ws(float u[], float y[], float g[], uint16_t row, uint16_t column, float alpha,
+		    struct ctl_workspace *ws);
+uint8_t okid_observer(float u[], float y[], float g[], uint16_t row, uint16_t column, uint8_t p);
+size_t okid_observer_workspace_size(uint8_t p);
+uint8_t okid_observer_ws(float u[], float y[], float g[], uint16_t row, uint16_t column, uint8_t p,
+			 struct ctl_workspace *ws);
+
 void era(float u[], float y[], uint16_t row, uint16_t column, float A[], float B[], float C[],
 	 uint8_t row_a, uint8_t inputs_outputs);
 void sr_ukf_parameter_estimation(float d[], float what[], float Re[], float x[],
 				 void (*G)(float[], float[], float[]), float lambda_rls, float Sw[],
 				 float alpha, float beta, uint8_t L);
+
+/*
+ * N estimators of the same structure updated together, see rls_bank.c for the layout
+ */
+struct rls_bank {
+	float *theta; // [(NP + NZ + NZE)*channels]
+	float *phi; // [(NP + NZ + NZE)*channels]
+	float *P; // Packed upper triangles [(NP + NZ + NZE)*(NP + NZ + NZE + 1)/2*channels]
+	float *Pphi; // Scratch [(NP + NZ + NZE)*channels]
+	float *past_e; // [channels]
+	float *past_y;
+	float *past_u;
+	float *sum; // Scratch [channels]
+	float *gain;
+	float Pq;
+	float forgetting;
+	uint16_t channels;
+	uint8_t NP;
+	uint8_t NZ;
+	uint8_t NZE;
+	uint8_t count;
+};
+
+size_t rls_bank_workspace_size(uint8_t NP, uint8_t NZ, uint8_t NZE, uint16_t channels);
+uint8_t rls_bank_init(struct rls_bank *bank, uint8_t NP, uint8_t NZ, uint8_t NZE,
+		      uint16_t channels, float Pq, float forgetting, struct ctl_workspace *ws);
+void rls_bank_update(struct rls_bank *bank, const float u[], const float y[]);
+
+/*
+ * Fast transversal filter RLS for a FIR model of n taps, O(n) per sample, see rls_ftf.c
+ */
+struct rls_ftf {
+	float *theta; // [n] b_1 ... b_n
+	float *wf; // Forward predictor [n]
+	float *wb; // Backward predictor [n]
+	float *k; // Normalized gain [n]
+	float *k1; // Scratch [n]
+	float *x; // u(t - 1) ... u(t - n - 1) [n + 1]
+	float alpha_f; // Forward and backward prediction error energies
+	float alpha_b;
+	float gamma; // Conversion factor
+	float past_u;
+	float Pq;
+	float forgetting;
+	uint32_t restarts; // Times the predictors were restarted
+	uint16_t n;
+};
+
+size_t rls_ftf_workspace_size(uint16_t n);
+uint8_t rls_ftf_init(struct rls_ftf *ctx, uint16_t n, float Pq, float forgetting,
+		     struct ctl_workspace *ws);
+uint8_t rls_ftf_update(struct rls_ftf *ctx, float u, float y);
+
+/*
+ * Variants that take their scratch memory from a caller supplied workspace instead of the stack.
+ * The *_workspace_size() functions return the number of bytes the matching *_ws function needs.
+ */
+size_t rls_workspace_size(uint8_t NP, uint8_t NZ, uint8_t NZE);
+uint8_t rls_ws(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], float u, float y,
+	       uint8_t *count, float *past_e, float *past_y, float *past_u, float phi[], float P[],
+	       float Pq, float forgetting, struct ctl_workspace *ws);
+size_t rls_ud_workspace_size(uint8_t NP, uint8_t NZ, uint8_t NZE);
+uint8_t rls_ud_ws(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], float u, float y,
+		  uint8_t *count, float *past_e, float *past_y, float *past_u, float phi[],
+		  float UD[], float Pq, float forgetting, struct ctl_workspace *ws);
+size_t rls_packed_workspace_size(uint8_t NP, uint8_t NZ, uint8_t NZE);
+uint8_t rls_packed_ws(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], float u, float y,
+		      uint8_t *count, float *past_e, float *past_y, float *past_u, float phi[],
+		      float P[], float Pq, float forgetting, struct ctl_workspace *ws);
+size_t okid_workspace_size(uint16_t row, uint16_t column);
+uint8_t okid_ws(float u[], float y[], float g[], uint16_t row, uint16_t column,
+		struct ctl_workspace *ws);
+size_t era_workspace_size(uint16_t row, uint16_t column);
+uint8_t era_ws(float u[], float y[], uint16_t row, uint16_t column, float A[], float B[],
+	       float C[], uint8_t row_a, uint8_t inputs_outputs, struct ctl_workspace *ws);
+size_t sr_ukf_parameter_estimation_workspace_size(uint8_t L);
+uint8_t sr_ukf_parameter_estimation_ws(float d[], float what[], float Re[], float x[],
+				       void (*G)(float[], float[], float[]), float lambda_rls,
+				       float Sw[], float alpha, float beta, uint8_t L,
+				       struct ctl_workspace *ws);
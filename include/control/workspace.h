@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: MIT */
+/**
+ * Copyright 2022 Martin Schröder <info@swedishembedded.com>
+ * Consulting: https://swedishembedded.com/consulting
+ * Simulation: https://swedishembedded.com/simulation
+ * Training: https://swedishembedded.com/training
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Scratch memory arena for the *_ws functions.
+ * The caller hands over one buffer, usually a static pool sized with the *_workspace_size()
+ * queries at init time, and the library takes its temporary matrices from it instead of
+ * the stack. Allocations are released in LIFO order with ctl_workspace_mark/release.
+ */
+struct ctl_workspace {
+	uint8_t *buffer;
+	size_t size;
+	size_t used;
+	size_t peak; // Largest number of bytes in use so far
+};
+
+#define CTL_WORKSPACE_ALIGN 16
+
+/* Bytes an allocation of n bytes or n floats takes in the workspace */
+#define CTL_WORKSPACE_BYTES(n)                                                                     \
+	(((size_t)(n) + CTL_WORKSPACE_ALIGN - 1) & ~((size_t)CTL_WORKSPACE_ALIGN - 1))
+#define CTL_WORKSPACE_FLOATS(n) CTL_WORKSPACE_BYTES((size_t)(n) * sizeof(float))
+
+/*
+ * Declare a workspace of the given size backed by a stack array. This is what the
+ * functions without the _ws suffix use to keep their original interface.
+ */
+#define CTL_WORKSPACE_ON_STACK(name, bytes)                                                        \
+	uint8_t name##_buffer[(bytes) + CTL_WORKSPACE_ALIGN];                                      \
+	struct ctl_workspace name;                                                                 \
+	ctl_workspace_init(&name, name##_buffer, sizeof(name##_buffer))
+
+void ctl_workspace_init(struct ctl_workspace *ws, void *buffer, size_t size);
+void *ctl_workspace_alloc(struct ctl_workspace *ws, size_t bytes);
+float *ctl_workspace_floats(struct ctl_workspace *ws, size_t count);
+size_t ctl_workspace_available(const struct ctl_workspace *ws);
+size_t ctl_workspace_mark(const struct ctl_workspace *ws);
+void ctl_workspace_release(struct ctl_workspace *ws, size_t mark);
+
+/* Size of a workspace shared by two nested calls that run one after the other */
+static inline size_t ctl_workspace_max(size_t a, size_t b)
+{
+	return a > b ? a : b;
+}
@@ -7,209 +7,574 @@
  * Training: https://swedishembedded.com/training
  */
 
-#include <math.h>
-#include <string.h>
 #include <stdlib.h>
+#include <string.h>
 #include <control/ai.h>
 
-static void heuristic_map(int *map, int x_stop, int y_stop, int height, int width,
-			  uint8_t norm_mode);
+// Step costs, 14/10 is close enough to sqrt(2) and keeps everything in integers
+#define ASTAR_STRAIGHT 10
+#define ASTAR_DIAGONAL 14
+
+// One entry of the open set, a binary heap ordered by f = g + h
+struct astar_node {
+	uint32_t f;
+	uint32_t g;
+	uint32_t cell;
+};
+
+struct grid {
+	const int *map;
+	int height;
+	int width;
+	// The free cells as bits row by row and column by column, only jps uses them
+	const uint32_t *rows;
+	const uint32_t *columns;
+	uint32_t row_words;
+	uint32_t column_words;
+};
+
+// The orthogonal moves come first, 4-connectivity only uses those
+static const int x_directions[8] = { -1, 1, 0, 0, -1, 1, -1, 1 };
+static const int y_directions[8] = { 0, 0, -1, 1, -1, -1, 1, 1 };
+
+static uint8_t search(const struct grid *grid, int path_x[], int path_y[], int x_start,
+		      int y_start, int x_stop, int y_stop, uint8_t connectivity, bool jump_points,
+		      int *steps, struct ctl_workspace *ws);
+static uint32_t jump(const struct grid *grid, int x, int y, int dx, int dy, int x_stop,
+		     int y_stop);
+static uint32_t scan(const uint32_t line[], const uint32_t side_a[], const uint32_t side_b[],
+		     uint32_t words, int from, int step, int goal);
+static uint32_t forced(const uint32_t side[], int word, uint32_t words, int step);
+static void transpose(uint32_t block[32]);
+static int first_bit(uint32_t bits);
+static int last_bit(uint32_t bits);
+static bool is_free(const struct grid *grid, int x, int y);
+static bool can_move(const struct grid *grid, int x, int y, int dx, int dy);
+static int sign(int value);
+static uint32_t heuristic(int x, int y, int x_stop, int y_stop, uint8_t connectivity);
+static bool before(const struct astar_node *a, const struct astar_node *b);
+static void sift_up(struct astar_node heap[], uint32_t index[], uint32_t position);
+static void sift_down(struct astar_node heap[], uint32_t index[], uint32_t length,
+		      uint32_t position);
 
 /*
  * This is A* algorithm. An AI-algorithm in other words.
- * It find the optimal(at least try too) path from your source to your destination.
+ * It finds the shortest path from your source to your destination with 4-connectivity.
+ * map [height*width], -1 is an obstacle, everything else can be walked on. map is not changed.
+ * path_x and path_y [height*width] get the path from start to stop, the rest is -1.
+ * steps is the number of coordinates in the path, 0 if there is none.
+ * norm_mode is kept for compatibility, the path is the shortest one for both norms.
  * See working example how to use.
  * I wrote this C code because I don't like calloc, malloc and recalloc in embedded.
+ * The search takes about 20 bytes per cell of the map from the stack, that is 5 MB for
+ * 512*512. Call astar_ws with a static workspace when the stack is not that large.
  */
 void Astar(int map[], int path_x[], int path_y[], int x_start, int y_start, int x_stop, int y_stop,
 	   int height, int width, uint8_t norm_mode, int *steps)
 {
-	// Clear first our path
+	(void)norm_mode;
+	CTL_WORKSPACE_ON_STACK(ws, astar_workspace_size(height, width));
+
+	memset(path_x, -1, height * width * sizeof(int));
+	memset(path_y, -1, height * width * sizeof(int));
+	astar_ws(map, path_x, path_y, x_start, y_start, x_stop, y_stop, height, width, 4, steps,
+		 &ws);
+}
+
+size_t astar_workspace_size(int height, int width)
+{
+	size_t cells = (size_t)height * width;
+	size_t words = (cells + 31) / 32;
+
+	return CTL_WORKSPACE_BYTES(cells * sizeof(struct astar_node)) +
+	       2 * CTL_WORKSPACE_BYTES(cells * sizeof(uint32_t)) +
+	       2 * CTL_WORKSPACE_BYTES(words * sizeof(uint32_t));
+}
+
+/*
+ * A* with a binary heap as the open set and bitmaps for the opened and the closed cells,
+ * everything taken from the workspace. Only the bitmaps are cleared, so the setup is
+ * O(height*width/8) and the search touches only the cells it expands.
+ * connectivity 4 moves left, right, up and down. connectivity 8 also moves diagonally
+ * at cost 1.4, but not past the corner of an obstacle.
+ * path_x and path_y [height*width], only the first steps entries are written.
+ * Returns 1 == Success
+ * Returns 0 == Fail, there is no path, start or stop is not free, connectivity is not
+ * 4 or 8 or the workspace is too small
+ */
+uint8_t astar_ws(const int map[], int path_x[], int path_y[], int x_start, int y_start,
+		 int x_stop, int y_stop, int height, int width, uint8_t connectivity, int *steps,
+		 struct ctl_workspace *ws)
+{
+	struct grid grid = { .map = map, .height = height, .width = width };
+
+	*steps = 0;
+	if (connectivity != 4 && connectivity != 8)
+		return 0;
+	return search(&grid, path_x, path_y, x_start, y_start, x_stop, y_stop, connectivity,
+		      false, steps, ws);
+}
+
+/*
+ * Jump Point Search, the same path as astar_ws with 8-connectivity but for grids where
+ * every step costs the same. Of the many equally short paths across open space it only
+ * follows one, so it jumps along straight lines and diagonals and only puts the cells
+ * where an obstacle forces a turn into the open set. On open floors that is a small
+ * fraction of the cells A* expands. The straight jumps test 32 cells at a time on a bitmap
+ * of the map.
+ * path_x and path_y [height*width], only the first steps entries are written.
+ * Like Astar, it takes about 20 bytes per cell of the map from the stack, so call jps_ws
+ * with a static workspace for large maps.
+ * Returns 1 == Success
+ * Returns 0 == Fail, there is no path, start or stop is not free
+ */
+uint8_t jps(const int map[], int path_x[], int path_y[], int x_start, int y_start, int x_stop,
+	    int y_stop, int height, int width, int *steps)
+{
+	CTL_WORKSPACE_ON_STACK(ws, jps_workspace_size(height, width));
+
 	memset(path_x, -1, height * width * sizeof(int));
 	memset(path_y, -1, height * width * sizeof(int));
+	return jps_ws(map, path_x, path_y, x_start, y_start, x_stop, y_stop, height, width, steps,
+		      &ws);
+}
 
-	// Create map with a norm
-	heuristic_map(map, x_stop, y_stop, height, width, norm_mode);
-
-	// Set some initial parameters
-	int direction[4];
-	const int x_directions[4] = { -1, 1, 0, 0 };
-	const int y_directions[4] = { 0, 0, -1, 1 };
-	int position = 0;
-	int minValue = 0;
-	int x = x_start;
-	int y = y_start;
-
-	//printf("Current start coordinate: x = %d, y = %d\n", x, y);
-
-	for (int k = 0; k < height * width; k++) {
-		// Look to the left, right, up and down
-		for (int index = 0; index < 4; index++)
-			direction[index] =
-				map[(y + y_directions[index]) * width + x + x_directions[index]];
-
-		// Take the decision where to go by looking at direction array
-		minValue = direction[0];
-		position = 0;
-		for (int index = 0; index < 4; index++) {
-			// If our minimal value is -1, change it
-			if (minValue == -1) {
-				minValue = direction[index];
-				position = index;
+size_t jps_workspace_size(int height, int width)
+{
+	size_t row_words = ((size_t)width + 31) / 32;
+	size_t column_words = ((size_t)height + 31) / 32;
+
+	return astar_workspace_size(height, width) +
+	       CTL_WORKSPACE_BYTES(height * row_words * sizeof(uint32_t)) +
+	       CTL_WORKSPACE_BYTES(width * column_words * sizeof(uint32_t));
+}
+
+/*
+ * Same as jps, with the search and the bitmaps taken from the workspace
+ * Returns 0 also when the workspace is too small
+ */
+uint8_t jps_ws(const int map[], int path_x[], int path_y[], int x_start, int y_start,
+	       int x_stop, int y_stop, int height, int width, int *steps,
+	       struct ctl_workspace *ws)
+{
+	*steps = 0;
+	if (ctl_workspace_available(ws) < jps_workspace_size(height, width))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	uint32_t row_words = (width + 31) / 32;
+	uint32_t column_words = (height + 31) / 32;
+	uint32_t *rows = ctl_workspace_alloc(ws, height * row_words * sizeof(uint32_t));
+	uint32_t *columns = ctl_workspace_alloc(ws, width * column_words * sizeof(uint32_t));
+	struct grid grid = {
+		.map = map,
+		.height = height,
+		.width = width,
+		.rows = rows,
+		.columns = columns,
+		.row_words = row_words,
+		.column_words = column_words,
+	};
+
+	// The bits past the edge of the map stay 0, blocked
+	for (int y = 0; y < height; y++) {
+		const int *line = &map[y * width];
+
+		for (uint32_t word = 0; word < row_words; word++) {
+			const int *cells = &line[word * 32];
+			uint32_t bits = 0;
+
+			// A whole word is a loop of constant length, which vectorizes
+			if ((int)(word + 1) * 32 <= width) {
+				for (int bit = 0; bit < 32; bit++)
+					bits |= (uint32_t)(cells[bit] != -1) << bit;
 			} else {
-				// Check if we have found the smallest number now
-				if (direction[index] != -1 && direction[index] < minValue) {
-					minValue = direction[index];
-					position = index;
-				}
+				for (int bit = 0; bit < width % 32; bit++)
+					bits |= (uint32_t)(cells[bit] != -1) << bit;
 			}
-		}
-		// Prevent repeating by increasing the weights
-		map[y * width + x] += map[y * width + x];
-
-		// Save path
-		path_x[k] = x;
-		path_y[k] = y;
-
-		// Where to go - position variable tells
-		if (position == 0)
-			x--; // Go one step left
-		if (position == 1)
-			x++; // Go one step right
-		if (position == 2)
-			y--; // Go one step up
-		if (position == 3)
-			y++; // Go one step down
-
-		// Check if we are at our goal
-		if (*(map + y * width + x) == 0) {
-			path_x[k + 1] = x;
-			path_y[k + 1] = y;
-			break;
+			rows[y * row_words + word] = bits;
 		}
 	}
 
-	// Filter the path_x and path_y from duplicates
-	for (int i = 0; i < height * width; i++) {
-		position = 0;
-		x = path_x[i];
-		y = path_y[i];
-		if (x != -1 && y != -1) {
-			// Search for the last same x and y in path_x and path_y
-			for (int j = i + 1; j < height * width; j++) {
-				if (x == path_x[j] && y == path_y[j]) {
-					position = j; // Remember this position
-				}
+	// The columns are the rows transposed in blocks of 32*32 bits
+	for (uint32_t y_word = 0; y_word < column_words; y_word++) {
+		for (uint32_t x_word = 0; x_word < row_words; x_word++) {
+			uint32_t block[32];
+
+			for (int bit = 0; bit < 32; bit++) {
+				int y = y_word * 32 + bit;
+
+				block[bit] = y < height ? rows[y * row_words + x_word] : 0;
 			}
-			// If we got duplicates - delete them
-			if (position > 0) {
-				memset(path_x + i, -1, (position - i) * sizeof(int));
-				memset(path_y + i, -1, (position - i) * sizeof(int));
-				i = position; // Jump
+			transpose(block);
+			for (int bit = 0; bit < 32; bit++) {
+				int x = x_word * 32 + bit;
+
+				if (x < width)
+					columns[x * column_words + y_word] = block[bit];
 			}
-		} else {
-			position = i; // Remember that too
-			break; // The rest is just -1's
 		}
 	}
 
-	// Pack path_x and path_y together now
-	for (int i = 0; i < position; i++) {
-		// If we have a deleted coordinate
-		if (path_x[i] == -1 && path_y[i] == -1) {
-			// Move them up
-			for (int j = i; j < height * width; j++) {
-				if (path_x[j] != -1 && path_y[j] != -1) {
-					path_x[i] = path_x[j];
-					path_x[j] = -1;
-					path_y[i] = path_y[j];
-					path_y[j] = -1;
-					break;
-				}
-			}
+	uint8_t found = search(&grid, path_x, path_y, x_start, y_start, x_stop, y_stop, 8, true,
+			       steps, ws);
+
+	ctl_workspace_release(ws, mark);
+	return found;
+}
+
+static uint8_t search(const struct grid *grid, int path_x[], int path_y[], int x_start,
+		      int y_start, int x_stop, int y_stop, uint8_t connectivity, bool jump_points,
+		      int *steps, struct ctl_workspace *ws)
+{
+	int width = grid->width;
+
+	*steps = 0;
+	if (ctl_workspace_available(ws) < astar_workspace_size(grid->height, width))
+		return 0;
+	if (!is_free(grid, x_start, y_start) || !is_free(grid, x_stop, y_stop))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	uint32_t cells = (uint32_t)grid->height * width;
+	uint32_t words = (cells + 31) / 32;
+	struct astar_node *heap = ctl_workspace_alloc(ws, cells * sizeof(struct astar_node));
+	uint32_t *index = ctl_workspace_alloc(ws, cells * sizeof(uint32_t));
+	uint32_t *parent = ctl_workspace_alloc(ws, cells * sizeof(uint32_t));
+	uint32_t *opened = ctl_workspace_alloc(ws, words * sizeof(uint32_t));
+	uint32_t *closed = ctl_workspace_alloc(ws, words * sizeof(uint32_t));
+	uint32_t start = (uint32_t)y_start * width + x_start;
+	uint32_t goal = (uint32_t)y_stop * width + x_stop;
+	uint32_t length = 1;
+	uint8_t found = 0;
+
+	memset(opened, 0, words * sizeof(uint32_t));
+	memset(closed, 0, words * sizeof(uint32_t));
+
+	heap[0].cell = start;
+	heap[0].g = 0;
+	heap[0].f = heuristic(x_start, y_start, x_stop, y_stop, connectivity);
+	index[start] = 0;
+	parent[start] = start;
+	opened[start / 32] |= 1u << (start % 32);
+
+	while (length > 0) {
+		struct astar_node node = heap[0];
+
+		// Pop the cell with the lowest f, it has its shortest g now
+		heap[0] = heap[--length];
+		index[heap[0].cell] = 0;
+		sift_down(heap, index, length, 0);
+		closed[node.cell / 32] |= 1u << (node.cell % 32);
+		if (node.cell == goal) {
+			found = 1;
+			break;
 		}
-	}
 
-	// Filter the path_x and path_y from zigzag
-	for (int i = 0; i < height * width; i++) {
-		position = 0;
-		x = path_x[i];
-		y = path_y[i];
-		if (x != -1 && y != -1) {
-			// Search for a jump
-			for (int index = 0; index < 4; index++) {
-				for (int j = i + 1; j < height * width; j++) {
-					if (x + x_directions[index] == path_x[j] &&
-					    y + y_directions[index] == path_y[j]) {
-						// We want to have the largest "gap",
-						// which is the zigzag
-						if (j > position)
-							position = j;
-					}
-				}
-				// If we got zigzag.
-				// We need to have + 1 because we cannot
-				// accept a neighbor step as zigzag
-				if (position > i + 1) {
-					memset(path_x + i + 1, -1,
-					       (position - i - 1) * sizeof(int));
-					memset(path_y + i + 1, -1,
-					       (position - i - 1) * sizeof(int));
-					i = position; // Jump
-				}
+		int x = node.cell % width;
+		int y = node.cell / width;
+		int px = sign(x - (int)(parent[node.cell] % width));
+		int py = sign(y - (int)(parent[node.cell] / width));
+
+		for (uint8_t k = 0; k < connectivity; k++) {
+			int dx = x_directions[k];
+			int dy = y_directions[k];
+			uint32_t distance;
+
+			if (jump_points) {
+				// Going back against the direction we came from is never shorter
+				if ((px != 0 && dx == -px) || (py != 0 && dy == -py))
+					continue;
+				distance = jump(grid, x, y, dx, dy, x_stop, y_stop);
+			} else {
+				distance = can_move(grid, x, y, dx, dy);
 			}
+			if (distance == 0)
+				continue;
+
+			int nx = x + (int)distance * dx;
+			int ny = y + (int)distance * dy;
+			uint32_t next = (uint32_t)ny * width + nx;
+
+			if (closed[next / 32] & (1u << (next % 32)))
+				continue;
 
-		} else {
-			position = i; // Remember that too
-			break; // The rest is just -1's
+			uint32_t g = node.g + distance * (k < 4 ? ASTAR_STRAIGHT : ASTAR_DIAGONAL);
+			uint32_t position;
+
+			if (opened[next / 32] & (1u << (next % 32))) {
+				// Already in the open set, keep it unless this way is shorter
+				position = index[next];
+				if (g >= heap[position].g)
+					continue;
+				heap[position].f -= heap[position].g - g;
+			} else {
+				opened[next / 32] |= 1u << (next % 32);
+				position = length++;
+				heap[position].cell = next;
+				heap[position].f = g + heuristic(nx, ny, x_stop, y_stop,
+								 connectivity);
+				index[next] = position;
+			}
+			heap[position].g = g;
+			parent[next] = node.cell;
+			sift_up(heap, index, position);
 		}
 	}
 
-	// Pack path_x and path_y together again
-	for (int i = 0; i < position; i++) {
-		// If we have a deleted coordinate
-		if (path_x[i] == -1 && path_y[i] == -1) {
-			// Move them up
-			for (int j = i; j < height * width; j++) {
-				if (path_x[j] != -1 && path_y[j] != -1) {
-					path_x[i] = path_x[j];
-					path_x[j] = -1;
-					path_y[i] = path_y[j];
-					path_y[j] = -1;
-					break;
-				}
+	if (found) {
+		// Count the steps from stop back to start, then fill the path backwards cell by
+		// cell, a jump point's parent is a straight line or a diagonal away
+		uint32_t cell = goal;
+		int count = 1;
+
+		while (cell != start) {
+			int dx = (int)(cell % width) - (int)(parent[cell] % width);
+			int dy = (int)(cell / width) - (int)(parent[cell] / width);
+
+			count += abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+			cell = parent[cell];
+		}
+		*steps = count;
+
+		int x = x_stop;
+		int y = y_stop;
+
+		path_x[--count] = x;
+		path_y[count] = y;
+		for (cell = goal; cell != start; cell = parent[cell]) {
+			int to_x = parent[cell] % width;
+			int to_y = parent[cell] / width;
+			int dx = sign(to_x - x);
+			int dy = sign(to_y - y);
+
+			while (x != to_x || y != to_y) {
+				x += dx;
+				y += dy;
+				path_x[--count] = x;
+				path_y[count] = y;
 			}
 		}
 	}
 
-	// How many steps have we done
-	//printf("position is = %d\n", position);
-	*steps = position;
-
-	//printf("Done\n");
-}
-
-// norm_mode = 2 -> L2 norm
-// norm_mode = 1 -> L1 norm
-static void heuristic_map(int map[], int x_stop, int y_stop, int height, int width,
-			  uint8_t norm_mode)
-{
-	for (int i = 0; i < width; i++) {
-		for (int j = 0; j < height; j++) {
-			if (map[j * width + i] != -1) {
-				// Distance we want to go in x-axis
-				int dx = (j + x_stop) - (j + i);
-				// Distance we want to go in y-axis
-				int dy = (y_stop + i) - (j + i);
-
-				// L1-Norm
-				if (norm_mode == 1)
-					map[j * width + i] = abs(dx) + abs(dy);
-				// L2-Norm (without square root, not needed due to integers)
-				if (norm_mode == 2)
-					map[j * width + i] = dx * dx + dy * dy;
-				// You can add more heuristic here!
-			}
+	ctl_workspace_release(ws, mark);
+	return found;
+}
+
+/*
+ * Move from (x, y) in the direction (dx, dy) until a jump point and return how many steps
+ * that is, or 0 when the way is blocked first. A jump point is the stop, a cell on a
+ * straight line with an obstacle beside it that ends just behind, or a cell on a diagonal
+ * from which a straight jump finds a jump point.
+ */
+static uint32_t jump(const struct grid *grid, int x, int y, int dx, int dy, int x_stop,
+		     int y_stop)
+{
+	if (dy == 0) {
+		const uint32_t *row = &grid->rows[y * grid->row_words];
+
+		return scan(row, y > 0 ? row - grid->row_words : NULL,
+			    y + 1 < grid->height ? row + grid->row_words : NULL, grid->row_words, x,
+			    dx, y == y_stop ? x_stop : -1);
+	}
+	if (dx == 0) {
+		const uint32_t *column = &grid->columns[x * grid->column_words];
+
+		return scan(column, x > 0 ? column - grid->column_words : NULL,
+			    x + 1 < grid->width ? column + grid->column_words : NULL,
+			    grid->column_words, y, dy, x == x_stop ? y_stop : -1);
+	}
+
+	for (uint32_t distance = 1;; distance++) {
+		if (!can_move(grid, x, y, dx, dy))
+			return 0;
+		x += dx;
+		y += dy;
+		if (x == x_stop && y == y_stop)
+			return distance;
+		if (jump(grid, x, y, dx, 0, x_stop, y_stop) ||
+		    jump(grid, x, y, 0, dy, x_stop, y_stop))
+			return distance;
+	}
+}
+
+/*
+ * Straight jump along a row, or a column, of the bitmap from position from in the direction
+ * step, 32 cells at a time. It stops at the first cell that is blocked, that is the goal,
+ * or that has a free cell beside it with a blocked one behind that.
+ * side_a and side_b are the lines beside it, NULL outside the map
+ * goal is -1 when the goal is not on this line
+ */
+static uint32_t scan(const uint32_t line[], const uint32_t side_a[], const uint32_t side_b[],
+		     uint32_t words, int from, int step, int goal)
+{
+	int position = from + step;
+
+	if (position < 0)
+		return 0;
+	for (int word = position / 32; word >= 0 && word < (int)words; word += step) {
+		uint32_t stop = ~line[word] | forced(side_a, word, words, step) |
+				forced(side_b, word, words, step);
+
+		if (goal >= 0 && goal / 32 == word)
+			stop |= 1u << (goal % 32);
+		if (word == position / 32)
+			stop &= step > 0 ? ~0u << (position % 32) : ~0u >> (31 - position % 32);
+		if (stop == 0)
+			continue;
+
+		int cell = word * 32 + (step > 0 ? first_bit(stop) : last_bit(stop));
+
+		if (!(line[word] & (1u << (cell % 32))))
+			return 0;
+		return step > 0 ? cell - from : from - cell;
+	}
+	return 0;
+}
+
+/*
+ * The cells of one word whose side cell is free while the side cell behind it is not
+ */
+static uint32_t forced(const uint32_t side[], int word, uint32_t words, int step)
+{
+	if (side == NULL)
+		return 0;
+
+	uint32_t behind;
+
+	if (step > 0)
+		behind = side[word] << 1 | (word > 0 ? side[word - 1] >> 31 : 0);
+	else
+		behind = side[word] >> 1 | (word + 1 < (int)words ? side[word + 1] << 31 : 0);
+	return side[word] & ~behind;
+}
+
+/*
+ * Transpose a 32*32 bit matrix in place, bit j of block[i] becomes bit i of block[j].
+ * It swaps the off diagonal 16*16 blocks, then the 8*8 blocks within those and so on.
+ */
+static void transpose(uint32_t block[32])
+{
+	uint32_t mask = 0x0000ffff;
+
+	for (int j = 16; j != 0; j >>= 1, mask ^= mask << j) {
+		for (int k = 0; k < 32; k = (k + j + 1) & ~j) {
+			uint32_t swap = ((block[k] >> j) ^ block[k + j]) & mask;
+
+			block[k + j] ^= swap;
+			block[k] ^= swap << j;
 		}
 	}
 }
+
+static int first_bit(uint32_t bits)
+{
+#if defined(__GNUC__)
+	return __builtin_ctz(bits);
+#else
+	int bit = 0;
+
+	while (!(bits & 1)) {
+		bits >>= 1;
+		bit++;
+	}
+	return bit;
+#endif
+}
+
+static int last_bit(uint32_t bits)
+{
+#if defined(__GNUC__)
+	return 31 - __builtin_clz(bits);
+#else
+	int bit = 31;
+
+	while (!(bits & 0x80000000u)) {
+		bits <<= 1;
+		bit--;
+	}
+	return bit;
+#endif
+}
+
+static bool is_free(const struct grid *grid, int x, int y)
+{
+	return x >= 0 && x < grid->width && y >= 0 && y < grid->height &&
+	       grid->map[y * grid->width + x] != -1;
+}
+
+/*
+ * One step, a diagonal one needs both cells beside it free so it does not cut a corner
+ */
+static bool can_move(const struct grid *grid, int x, int y, int dx, int dy)
+{
+	if (!is_free(grid, x + dx, y + dy))
+		return false;
+	return dx == 0 || dy == 0 || (is_free(grid, x + dx, y) && is_free(grid, x, y + dy));
+}
+
+static int sign(int value)
+{
+	return (value > 0) - (value < 0);
+}
+
+/*
+ * Lower bound of the cost left from (x, y), Manhattan for 4-connectivity and octile for
+ * 8-connectivity, so that the first time the goal is popped its path is the shortest
+ */
+static uint32_t heuristic(int x, int y, int x_stop, int y_stop, uint8_t connectivity)
+{
+	uint32_t dx = x > x_stop ? x - x_stop : x_stop - x;
+	uint32_t dy = y > y_stop ? y - y_stop : y_stop - y;
+
+	if (connectivity == 4)
+		return ASTAR_STRAIGHT * (dx + dy);
+	if (dx < dy)
+		return ASTAR_STRAIGHT * dy + (ASTAR_DIAGONAL - ASTAR_STRAIGHT) * dx;
+	return ASTAR_STRAIGHT * dx + (ASTAR_DIAGONAL - ASTAR_STRAIGHT) * dy;
+}
+
+/*
+ * Lowest f first, and on a tie the one that has come furthest, which is closer to the goal
+ */
+static bool before(const struct astar_node *a, const struct astar_node *b)
+{
+	return a->f < b->f || (a->f == b->f && a->g > b->g);
+}
+
+static void sift_up(struct astar_node heap[], uint32_t index[], uint32_t position)
+{
+	struct astar_node node = heap[position];
+
+	while (position > 0) {
+		uint32_t up = (position - 1) / 2;
+
+		if (!before(&node, &heap[up]))
+			break;
+		heap[position] = heap[up];
+		index[heap[position].cell] = position;
+		position = up;
+	}
+	heap[position] = node;
+	index[node.cell] = position;
+}
+
+static void sift_down(struct astar_node heap[], uint32_t index[], uint32_t length,
+		      uint32_t position)
+{
+	struct astar_node node = heap[position];
+
+	while (2 * position + 1 < length) {
+		uint32_t down = 2 * position + 1;
+
+		if (down + 1 < length && before(&heap[down + 1], &heap[down]))
+			down++;
+		if (!before(&heap[down], &node))
+			break;
+		heap[position] = heap[down];
+		index[heap[position].cell] = position;
+		position = down;
+	}
+	heap[position] = node;
+	index[node.cell] = position;
+}
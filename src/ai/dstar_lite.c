@@ -0,0 +1,401 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Copyright 2022 Martin Schröder <info@swedishembedded.com>
+ * Consulting: https://swedishembedded.com/consulting
+ * Simulation: https://swedishembedded.com/simulation
+ * Training: https://swedishembedded.com/training
+ */
+
+#include <string.h>
+
+#include <control/ai.h>
+
+// Same step costs as astar_ws, so both find paths of the same length
+#define DSTAR_STRAIGHT 10
+#define DSTAR_DIAGONAL 14
+#define DSTAR_INFINITY UINT32_MAX
+
+static const int x_directions[8] = { -1, 1, 0, 0, -1, 1, -1, 1 };
+static const int y_directions[8] = { 0, 0, -1, 1, -1, -1, 1, 1 };
+
+static void compute_shortest_path(struct dstar_lite *ctx);
+static void update_vertex(struct dstar_lite *ctx, uint32_t cell);
+static uint32_t cost(const struct dstar_lite *ctx, int x, int y, uint8_t k);
+static uint32_t add(uint32_t a, uint32_t b);
+static uint32_t heuristic(const struct dstar_lite *ctx, uint32_t a, uint32_t b);
+static bool is_free(const struct dstar_lite *ctx, int x, int y);
+static bool before(const struct dstar_lite *ctx, uint32_t key, uint32_t cell,
+		   uint32_t other_key, uint32_t other);
+static void push(struct dstar_lite *ctx, uint32_t cell, uint32_t key);
+static void remove_cell(struct dstar_lite *ctx, uint32_t cell);
+static void sift_up(struct dstar_lite *ctx, uint32_t position);
+static void sift_down(struct dstar_lite *ctx, uint32_t position);
+
+/*
+ * D* Lite, a shortest path on the grid map that is repaired instead of searched again when
+ * cells of the map change or the start moves. It searches from the stop towards the start
+ * and keeps, for every cell, g, its distance to the stop, and rhs, the distance one step
+ * ahead. A change only makes the cells around it inconsistent (g != rhs), and only those and
+ * the cells whose distance really changes are expanded again.
+ * map [height*width] is the caller's map with -1 as obstacles, like for astar_ws. It is not
+ * copied, change it and tell with dstar_lite_update_cell.
+ * connectivity 4 or 8, diagonal steps do not cut the corner of an obstacle.
+ * Everything lives in ws for as long as the planner is used.
+ */
+size_t dstar_lite_workspace_size(int height, int width)
+{
+	size_t cells = (size_t)height * width;
+
+	return 5 * CTL_WORKSPACE_BYTES(cells * sizeof(uint32_t)) +
+	       CTL_WORKSPACE_BYTES((cells + 31) / 32 * sizeof(uint32_t));
+}
+
+/*
+ * Returns 1 == Success
+ * Returns 0 == Fail, connectivity is not 4 or 8 or the workspace is too small
+ */
+uint8_t dstar_lite_init(struct dstar_lite *ctx, const int map[], int height, int width,
+			uint8_t connectivity, int x_start, int y_start, int x_stop, int y_stop,
+			struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < dstar_lite_workspace_size(height, width))
+		return 0;
+	if (connectivity != 4 && connectivity != 8)
+		return 0;
+
+	uint32_t cells = (uint32_t)height * width;
+	uint32_t words = (cells + 31) / 32;
+
+	ctx->g = ctl_workspace_alloc(ws, cells * sizeof(uint32_t));
+	ctx->rhs = ctl_workspace_alloc(ws, cells * sizeof(uint32_t));
+	ctx->key = ctl_workspace_alloc(ws, cells * sizeof(uint32_t));
+	ctx->heap = ctl_workspace_alloc(ws, cells * sizeof(uint32_t));
+	ctx->index = ctl_workspace_alloc(ws, cells * sizeof(uint32_t));
+	ctx->queued = ctl_workspace_alloc(ws, words * sizeof(uint32_t));
+	ctx->map = map;
+	ctx->height = height;
+	ctx->width = width;
+	ctx->connectivity = connectivity;
+	ctx->start = (uint32_t)y_start * width + x_start;
+	ctx->goal = (uint32_t)y_stop * width + x_stop;
+	ctx->km = 0;
+	ctx->length = 0;
+
+	// Nothing is known, the stop is the only inconsistent cell
+	memset(ctx->g, 0xff, cells * sizeof(uint32_t));
+	memset(ctx->rhs, 0xff, cells * sizeof(uint32_t));
+	memset(ctx->queued, 0, words * sizeof(uint32_t));
+	ctx->rhs[ctx->goal] = 0;
+	push(ctx, ctx->goal, heuristic(ctx, ctx->start, ctx->goal));
+	return 1;
+}
+
+/*
+ * The robot is now at (x, y). Only the start of the search moves, the distances to the stop
+ * stay valid. The keys in the queue were computed with the heuristic from the old start,
+ * adding how far the start moved to km keeps them lower bounds of the new keys.
+ */
+void dstar_lite_move(struct dstar_lite *ctx, int x, int y)
+{
+	uint32_t start = (uint32_t)y * ctx->width + x;
+
+	ctx->km += heuristic(ctx, ctx->start, start);
+	ctx->start = start;
+}
+
+/*
+ * map[y*width + x] has changed between free and -1. That changes the steps into and out of
+ * the cell and the diagonal steps past its corners, so the cell and its 8 neighbours get
+ * their rhs again. The path is repaired at the next dstar_lite_plan.
+ */
+void dstar_lite_update_cell(struct dstar_lite *ctx, int x, int y)
+{
+	int width = ctx->width;
+
+	update_vertex(ctx, (uint32_t)y * width + x);
+	for (uint8_t k = 0; k < 8; k++) {
+		int nx = x + x_directions[k];
+		int ny = y + y_directions[k];
+
+		if (nx >= 0 && nx < width && ny >= 0 && ny < ctx->height)
+			update_vertex(ctx, (uint32_t)ny * width + nx);
+	}
+}
+
+/*
+ * Repair the distances and write the path from the start to the stop, cell by cell like
+ * astar_ws does.
+ * path_x and path_y [height*width], only the first steps entries are written
+ * Returns 1 == Success
+ * Returns 0 == Fail, there is no path from the start
+ */
+uint8_t dstar_lite_plan(struct dstar_lite *ctx, int path_x[], int path_y[], int *steps)
+{
+	int width = ctx->width;
+	uint32_t cell = ctx->start;
+	int count = 0;
+
+	*steps = 0;
+	compute_shortest_path(ctx);
+	if (ctx->g[cell] == DSTAR_INFINITY)
+		return 0;
+
+	// Walk down the distances, every step goes to the neighbour that is closest to the stop
+	for (;;) {
+		path_x[count] = cell % width;
+		path_y[count] = cell / width;
+		count++;
+		if (cell == ctx->goal)
+			break;
+
+		uint32_t best = DSTAR_INFINITY;
+		uint32_t next = cell;
+
+		for (uint8_t k = 0; k < ctx->connectivity; k++) {
+			uint32_t step = cost(ctx, path_x[count - 1], path_y[count - 1], k);
+
+			if (step == DSTAR_INFINITY)
+				continue;
+			uint32_t neighbour = cell + y_directions[k] * width + x_directions[k];
+			uint32_t distance = add(step, ctx->g[neighbour]);
+
+			if (distance < best) {
+				best = distance;
+				next = neighbour;
+			}
+		}
+		if (next == cell)
+			return 0;
+		cell = next;
+	}
+	*steps = count;
+	return 1;
+}
+
+static void compute_shortest_path(struct dstar_lite *ctx)
+{
+	uint32_t start = ctx->start;
+
+	for (;;) {
+		uint32_t distance = ctx->g[start] < ctx->rhs[start] ? ctx->g[start] : ctx->rhs[start];
+		uint32_t start_key = add(distance, ctx->km);
+
+		// Done when the start is consistent and nothing in the queue can still lower it
+		if (ctx->length == 0)
+			break;
+		uint32_t cell = ctx->heap[0];
+
+		if (!before(ctx, ctx->key[cell], cell, start_key, start) &&
+		    ctx->g[start] == ctx->rhs[start])
+			break;
+
+		uint32_t g = ctx->g[cell];
+		uint32_t rhs = ctx->rhs[cell];
+		uint32_t key = add(add(g < rhs ? g : rhs, heuristic(ctx, start, cell)), ctx->km);
+
+		if (ctx->key[cell] < key) {
+			// The key was from an older start
+			ctx->key[cell] = key;
+			sift_down(ctx, 0);
+			continue;
+		}
+
+		remove_cell(ctx, cell);
+		if (g > rhs) {
+			// Overconsistent, the cell got closer to the stop
+			ctx->g[cell] = rhs;
+		} else {
+			// Underconsistent, its old distance no longer holds
+			ctx->g[cell] = DSTAR_INFINITY;
+			update_vertex(ctx, cell);
+		}
+
+		int x = cell % ctx->width;
+		int y = cell / ctx->width;
+
+		for (uint8_t k = 0; k < ctx->connectivity; k++) {
+			int nx = x + x_directions[k];
+			int ny = y + y_directions[k];
+
+			if (nx >= 0 && nx < ctx->width && ny >= 0 && ny < ctx->height)
+				update_vertex(ctx, (uint32_t)ny * ctx->width + nx);
+		}
+	}
+}
+
+/*
+ * rhs = the shortest step into a neighbour plus its g, and the cell is in the queue exactly
+ * when g != rhs
+ */
+static void update_vertex(struct dstar_lite *ctx, uint32_t cell)
+{
+	if (cell != ctx->goal) {
+		int x = cell % ctx->width;
+		int y = cell / ctx->width;
+		uint32_t rhs = DSTAR_INFINITY;
+
+		for (uint8_t k = 0; k < ctx->connectivity && ctx->map[cell] != -1; k++) {
+			uint32_t step = cost(ctx, x, y, k);
+
+			if (step == DSTAR_INFINITY)
+				continue;
+			uint32_t neighbour = cell + y_directions[k] * ctx->width + x_directions[k];
+			uint32_t distance = add(step, ctx->g[neighbour]);
+
+			if (distance < rhs)
+				rhs = distance;
+		}
+		ctx->rhs[cell] = rhs;
+	}
+
+	bool queued = ctx->queued[cell / 32] & (1u << (cell % 32));
+	uint32_t g = ctx->g[cell];
+	uint32_t rhs = ctx->rhs[cell];
+
+	if (g == rhs) {
+		if (queued)
+			remove_cell(ctx, cell);
+		return;
+	}
+
+	uint32_t key = add(add(g < rhs ? g : rhs, heuristic(ctx, ctx->start, cell)), ctx->km);
+
+	if (queued) {
+		ctx->key[cell] = key;
+		sift_up(ctx, ctx->index[cell]);
+		sift_down(ctx, ctx->index[cell]);
+	} else {
+		push(ctx, cell, key);
+	}
+}
+
+/*
+ * Cost of the step from the free cell (x, y) in direction k, infinite into an obstacle, off
+ * the map or past the corner of an obstacle
+ */
+static uint32_t cost(const struct dstar_lite *ctx, int x, int y, uint8_t k)
+{
+	int dx = x_directions[k];
+	int dy = y_directions[k];
+
+	if (!is_free(ctx, x + dx, y + dy))
+		return DSTAR_INFINITY;
+	if (k < 4)
+		return DSTAR_STRAIGHT;
+	if (!is_free(ctx, x + dx, y) || !is_free(ctx, x, y + dy))
+		return DSTAR_INFINITY;
+	return DSTAR_DIAGONAL;
+}
+
+/*
+ * a + b where infinity stays infinity
+ */
+static uint32_t add(uint32_t a, uint32_t b)
+{
+	return a >= DSTAR_INFINITY - b ? DSTAR_INFINITY : a + b;
+}
+
+/*
+ * Manhattan for 4-connectivity and octile for 8-connectivity, both consistent
+ */
+static uint32_t heuristic(const struct dstar_lite *ctx, uint32_t a, uint32_t b)
+{
+	int ax = a % ctx->width;
+	int ay = a / ctx->width;
+	int bx = b % ctx->width;
+	int by = b / ctx->width;
+	uint32_t dx = ax > bx ? ax - bx : bx - ax;
+	uint32_t dy = ay > by ? ay - by : by - ay;
+
+	if (ctx->connectivity == 4)
+		return DSTAR_STRAIGHT * (dx + dy);
+	if (dx < dy)
+		return DSTAR_STRAIGHT * dy + (DSTAR_DIAGONAL - DSTAR_STRAIGHT) * dx;
+	return DSTAR_STRAIGHT * dx + (DSTAR_DIAGONAL - DSTAR_STRAIGHT) * dy;
+}
+
+static bool is_free(const struct dstar_lite *ctx, int x, int y)
+{
+	return x >= 0 && x < ctx->width && y >= 0 && y < ctx->height &&
+	       ctx->map[y * ctx->width + x] != -1;
+}
+
+/*
+ * The queue is ordered by [key; min(g, rhs)], the second one only breaks ties
+ */
+static bool before(const struct dstar_lite *ctx, uint32_t key, uint32_t cell,
+		   uint32_t other_key, uint32_t other)
+{
+	if (key != other_key)
+		return key < other_key;
+
+	uint32_t a = ctx->g[cell] < ctx->rhs[cell] ? ctx->g[cell] : ctx->rhs[cell];
+	uint32_t b = ctx->g[other] < ctx->rhs[other] ? ctx->g[other] : ctx->rhs[other];
+
+	return a < b;
+}
+
+static void push(struct dstar_lite *ctx, uint32_t cell, uint32_t key)
+{
+	ctx->queued[cell / 32] |= 1u << (cell % 32);
+	ctx->key[cell] = key;
+	ctx->heap[ctx->length] = cell;
+	ctx->index[cell] = ctx->length;
+	sift_up(ctx, ctx->length++);
+}
+
+static void remove_cell(struct dstar_lite *ctx, uint32_t cell)
+{
+	uint32_t position = ctx->index[cell];
+	uint32_t last = ctx->heap[--ctx->length];
+
+	ctx->queued[cell / 32] &= ~(1u << (cell % 32));
+	if (last == cell)
+		return;
+	ctx->heap[position] = last;
+	ctx->index[last] = position;
+	sift_up(ctx, position);
+	sift_down(ctx, ctx->index[last]);
+}
+
+static void sift_up(struct dstar_lite *ctx, uint32_t position)
+{
+	uint32_t cell = ctx->heap[position];
+
+	while (position > 0) {
+		uint32_t up = (position - 1) / 2;
+		uint32_t other = ctx->heap[up];
+
+		if (!before(ctx, ctx->key[cell], cell, ctx->key[other], other))
+			break;
+		ctx->heap[position] = other;
+		ctx->index[other] = position;
+		position = up;
+	}
+	ctx->heap[position] = cell;
+	ctx->index[cell] = position;
+}
+
+static void sift_down(struct dstar_lite *ctx, uint32_t position)
+{
+	uint32_t cell = ctx->heap[position];
+
+	while (2 * position + 1 < ctx->length) {
+		uint32_t down = 2 * position + 1;
+
+		if (down + 1 < ctx->length &&
+		    before(ctx, ctx->key[ctx->heap[down + 1]], ctx->heap[down + 1],
+			   ctx->key[ctx->heap[down]], ctx->heap[down]))
+			down++;
+
+		uint32_t other = ctx->heap[down];
+
+		if (!before(ctx, ctx->key[other], other, ctx->key[cell], cell))
+			break;
+		ctx->heap[position] = other;
+		ctx->index[other] = position;
+		position = down;
+	}
+	ctx->heap[position] = cell;
+	ctx->index[cell] = position;
+}
@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Copyright 2022 Martin Schröder <info@swedishembedded.com>
+ * Consulting: https://swedishembedded.com/consulting
+ * Simulation: https://swedishembedded.com/simulation
+ * Training: https://swedishembedded.com/training
+ */
+
+#include <string.h>
+
+#include <control/ai.h>
+#include <control/misc.h>
+
+static void bounds(const float px[], const float py[], uint32_t p, struct geofence_zone *box);
+static void cell_range(const struct geofence *index, const struct geofence_zone *box,
+		       uint32_t *column_first, uint32_t *column_last, uint32_t *row_first,
+		       uint32_t *row_last);
+static uint32_t cell(float value, float origin, float scale, uint32_t cells);
+static void grid(struct geofence *index, const float px[], const float py[],
+		 const uint32_t points[], uint32_t zones, uint32_t columns, uint32_t rows);
+
+/*
+ * Index over many polygons, the zones, that finds the zones that contain a point without
+ * testing all of them. Their common bounding box is split into columns*rows cells and every
+ * cell lists the zones whose bounding box overlaps it. A query tests only the zones of its
+ * cell with inpolygon_prepared, so it costs O(1 + k) for k zones listed in the cell.
+ * px[], py[] - The points of all zones one after the other
+ * points[zones] - Number of points of every zone
+ * The index is one block of memory that starts at the header and holds no pointers, only
+ * offsets. Its index->size bytes can be copied and placed in flash as they are.
+ */
+size_t geofence_workspace_size(const float px[], const float py[], const uint32_t points[],
+			       uint32_t zones, uint32_t columns, uint32_t rows)
+{
+	struct geofence index;
+	size_t size = CTL_WORKSPACE_BYTES(sizeof(struct geofence)) +
+		      CTL_WORKSPACE_BYTES(zones * sizeof(struct geofence_zone)) +
+		      CTL_WORKSPACE_BYTES(((size_t)columns * rows + 1) * sizeof(uint32_t));
+	size_t entries = 0;
+	uint32_t first = 0;
+	struct geofence_zone box;
+
+	grid(&index, px, py, points, zones, columns, rows);
+	for (uint32_t z = 0; z < zones; first += points[z++]) {
+		uint32_t column_first, column_last, row_first, row_last;
+
+		bounds(&px[first], &py[first], points[z], &box);
+		cell_range(&index, &box, &column_first, &column_last, &row_first, &row_last);
+		entries += (size_t)(column_last - column_first + 1) * (row_last - row_first + 1);
+		size += polygon_workspace_size(points[z]);
+	}
+	return size + CTL_WORKSPACE_BYTES(entries * sizeof(uint32_t));
+}
+
+/*
+ * Build the index in ws, where it stays. *index points to its header.
+ * Returns 1 == Success
+ * Returns 0 == Fail, a zone has no points, columns or rows is 0 or the workspace is too small
+ */
+uint8_t geofence_build(struct geofence **index, const float px[], const float py[],
+		       const uint32_t points[], uint32_t zones, uint32_t columns, uint32_t rows,
+		       struct ctl_workspace *ws)
+{
+	if (columns == 0 || rows == 0)
+		return 0;
+	for (uint32_t z = 0; z < zones; z++)
+		if (points[z] == 0)
+			return 0;
+	if (ctl_workspace_available(ws) <
+	    geofence_workspace_size(px, py, points, zones, columns, rows))
+		return 0;
+
+	uint32_t cells = columns * rows;
+	struct geofence *header = ctl_workspace_alloc(ws, sizeof(struct geofence));
+	struct geofence_zone *zone = ctl_workspace_alloc(ws, zones * sizeof(struct geofence_zone));
+	uint8_t *base = (uint8_t *)header;
+
+	grid(header, px, py, points, zones, columns, rows);
+	header->zones = zones;
+	header->zone_offset = (uint8_t *)zone - base;
+
+	// The edge tables of every zone, in the layout of polygon_prepare
+	uint32_t first = 0;
+
+	for (uint32_t z = 0; z < zones; first += points[z++]) {
+		struct polygon polygon;
+
+		polygon_prepare(&polygon, &px[first], &py[first], points[z], ws);
+		zone[z].min_x = polygon.min_x;
+		zone[z].max_x = polygon.max_x;
+		zone[z].min_y = polygon.min_y;
+		zone[z].max_y = polygon.max_y;
+		zone[z].edges = points[z];
+		zone[z].offset = (uint8_t *)polygon.lo - base;
+	}
+
+	// Count the zones of every cell, turn the counts into the end of every cell and fill
+	// the cells from the end, which leaves start[c] at the first zone of cell c
+	uint32_t *start = ctl_workspace_alloc(ws, (cells + 1) * sizeof(uint32_t));
+	uint32_t entries = 0;
+
+	memset(start, 0, (cells + 1) * sizeof(uint32_t));
+	header->cell_offset = (uint8_t *)start - base;
+	for (uint8_t pass = 0; pass < 2; pass++) {
+		uint32_t *entry = NULL;
+
+		if (pass == 1) {
+			for (uint32_t c = 0; c < cells; c++) {
+				entries += start[c];
+				start[c] = entries;
+			}
+			start[cells] = entries;
+			entry = ctl_workspace_alloc(ws, entries * sizeof(uint32_t));
+			header->entry_offset = (uint8_t *)entry - base;
+		}
+		for (uint32_t z = zones; z-- > 0;) {
+			uint32_t column_first, column_last, row_first, row_last;
+
+			cell_range(header, &zone[z], &column_first, &column_last, &row_first,
+				   &row_last);
+			for (uint32_t r = row_first; r <= row_last; r++)
+				for (uint32_t c = column_first; c <= column_last; c++) {
+					if (pass == 0)
+						start[r * columns + c]++;
+					else
+						entry[--start[r * columns + c]] = z;
+				}
+		}
+	}
+	header->size = ws->buffer + ws->used - base;
+	*index = header;
+	return 1;
+}
+
+/*
+ * Find the zones that contain x, y
+ * zones[max] - Numbers of the zones in increasing order, at most max of them
+ * Returns the number of zones written to zones
+ */
+uint32_t geofence_query(const struct geofence *index, float x, float y, uint32_t zones[],
+			uint32_t max)
+{
+	if (y < index->min_y || y > index->max_y || x < index->min_x || x > index->max_x)
+		return 0;
+
+	const uint8_t *base = (const uint8_t *)index;
+	const struct geofence_zone *zone =
+		(const struct geofence_zone *)(base + index->zone_offset);
+	const uint32_t *start = (const uint32_t *)(base + index->cell_offset);
+	const uint32_t *entry = (const uint32_t *)(base + index->entry_offset);
+	uint32_t c = cell(y, index->min_y, index->scale_y, index->rows) * index->columns +
+		     cell(x, index->min_x, index->scale_x, index->columns);
+	uint32_t found = 0;
+
+	for (uint32_t i = start[c]; i < start[c + 1] && found < max; i++) {
+		const struct geofence_zone *z = &zone[entry[i]];
+
+		if (y < z->min_y || y > z->max_y || x < z->min_x || x > z->max_x)
+			continue;
+
+		// The four arrays of the edge table follow each other like polygon_prepare
+		// allocated them
+		size_t stride = CTL_WORKSPACE_FLOATS(z->edges) / sizeof(float);
+		struct polygon polygon = {
+			.lo = (float *)(base + z->offset),
+			.min_x = z->min_x,
+			.max_x = z->max_x,
+			.min_y = z->min_y,
+			.max_y = z->max_y,
+			.edges = z->edges,
+		};
+
+		polygon.hi = polygon.lo + stride;
+		polygon.y_lo = polygon.hi + stride;
+		polygon.slope = polygon.y_lo + stride;
+		if (inpolygon_prepared(&polygon, x, y))
+			zones[found++] = entry[i];
+	}
+	return found;
+}
+
+/*
+ * Common bounding box of all zones and the size of the cells
+ */
+static void grid(struct geofence *index, const float px[], const float py[],
+		 const uint32_t points[], uint32_t zones, uint32_t columns, uint32_t rows)
+{
+	uint32_t total = 0;
+	struct geofence_zone box = { 0 };
+
+	for (uint32_t z = 0; z < zones; z++)
+		total += points[z];
+	if (total > 0)
+		bounds(px, py, total, &box);
+
+	index->min_x = box.min_x;
+	index->max_x = box.max_x;
+	index->min_y = box.min_y;
+	index->max_y = box.max_y;
+	index->columns = columns;
+	index->rows = rows;
+	index->scale_x = box.max_x > box.min_x ? columns / (box.max_x - box.min_x) : 0;
+	index->scale_y = box.max_y > box.min_y ? rows / (box.max_y - box.min_y) : 0;
+}
+
+/*
+ * Bounding box of p points, the same one that polygon_prepare finds for geofence_build
+ */
+static void bounds(const float px[], const float py[], uint32_t p, struct geofence_zone *box)
+{
+	box->min_x = px[0];
+	box->max_x = px[0];
+	box->min_y = py[0];
+	box->max_y = py[0];
+	for (uint32_t i = 0; i < p; i++) {
+		box->min_x = vmin(px[i], box->min_x);
+		box->max_x = vmax(px[i], box->max_x);
+		box->min_y = vmin(py[i], box->min_y);
+		box->max_y = vmax(py[i], box->max_y);
+	}
+}
+
+/*
+ * Cells that the bounding box of a zone overlaps
+ */
+static void cell_range(const struct geofence *index, const struct geofence_zone *box,
+		       uint32_t *column_first, uint32_t *column_last, uint32_t *row_first,
+		       uint32_t *row_last)
+{
+	*column_first = cell(box->min_x, index->min_x, index->scale_x, index->columns);
+	*column_last = cell(box->max_x, index->min_x, index->scale_x, index->columns);
+	*row_first = cell(box->min_y, index->min_y, index->scale_y, index->rows);
+	*row_last = cell(box->max_y, index->min_y, index->scale_y, index->rows);
+}
+
+/*
+ * Cell of a coordinate inside the bounding box, the largest one lands in the last cell
+ */
+static uint32_t cell(float value, float origin, float scale, uint32_t cells)
+{
+	float position = (value - origin) * scale;
+
+	if (position <= 0)
+		return 0;
+	if (position >= cells)
+		return cells - 1;
+	return (uint32_t)position;
+}
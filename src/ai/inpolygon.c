@@ -10,6 +10,9 @@
 #include <control/ai.h>
 #include <control/misc.h>
 
+// Points per block of inpolygon_many
+#define INPOLYGON_BLOCK 64
+
 /*
  * Check if the coordinates x and y are inside the polygon px and py
  * px[p] - Points in x-axis
@@ -51,3 +54,122 @@ uint8_t inpolygon(float x, float y, float px[], float py[], uint8_t p)
 	}
 	return ok;
 }
+
+/*
+ * Edge table of the polygon px and py for many queries with inpolygon_prepared and
+ * inpolygon_many. Every edge is stored from its end with the smallest x, so the ray test
+ * of inpolygon becomes lo <= x < hi and y < y_lo + slope*(x - lo), without the division.
+ * px[p] - Points in x-axis
+ * py[p] - Points in y-axis
+ * The polygon is closed from px[p - 1], py[p - 1] back to px[0], py[0]
+ */
+size_t polygon_workspace_size(uint32_t p)
+{
+	return 4 * CTL_WORKSPACE_FLOATS(p);
+}
+
+/*
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or p is 0
+ */
+uint8_t polygon_prepare(struct polygon *polygon, const float px[], const float py[], uint32_t p,
+			struct ctl_workspace *ws)
+{
+	if (p == 0 || ctl_workspace_available(ws) < polygon_workspace_size(p))
+		return 0;
+
+	polygon->lo = ctl_workspace_floats(ws, p);
+	polygon->hi = ctl_workspace_floats(ws, p);
+	polygon->y_lo = ctl_workspace_floats(ws, p);
+	polygon->slope = ctl_workspace_floats(ws, p);
+	polygon->edges = p;
+	polygon->min_x = px[0];
+	polygon->max_x = px[0];
+	polygon->min_y = py[0];
+	polygon->max_y = py[0];
+
+	for (uint32_t i = 0, j = p - 1; i < p; j = i++) {
+		polygon->min_x = vmin(px[i], polygon->min_x);
+		polygon->max_x = vmax(px[i], polygon->max_x);
+		polygon->min_y = vmin(py[i], polygon->min_y);
+		polygon->max_y = vmax(py[i], polygon->max_y);
+
+		uint32_t l = px[i] < px[j] ? i : j;
+		uint32_t h = l == i ? j : i;
+
+		polygon->lo[i] = px[l];
+		polygon->hi[i] = px[h];
+		polygon->y_lo[i] = py[l];
+		// A vertical edge never straddles x, its slope is only kept finite
+		polygon->slope[i] = px[h] > px[l] ? (py[h] - py[l]) / (px[h] - px[l]) : 0;
+	}
+	return 1;
+}
+
+/*
+ * Return 1 or 0 if the coordinate x,y is inside the prepared polygon
+ */
+uint8_t inpolygon_prepared(const struct polygon *polygon, float x, float y)
+{
+	if (y < polygon->min_y || y > polygon->max_y || x < polygon->min_x || x > polygon->max_x)
+		return 0;
+
+	uint8_t ok = 0;
+
+	for (uint32_t i = 0; i < polygon->edges; i++) {
+		float lo = polygon->lo[i];
+		float y_cross = polygon->y_lo[i] + polygon->slope[i] * (x - lo);
+
+		if (lo <= x && x < polygon->hi[i] && y < y_cross)
+			ok = !ok;
+	}
+	return ok;
+}
+
+/*
+ * inside[k] = inpolygon_prepared(polygon, x[k], y[k]) for k = 0 ... n - 1
+ * The points go through in blocks of INPOLYGON_BLOCK. Every edge is tested against the whole
+ * block with a constant length loop, which the compiler turns into SIMD compares, and an edge
+ * is skipped for a block that lies entirely to one side of it.
+ */
+void inpolygon_many(const struct polygon *polygon, const float x[], const float y[],
+		    uint8_t inside[], uint32_t n)
+{
+	float bx[INPOLYGON_BLOCK];
+	float by[INPOLYGON_BLOCK];
+	int32_t crossings[INPOLYGON_BLOCK];
+
+	for (uint32_t k0 = 0; k0 < n; k0 += INPOLYGON_BLOCK) {
+		uint32_t m = n - k0 < INPOLYGON_BLOCK ? n - k0 : INPOLYGON_BLOCK;
+		float block_min = x[k0];
+		float block_max = x[k0];
+
+		// The tail of the last block is left of the polygon, where nothing crosses
+		for (uint32_t k = 0; k < INPOLYGON_BLOCK; k++) {
+			bx[k] = k < m ? x[k0 + k] : polygon->min_x - 1;
+			by[k] = k < m ? y[k0 + k] : 0;
+			crossings[k] = 0;
+		}
+		for (uint32_t k = 0; k < m; k++) {
+			block_min = bx[k] < block_min ? bx[k] : block_min;
+			block_max = bx[k] > block_max ? bx[k] : block_max;
+		}
+
+		for (uint32_t i = 0; i < polygon->edges; i++) {
+			float lo = polygon->lo[i];
+			float hi = polygon->hi[i];
+			float y_lo = polygon->y_lo[i];
+			float slope = polygon->slope[i];
+
+			if (hi <= block_min || lo > block_max)
+				continue;
+			for (uint32_t k = 0; k < INPOLYGON_BLOCK; k++)
+				crossings[k] ^= (lo <= bx[k]) & (bx[k] < hi) &
+						(by[k] < y_lo + slope * (bx[k] - lo));
+		}
+
+		// Outside the bounding box the crossings are even, so only the parity is needed
+		for (uint32_t k = 0; k < m; k++)
+			inside[k0 + k] = crossings[k];
+	}
+}
@@ -7,7 +7,6 @@
  * Training: https://swedishembedded.com/training
  */
 
-#include <string.h>
 #include <control/linalg.h>
 #include <control/controller.h>
 
@@ -17,31 +16,36 @@
  */
 void c2d(float A[], float B[], uint8_t ADIM, uint8_t RDIM, float sampleTime)
 {
-	float M[(ADIM + RDIM) * (ADIM + RDIM)];
-
-	memset(M, 0, sizeof(M));
-	// Create M = [A B; zeros(RDIM, ADIM) zeros(RDIM, RDIM)]
-	for (uint8_t i = 0; i < ADIM; i++) {
-		// For A row
-		for (uint8_t j = 0; j < ADIM; j++) {
-			M[i * (ADIM + RDIM) + j] = A[i * ADIM + j] * sampleTime;
-		}
-		// For B row
-		for (uint8_t j = 0; j < RDIM; j++) {
-			M[i * (ADIM + RDIM) + j + ADIM] = B[i * RDIM + j] * sampleTime;
-		}
-	}
-	expm(M, ADIM + RDIM);
-	for (uint8_t i = 0; i < ADIM; i++) {
-		// For A row
-		for (uint8_t j = 0; j < ADIM; j++) {
-			A[i * ADIM + j] = M[i * (ADIM + RDIM) + j];
-		}
-		// For B row
-		for (uint8_t j = 0; j < RDIM; j++) {
-			B[i * RDIM + j] = M[i * (ADIM + RDIM) + j + ADIM];
-		}
-	}
+	CTL_WORKSPACE_ON_STACK(ws, c2d_workspace_size(ADIM, RDIM));
+
+	c2d_ws(A, B, ADIM, RDIM, sampleTime, &ws);
+}
+
+size_t c2d_workspace_size(uint8_t ADIM, uint8_t RDIM)
+{
+	return expm_augmented_workspace_size(ADIM, RDIM);
+}
+
+/*
+ * Same as c2d, with the matrix exponential scratch taken from the workspace
+ * expm([A B; 0 0]*sampleTime) is block triangular, so only its top block row
+ * [ADIM*(ADIM + RDIM)] is computed, see expm_augmented
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or A and B are not finite
+ */
+uint8_t c2d_ws(float A[], float B[], uint8_t ADIM, uint8_t RDIM, float sampleTime,
+	       struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < c2d_workspace_size(ADIM, RDIM))
+		return 0;
+
+	for (uint16_t i = 0; i < ADIM * ADIM; i++)
+		A[i] *= sampleTime;
+	for (uint16_t i = 0; i < ADIM * RDIM; i++)
+		B[i] *= sampleTime;
+
+	// [A B] = expm([A B; 0 0]*sampleTime)(1:ADIM, :)
+	return expm_augmented_ws(A, B, ADIM, RDIM, ws);
 }
 
 /*
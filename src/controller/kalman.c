@@ -7,6 +7,8 @@
  * Training: https://swedishembedded.com/training
  */
 
+#include <string.h>
+
 #include <control/linalg.h>
 #include <control/controller.h>
 
@@ -17,28 +19,52 @@
 void kalman(float A[], float B[], float C[], float K[], float u[], float x[], float y[],
 	    uint8_t ADIM, uint8_t YDIM, uint8_t RDIM)
 {
+	CTL_WORKSPACE_ON_STACK(ws, kalman_workspace_size(ADIM, YDIM, RDIM));
+
+	kalman_ws(A, B, C, K, u, x, y, ADIM, YDIM, RDIM, &ws);
+}
+
+size_t kalman_workspace_size(uint8_t ADIM, uint8_t YDIM, uint8_t RDIM)
+{
+	(void)RDIM;
+	return 4 * CTL_WORKSPACE_FLOATS(ADIM) + CTL_WORKSPACE_FLOATS(YDIM);
+}
+
+/*
+ * Same as kalman, with the temporary vectors taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t kalman_ws(float A[], float B[], float C[], float K[], float u[], float x[], float y[],
+		  uint8_t ADIM, uint8_t YDIM, uint8_t RDIM, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < kalman_workspace_size(ADIM, YDIM, RDIM))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+
 	// Compute the vector A_vec = A*x
-	float A_vec[ADIM * 1];
+	float *A_vec = ctl_workspace_floats(ws, ADIM);
 
 	mul(A, x, A_vec, ADIM, ADIM, 1);
 
 	// Compute the vector B_vec = B*u
-	float B_vec[ADIM * 1];
+	float *B_vec = ctl_workspace_floats(ws, ADIM);
 
 	mul(B, u, B_vec, ADIM, RDIM, 1);
 
 	// Compute the vector C_vec = C*x
-	float C_vec[YDIM * 1];
+	float *C_vec = ctl_workspace_floats(ws, YDIM);
 
 	mul(C, x, C_vec, YDIM, ADIM, 1);
 
 	// Compute the vector KC_vec = K*C_vec
-	float KC_vec[ADIM * 1];
+	float *KC_vec = ctl_workspace_floats(ws, ADIM);
 
 	mul(K, C_vec, KC_vec, ADIM, YDIM, 1);
 
 	// Compute the vector Ky_vec = K*y
-	float Ky_vec[ADIM * 1];
+	float *Ky_vec = ctl_workspace_floats(ws, ADIM);
 
 	mul(K, y, Ky_vec, ADIM, YDIM, 1);
 
@@ -46,4 +72,66 @@ void kalman(float A[], float B[], float C[], float K[], float u[], float x[], fl
 	for (uint8_t i = 0; i < ADIM; i++) {
 		x[i] = A_vec[i] - KC_vec[i] + B_vec[i] + Ky_vec[i];
 	}
+
+	ctl_workspace_release(ws, mark);
+	return 1;
+}
+
+size_t kalman_init_workspace_size(uint8_t ADIM, uint8_t YDIM, uint8_t RDIM)
+{
+	uint16_t column = (uint16_t)ADIM + RDIM + YDIM;
+
+	return CTL_WORKSPACE_FLOATS((size_t)ADIM * column) + CTL_WORKSPACE_FLOATS(column);
+}
+
+/*
+ * Fuse the constant matrices of kalman into M = [A - KC | B | K] once, so that every
+ * update is the single matrix-vector product x = M*[x; u; y]
+ * M and the concatenated vector live in ws for as long as the ctx is used
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t kalman_init(struct kalman_ctx *ctx, float A[], float B[], float C[], float K[],
+		    uint8_t ADIM, uint8_t YDIM, uint8_t RDIM, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < kalman_init_workspace_size(ADIM, YDIM, RDIM))
+		return 0;
+
+	uint16_t column = (uint16_t)ADIM + RDIM + YDIM;
+
+	ctx->M = ctl_workspace_floats(ws, (size_t)ADIM * column);
+	ctx->v = ctl_workspace_floats(ws, column);
+	ctx->ADIM = ADIM;
+	ctx->YDIM = YDIM;
+	ctx->RDIM = RDIM;
+
+	for (uint8_t i = 0; i < ADIM; i++) {
+		float *row = &ctx->M[(size_t)i * column];
+
+		// A - K*C
+		for (uint8_t j = 0; j < ADIM; j++) {
+			float KC = 0;
+
+			for (uint8_t k = 0; k < YDIM; k++)
+				KC += K[i * YDIM + k] * C[k * ADIM + j];
+			row[j] = A[i * ADIM + j] - KC;
+		}
+		memcpy(&row[ADIM], &B[i * RDIM], RDIM * sizeof(float));
+		memcpy(&row[ADIM + RDIM], &K[i * YDIM], YDIM * sizeof(float));
+	}
+	memset(ctx->v, 0, column * sizeof(float));
+	return 1;
+}
+
+/*
+ * Same state update as kalman, x = [A - KC | B | K]*[x; u; y]
+ */
+void kalman_step(struct kalman_ctx *ctx, float u[], float x[], float y[])
+{
+	float *v = ctx->v;
+
+	memcpy(v, x, ctx->ADIM * sizeof(float));
+	memcpy(&v[ctx->ADIM], u, ctx->RDIM * sizeof(float));
+	memcpy(&v[ctx->ADIM + ctx->RDIM], y, ctx->YDIM * sizeof(float));
+	mul(ctx->M, v, x, ctx->ADIM, (uint16_t)ctx->ADIM + ctx->RDIM + ctx->YDIM, 1);
 }
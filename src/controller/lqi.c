@@ -7,6 +7,8 @@
  * Training: https://swedishembedded.com/training
  */
 
+#include <string.h>
+
 #include <control/linalg.h>
 #include <control/controller.h>
 
@@ -26,13 +28,36 @@ static void integral(uint8_t ANTI_WINDUP, float xi[], float r[], float y[], uint
 void lqi(float y[], float u[], float qi, float r[], float L[], float Li[], float x[], float xi[],
 	 uint8_t ADIM, uint8_t YDIM, uint8_t RDIM, uint8_t ANTI_WINDUP)
 {
+	CTL_WORKSPACE_ON_STACK(ws, lqi_workspace_size(RDIM));
+
+	lqi_ws(y, u, qi, r, L, Li, x, xi, ADIM, YDIM, RDIM, ANTI_WINDUP, &ws);
+}
+
+size_t lqi_workspace_size(uint8_t RDIM)
+{
+	return 2 * CTL_WORKSPACE_FLOATS(RDIM);
+}
+
+/*
+ * Same as lqi, with the temporary vectors taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t lqi_ws(float y[], float u[], float qi, float r[], float L[], float Li[], float x[],
+	       float xi[], uint8_t ADIM, uint8_t YDIM, uint8_t RDIM, uint8_t ANTI_WINDUP,
+	       struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < lqi_workspace_size(RDIM))
+		return 0;
+
 	// First compute the control law: L_vec = L*x
-	float L_vec[RDIM * 1];
+	size_t mark = ctl_workspace_mark(ws);
+	float *L_vec = ctl_workspace_floats(ws, RDIM);
 
 	mul(L, x, L_vec, RDIM, ADIM, 1);
 
 	// Then compute the integral law: Li_vec = Li*xi
-	float Li_vec[RDIM];
+	float *Li_vec = ctl_workspace_floats(ws, RDIM);
 
 	integral(ANTI_WINDUP, xi, r, y, RDIM);
 	mul(Li, xi, Li_vec, RDIM, YDIM, 1);
@@ -41,6 +66,91 @@ void lqi(float y[], float u[], float qi, float r[], float L[], float Li[], float
 	for (uint8_t i = 0; i < RDIM; i++) {
 		u[i] = Li[i * RDIM] / (1 - qi) * r[i] - (L_vec[i] - Li_vec[i]);
 	}
+
+	ctl_workspace_release(ws, mark);
+	return 1;
+}
+
+size_t lqi_init_workspace_size(uint8_t ADIM, uint8_t YDIM, uint8_t RDIM)
+{
+	uint16_t column = (uint16_t)ADIM + YDIM;
+
+	return CTL_WORKSPACE_FLOATS((size_t)RDIM * column) + CTL_WORKSPACE_FLOATS(RDIM) +
+	       CTL_WORKSPACE_FLOATS(column);
+}
+
+/*
+ * Fuse the control law and the integral law of lqi into M = [-L | Li] and the reference
+ * gains Li(i, 0)/(1 - qi) once, so that every step is u = gain.*r + M*[x; xi]
+ * The integral state xi is kept in the ctx and starts at zero
+ * Everything lives in ws for as long as the ctx is used
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t lqi_init(struct lqi_ctx *ctx, float L[], float Li[], float qi, uint8_t ADIM,
+		 uint8_t YDIM, uint8_t RDIM, uint8_t ANTI_WINDUP, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < lqi_init_workspace_size(ADIM, YDIM, RDIM))
+		return 0;
+
+	uint16_t column = (uint16_t)ADIM + YDIM;
+
+	ctx->M = ctl_workspace_floats(ws, (size_t)RDIM * column);
+	ctx->gain = ctl_workspace_floats(ws, RDIM);
+	ctx->v = ctl_workspace_floats(ws, column);
+	ctx->ADIM = ADIM;
+	ctx->YDIM = YDIM;
+	ctx->RDIM = RDIM;
+	ctx->ANTI_WINDUP = ANTI_WINDUP;
+
+	for (uint8_t i = 0; i < RDIM; i++) {
+		float *row = &ctx->M[(size_t)i * column];
+
+		for (uint8_t j = 0; j < ADIM; j++)
+			row[j] = -L[i * ADIM + j];
+		memcpy(&row[ADIM], &Li[i * YDIM], YDIM * sizeof(float));
+		ctx->gain[i] = Li[i * RDIM] / (1 - qi);
+	}
+	memset(ctx->v, 0, column * sizeof(float));
+	return 1;
+}
+
+/*
+ * Same inputs as lqi, u = Li/(1-qi)*r - (L*x - Li*xi) as one matrix-vector product
+ */
+void lqi_step(struct lqi_ctx *ctx, float y[], float u[], float r[], float x[])
+{
+	float *v = ctx->v;
+
+	memcpy(v, x, ctx->ADIM * sizeof(float));
+	integral(ctx->ANTI_WINDUP, &v[ctx->ADIM], r, y, ctx->RDIM);
+	mul(ctx->M, v, u, ctx->RDIM, (uint16_t)ctx->ADIM + ctx->YDIM, 1);
+	for (uint8_t i = 0; i < ctx->RDIM; i++)
+		u[i] += ctx->gain[i] * r[i];
+}
+
+/*
+ * One tick of the observer and the regulator together: the regulator computes u from the
+ * estimate x, then the observer updates x with u and the measurement y
+ * Does the same as lqi_step followed by kalman_step, but u is written straight into the
+ * concatenated vector of the observer
+ */
+void lqi_kalman_step(struct lqi_ctx *regulator, struct kalman_ctx *observer, float y[],
+		     float u[], float r[], float x[])
+{
+	uint8_t ADIM = observer->ADIM;
+	uint8_t RDIM = observer->RDIM;
+	float *v = observer->v;
+	float *uv = &v[ADIM];
+
+	// Regulator
+	lqi_step(regulator, y, uv, r, x);
+	memcpy(u, uv, RDIM * sizeof(float));
+
+	// Observer
+	memcpy(v, x, ADIM * sizeof(float));
+	memcpy(&v[ADIM + RDIM], y, observer->YDIM * sizeof(float));
+	mul(observer->M, v, x, ADIM, (uint16_t)ADIM + RDIM + observer->YDIM, 1);
 }
 
 /*
@@ -13,111 +13,325 @@
 #include <control/linalg.h>
 
 static void obsv(float PHI[], float A[], float C[], uint8_t ADIM, uint8_t YDIM, uint8_t RDIM,
-		 uint8_t HORIZON);
+		 uint8_t HORIZON, struct ctl_workspace *ws);
 static void cab(float GAMMA[], float PHI[], float A[], float B[], float C[], uint8_t ADIM,
-		uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON);
+		uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON, struct ctl_workspace *ws);
+static size_t obsv_workspace_size(uint8_t ADIM, uint8_t YDIM);
+static size_t cab_workspace_size(uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON);
+static uint8_t mpc_step_qp(struct mpc_ctx *ctx, float b[], float U[], struct ctl_workspace *ws);
 
 /*
  * Model predictive control
  * Hint: Look up lmpc.m in Matavecontrol
+ * This builds the prediction matrices on every call, use mpc_init and mpc_step when
+ * the model and the horizon stay the same between the calls.
  */
 void mpc(float A[], float B[], float C[], float x[], float u[], float r[], uint8_t ADIM,
 	 uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON, uint8_t ITERATION_LIMIT, bool has_integration)
 {
-	// Create the extended observability matrix
-	float PHI[HORIZON * YDIM * ADIM];
+	CTL_WORKSPACE_ON_STACK(ws, mpc_workspace_size(ADIM, YDIM, RDIM, HORIZON));
+
+	mpc_ws(A, B, C, x, u, r, ADIM, YDIM, RDIM, HORIZON, ITERATION_LIMIT, has_integration, &ws);
+}
+
+size_t mpc_workspace_size(uint8_t ADIM, uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON)
+{
+	return mpc_init_workspace_size(ADIM, YDIM, RDIM, HORIZON) +
+	       mpc_step_workspace_size(YDIM, RDIM, HORIZON);
+}
+
+/*
+ * Same as mpc, with all matrices taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t mpc_ws(float A[], float B[], float C[], float x[], float u[], float r[], uint8_t ADIM,
+	       uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON, uint8_t ITERATION_LIMIT,
+	       bool has_integration, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < mpc_workspace_size(ADIM, YDIM, RDIM, HORIZON))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	struct mpc_ctx ctx;
+
+	mpc_init(&ctx, A, B, C, ADIM, YDIM, RDIM, HORIZON, ITERATION_LIMIT, has_integration, ws);
+	mpc_step(&ctx, x, u, r, ws);
+
+	ctl_workspace_release(ws, mark);
+	return 1;
+}
+
+/*
+ * Workspace that mpc_init takes. PHI, GAMMA and GAMMA'*GAMMA stay allocated for the
+ * lifetime of the context, the rest is only used while they are built.
+ */
+size_t mpc_init_workspace_size(uint8_t ADIM, uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON)
+{
+	uint16_t HY = HORIZON * YDIM;
+	uint16_t HR = HORIZON * RDIM;
+	size_t nested = obsv_workspace_size(ADIM, YDIM);
+
+	nested = ctl_workspace_max(nested, cab_workspace_size(YDIM, RDIM, HORIZON));
+
+	return CTL_WORKSPACE_FLOATS(HY * ADIM) + CTL_WORKSPACE_FLOATS(HY * HR) +
+	       CTL_WORKSPACE_FLOATS(HR * HR) + nested;
+}
+
+/*
+ * Build the prediction matrices for a model and a horizon once
+ * PHI = [C*A; C*A^2; ... ; C*A^HORIZON]
+ * GAMMA = lower triangular toeplitz of C*A^i*B
+ * H = GAMMA'*GAMMA
+ * They are taken from the workspace and stay there, so the workspace must outlive ctx
+ * and must not be released past this call while ctx is in use.
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t mpc_init(struct mpc_ctx *ctx, float A[], float B[], float C[], uint8_t ADIM,
+		 uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON, uint8_t ITERATION_LIMIT,
+		 bool has_integration, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < mpc_init_workspace_size(ADIM, YDIM, RDIM, HORIZON))
+		return 0;
 
-	obsv(PHI, A, C, ADIM, YDIM, RDIM, HORIZON);
+	uint16_t HY = HORIZON * YDIM;
+	uint16_t HR = HORIZON * RDIM;
+
+	ctx->ADIM = ADIM;
+	ctx->YDIM = YDIM;
+	ctx->RDIM = RDIM;
+	ctx->HORIZON = HORIZON;
+	ctx->ITERATION_LIMIT = ITERATION_LIMIT;
+	ctx->has_integration = has_integration;
+	ctx->constrained = false;
+
+	// Create the extended observability matrix
+	ctx->PHI = ctl_workspace_floats(ws, HY * ADIM);
+	obsv(ctx->PHI, A, C, ADIM, YDIM, RDIM, HORIZON, ws);
 
 	// Create the lower triangular toeplitz matrix
-	float GAMMA[HORIZON * YDIM * HORIZON * RDIM];
+	ctx->GAMMA = ctl_workspace_floats(ws, HY * HR);
+	memset(ctx->GAMMA, 0, HY * HR * sizeof(float));
+	cab(ctx->GAMMA, ctx->PHI, A, B, C, ADIM, YDIM, RDIM, HORIZON, ws);
 
-	// We need memset here
-	memset(GAMMA, 0, HORIZON * YDIM * HORIZON * RDIM * sizeof(float));
-	cab(GAMMA, PHI, A, B, C, ADIM, YDIM, RDIM, HORIZON);
+	// H = GAMMA'*GAMMA, the transpose is read in place
+	ctx->H = ctl_workspace_floats(ws, HR * HR);
+	gemm(true, false, 1.0f, ctx->GAMMA, ctx->GAMMA, 0.0f, ctx->H, HR, HR, HY);
 
-	// Find the input value from GAMMA and PHI
-	// R_vec = R*r
-	float R_vec[HORIZON * YDIM];
+	return 1;
+}
+
+size_t mpc_constrain_workspace_size(uint8_t RDIM, uint8_t HORIZON)
+{
+	uint16_t HR = HORIZON * RDIM;
+
+	return 2 * CTL_WORKSPACE_FLOATS(HR) + CTL_WORKSPACE_FLOATS(2 * HR * HR) +
+	       2 * CTL_WORKSPACE_FLOATS(RDIM) + qp_init_workspace_size(HR);
+}
 
-	for (uint8_t i = 0; i < HORIZON * YDIM; i++) {
-		for (uint8_t j = 0; j < YDIM; j++) {
-			R_vec[i + j] = r[j];
+/*
+ * Let mpc_step find the inputs U over the horizon with quadratic programming
+ * Min 0.5*U'*(GAMMA'*GAMMA + lambda*I)*U - (GAMMA'*(R - PHI*x))'*U
+ * S.t umin <= u <= umax
+ *     -du_max <= u(k) - u(k - 1) <= du_max
+ * umin, umax, du_max [RDIM], each of them can be NULL to leave it out
+ * lambda > 0 weights the inputs and keeps the Hessian positive definite
+ * Call it once after mpc_init with the same workspace. mpc_step then applies the first
+ * input of U, warm starts every solve from the last one and limits the change to the
+ * input it applied before, which starts at zero.
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or the Hessian is not positive definite
+ */
+uint8_t mpc_constrain(struct mpc_ctx *ctx, float umin[], float umax[], float du_max[],
+		      float lambda, struct ctl_workspace *ws)
+{
+	uint8_t RDIM = ctx->RDIM;
+	uint16_t HR = ctx->HORIZON * RDIM;
+
+	if (ctl_workspace_available(ws) < mpc_constrain_workspace_size(RDIM, ctx->HORIZON))
+		return 0;
+
+	ctx->lb = NULL;
+	ctx->ub = NULL;
+	ctx->D = NULL;
+	if (umin) {
+		ctx->lb = ctl_workspace_floats(ws, HR);
+		for (uint16_t i = 0; i < HR; i += RDIM)
+			memcpy(ctx->lb + i, umin, RDIM * sizeof(float));
+	}
+	if (umax) {
+		ctx->ub = ctl_workspace_floats(ws, HR);
+		for (uint16_t i = 0; i < HR; i += RDIM)
+			memcpy(ctx->ub + i, umax, RDIM * sizeof(float));
+	}
+
+	// D = [I - shifted I; -I + shifted I], the first block is bounded by u_last in mpc_step
+	if (du_max) {
+		ctx->D = ctl_workspace_floats(ws, 2 * HR * HR);
+		memset(ctx->D, 0, 2 * HR * HR * sizeof(float));
+		for (uint16_t i = 0; i < HR; i++) {
+			ctx->D[i * HR + i] = 1.0f;
+			ctx->D[(HR + i) * HR + i] = -1.0f;
+			if (i >= RDIM) {
+				ctx->D[i * HR + i - RDIM] = -1.0f;
+				ctx->D[(HR + i) * HR + i - RDIM] = 1.0f;
+			}
 		}
-		i += YDIM - 1;
+		ctx->du_max = ctl_workspace_floats(ws, RDIM);
+		memcpy(ctx->du_max, du_max, RDIM * sizeof(float));
 	}
+	ctx->u_last = ctl_workspace_floats(ws, RDIM);
+	memset(ctx->u_last, 0, RDIM * sizeof(float));
 
-	// PHI_vec = PHI*x
-	float PHI_vec[HORIZON * YDIM];
+	for (uint16_t i = 0; i < HR; i++)
+		ctx->H[i * HR + i] += lambda;
 
-	mul(PHI, x, PHI_vec, HORIZON * YDIM, ADIM, 1);
+	ctx->constrained = qp_init(&ctx->qp, ctx->H, HR, ws);
+	return ctx->constrained;
+}
 
-	// R_PHI_vec = R_vec - PHI_vec
-	float R_PHI_vec[HORIZON * YDIM];
+size_t mpc_step_workspace_size(uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON)
+{
+	uint16_t HY = HORIZON * YDIM;
+	uint16_t HR = HORIZON * RDIM;
+	uint16_t vector = HY > HR ? HY : HR;
+	size_t nested = linprog_workspace_size(HY, HR, 0);
 
-	for (uint8_t i = 0; i < HORIZON * YDIM; i++) {
-		*(R_PHI_vec + i) = *(R_vec + i) - *(PHI_vec + i);
-	}
+	nested = ctl_workspace_max(nested, CTL_WORKSPACE_FLOATS(2 * HR) +
+						   qp_solve_workspace_size(2 * HR, HR));
+
+	return 4 * CTL_WORKSPACE_FLOATS(vector) + nested;
+}
+
+/*
+ * Compute the next input u from the state x and the reference r with the prediction
+ * matrices in ctx. This is a few matrix-vector products and the linear programming, or
+ * the quadratic programming after mpc_constrain.
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or the QP had no solution within
+ * ITERATION_LIMIT changes of the active set. u is still the best input found then.
+ */
+uint8_t mpc_step(struct mpc_ctx *ctx, float x[], float u[], float r[], struct ctl_workspace *ws)
+{
+	uint8_t YDIM = ctx->YDIM;
+	uint8_t RDIM = ctx->RDIM;
+	uint8_t HORIZON = ctx->HORIZON;
 
-	// Transpose gamma
-	float GAMMAT[HORIZON * YDIM * HORIZON * RDIM];
+	if (ctl_workspace_available(ws) < mpc_step_workspace_size(YDIM, RDIM, HORIZON))
+		return 0;
 
-	memcpy(GAMMAT, GAMMA, HORIZON * YDIM * HORIZON * RDIM * sizeof(float)); // GAMMA -> GAMMAT
-	tran(GAMMAT, HORIZON * YDIM, HORIZON * RDIM);
+	size_t mark = ctl_workspace_mark(ws);
+	uint16_t HY = HORIZON * YDIM;
+	uint16_t HR = HORIZON * RDIM;
 
-	// b = GAMMAT*R_PHI_vec
-	float b[HORIZON * YDIM];
+	// The vectors that hold HORIZON * RDIM elements as well
+	uint16_t vector = HY > HR ? HY : HR;
 
-	//memset(b, 0, HORIZON * YDIM * sizeof(float));
-	mul(GAMMAT, R_PHI_vec, b, HORIZON * RDIM, HORIZON * YDIM, 1);
+	// Find the input value from GAMMA and PHI
+	// R_vec = R*r
+	float *R_vec = ctl_workspace_floats(ws, vector);
+
+	for (uint16_t i = 0; i < HY; i += YDIM)
+		memcpy(R_vec + i, r, YDIM * sizeof(float));
+
+	// R_PHI_vec = R_vec - PHI*x
+	float *R_PHI_vec = ctl_workspace_floats(ws, vector);
+
+	memcpy(R_PHI_vec, R_vec, HY * sizeof(float));
+	gemm(false, false, -1.0f, ctx->PHI, x, 1.0f, R_PHI_vec, HY, 1, ctx->ADIM);
 
-	// GAMMATGAMMA = GAMMAT*GAMMA = A
-	float GAMMATGAMMA[HORIZON * RDIM * HORIZON * RDIM];
+	// b = GAMMA'*R_PHI_vec, the transpose is read in place
+	float *b = ctl_workspace_floats(ws, vector);
 
-	//memset(GAMMATGAMMA, 0, HORIZON * RDIM*HORIZON * RDIM * sizeof(float));
-	mul(GAMMAT, GAMMA, GAMMATGAMMA, HORIZON * RDIM, HORIZON * YDIM, HORIZON * RDIM);
+	gemm(true, false, 1.0f, ctx->GAMMA, R_PHI_vec, 0.0f, b, HR, 1, HY);
 
-	// Copy A and call it AT
-	float AT[HORIZON * RDIM * HORIZON * RDIM];
+	if (ctx->constrained) {
+		uint8_t status = mpc_step_qp(ctx, b, R_vec, ws);
 
-	memcpy(AT, GAMMATGAMMA, HORIZON * RDIM * HORIZON * RDIM * sizeof(float)); // A -> AT
-	tran(AT, HORIZON * RDIM, HORIZON * RDIM);
+		memcpy(u, R_vec, RDIM * sizeof(float));
+		memcpy(ctx->u_last, u, RDIM * sizeof(float));
+		ctl_workspace_release(ws, mark);
+		return status;
+	}
 
-	// Now create c = AT*R_PHI_vec
-	float c[HORIZON * YDIM];
+	// Now create c = GAMMA'*GAMMA*R_PHI_vec
+	float *c = ctl_workspace_floats(ws, vector);
 
-	mul(AT, R_PHI_vec, c, HORIZON * RDIM, HORIZON * RDIM, 1);
+	mul(ctx->H, R_PHI_vec, c, HR, HR, 1);
 
 	// Do linear programming now
-	linprog(c, GAMMATGAMMA, b, R_vec, HORIZON * YDIM, HORIZON * RDIM, 0, ITERATION_LIMIT);
+	linprog_ws(c, ctx->H, b, R_vec, HY, HR, 0, ctx->ITERATION_LIMIT, ws);
 
 	// We select the best input values, depending on if we have integration behavior or not in our model
-	if (has_integration == true) {
+	if (ctx->has_integration == true) {
 		// Set first R_vec to u - Done
-		for (uint8_t i = 0; i < RDIM; i++) {
-			u[i] = R_vec[i];
-		}
+		memcpy(u, R_vec, RDIM * sizeof(float));
 	} else {
 		// Set last R_vec to u - Done
+		memcpy(u, R_vec + HR - RDIM, RDIM * sizeof(float));
+	}
+
+	ctl_workspace_release(ws, mark);
+	return 1;
+}
+
+/*
+ * Solve for the inputs U over the horizon with the QP of mpc_constrain
+ * b = GAMMA'*(R - PHI*x) is negated into the linear term
+ */
+static uint8_t mpc_step_qp(struct mpc_ctx *ctx, float b[], float U[], struct ctl_workspace *ws)
+{
+	uint8_t RDIM = ctx->RDIM;
+	uint16_t HR = ctx->HORIZON * RDIM;
+	size_t mark = ctl_workspace_mark(ws);
+	float *d = NULL;
+	uint16_t m = 0;
+
+	for (uint16_t i = 0; i < HR; i++)
+		b[i] = -b[i];
+
+	// The rate of the first input is relative to the input applied last time
+	if (ctx->D) {
+		m = 2 * HR;
+		d = ctl_workspace_floats(ws, m);
+		for (uint16_t i = 0; i < HR; i++) {
+			d[i] = ctx->du_max[i % RDIM];
+			d[HR + i] = ctx->du_max[i % RDIM];
+		}
 		for (uint8_t i = 0; i < RDIM; i++) {
-			u[i] = R_vec[HORIZON * RDIM - RDIM + i];
+			d[i] += ctx->u_last[i];
+			d[HR + i] -= ctx->u_last[i];
 		}
 	}
+
+	uint8_t status = qp_solve(&ctx->qp, b, ctx->D, d, ctx->lb, ctx->ub, U, m,
+				  ctx->ITERATION_LIMIT, ws);
+
+	ctl_workspace_release(ws, mark);
+	return status;
 }
 
 /*
  * [C*A^1; C*A^2; C*A^3; ... ; C*A^HORIZON] % Extended observability matrix
  */
+static size_t obsv_workspace_size(uint8_t ADIM, uint8_t YDIM)
+{
+	return 2 * CTL_WORKSPACE_FLOATS(ADIM * ADIM) + CTL_WORKSPACE_FLOATS(YDIM * ADIM);
+}
+
 static void obsv(float PHI[], float A[], float C[], uint8_t ADIM, uint8_t YDIM, uint8_t RDIM,
-		 uint8_t HORIZON)
+		 uint8_t HORIZON, struct ctl_workspace *ws)
 {
+	size_t mark = ctl_workspace_mark(ws);
+
 	// This matrix will A^(i+1) all the time
-	float A_copy[ADIM * ADIM];
+	float *A_copy = ctl_workspace_floats(ws, ADIM * ADIM);
 
 	memcpy(A_copy, A, ADIM * ADIM * sizeof(float));
 
 	// Temporary matrix
-	float T[YDIM * ADIM];
+	float *T = ctl_workspace_floats(ws, YDIM * ADIM);
 	//memset(T, 0, YDIM * ADIM * sizeof(float));
 
 	// Regular T = C*A^(1+i)
@@ -127,7 +341,7 @@ static void obsv(float PHI[], float A[], float C[], uint8_t ADIM, uint8_t YDIM,
 	memcpy(PHI, T, YDIM * ADIM * sizeof(float));
 
 	// Do the rest C*A^(i+1) because we have already done i = 0
-	float A_pow[ADIM * ADIM];
+	float *A_pow = ctl_workspace_floats(ws, ADIM * ADIM);
 
 	for (uint8_t i = 1; i < HORIZON; i++) {
 		mul(A, A_copy, A_pow, ADIM, ADIM, ADIM); //  Matrix power A_pow = A*A_copy
@@ -136,28 +350,34 @@ static void obsv(float PHI[], float A[], float C[], uint8_t ADIM, uint8_t YDIM,
 		       YDIM * ADIM * sizeof(float)); // Insert temporary T into PHI
 		memcpy(A_copy, A_pow, ADIM * ADIM * sizeof(float)); // A_copy <- A_pow
 	}
+
+	ctl_workspace_release(ws, mark);
 }
 
 /*
  * Lower triangular toeplitz of extended observability matrix
  * CAB stands for C*A^i*B because every element is C*A*B
  */
+static size_t cab_workspace_size(uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON)
+{
+	return CTL_WORKSPACE_FLOATS(YDIM * RDIM) + CTL_WORKSPACE_FLOATS(HORIZON * YDIM * RDIM);
+}
+
 static void cab(float GAMMA[], float PHI[], float A[], float B[], float C[], uint8_t ADIM,
-		uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON)
+		uint8_t YDIM, uint8_t RDIM, uint8_t HORIZON, struct ctl_workspace *ws)
 {
-	// First create the initial C*A^0*B == C*I*B == C*B
-	float CB[YDIM * RDIM];
+	size_t mark = ctl_workspace_mark(ws);
 
-	mul(C, B, CB, YDIM, ADIM, RDIM);
+	// First create the initial C*A^0*B == C*I*B == C*B
+	// It is stored transposed as (C*B)' = B'*C' so it has dimension RDIM*YDIM instead
+	float *CB = ctl_workspace_floats(ws, YDIM * RDIM);
 
-	// Take the transpose of CB so it will have dimension RDIM*YDIM instead
-	tran(CB, YDIM, RDIM);
+	gemm(true, true, 1.0f, B, C, 0.0f, CB, RDIM, YDIM, ADIM);
 
-	// Create the CAB matrix from PHI*B
-	float PHIB[HORIZON * YDIM * RDIM];
+	// Create the CAB matrix from PHI*B, also transposed
+	float *PHIB = ctl_workspace_floats(ws, HORIZON * YDIM * RDIM);
 
-	mul(PHI, B, PHIB, HORIZON * YDIM, ADIM, RDIM); // CAB = PHI*B
-	tran(PHIB, HORIZON * YDIM, RDIM);
+	gemm(true, true, 1.0f, B, PHI, 0.0f, PHIB, RDIM, HORIZON * YDIM, ADIM); // CAB' = B'*PHI'
 
 	/*
 	 * We insert GAMMA = [CB PHI;
@@ -177,4 +397,6 @@ static void cab(float GAMMA[], float PHI[], float A[], float B[], float C[], uin
 
 	// Transpose of gamma
 	tran(GAMMA, HORIZON * RDIM, HORIZON * YDIM);
+
+	ctl_workspace_release(ws, mark);
 }
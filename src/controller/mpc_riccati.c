@@ -0,0 +1,384 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Copyright 2022 Martin Schröder <info@swedishembedded.com>
+ * Consulting: https://swedishembedded.com/consulting
+ * Simulation: https://swedishembedded.com/simulation
+ * Training: https://swedishembedded.com/training
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <control/controller.h>
+#include <control/linalg.h>
+
+// ADMM stops when the constraints and the split variables move less than this, relative
+// to the largest input
+#define MPC_RICCATI_TOLERANCE 1e-4f
+
+// Over-relaxation of the ADMM iterates, 1.5 - 1.8 usually needs the fewest iterations
+#define MPC_RICCATI_RELAXATION 1.6f
+
+static void riccati_solve(struct mpc_riccati_ctx *ctx, const float x[], const float Cr[],
+			  float U[], float kff[], float vectors[]);
+
+/*
+ * Model predictive control that keeps the stage wise structure of the problem
+ * Min sum_k 0.5*||C*x(k + 1) - r||^2 + 0.5*lambda*||u(k)||^2, k = 0 ... HORIZON - 1
+ * S.t x(k + 1) = A*x(k) + B*u(k)
+ *     umin <= u(k) <= umax
+ *     -du_max <= u(k) - u(k - 1) <= du_max
+ * This is the same problem as mpc_constrain, but it is solved with a backward Riccati
+ * recursion over the stages, so time and memory grow linearly with HORIZON instead of
+ * with its cube and square. The constraints are handled by ADMM with the penalty rho,
+ * which only changes the linear terms of the recursion, so the feedback gains of every
+ * stage are computed once by mpc_riccati_init.
+ * The state of the recursion is [x(k); u(k - 1)] so that the rate of change is a stage
+ * cost as well.
+ *
+ * umin, umax, du_max [RDIM], each of them can be NULL to leave it out
+ * lambda > 0 weights the inputs
+ * rho > 0 is the ADMM penalty, about 1 for outputs and inputs of similar magnitude
+ * The matrices stay in the workspace, so it must not be released past this call while
+ * ctx is in use.
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or a stage is not positive definite
+ */
+uint8_t mpc_riccati_init(struct mpc_riccati_ctx *ctx, float A[], float B[], float C[],
+			 uint8_t ADIM, uint8_t YDIM, uint8_t RDIM, uint16_t HORIZON, float lambda,
+			 float umin[], float umax[], float du_max[], float rho,
+			 uint16_t ITERATION_LIMIT, struct ctl_workspace *ws)
+{
+	size_t size = mpc_riccati_init_workspace_size(ADIM, YDIM, RDIM, HORIZON);
+
+	if (ctl_workspace_available(ws) < size)
+		return 0;
+
+	uint16_t n = ADIM + RDIM;
+	uint16_t m = RDIM;
+
+	ctx->ADIM = ADIM;
+	ctx->YDIM = YDIM;
+	ctx->RDIM = RDIM;
+	ctx->HORIZON = HORIZON;
+	ctx->ITERATION_LIMIT = ITERATION_LIMIT;
+	ctx->iterations = 0;
+	ctx->rho_box = umin || umax ? rho : 0.0f;
+	ctx->rho_rate = du_max ? rho : 0.0f;
+
+	// What the steps need
+	ctx->A = ctl_workspace_floats(ws, ADIM * ADIM);
+	ctx->B = ctl_workspace_floats(ws, ADIM * RDIM);
+	ctx->C = ctl_workspace_floats(ws, YDIM * ADIM);
+	ctx->K = ctl_workspace_floats(ws, (uint32_t)HORIZON * m * n);
+	ctx->Ruu_inv = ctl_workspace_floats(ws, (uint32_t)HORIZON * m * m);
+	ctx->umin = ctl_workspace_floats(ws, m);
+	ctx->umax = ctl_workspace_floats(ws, m);
+	ctx->du_max = ctl_workspace_floats(ws, m);
+	ctx->u_last = ctl_workspace_floats(ws, m);
+	ctx->z = ctl_workspace_floats(ws, 4 * (uint32_t)HORIZON * m);
+	ctx->w = ctx->z + 2 * (uint32_t)HORIZON * m;
+	memcpy(ctx->A, A, ADIM * ADIM * sizeof(float));
+	memcpy(ctx->B, B, ADIM * RDIM * sizeof(float));
+	memcpy(ctx->C, C, YDIM * ADIM * sizeof(float));
+	for (uint8_t i = 0; i < m; i++) {
+		ctx->umin[i] = umin ? umin[i] : -INFINITY;
+		ctx->umax[i] = umax ? umax[i] : INFINITY;
+		ctx->du_max[i] = du_max ? du_max[i] : INFINITY;
+	}
+	memset(ctx->u_last, 0, m * sizeof(float));
+	memset(ctx->z, 0, 4 * (uint32_t)HORIZON * m * sizeof(float));
+
+	size_t mark = ctl_workspace_mark(ws);
+	float *At = ctl_workspace_floats(ws, n * n);
+	float *Bt = ctl_workspace_floats(ws, n * m);
+	float *Q = ctl_workspace_floats(ws, n * n);
+	float *P = ctl_workspace_floats(ws, n * n);
+	float *PA = ctl_workspace_floats(ws, n * n);
+	float *PB = ctl_workspace_floats(ws, n * m);
+	float *Rus = ctl_workspace_floats(ws, m * n);
+	float *L = ctl_workspace_floats(ws, m * m);
+	uint8_t status = 1;
+
+	// [x(k + 1); u(k)] = [A 0; 0 0]*[x(k); u(k - 1)] + [B; I]*u(k)
+	memset(At, 0, n * n * sizeof(float));
+	memset(Bt, 0, n * m * sizeof(float));
+	for (uint8_t i = 0; i < ADIM; i++) {
+		memcpy(At + i * n, A + i * ADIM, ADIM * sizeof(float));
+		memcpy(Bt + i * m, B + i * RDIM, RDIM * sizeof(float));
+	}
+	for (uint8_t i = 0; i < m; i++)
+		Bt[(ADIM + i) * m + i] = 1.0f;
+
+	// Q = [C'*C 0; 0 rho_rate*I], the terminal stage has no rate of change
+	memset(Q, 0, n * n * sizeof(float));
+	gemm(true, false, 1.0f, C, C, 0.0f, PA, ADIM, ADIM, YDIM);
+	for (uint8_t i = 0; i < ADIM; i++)
+		memcpy(Q + i * n, PA + i * ADIM, ADIM * sizeof(float));
+	memcpy(P, Q, n * n * sizeof(float));
+	for (uint8_t i = 0; i < m; i++)
+		Q[(ADIM + i) * n + ADIM + i] = ctx->rho_rate;
+
+	for (int32_t k = HORIZON - 1; k >= 0 && status; k--) {
+		float *K = ctx->K + (uint32_t)k * m * n;
+		float *Ruu = ctx->Ruu_inv + (uint32_t)k * m * m;
+
+		// Ruu = (lambda + rho_box + rho_rate)*I + Bt'*P*Bt
+		gemm(false, false, 1.0f, P, Bt, 0.0f, PB, n, m, n);
+		gemm(true, false, 1.0f, Bt, PB, 0.0f, Ruu, m, m, n);
+		for (uint8_t i = 0; i < m; i++)
+			Ruu[i * m + i] += lambda + ctx->rho_box + ctx->rho_rate;
+
+		// Rus = S + Bt'*P*At where S = -rho_rate*[0 I] couples u(k) with u(k - 1)
+		gemm(false, false, 1.0f, P, At, 0.0f, PA, n, n, n);
+		gemm(true, false, 1.0f, Bt, PA, 0.0f, Rus, m, n, n);
+		for (uint8_t i = 0; i < m; i++)
+			Rus[i * n + ADIM + i] -= ctx->rho_rate;
+
+		// K = -inv(Ruu)*Rus and inv(Ruu) for the steps, from the Cholesky factor of Ruu
+		memcpy(L, Ruu, m * m * sizeof(float));
+		status = chol_factor(L, m);
+		if (!status)
+			break;
+		for (uint32_t i = 0; i < (uint32_t)m * n; i++)
+			K[i] = -Rus[i];
+		chol_solve_multi(L, K, m, n);
+		memset(Ruu, 0, m * m * sizeof(float));
+		for (uint8_t i = 0; i < m; i++)
+			Ruu[i * m + i] = 1.0f;
+		chol_solve_multi(L, Ruu, m, m);
+
+		// P = Q + At'*P*At + Rus'*K
+		if (k > 0) {
+			memcpy(P, Q, n * n * sizeof(float));
+			gemm(true, false, 1.0f, At, PA, 1.0f, P, n, n, n);
+			gemm(true, false, 1.0f, Rus, K, 1.0f, P, n, n, m);
+		}
+	}
+
+	ctl_workspace_release(ws, mark);
+	return status;
+}
+
+size_t mpc_riccati_init_workspace_size(uint8_t ADIM, uint8_t YDIM, uint8_t RDIM,
+				       uint16_t HORIZON)
+{
+	uint16_t n = ADIM + RDIM;
+	uint16_t m = RDIM;
+	size_t scratch = 4 * CTL_WORKSPACE_FLOATS(n * n) + 2 * CTL_WORKSPACE_FLOATS(n * m) +
+			 CTL_WORKSPACE_FLOATS(m * n) + CTL_WORKSPACE_FLOATS(m * m);
+
+	return CTL_WORKSPACE_FLOATS(ADIM * ADIM) + CTL_WORKSPACE_FLOATS(ADIM * RDIM) +
+	       CTL_WORKSPACE_FLOATS(YDIM * ADIM) +
+	       CTL_WORKSPACE_FLOATS((uint32_t)HORIZON * m * n) +
+	       CTL_WORKSPACE_FLOATS((uint32_t)HORIZON * m * m) + 4 * CTL_WORKSPACE_FLOATS(m) +
+	       CTL_WORKSPACE_FLOATS(4 * (uint32_t)HORIZON * m) + scratch;
+}
+
+size_t mpc_riccati_step_workspace_size(uint8_t ADIM, uint8_t RDIM, uint16_t HORIZON)
+{
+	uint16_t n = ADIM + RDIM;
+
+	return 2 * CTL_WORKSPACE_FLOATS((uint32_t)HORIZON * RDIM) + CTL_WORKSPACE_FLOATS(ADIM) +
+	       CTL_WORKSPACE_FLOATS(3 * n + RDIM);
+}
+
+/*
+ * Compute the next input u from the state x and the reference r [YDIM]
+ * Every ADMM iteration is one backward and one forward pass over the stages. The split
+ * variables are shifted one stage and kept for the next call as a warm start.
+ * ctx->iterations tells how many ADMM iterations the call took.
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or ADMM did not converge within
+ * ITERATION_LIMIT. u is still within the constraints then.
+ */
+uint8_t mpc_riccati_step(struct mpc_riccati_ctx *ctx, float x[], float u[], float r[],
+			 struct ctl_workspace *ws)
+{
+	uint8_t ADIM = ctx->ADIM;
+	uint8_t m = ctx->RDIM;
+	uint16_t N = ctx->HORIZON;
+	uint32_t Nm = (uint32_t)N * m;
+
+	if (ctl_workspace_available(ws) < mpc_riccati_step_workspace_size(ADIM, m, N))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	float *U = ctl_workspace_floats(ws, Nm);
+	float *kff = ctl_workspace_floats(ws, Nm);
+	float *Cr = ctl_workspace_floats(ws, ADIM);
+	float *vectors = ctl_workspace_floats(ws, 3 * (ADIM + m) + m);
+	float *z_box = ctx->z;
+	float *z_rate = ctx->z + Nm;
+	float *w_box = ctx->w;
+	float *w_rate = ctx->w + Nm;
+	bool constrained = ctx->rho_box > 0.0f || ctx->rho_rate > 0.0f;
+	uint8_t status = !constrained;
+
+	// The tracking term is -C'*r on every stage
+	gemm(true, false, -1.0f, ctx->C, r, 0.0f, Cr, ADIM, 1, ctx->YDIM);
+
+	ctx->iterations = 0;
+	do {
+		ctx->iterations++;
+		riccati_solve(ctx, x, Cr, U, kff, vectors);
+		if (!constrained)
+			break;
+
+		// Project on the constraints and update the scaled dual variables
+		float primal = 0.0f, dual = 0.0f, size = 1.0f;
+
+		for (uint32_t i = 0; i < Nm; i++) {
+			uint8_t j = i % m;
+			float previous = i < m ? ctx->u_last[j] : U[i - m];
+			float rate = U[i] - previous;
+
+			// Over-relaxed iterates
+			float v = MPC_RICCATI_RELAXATION * U[i] +
+				  (1.0f - MPC_RICCATI_RELAXATION) * z_box[i];
+			float v2 = MPC_RICCATI_RELAXATION * rate +
+				   (1.0f - MPC_RICCATI_RELAXATION) * z_rate[i];
+			float z = fminf(fmaxf(v + w_box[i], ctx->umin[j]), ctx->umax[j]);
+			float z2 = fminf(fmaxf(v2 + w_rate[i], -ctx->du_max[j]), ctx->du_max[j]);
+
+			dual = fmaxf(dual, fmaxf(fabsf(z - z_box[i]), fabsf(z2 - z_rate[i])));
+			w_box[i] += v - z;
+			w_rate[i] += v2 - z2;
+			primal = fmaxf(primal, fmaxf(fabsf(U[i] - z), fabsf(rate - z2)));
+			size = fmaxf(size, fabsf(z));
+			z_box[i] = z;
+			z_rate[i] = z2;
+		}
+		if (primal < MPC_RICCATI_TOLERANCE * size && dual < MPC_RICCATI_TOLERANCE * size) {
+			status = 1;
+			break;
+		}
+	} while (ctx->iterations < ctx->ITERATION_LIMIT);
+
+	// The first input, within its bounds and its rate of change
+	for (uint8_t i = 0; i < m; i++) {
+		float lower = fmaxf(ctx->umin[i], ctx->u_last[i] - ctx->du_max[i]);
+		float upper = fminf(ctx->umax[i], ctx->u_last[i] + ctx->du_max[i]);
+
+		u[i] = fminf(fmaxf(U[i], lower), upper);
+		ctx->u_last[i] = u[i];
+	}
+
+	// Shift the split variables one stage for the next call
+	memmove(z_box, z_box + m, (Nm - m) * sizeof(float));
+	memmove(z_rate, z_rate + m, (Nm - m) * sizeof(float));
+	memmove(w_box, w_box + m, (Nm - m) * sizeof(float));
+	memmove(w_rate, w_rate + m, (Nm - m) * sizeof(float));
+
+	ctl_workspace_release(ws, mark);
+	return status;
+}
+
+/*
+ * Minimize the stage costs plus the ADMM penalties for the inputs U [HORIZON*RDIM]
+ * Backward: g = ru(k) + Bt'*p, kff(k) = -inv(Ruu(k))*g, p = q(k) + At'*p + K(k)'*g
+ * Forward: u(k) = K(k)*s + kff(k), s = [A*x + B*u(k); u(k)]
+ * where ru(k) = -rho_box*(z_box - w_box) - rho_rate*(z_rate - w_rate) and
+ * q(k) = [-C'*r; rho_rate*(z_rate - w_rate)]
+ * vectors [3*n + RDIM] is scratch
+ */
+static void riccati_solve(struct mpc_riccati_ctx *ctx, const float x[], const float Cr[],
+			  float U[], float kff[], float vectors[])
+{
+	// The matrices of a stage are a few elements, plain loops beat the gemm() calls
+	uint8_t ADIM = ctx->ADIM;
+	uint8_t m = ctx->RDIM;
+	uint16_t n = ADIM + m;
+	uint16_t N = ctx->HORIZON;
+	uint32_t Nm = (uint32_t)N * m;
+	const float *A = ctx->A;
+	const float *B = ctx->B;
+	float rho_box = ctx->rho_box;
+	float rho_rate = ctx->rho_rate;
+	float *p = vectors;
+	float *s = p + n;
+	float *t = s + n;
+	float *g = t + n;
+
+	// Terminal stage
+	memcpy(p, Cr, ADIM * sizeof(float));
+	memset(p + ADIM, 0, m * sizeof(float));
+
+	for (int32_t k = N - 1; k >= 0; k--) {
+		const float *K = ctx->K + (uint32_t)k * m * n;
+		const float *Ruu_inv = ctx->Ruu_inv + (uint32_t)k * m * m;
+		const float *z_box = ctx->z + (uint32_t)k * m;
+		const float *z_rate = ctx->z + Nm + (uint32_t)k * m;
+		const float *w_box = ctx->w + (uint32_t)k * m;
+		const float *w_rate = ctx->w + Nm + (uint32_t)k * m;
+		float *f = kff + (uint32_t)k * m;
+
+		// g = ru + Bt'*p = ru + B'*p(1:ADIM) + p(ADIM + 1:n)
+		for (uint8_t i = 0; i < m; i++) {
+			float sum = p[ADIM + i] - rho_box * (z_box[i] - w_box[i]) -
+				    rho_rate * (z_rate[i] - w_rate[i]);
+
+			for (uint8_t j = 0; j < ADIM; j++)
+				sum += B[j * m + i] * p[j];
+			g[i] = sum;
+		}
+
+		// kff = -inv(Ruu)*g
+		for (uint8_t i = 0; i < m; i++) {
+			float sum = 0.0f;
+
+			for (uint8_t j = 0; j < m; j++)
+				sum -= Ruu_inv[i * m + j] * g[j];
+			f[i] = sum;
+		}
+		if (k == 0)
+			break;
+
+		// p = q + At'*p + K'*g
+		for (uint8_t i = 0; i < ADIM; i++) {
+			float sum = Cr[i];
+
+			for (uint8_t j = 0; j < ADIM; j++)
+				sum += A[j * ADIM + i] * p[j];
+			t[i] = sum;
+		}
+		for (uint8_t i = 0; i < m; i++)
+			t[ADIM + i] = rho_rate * (z_rate[i] - w_rate[i]);
+		for (uint16_t i = 0; i < n; i++) {
+			float sum = t[i];
+
+			for (uint8_t j = 0; j < m; j++)
+				sum += K[j * n + i] * g[j];
+			p[i] = sum;
+		}
+	}
+
+	memcpy(s, x, ADIM * sizeof(float));
+	memcpy(s + ADIM, ctx->u_last, m * sizeof(float));
+	for (uint16_t k = 0; k < N; k++) {
+		const float *K = ctx->K + (uint32_t)k * m * n;
+		float *u = U + (uint32_t)k * m;
+
+		// u = K*s + kff
+		for (uint8_t i = 0; i < m; i++) {
+			float sum = kff[(uint32_t)k * m + i];
+
+			for (uint16_t j = 0; j < n; j++)
+				sum += K[i * n + j] * s[j];
+			u[i] = sum;
+		}
+
+		// s = [A*x + B*u; u]
+		for (uint8_t i = 0; i < ADIM; i++) {
+			float sum = 0.0f;
+
+			for (uint8_t j = 0; j < ADIM; j++)
+				sum += A[i * ADIM + j] * s[j];
+			for (uint8_t j = 0; j < m; j++)
+				sum += B[i * m + j] * u[j];
+			t[i] = sum;
+		}
+		memcpy(s, t, ADIM * sizeof(float));
+		memcpy(s + ADIM, u, m * sizeof(float));
+	}
+}
@@ -33,8 +33,30 @@ static void findinput(float u[], float r[], float I1[], float y[], float I2[], u
 void mrac(float limit, float gain, float y[], float u[], float r[], float I1[], float I2[],
 	  uint8_t RDIM)
 {
+	CTL_WORKSPACE_ON_STACK(ws, mrac_workspace_size(RDIM));
+
+	mrac_ws(limit, gain, y, u, r, I1, I2, RDIM, &ws);
+}
+
+size_t mrac_workspace_size(uint8_t RDIM)
+{
+	return CTL_WORKSPACE_FLOATS(RDIM);
+}
+
+/*
+ * Same as mrac, with the model error taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t mrac_ws(float limit, float gain, float y[], float u[], float r[], float I1[], float I2[],
+		uint8_t RDIM, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < mrac_workspace_size(RDIM))
+		return 0;
+
 	// Find the model error
-	float e[RDIM];
+	size_t mark = ctl_workspace_mark(ws);
+	float *e = ctl_workspace_floats(ws, RDIM);
 
 	modelerror(e, y, r, RDIM);
 
@@ -48,6 +70,9 @@ void mrac(float limit, float gain, float y[], float u[], float r[], float I1[],
 
 	// Find input signal
 	findinput(u, r, I1, y, I2, RDIM);
+
+	ctl_workspace_release(ws, mark);
+	return 1;
 }
 
 static void integral(float I[], float gain, float x[], float e[], uint8_t RDIM)
@@ -18,8 +18,28 @@
  */
 bool stability(float A[], uint8_t ADIM)
 {
-	float wr[ADIM]; // Real eigenvalues
-	float wi[ADIM]; // Imaginary eigenvalues
+	CTL_WORKSPACE_ON_STACK(ws, stability_workspace_size(ADIM));
+
+	return stability_ws(A, ADIM, &ws);
+}
+
+size_t stability_workspace_size(uint8_t ADIM)
+{
+	return 2 * CTL_WORKSPACE_FLOATS(ADIM);
+}
+
+/*
+ * Same as stability, with the eigenvalues stored in the workspace
+ * Returns false also when the workspace is too small
+ */
+bool stability_ws(float A[], uint8_t ADIM, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < stability_workspace_size(ADIM))
+		return false;
+
+	size_t mark = ctl_workspace_mark(ws);
+	float *wr = ctl_workspace_floats(ws, ADIM); // Real eigenvalues
+	float *wi = ctl_workspace_floats(ws, ADIM); // Imaginary eigenvalues
 	bool stable = true; // Assume that the system is stable
 
 	eig(A, wr, wi, ADIM);
@@ -30,5 +50,6 @@ bool stability(float A[], uint8_t ADIM)
 			stable = false;
 		}
 	}
+	ctl_workspace_release(ws, mark);
 	return stable;
 }
@@ -17,17 +17,18 @@ static void create_weights(float Wc[], float Wm[], float alpha, float beta, floa
 static void create_sigma_point_matrix(float X[], float x[], float S[], float alpha, float kappa,
 				      uint8_t L);
 static void compute_transistion_function(float Xstar[], float X[], float u[],
-					 void (*F)(float[], float[], float[]), uint8_t L);
+					 void (*F)(float[], float[], float[]), uint8_t L,
+					 struct ctl_workspace *ws);
 static void multiply_sigma_point_matrix_to_weights(float x[], float X[], float W[], uint8_t L);
-static void create_state_estimation_error_covariance_matrix(float S[], float W[], float X[],
-							    float x[], float R[], uint8_t L);
+static uint8_t create_state_estimation_error_covariance_matrix(float S[], float W[], float X[],
+							      float x[], float R[], uint8_t L,
+							      struct ctl_workspace *ws);
 static void H(float Y[], float X[], uint8_t L);
 static void create_state_cross_covariance_matrix(float P[], float W[], float X[], float Y[],
 						 float x[], float y[], uint8_t L);
-static void update_state_covarariance_matrix_and_state_estimation_vector(float S[], float xhat[],
-									 float yhat[], float y[],
-									 float Sy[], float Pxy[],
-									 uint8_t L);
+static uint8_t update_state_covarariance_matrix_and_state_estimation_vector(
+	float S[], float xhat[], float yhat[], float y[], float Sy[], float Pxy[], uint8_t L,
+	struct ctl_workspace *ws);
 
 /*
  * Square Root Unscented Kalman Filter For State Estimation (A better version than regular UKF)
@@ -47,57 +48,103 @@ void sr_ukf_state_estimation(float y[], float xhat[], float Rn[], float Rv[], fl
 			     void (*F)(float[], float[], float[]), float S[], float alpha,
 			     float beta, uint8_t L)
 {
+	CTL_WORKSPACE_ON_STACK(ws, sr_ukf_state_estimation_workspace_size(L));
+
+	sr_ukf_state_estimation_ws(y, xhat, Rn, Rv, u, F, S, alpha, beta, L, &ws);
+}
+
+size_t sr_ukf_state_estimation_workspace_size(uint8_t L)
+{
+	uint8_t N = 2 * L + 1;
+	uint8_t M = 2 * L + L;
+
+	/* The largest of the private functions, they run one after the other */
+	size_t transition = 2 * CTL_WORKSPACE_FLOATS(L);
+	size_t covariance = CTL_WORKSPACE_FLOATS(M * L) + 2 * CTL_WORKSPACE_FLOATS(L) +
+			    qr_factor_workspace_size(M, L);
+	size_t update = 2 * CTL_WORKSPACE_FLOATS(L * L) + 2 * CTL_WORKSPACE_FLOATS(L);
+	size_t nested = ctl_workspace_max(ctl_workspace_max(transition, covariance), update);
+
+	return 2 * CTL_WORKSPACE_FLOATS(N) + 3 * CTL_WORKSPACE_FLOATS(L * N) +
+	       CTL_WORKSPACE_FLOATS(L) + 2 * CTL_WORKSPACE_FLOATS(L * L) + nested;
+}
+
+/*
+ * Same as sr_ukf_state_estimation, with all matrices taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or a Cholesky downdate made the square
+ * root covariance indefinite, which is then not usable
+ */
+uint8_t sr_ukf_state_estimation_ws(float y[], float xhat[], float Rn[], float Rv[], float u[],
+				   void (*F)(float[], float[], float[]), float S[], float alpha,
+				   float beta, uint8_t L, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < sr_ukf_state_estimation_workspace_size(L))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	uint8_t status;
+
 	/* Create the size N */
 	uint8_t N = 2 * L + 1;
 
 	/* Predict: Create the weights */
-	float Wc[N];
-	float Wm[N];
+	float *Wc = ctl_workspace_floats(ws, N);
+	float *Wm = ctl_workspace_floats(ws, N);
 	float kappa = 0.0f; /* kappa is 0 for state estimation */
 
 	create_weights(Wc, Wm, alpha, beta, kappa, L);
 
 	/* Predict: Create sigma point matrix for F function  */
-	float X[L * N];
+	float *X = ctl_workspace_floats(ws, L * N);
 
 	create_sigma_point_matrix(X, xhat, S, alpha, kappa, L);
 
 	/* Predict: Compute the transition function F */
-	float Xstar[L * N];
+	float *Xstar = ctl_workspace_floats(ws, L * N);
 
-	compute_transistion_function(Xstar, X, u, F, L);
+	compute_transistion_function(Xstar, X, u, F, L, ws);
 
 	/* Predict: Multiply sigma points to weights for xhat */
 	multiply_sigma_point_matrix_to_weights(xhat, Xstar, Wm, L);
 
 	/* Predict: Create state estimate error covariance  */
-	create_state_estimation_error_covariance_matrix(S, Wc, Xstar, xhat, Rv, L);
+	status = create_state_estimation_error_covariance_matrix(S, Wc, Xstar, xhat, Rv, L, ws);
+	if (status == 0)
+		goto out; // The downdate of a negative weight made it indefinite
 
 	/* Predict: Create sigma point matrix for H function. This is the updated version of SR-UKF paper. The old SR-UKF paper don't have this */
 	create_sigma_point_matrix(X, xhat, S, alpha, kappa, L);
 
 	/* Predict: Compute the observability function H */
-	float Y[L * N];
+	float *Y = ctl_workspace_floats(ws, L * N);
 
 	H(Y, X, L);
 
 	/* Predict: Multiply sigma points to weights for yhat */
-	float yhat[L];
+	float *yhat = ctl_workspace_floats(ws, L);
 
 	multiply_sigma_point_matrix_to_weights(yhat, Y, Wm, L);
 
 	/* Update: Create measurement covariance matrix */
-	float Sy[L * L];
+	float *Sy = ctl_workspace_floats(ws, L * L);
 
-	create_state_estimation_error_covariance_matrix(Sy, Wc, Y, yhat, Rn, L);
+	status = create_state_estimation_error_covariance_matrix(Sy, Wc, Y, yhat, Rn, L, ws);
+	if (status == 0)
+		goto out; // The downdate of a negative weight made it indefinite
 
 	/* Update: Create state covariance matrix */
-	float Pxy[L * L];
+	float *Pxy = ctl_workspace_floats(ws, L * L);
 
 	create_state_cross_covariance_matrix(Pxy, Wc, X, Y, xhat, yhat, L);
 
 	/* Update: Perform state update and covariance update */
-	update_state_covarariance_matrix_and_state_estimation_vector(S, xhat, yhat, y, Sy, Pxy, L);
+	status = update_state_covarariance_matrix_and_state_estimation_vector(S, xhat, yhat, y, Sy,
+									      Pxy, L, ws);
+
+out:
+	ctl_workspace_release(ws, mark);
+	return status;
 }
 
 static void create_weights(float Wc[], float Wm[], float alpha, float beta, float kappa, uint8_t L)
@@ -146,14 +193,16 @@ static void create_sigma_point_matrix(float X[], float x[], float S[], float alp
 }
 
 static void compute_transistion_function(float Xstar[], float X[], float u[],
-					 void (*F)(float[], float[], float[]), uint8_t L)
+					 void (*F)(float[], float[], float[]), uint8_t L,
+					 struct ctl_workspace *ws)
 {
 	/* Create the size N */
 	uint8_t N = 2 * L + 1;
 
 	/* Create the derivative state and state vector */
-	float dx[L];
-	float x[L];
+	size_t mark = ctl_workspace_mark(ws);
+	float *dx = ctl_workspace_floats(ws, L);
+	float *x = ctl_workspace_floats(ws, L);
 
 	/* Call the F transition function with X matrix */
 	for (uint8_t j = 0; j < N; j++) {
@@ -168,6 +217,8 @@ static void compute_transistion_function(float Xstar[], float X[], float u[],
 		for (uint8_t i = 0; i < L; i++)
 			Xstar[i * N + j] = dx[i];
 	}
+
+	ctl_workspace_release(ws, mark);
 }
 
 static void multiply_sigma_point_matrix_to_weights(float x[], float X[], float W[], uint8_t L)
@@ -184,8 +235,9 @@ static void multiply_sigma_point_matrix_to_weights(float x[], float X[], float W
 			x[i] += W[j] * X[i * N + j];
 }
 
-static void create_state_estimation_error_covariance_matrix(float S[], float W[], float X[],
-							    float x[], float R[], uint8_t L)
+static uint8_t create_state_estimation_error_covariance_matrix(float S[], float W[], float X[],
+							      float x[], float R[], uint8_t L,
+							      struct ctl_workspace *ws)
 {
 	/* Create the size N, M and K */
 	uint8_t N = 2 * L + 1;
@@ -196,37 +248,40 @@ static void create_state_estimation_error_covariance_matrix(float S[], float W[]
 	float weight1 = sqrtf(fabsf(W[1]));
 
 	/* Create [Q, R_] = qr(A') */
-	float AT[L * M];
-	float Q[M * M];
-	float R_[M * L];
+	size_t mark = ctl_workspace_mark(ws);
+	float *AT = ctl_workspace_floats(ws, M * L);
+	float *tau = ctl_workspace_floats(ws, L);
 
+	/* We need to do transpose on A according to the SR-UKF paper, so A' is filled directly */
 	for (uint8_t j = 0; j < K; j++) {
 		for (uint8_t i = 0; i < L; i++) {
-			AT[i * M + j] = weight1 * (X[i * N + j + 1] - x[i]);
+			AT[j * L + i] = weight1 * (X[i * N + j + 1] - x[i]);
 		}
 	}
 	for (uint8_t j = K; j < M; j++)
 		for (uint8_t i = 0; i < L; i++)
-			AT[i * M + j] = sqrtf(R[i * L + j - K]);
+			AT[j * L + i] = sqrtf(R[i * L + j - K]);
 
-	/* We need to do transpose on A according to the SR-UKF paper */
-	tran(AT, L, M);
-
-	/* Solve [Q, R_] = qr(A') but we only need R_ matrix */
-	qr(AT, Q, R_, M, L, true);
+	/* Solve [Q, R_] = qr(A') but we only need R_ matrix, so A' is factored in place */
+	qr_factor_ws(AT, tau, M, L, ws);
 
 	/* Get the upper triangular of R_ according to the SR-UKF paper */
-	memcpy(S, R_, L * L * sizeof(float));
+	for (uint8_t i = 0; i < L; i++)
+		for (uint8_t j = 0; j < L; j++)
+			S[i * L + j] = j < i ? 0.0f : AT[i * L + j];
 
 	/* Perform cholesky update on S */
-	float b[L];
+	float *b = ctl_workspace_floats(ws, L);
 
 	for (uint8_t i = 0; i < L; i++)
 		b[i] = X[i * N] - x[i];
 
 	bool rank_one_update = W[0] < 0.0f ? false : true;
 
-	cholupdate(S, b, L, rank_one_update);
+	uint8_t status = cholupdate_upper(S, b, L, rank_one_update);
+
+	ctl_workspace_release(ws, mark);
+	return status;
 }
 
 static void H(float Y[], float X[], uint8_t L)
@@ -241,64 +296,40 @@ static void H(float Y[], float X[], uint8_t L)
 static void create_state_cross_covariance_matrix(float P[], float W[], float X[], float Y[],
 						 float x[], float y[], uint8_t L)
 {
-	/* Create the size N and K */
+	/* Create the size N */
 	uint8_t N = 2 * L + 1;
-	uint8_t K = 2 * L;
-
-	/* clear P */
-	memset(P, 0, K * sizeof(float));
 
-	/* Subtract the matrices */
+	/* Subtract the matrices and weight the columns of X, X = (X - x)*diagonal_W */
 	for (uint8_t j = 0; j < N; j++) {
 		for (uint8_t i = 0; i < L; i++) {
-			X[i * N + j] -= x[i];
+			X[i * N + j] = W[j] * (X[i * N + j] - x[i]);
 			Y[i * N + j] -= y[i];
 		}
 	}
 
-	/* Create diagonal matrix */
-	float diagonal_W[N * N];
-
-	memset(diagonal_W, 0, N * N * sizeof(float));
-	for (uint8_t i = 0; i < N; i++)
-		diagonal_W[i * N + i] = W[i];
-
-	/* Do P = X*diagonal_W*Y' */
-	tran(Y, L, N);
-
-	float diagonal_WY[N * L];
-
-	mul(diagonal_W, Y, diagonal_WY, N, N, L);
-	mul(X, diagonal_WY, P, L, N, L);
+	/* Do P = X*diagonal_W*Y', Y' is read in place */
+	gemm(false, true, 1.0f, X, Y, 0.0f, P, L, L, N);
 }
 
-static void update_state_covarariance_matrix_and_state_estimation_vector(float S[], float xhat[],
-									 float yhat[], float y[],
-									 float Sy[], float Pxy[],
-									 uint8_t L)
+static uint8_t update_state_covarariance_matrix_and_state_estimation_vector(
+	float S[], float xhat[], float yhat[], float y[], float Sy[], float Pxy[], uint8_t L,
+	struct ctl_workspace *ws)
 {
-	/* Transpose of Sy */
-	float SyT[L * L];
-
-	memcpy(SyT, Sy, L * L * sizeof(float));
-	tran(SyT, L, L);
-
-	/* Multiply Sy and Sy' to Sy'Sy */
-	float SyTSy[L * L];
+	size_t mark = ctl_workspace_mark(ws);
 
-	mul(SyT, Sy, SyTSy, L, L, L);
+	/*
+	 * Compute kalman gain K from K * Sy'Sy = Pxy. Sy is upper triangular, so
+	 * K = Pxy * inv(Sy) * inv(Sy') is two triangular solves without forming Sy'Sy
+	 */
+	float *K = ctl_workspace_floats(ws, L * L);
 
-	/* Take inverse of Sy'Sy - Inverse is using LUP-decomposition */
-	inv(SyTSy, L);
-
-	/* Compute kalman gain K from Sy'Sy * K = Pxy => K = Pxy * inv(SyTSy) */
-	float K[L * L];
-
-	mul(Pxy, SyTSy, K, L, L, L);
+	memcpy(K, Pxy, L * L * sizeof(float));
+	trsm(false, true, false, Sy, K, L, L);
+	trsm(false, true, true, Sy, K, L, L);
 
 	/* Compute xhat = xhat + K*(y - yhat) */
-	float yyhat[L];
-	float Ky[L];
+	float *yyhat = ctl_workspace_floats(ws, L);
+	float *Ky = ctl_workspace_floats(ws, L);
 
 	for (uint8_t i = 0; i < L; i++)
 		yyhat[i] = y[i] - yhat[i];
@@ -306,17 +337,14 @@ static void update_state_covarariance_matrix_and_state_estimation_vector(float S
 	for (uint8_t i = 0; i < L; i++)
 		xhat[i] = xhat[i] + Ky[i];
 
-	/* Compute U = K*Sy */
-	float U[L * L];
+	/* Compute U = K*Sy, stored as U' = Sy'*K' so that the columns of U are rows */
+	float *UT = ctl_workspace_floats(ws, L * L);
 
-	mul(K, Sy, U, L, L, L);
+	gemm(true, true, 1.0f, Sy, K, 0.0f, UT, L, L, L);
 
-	/* Compute S = cholupdate(S, Uk, -1) because Uk is a vector and U is a matrix */
-	float Uk[L];
+	/* Compute S = cholupdate(S, U, -1) with all columns of U in one pass over S */
+	uint8_t status = cholupdate_k_upper(S, UT, L, L, false);
 
-	for (uint8_t j = 0; j < L; j++) {
-		for (uint8_t i = 0; i < L; i++)
-			Uk[i] = U[i * L + j];
-		cholupdate(S, Uk, L, false);
-	}
+	ctl_workspace_release(ws, mark);
+	return status;
 }
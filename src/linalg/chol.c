@@ -9,33 +9,81 @@
 
 #include <string.h>
 #include <math.h>
-#include <float.h>
 #include <control/linalg.h>
 
+#include "linalg/dot.h"
+
+// Columns of L that are factorized before the rest of the matrix is updated with syrk
+#define CHOL_BLOCK 32
+
 /*
  * Create A = L*L^T
- * A need to be symmetric positive definite
+ * A need to be symmetric positive definite, only its lower triangle is read
  * A [m*n]
- * L [m*n]
+ * L [m*n] // The upper triangle is zero
  * n == m
+ * Returns 1 == Success
+ * Returns 0 == Fail, A is not positive definite
  */
-void chol(float A[], float L[], uint16_t row)
+uint8_t chol(float A[], float L[], uint16_t row)
 {
-	float s;
-	uint16_t i, j, k;
-
-	memset(L, 0, row * row * sizeof(float));
-	for (i = 0; i < row; i++)
-		for (j = 0; j <= i; j++) {
-			s = 0;
-			for (k = 0; k < j; k++)
-				s += L[row * i + k] * L[row * j + k];
-
-			// We cannot divide with zero
-			if (L[row * j + j] == 0) {
-				L[row * j + j] = FLT_EPSILON; // Same as eps command in MATLAB
+	memcpy(L, A, row * row * sizeof(float));
+	for (uint16_t i = 0; i < row; i++)
+		memset(&L[row * i + i + 1], 0, (row - i - 1) * sizeof(float));
+	return chol_factor(L, row);
+}
+
+/*
+ * Cholesky factorization A = L*L^T in place, right looking and blocked.
+ * CHOL_BLOCK columns of L are factorized with dot products along the rows and the
+ * rest of the lower triangle is then updated with syrk, so most of the work runs in the
+ * micro kernel of gemm. The upper triangle of A is neither read nor written.
+ * A [m*n] // Lower triangle of A on entry, L on return
+ * n == m
+ * Returns 1 == Success
+ * Returns 0 == Fail, a pivot is not positive and finite so A is not positive definite
+ */
+uint8_t chol_factor(float A[], uint16_t row)
+{
+	for (uint16_t first = 0; first < row; first += CHOL_BLOCK) {
+		uint16_t size = row - first < CHOL_BLOCK ? row - first : CHOL_BLOCK;
+		uint16_t end = first + size;
+
+		// The columns of the block, for the rows of the block and all rows below it
+		for (uint16_t j = first; j < end; j++) {
+			float *Lj = &A[(size_t)j * row + first];
+			float pivot = A[(size_t)j * row + j] - ctl_dot(Lj, Lj, j - first);
+
+			if (!(pivot > 0.0f) || !isfinite(pivot))
+				return 0;
+			pivot = sqrtf(pivot);
+			A[(size_t)j * row + j] = pivot;
+			for (uint16_t i = j + 1; i < row; i++) {
+				float *Li = &A[(size_t)i * row + first];
+
+				Li[j - first] =
+					(Li[j - first] - ctl_dot(Li, Lj, j - first)) / pivot;
 			}
-			L[row * i + j] = (i == j) ? sqrtf(A[row * i + i] - s) :
-						    (1.0 / L[row * j + j] * (A[row * i + j] - s));
 		}
+
+		// A(end:row, end:row) -= L(end:row, block)*L(end:row, block)'
+		if (end < row) {
+			float *below = &A[(size_t)end * row];
+
+			syrk(-1.0f, &below[first], 1.0f, &below[end], row - end, size, row);
+		}
+	}
+	return 1;
+}
+
+/*
+ * Solve A*X = B for many right hand sides with the factor of chol_factor, L*L^T*X = B
+ * L [m*n]
+ * B [m*column] // Right hand sides on entry, X on return
+ * n == m
+ */
+void chol_solve_multi(const float L[], float B[], uint16_t row, uint16_t column)
+{
+	trsm(true, false, false, L, B, row, column);
+	trsm(true, false, true, L, B, row, column);
 }
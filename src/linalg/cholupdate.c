@@ -10,57 +10,157 @@
 #include <math.h>
 #include <control/linalg.h>
 
+// Vectors that cholupdate_k rotates into one column of L before it moves to the next column
+#define CHOLUPDATE_GROUP 8
+
 /*
  * Create L = cholupdate(L, x, rank_one_update)
- * L is a lower triangular matrix with real and positive diagonal entries from cholesky decomposition L = chol(A)
+ * L is a lower triangular matrix with real and positive diagonal entries from cholesky
+ * decomposition L = chol(A), A = L*L^T
  * L [m*n]
- * x [m]
+ * x [m] // Overwritten
  * n == m
  */
 void cholupdate(float L[], float x[], uint16_t row, bool rank_one_update)
 {
-	float alpha = 0.0, beta = 1.0, beta2 = 0.0, gamma = 0.0, delta = 0.0;
+	CTL_WORKSPACE_ON_STACK(ws, cholupdate_workspace_size(row));
 
-	tran(L, row, row);
+	cholupdate_ws(L, x, row, rank_one_update, &ws);
+}
 
-	for (uint8_t i = 0; i < row; i++) {
-		alpha = x[i] / L[row * i + i];
-		beta2 = rank_one_update == true ? sqrtf(beta * beta + alpha * alpha) :
-						  sqrtf(beta * beta - alpha * alpha);
-		gamma = rank_one_update == true ? alpha / (beta2 * beta) : -alpha / (beta2 * beta);
+size_t cholupdate_workspace_size(uint16_t row)
+{
+	(void)row;
+	return 0;
+}
 
-		if (rank_one_update) {
-			// Update
-			delta = beta / beta2;
-			L[row * i + i] = delta * L[row * i + i] + gamma * x[i];
+/*
+ * Same as cholupdate. L is updated in place, so no scratch is taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or the downdate would make L*L^T indefinite
+ */
+uint8_t cholupdate_ws(float L[], float x[], uint16_t row, bool rank_one_update,
+		      struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < cholupdate_workspace_size(row))
+		return 0;
 
-			if (i < row) {
-				// line 34 in tripfield chol_updown function
-				for (uint8_t k = i + 1; k < row; k++)
-					x[k] -= alpha * L[row * k + i];
+	return cholupdate_k(L, x, row, 1, rank_one_update);
+}
 
-				// line 35 in tripfield chol_updown function
-				for (uint8_t k = i + 1; k < row; k++)
-					L[row * k + i] = delta * L[row * k + i] + gamma * x[k];
+/*
+ * Create L = cholupdate(L, X', rank_k_update) for the k rows of X, which gives the same factor
+ * as k calls to cholupdate. The signs of the diagonal of L are kept. The columns of L are
+ * strided, so the rotations of CHOLUPDATE_GROUP vectors are applied to a column of L in one
+ * pass down the column, and cholupdate_k_upper is faster for a factor stored transposed.
+ * L [m*n] // Lower triangle as for cholupdate
+ * X [k*m] // One vector per row, overwritten
+ * n == m
+ * Returns 1 == Success
+ * Returns 0 == Fail, the downdate would make L*L^T indefinite, L is then partly updated
+ */
+uint8_t cholupdate_k(float L[], float X[], uint16_t row, uint16_t k, bool rank_k_update)
+{
+	float sign = rank_k_update ? 1.0f : -1.0f;
+	float c[CHOLUPDATE_GROUP], s[CHOLUPDATE_GROUP], inverse_c[CHOLUPDATE_GROUP];
+
+	for (uint16_t first = 0; first < k; first += CHOLUPDATE_GROUP) {
+		uint16_t group = k - first < CHOLUPDATE_GROUP ? k - first : CHOLUPDATE_GROUP;
+		float *X_group = &X[(size_t)row * first];
+
+		for (uint16_t i = 0; i < row; i++) {
+			float *diagonal = &L[(size_t)row * i + i];
+
+			// The rotations only depend on the diagonal and x(i), a zero x(i) is the identity
+			for (uint16_t j = 0; j < group; j++) {
+				float xi = X_group[(size_t)row * j + i];
+				float square = *diagonal * *diagonal + sign * xi * xi;
+
+				c[j] = inverse_c[j] = 1.0f;
+				s[j] = 0.0f;
+				if (xi == 0.0f)
+					continue;
+				if (!(square > 0.0f) || !isfinite(square))
+					return 0;
+
+				float r = copysignf(sqrtf(square), *diagonal);
+
+				c[j] = r / *diagonal;
+				s[j] = xi / *diagonal;
+				inverse_c[j] = 1.0f / c[j];
+				*diagonal = r;
 			}
-			x[i] = alpha;
-			beta = beta2;
-		} else {
-			// Downdate
-			delta = beta2 / beta;
-			L[row * i + i] = delta * L[row * i + i];
-
-			if (i < row) {
-				for (uint8_t k = i + 1; k < row; k++)
-					x[k] -= alpha * L[row * k + i];
-
-				for (uint8_t k = i + 1; k < row; k++)
-					L[row * k + i] = delta * L[row * k + i] + gamma * x[k];
+
+			for (uint16_t l = i + 1; l < row; l++) {
+				float t = L[(size_t)row * l + i];
+
+				for (uint16_t j = 0; j < group; j++) {
+					float *x = &X_group[(size_t)row * j + l];
+
+					t = (t + sign * s[j] * *x) * inverse_c[j];
+					*x = c[j] * *x - s[j] * t;
+				}
+				L[(size_t)row * l + i] = t;
 			}
-			x[i] = alpha;
-			beta = beta2;
 		}
 	}
+	return 1;
+}
 
-	tran(L, row, row);
+/*
+ * Same as cholupdate, but R holds the Cholesky factor A = R^T*R as an upper triangle, like
+ * the R of qr. Its rows are the columns of the lower triangular factor, so the update runs
+ * along contiguous rows.
+ * R [m*n]
+ * x [m] // Overwritten
+ * n == m
+ * Returns 1 == Success
+ * Returns 0 == Fail, the downdate would make R^T*R indefinite, R is then partly updated
+ */
+uint8_t cholupdate_upper(float R[], float x[], uint16_t row, bool rank_one_update)
+{
+	return cholupdate_k_upper(R, x, row, 1, rank_one_update);
+}
+
+/*
+ * Same as cholupdate_k for an upper triangular R with A = R^T*R. Row i of R takes the
+ * rotations of all k vectors while it is in the cache.
+ * R [m*n]
+ * X [k*m] // One vector per row, overwritten
+ * n == m
+ * Returns 1 == Success
+ * Returns 0 == Fail, the downdate would make R^T*R indefinite, R is then partly updated
+ */
+uint8_t cholupdate_k_upper(float R[], float X[], uint16_t row, uint16_t k, bool rank_k_update)
+{
+	float sign = rank_k_update ? 1.0f : -1.0f;
+
+	for (uint16_t i = 0; i < row; i++) {
+		float *Ri = &R[(size_t)row * i];
+
+		for (uint16_t j = 0; j < k; j++) {
+			float *x = &X[(size_t)row * j];
+
+			// A zero element rotates nothing
+			if (x[i] == 0.0f)
+				continue;
+
+			float diagonal = Ri[i] * Ri[i] + sign * x[i] * x[i];
+
+			if (!(diagonal > 0.0f) || !isfinite(diagonal))
+				return 0;
+
+			float r = copysignf(sqrtf(diagonal), Ri[i]);
+			float c = r / Ri[i];
+			float s = x[i] / Ri[i];
+			float inverse_c = 1.0f / c;
+
+			Ri[i] = r;
+			for (uint16_t l = i + 1; l < row; l++) {
+				Ri[l] = (Ri[l] + sign * s * x[l]) * inverse_c;
+				x[l] = c * x[l] - s * Ri[l];
+			}
+		}
+	}
+	return 1;
 }
@@ -7,6 +7,7 @@
  * Training: https://swedishembedded.com/training
  */
 
+#include <string.h>
 #include <control/linalg.h>
 
 /*
@@ -17,25 +18,43 @@
  */
 float det(float A[], uint16_t row)
 {
-	float determinant = 1.0;
-	float LU[row * row];
-	uint8_t P[row];
-	uint8_t status = lup(A, LU, P, row);
+	CTL_WORKSPACE_ON_STACK(ws, det_workspace_size(row));
 
-	if (status == 0)
-		return 0; // matrix is singular
+	return det_ws(A, row, &ws);
+}
 
-	for (uint16_t i = 0; i < row; ++i)
-		determinant *= LU[row * P[i] + i];
+size_t det_workspace_size(uint16_t row)
+{
+	return CTL_WORKSPACE_FLOATS(row * row) + CTL_WORKSPACE_BYTES(row * sizeof(uint16_t));
+}
 
-	int j = 0;
+/*
+ * Same as det, with the LU factors taken from the workspace
+ * Returns 0 also when the workspace is too small
+ */
+float det_ws(float A[], uint16_t row, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < det_workspace_size(row))
+		return 0;
 
-	for (uint16_t i = 0; i < row; ++i)
-		if (P[i] != i)
-			++j;
+	size_t mark = ctl_workspace_mark(ws);
+	float determinant = 1.0;
+	float *LU = ctl_workspace_floats(ws, row * row);
+	uint16_t *P = ctl_workspace_alloc(ws, row * sizeof(uint16_t));
 
-	if (j && (j - 1) % 2 == 1)
-		determinant = -determinant;
+	memcpy(LU, A, row * row * sizeof(float));
+	if (lu_factor(LU, P, row) == 0) {
+		ctl_workspace_release(ws, mark);
+		return 0; // matrix is singular
+	}
+
+	// Every row swap of the factorization changes the sign
+	for (uint16_t i = 0; i < row; ++i) {
+		determinant *= LU[row * i + i];
+		if (P[i] != i)
+			determinant = -determinant;
+	}
 
+	ctl_workspace_release(ws, mark);
 	return determinant;
 }
@@ -7,10 +7,21 @@
  * Training: https://swedishembedded.com/training
  */
 
+#include <float.h>
+#include <math.h>
 #include <string.h>
-#include <control/misc.h>
+
 #include <control/linalg.h>
 
+// Doubling steps before giving up, enough for a spectral radius up to 1 - 2^-24
+#define DLYAP_MAX_ITERATIONS 32
+
+// Rows of A*P*A' that are computed at a time in the symmetric case
+#define DLYAP_PANEL 16
+
+static bool is_symmetric(const float Q[], uint16_t row);
+static void add_symmetric(float P[], const float T[], const float A[], float W[], uint16_t row);
+
 /*
  * Discrete Lyapunov equation
  * Solves A * P * A' - P + Q = 0
@@ -19,68 +30,140 @@
  * Q [m*n]
  * P [m*n]
  * n == m
+ *
+ * Uses Smith doubling: P = Q + A*Q*A' + A^2*Q*A^2' + ... is summed as
+ * P_(k+1) = P_k + A_k*P_k*A_k', A_(k+1) = A_k*A_k, which doubles the number of terms
+ * in every step. That is O(n^3) per step and O(n^2) memory. A must be Schur stable
+ * (all absolute eigenvalues < 1), otherwise the sum does not converge.
+ * When Q is symmetric only the upper triangle of A_k*P_k*A_k' is computed and mirrored.
  */
 void dlyap(float *A, float *P, float *Q, uint16_t row)
 {
-	// Create an zero large matrix M
-	float M[row * row * row * row]; // row_a^2 * row_a^2
-
-	// Create a temporary B matrix
-	float B[row * row];
-
-	// Fill the M matrix
-	for (uint16_t k = 0; k < row; k++) {
-		for (uint16_t l = 0; l < row; l++) {
-			memcpy(B, A, row * row * sizeof(float)); // B = A*A(k, l);
-			for (uint16_t i = 0; i < row * row; i++)
-				B[i] *= A[row * k + l];
-			insert(B, M, row, row, row * row, row * k, row * l);
+	CTL_WORKSPACE_ON_STACK(ws, dlyap_workspace_size(row));
+
+	dlyap_ws(A, P, Q, row, &ws);
+}
+
+size_t dlyap_workspace_size(uint16_t row)
+{
+	return 3 * CTL_WORKSPACE_FLOATS(row * row);
+}
+
+/*
+ * Same as dlyap, with A_k, A_k*P_k and A_k^2 taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or A is not Schur stable
+ */
+uint8_t dlyap_ws(float *A, float *P, float *Q, uint16_t row, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < dlyap_workspace_size(row))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	uint32_t n2 = row * row;
+	float *Ak = ctl_workspace_floats(ws, n2);
+	float *T = ctl_workspace_floats(ws, n2);
+	float *A2 = ctl_workspace_floats(ws, n2);
+	bool symmetric = is_symmetric(Q, row);
+	uint8_t status = 0;
+
+	memcpy(Ak, A, n2 * sizeof(float));
+	memcpy(P, Q, n2 * sizeof(float));
+
+	for (uint8_t k = 0; k < DLYAP_MAX_ITERATIONS; k++) {
+		// T = A_k*P_k
+		gemm(false, false, 1.0f, Ak, P, 0.0f, T, row, row, row);
+
+		// The update is smaller than rounding when A_k*P_k is
+		float step = 0.0f, size = 0.0f;
+		bool finite = true;
+
+		for (uint32_t i = 0; i < n2; i++) {
+			float t = fabsf(T[i]);
+			float p = fabsf(P[i]);
+
+			finite = finite && isfinite(t) && isfinite(p);
+			step = t > step ? t : step;
+			size = p > size ? p : size;
 		}
+		if (!finite)
+			break;
+		if (step <= FLT_EPSILON * size) {
+			status = 1;
+			break;
+		}
+
+		// P_(k+1) = P_k + T*A_k', A2 is free until A_k is squared below
+		if (symmetric)
+			add_symmetric(P, T, Ak, A2, row);
+		else
+			gemm(false, true, 1.0f, T, Ak, 1.0f, P, row, row, row);
+
+		// A_(k+1) = A_k*A_k
+		gemm(false, false, 1.0f, Ak, Ak, 0.0f, A2, row, row, row);
+
+		float *swap = Ak;
+
+		Ak = A2;
+		A2 = swap;
 	}
 
-	// Turn M negative but add +1 on diagonals
-	for (uint16_t i = 0; i < row * row; i++)
-		for (uint16_t j = 0; j < row * row; j++)
-			if (i == j)
-				M[row * row * i + j] = -M[row * row * i + j] + 1;
-			else
-				M[row * row * i + j] = -M[row * row * i + j];
-
-	/*
-	 * Solve with LUP-Decomposition
-	 * MP=Q, where P is our solution
-	 */
-	linsolve_lup(M, P, Q, row * row);
+	ctl_workspace_release(ws, mark);
+	return status;
+}
+
+static bool is_symmetric(const float Q[], uint16_t row)
+{
+	for (uint16_t i = 0; i < row; i++)
+		for (uint16_t j = i + 1; j < row; j++)
+			if (Q[i * row + j] != Q[j * row + i])
+				return false;
+	return true;
+}
+
+/*
+ * P += T*A' where the result is known to be symmetric. A panel of rows is multiplied
+ * with the rows of A from the diagonal on, so about half of the product is skipped.
+ * W [DLYAP_PANEL*n] holds one panel.
+ */
+static void add_symmetric(float P[], const float T[], const float A[], float W[], uint16_t row)
+{
+	for (uint16_t i0 = 0; i0 < row; i0 += DLYAP_PANEL) {
+		uint16_t rows = row - i0 < DLYAP_PANEL ? row - i0 : DLYAP_PANEL;
+		uint16_t columns = row - i0;
+
+		// W = T(i0:i0+rows, :)*A(i0:n, :)'
+		gemm(false, true, 1.0f, &T[i0 * row], &A[i0 * row], 0.0f, W, rows, columns, row);
+
+		for (uint16_t i = 0; i < rows; i++) {
+			for (uint16_t j = i; j < columns; j++) {
+				uint16_t r = i0 + i;
+				uint16_t c = i0 + j;
+
+				P[r * row + c] += W[i * columns + j];
+				if (c != r)
+					P[c * row + r] = P[r * row + c];
+			}
+		}
+	}
 }
 
 /*
  * GNU Octave code:
- *  function P = dlyap(A)
+ *  function P = dlyap(A, Q)
 		% This function solves A * P * A' - P + Q = 0
 
-		n = length(A);
-		M = zeros(n^2, n^2);
-		Q = zeros(n,n);
-
-		% Create the symmetric postitive matrix Q
-		for i = 0:n-1
-		  for j = 0:n-1
-			Q(i+1, j+1) = 1 + j + i;
+		P = Q;
+		Ak = A;
+		for k = 1:32
+		  T = Ak * P;
+		  if max(abs(T(:))) <= eps('single') * max(abs(P(:)))
+		    break;
 		  end
+		  P = P + T * Ak';
+		  Ak = Ak * Ak;
 		end
 
-		for k = 0 : n-1
-			for l = 0 : n-1
-				B = A * A(k+1,l+1);
-				M( (1:n) + n*k, (1:n) + n*l) = B;
-			end
-		end
-
-		M = - M + eye(n^2, n^2);
-		K = Q(:);
-		x = linsolve(M, K);
-		P = reshape(x, n, n);
-
 		% Check if this is zero
 		A * P * A' - P + Q
 	end
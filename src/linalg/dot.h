@@ -0,0 +1,18 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Copyright 2022 Martin Schröder <info@swedishembedded.com>
+ * Consulting: https://swedishembedded.com/consulting
+ * Simulation: https://swedishembedded.com/simulation
+ * Training: https://swedishembedded.com/training
+ */
+
+#pragma once
+#include <stdint.h>
+
+/*
+ * Dot products with the SIMD kernel of mul.c, for the solvers of the library. They are not
+ * part of the public interface.
+ */
+float ctl_dot(const float a[], const float b[], uint32_t length);
+// Sum of a[i]*d[i]*b[i], for a diagonal d between the vectors
+float ctl_dot_scaled(const float a[], const float b[], const float d[], uint32_t length);
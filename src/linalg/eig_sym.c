@@ -29,12 +29,36 @@ static float pythag_float(float a, float b);
  */
 void eig_sym(float *A, uint16_t row, float d[])
 {
-	float e[row];
+	CTL_WORKSPACE_ON_STACK(ws, eig_sym_workspace_size(row));
+
+	eig_sym_ws(A, row, d, &ws);
+}
+
+size_t eig_sym_workspace_size(uint16_t row)
+{
+	return CTL_WORKSPACE_FLOATS(row);
+}
+
+/*
+ * Same as eig_sym, with the off diagonal taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t eig_sym_ws(float *A, uint16_t row, float d[], struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < eig_sym_workspace_size(row))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	float *e = ctl_workspace_floats(ws, row);
 
 	memset(e, 0, row * sizeof(float));
 	memset(d, 0, row * sizeof(float));
 	tridiag(A, row, d, e);
 	tqli(d, e, row, A);
+
+	ctl_workspace_release(ws, mark);
+	return 1;
 }
 
 // Create a tridiagonal matrix
@@ -7,9 +7,54 @@
  * Training: https://swedishembedded.com/training
  */
 
+#include <math.h>
 #include <string.h>
 #include <control/linalg.h>
 
+/*
+ * Pade coefficients b_k of p(X) = sum(b_k*X^k), the approximant is q(X)\p(X) with
+ * q(X) = p(-X). Higham, "The scaling and squaring method for the matrix exponential revisited"
+ */
+static const float pade3[] = { 120, 60, 12, 1 };
+static const float pade5[] = { 30240, 15120, 3360, 420, 30, 1 };
+static const float pade7[] = { 17297280, 8648640, 1995840, 277200, 25200, 1512, 56, 1 };
+static const float pade13[] = { 64764752532480000.0f,
+				32382376266240000.0f,
+				7771770303897600.0f,
+				1187353796428800.0f,
+				129060195264000.0f,
+				10559470521600.0f,
+				670442572800.0f,
+				33522128640.0f,
+				1323241920.0f,
+				40840800.0f,
+				960960.0f,
+				16380.0f,
+				182.0f,
+				1.0f };
+
+// Largest 1-norm for which degree 3, 5 and 7 are accurate to single precision
+static const float theta[] = { 4.258730016922831e-1f, 1.880152677804762f, 3.925724783138660f };
+
+// Largest 1-norm for degree 13, which is accurate to double precision below it
+#define THETA_13 5.371920351148152f
+
+/*
+ * Top block row [X11 X12] of a matrix [X11 X12; 0 x*I] that is a polynomial in [A B; 0 0].
+ * The scalar x is the coefficient of the identity and is passed along separately.
+ */
+struct block {
+	float *L; // [row*row]
+	float *R; // [row*column]
+};
+
+static struct block block_alloc(struct ctl_workspace *ws, uint16_t row, uint16_t column);
+static float norm_1(const float A[], const float B[], uint16_t row, uint16_t column);
+static void product(struct block Z, struct block X, struct block Y, float y, uint16_t row,
+		    uint16_t column);
+static void sum_powers(struct block Z, const float b[], const struct block X[], uint8_t count,
+		       float identity, uint16_t row, uint16_t column);
+
 /*
  * Find matrix exponential, return A as A = expm(A)
  * A[m*n]
@@ -17,54 +62,257 @@
  */
 void expm(float A[], uint16_t row)
 {
-	// Create zero matrix
-	float E[row * row];
-
-	memset(E, 0, sizeof(E));
-	// Create identity matrices
-	float F[row * row];
-	float T[row * row];
-
-	memset(F, 0, sizeof(F));
-	memset(T, 0, sizeof(T));
-	for (uint16_t i = 0; i < row; i++) {
-		F[i * row + i] = 1;
-		T[i * row + i] = 1;
+	CTL_WORKSPACE_ON_STACK(ws, expm_workspace_size(row));
+
+	expm_ws(A, row, &ws);
+}
+
+size_t expm_workspace_size(uint16_t row)
+{
+	return expm_augmented_workspace_size(row, 0);
+}
+
+/*
+ * Same as expm, with the matrix powers taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or A is not finite
+ */
+uint8_t expm_ws(float A[], uint16_t row, struct ctl_workspace *ws)
+{
+	return expm_augmented_ws(A, NULL, row, 0, ws);
+}
+
+/*
+ * Exponential of the augmented matrix [A B; 0 0], which is [expm(A) S; 0 I] with
+ * S = integral of expm(A*t)*B from 0 to 1. Returns A = expm(A) and B = S
+ * A [m*m]
+ * B [m*n]
+ *
+ * Scaling and squaring with a Pade approximant (Higham 2005). The degree, 3, 5, 7 or 13, is
+ * the lowest that is accurate for the 1-norm of [A B], above that [A B] is scaled by 2^-s to
+ * the bound of degree 13 and the result is squared s times. That is at most 6 products and
+ * one LU solve plus s squarings, where s = log2(norm/5.37).
+ * Every polynomial in [A B; 0 0] is again block upper triangular with a multiple of I in the
+ * bottom right, so only the top block row [m*(m + n)] is ever formed and multiplied.
+ */
+void expm_augmented(float A[], float B[], uint16_t row, uint16_t column)
+{
+	CTL_WORKSPACE_ON_STACK(ws, expm_augmented_workspace_size(row, column));
+
+	expm_augmented_ws(A, B, row, column, &ws);
+}
+
+size_t expm_augmented_workspace_size(uint16_t row, uint16_t column)
+{
+	size_t block = (size_t)row * row + (size_t)row * column;
+
+	return 6 * CTL_WORKSPACE_FLOATS(block) + CTL_WORKSPACE_BYTES(row * sizeof(uint16_t));
+}
+
+/*
+ * Same as expm_augmented, with the matrix powers taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or [A B] is not finite
+ */
+uint8_t expm_augmented_ws(float A[], float B[], uint16_t row, uint16_t column,
+			  struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < expm_augmented_workspace_size(row, column))
+		return 0;
+
+	float size = norm_1(A, B, row, column);
+
+	if (!isfinite(size))
+		return 0;
+
+	uint32_t n2 = (uint32_t)row * row;
+	uint32_t length = n2 + (uint32_t)row * column;
+	const float *b = pade13;
+	int s = 0;
+
+	if (size <= theta[0]) {
+		b = pade3;
+	} else if (size <= theta[1]) {
+		b = pade5;
+	} else if (size <= theta[2]) {
+		b = pade7;
+	} else if (size > THETA_13) {
+		// Scale by 2^-s, which is exact, so that the 1-norm is at most THETA_13
+		float mantissa = frexpf(size / THETA_13, &s);
+
+		if (mantissa == 0.5f)
+			s--;
+		for (uint32_t i = 0; i < n2; i++)
+			A[i] = ldexpf(A[i], -s);
+		for (uint32_t i = 0; i < (uint32_t)row * column; i++)
+			B[i] = ldexpf(B[i], -s);
 	}
 
-	uint8_t k = 1;
+	size_t mark = ctl_workspace_mark(ws);
+	struct block M = { .L = A, .R = B };
+	struct block X[3]; // [A B; 0 0]^2, ^4 and ^6
+	struct block T = block_alloc(ws, row, column);
+	struct block U = block_alloc(ws, row, column);
+	struct block V = block_alloc(ws, row, column);
+	uint16_t *P = ctl_workspace_alloc(ws, row * sizeof(uint16_t));
 
-	while (norm(T, row, row, 1) > 0) {
-		// E = E + F
-		for (uint16_t i = 0; i < row * row; i++) {
-			E[i] = E[i] + F[i];
-		}
-		// F = A*F/k (we are borrowing T)
-		mul(A, F, T, row, row, row);
-		for (uint16_t i = 0; i < row * row; i++) {
-			F[i] = T[i] / k;
+	for (uint8_t i = 0; i < 3; i++)
+		X[i] = block_alloc(ws, row, column);
+
+	product(X[0], M, M, 0, row, column);
+	if (b != pade3)
+		product(X[1], X[0], X[0], 0, row, column);
+	if (b == pade7 || b == pade13)
+		product(X[2], X[1], X[0], 0, row, column);
+
+	if (b == pade13) {
+		// U = M*(X6*(b13*X6 + b11*X4 + b9*X2) + b7*X6 + b5*X4 + b3*X2 + b1*I)
+		const float odd_high[] = { b[9], b[11], b[13] };
+		const float odd_low[] = { b[3], b[5], b[7] };
+		const float even_high[] = { b[8], b[10], b[12] };
+		const float even_low[] = { b[2], b[4], b[6] };
+
+		sum_powers(T, odd_high, X, 3, 0, row, column);
+		product(U, X[2], T, 0, row, column);
+		sum_powers(T, odd_low, X, 3, 0, row, column);
+		for (uint32_t i = 0; i < length; i++)
+			U.L[i] += T.L[i];
+		for (uint16_t i = 0; i < row; i++)
+			U.L[i * row + i] += b[1];
+		product(T, M, U, b[1], row, column);
+
+		// V = X6*(b12*X6 + b10*X4 + b8*X2) + b6*X6 + b4*X4 + b2*X2 + b0*I
+		sum_powers(U, even_high, X, 3, 0, row, column);
+		product(V, X[2], U, 0, row, column);
+		sum_powers(U, even_low, X, 3, b[0], row, column);
+		for (uint32_t i = 0; i < length; i++)
+			V.L[i] += U.L[i];
+	} else {
+		// U = M*(sum(b_(2k+1)*X^2k)), V = sum(b_2k*X^2k)
+		uint8_t count = b == pade3 ? 1 : (b == pade5 ? 2 : 3);
+		float odd[3], even[3];
+
+		for (uint8_t k = 0; k < count; k++) {
+			odd[k] = b[2 * k + 3];
+			even[k] = b[2 * k + 2];
 		}
-		// T = E + F - E ( This is faster than T = F)
-		for (uint16_t i = 0; i < row * row; i++) {
-			T[i] = E[i] + F[i] - E[i];
+		sum_powers(U, odd, X, count, b[1], row, column);
+		product(T, M, U, b[1], row, column);
+		sum_powers(V, even, X, count, b[0], row, column);
+	}
+
+	// Now T holds the odd part U and V the even part, solve (V - U)*E = V + U
+	for (uint32_t i = 0; i < length; i++) {
+		float odd = T.L[i];
+
+		T.L[i] = V.L[i] - odd;
+		V.L[i] = V.L[i] + odd;
+	}
+	// Both identity coefficients are b0, so the bottom right block of E is I
+	for (uint32_t i = 0; i < (uint32_t)row * column; i++)
+		V.R[i] -= T.R[i];
+
+	uint8_t status = lu_factor(T.L, P, row);
+
+	if (status) {
+		lu_solve_multi(T.L, P, V.L, row, row);
+		if (column > 0)
+			lu_solve_multi(T.L, P, V.R, row, column);
+
+		// Undo the scaling, E = E^(2^s)
+		for (int k = 0; k < s; k++) {
+			struct block E = V;
+
+			product(T, E, E, 1, row, column);
+			V = T;
+			T = E;
 		}
-		k++;
+		memcpy(A, V.L, n2 * sizeof(float));
+		if (column > 0)
+			memcpy(B, V.R, (size_t)row * column * sizeof(float));
+	}
+
+	ctl_workspace_release(ws, mark);
+	return status;
+}
+
+/*
+ * One block of row*(row + column) floats, the top right part follows the top left part
+ */
+static struct block block_alloc(struct ctl_workspace *ws, uint16_t row, uint16_t column)
+{
+	float *X = ctl_workspace_floats(ws, (size_t)row * row + (size_t)row * column);
+
+	return (struct block){ .L = X, .R = &X[(uint32_t)row * row] };
+}
+
+/*
+ * 1-norm of [A B; 0 0], the largest absolute column sum
+ */
+static float norm_1(const float A[], const float B[], uint16_t row, uint16_t column)
+{
+	float size = 0;
+
+	for (uint16_t j = 0; j < row + column; j++) {
+		float sum = 0;
+
+		for (uint16_t i = 0; i < row; i++)
+			sum += j < row ? fabsf(A[i * row + j]) : fabsf(B[i * column + j - row]);
+		// Written this way so that NaN propagates
+		size = sum > size || isnan(sum) ? sum : size;
+	}
+	return size;
+}
+
+/*
+ * Z = X*Y, where y is the identity coefficient of Y: Z11 = X11*Y11, Z12 = X11*Y12 + y*X12
+ * The identity coefficient of Z is that of X times y, the callers keep track of it
+ */
+static void product(struct block Z, struct block X, struct block Y, float y, uint16_t row,
+		    uint16_t column)
+{
+	gemm(false, false, 1.0f, X.L, Y.L, 0.0f, Z.L, row, row, row);
+	if (column > 0) {
+		for (uint32_t i = 0; i < (uint32_t)row * column; i++)
+			Z.R[i] = y * X.R[i];
+		gemm(false, false, 1.0f, X.L, Y.R, 1.0f, Z.R, row, column, row);
+	}
+}
+
+/*
+ * Z = b[0]*X[0] + b[1]*X[1] + ... + identity*I, the X are all blocks from block_alloc
+ */
+static void sum_powers(struct block Z, const float b[], const struct block X[], uint8_t count,
+		       float identity, uint16_t row, uint16_t column)
+{
+	uint32_t length = (uint32_t)row * row + (uint32_t)row * column;
+
+	for (uint32_t i = 0; i < length; i++) {
+		float sum = 0;
+
+		for (uint8_t k = 0; k < count; k++)
+			sum += b[k] * X[k].L[i];
+		Z.L[i] = sum;
 	}
-	memcpy(A, E, sizeof(E));
+	for (uint16_t i = 0; i < row; i++)
+		Z.L[i * row + i] += identity;
 }
 
 /*
  * MATLAB:
- * function E = expm2(A)
-	  E = zeros(size(A));
-	  F = eye(size(A));
-	  T = eye(size(A));
-	  k = 1;
-	  while norm(T,1) > 0
-		E = E + F;
-		F = A*F/k;
-		k = k+1;
-		T = E+F-E;
+ * function E = expm13(A)
+	  b = [64764752532480000, 32382376266240000, 7771770303897600, 1187353796428800, ...
+	       129060195264000, 10559470521600, 670442572800, 33522128640, ...
+	       1323241920, 40840800, 960960, 16380, 182, 1];
+	  s = max(0, ceil(log2(norm(A,1)/5.371920351148152)));
+	  A = A/2^s;
+	  I = eye(size(A));
+	  A2 = A*A; A4 = A2*A2; A6 = A2*A4;
+	  U = A*(A6*(b(14)*A6 + b(12)*A4 + b(10)*A2) + b(8)*A6 + b(6)*A4 + b(4)*A2 + b(2)*I);
+	  V = A6*(b(13)*A6 + b(11)*A4 + b(9)*A2) + b(7)*A6 + b(5)*A4 + b(3)*A2 + b(1)*I;
+	  E = (V - U)\(V + U);
+	  for k = 1:s
+		E = E*E;
 	  end
 	end
  */
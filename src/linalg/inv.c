@@ -7,13 +7,9 @@
  * Training: https://swedishembedded.com/training
  */
 
-#include <math.h>
-#include <float.h>
 #include <string.h>
 #include <control/linalg.h>
 
-static uint8_t solve(float A[], float x[], float b[], uint8_t P[], float LU[], uint16_t row);
-
 /*
  * A to A^(-1)
  * Notice that only square matrices are only allowed.
@@ -26,63 +22,44 @@ static uint8_t solve(float A[], float x[], float b[], uint8_t P[], float LU[], u
  */
 uint8_t inv(float A[], uint16_t row)
 {
-	// Create iA matrix
-	float iA[row * row];
-
-	// Create temporary matrix and status variable
-	float tmpvec[row];
-
-	memset(tmpvec, 0, row * sizeof(float));
-
-	uint8_t status = 0;
-
-	// Check if the determinant is 0
-	float LU[row * row];
-	uint8_t P[row];
-
-	status = lup(A, LU, P, row);
-	if (status == 0)
-		return 0; // matrix is singular. Determinant 0
-	// Create the inverse
-	for (uint16_t i = 0; i < row; i++) {
-		tmpvec[i] = 1.0f;
-		if (!solve(A, &iA[row * i], tmpvec, P, LU, row))
-			return 0; // We divided with zero
-		tmpvec[i] = 0.0f;
-	}
-
-	// Transpose of iA
-	tran(iA, row, row);
+	CTL_WORKSPACE_ON_STACK(ws, inv_workspace_size(row));
 
-	// Copy over iA -> A
-	memcpy(A, iA, row * row * sizeof(float));
+	return inv_ws(A, row, &ws);
+}
 
-	return status;
+size_t inv_workspace_size(uint16_t row)
+{
+	return CTL_WORKSPACE_FLOATS(row * row) + CTL_WORKSPACE_BYTES(row * sizeof(uint16_t));
 }
 
-static uint8_t solve(float A[], float x[], float b[], uint8_t P[], float LU[], uint16_t row)
+/*
+ * Same as inv, with the LU factors taken from the workspace
+ * Returns 0 also when the workspace is too small
+ */
+uint8_t inv_ws(float A[], uint16_t row, struct ctl_workspace *ws)
 {
-	// forward substitution with pivoting
-	for (uint16_t i = 0; i < row; ++i) {
-		x[i] = b[P[i]];
+	if (ctl_workspace_available(ws) < inv_workspace_size(row))
+		return 0;
 
-		for (uint16_t j = 0; j < i; ++j)
-			x[i] = x[i] - LU[row * P[i] + j] * x[j];
-	}
+	size_t mark = ctl_workspace_mark(ws);
+	float *LU = ctl_workspace_floats(ws, row * row);
+	uint16_t *P = ctl_workspace_alloc(ws, row * sizeof(uint16_t));
+	uint8_t status;
 
-	// backward substitution with pivoting
-	for (int16_t i = row - 1; i >= 0; --i) {
-		for (int16_t j = i + 1; j < row; ++j)
-			x[i] = x[i] - LU[row * P[i] + j] * x[j];
+	memcpy(LU, A, row * row * sizeof(float));
+	status = lu_factor(LU, P, row);
+	if (status == 0)
+		goto out; // matrix is singular. Determinant 0
 
-		// Just in case if we divide with zero
-		if (fabsf(LU[row * P[i] + i]) > FLT_EPSILON)
-			x[i] = x[i] / LU[row * P[i] + i];
-		else
-			return 0;
-	}
+	// Solve A*X = I for all columns at once, A is left untouched when A is singular
+	memset(A, 0, row * row * sizeof(float));
+	for (uint16_t i = 0; i < row; i++)
+		A[i * row + i] = 1.0f;
+	lu_solve_multi(LU, P, A, row, row);
 
-	return 1; // No problems
+out:
+	ctl_workspace_release(ws, mark);
+	return status;
 }
 
 /*
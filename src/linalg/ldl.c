@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Copyright 2022 Martin Schröder <info@swedishembedded.com>
+ * Consulting: https://swedishembedded.com/consulting
+ * Simulation: https://swedishembedded.com/simulation
+ * Training: https://swedishembedded.com/training
+ */
+
+#include <float.h>
+#include <math.h>
+
+#include <control/linalg.h>
+
+#include "linalg/dot.h"
+
+/*
+ * LDL^T factorization A = L*D*L^T in place, without square roots and without pivoting.
+ * Unlike chol_factor it also takes positive semidefinite matrices: a pivot that is zero
+ * to rounding, compared to the largest diagonal element of A, is set to zero together
+ * with the column of L below it.
+ * A [m*n] // Lower triangle of A on entry, the unit lower triangle L on return
+ * d [m] // D
+ * n == m
+ * Returns 1 == Success
+ * Returns 0 == Fail, a pivot is negative or not finite so A is not positive semidefinite
+ */
+uint8_t ldl_factor(float A[], float d[], uint16_t row)
+{
+	float largest = 0.0f;
+
+	for (uint16_t i = 0; i < row; i++)
+		largest = fmaxf(largest, fabsf(A[(size_t)i * row + i]));
+
+	float tolerance = row * FLT_EPSILON * largest;
+
+	for (uint16_t j = 0; j < row; j++) {
+		float *Lj = &A[(size_t)j * row];
+		float pivot = Lj[j] - ctl_dot_scaled(Lj, Lj, d, j);
+
+		if (pivot < -tolerance || !isfinite(pivot))
+			return 0;
+		if (pivot <= tolerance)
+			pivot = 0.0f;
+		d[j] = pivot;
+		Lj[j] = 1.0f;
+		for (uint16_t i = j + 1; i < row; i++) {
+			float *Li = &A[(size_t)i * row];
+
+			if (pivot > 0.0f)
+				Li[j] = (Li[j] - ctl_dot_scaled(Li, Lj, d, j)) / pivot;
+			else
+				Li[j] = 0.0f;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Solve A*X = B for many right hand sides with the factors of ldl_factor. The elements
+ * of X that belong to a zero pivot are set to zero, which still solves A*X = B when B is
+ * in the range of a semidefinite A.
+ * L [m*n]
+ * d [m]
+ * B [m*column] // Right hand sides on entry, X on return
+ * n == m
+ */
+void ldl_solve_multi(const float L[], const float d[], float B[], uint16_t row,
+		     uint16_t column)
+{
+	trsm(true, false, false, L, B, row, column);
+	for (uint16_t i = 0; i < row; i++) {
+		float *Bi = &B[(size_t)i * column];
+		float scale = d[i] > 0.0f ? 1.0f / d[i] : 0.0f;
+
+		for (uint16_t j = 0; j < column; j++)
+			Bi[j] *= scale;
+	}
+	trsm(true, false, true, L, B, row, column);
+}
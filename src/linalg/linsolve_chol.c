@@ -7,6 +7,7 @@
  * Training: https://swedishembedded.com/training
  */
 
+#include <string.h>
 #include <control/linalg.h>
 
 /*
@@ -18,11 +19,37 @@
  */
 void linsolve_chol(float A[], float x[], float b[], uint16_t row)
 {
-	float L[row * row];
-	float y[row];
+	CTL_WORKSPACE_ON_STACK(ws, linsolve_chol_workspace_size(row));
 
-	chol(A, L, row);
-	linsolve_lower_triangular(L, y, b, row);
-	tran(L, row, row);
-	linsolve_upper_triangular(L, x, y, row);
+	linsolve_chol_ws(A, x, b, row, &ws);
+}
+
+size_t linsolve_chol_workspace_size(uint16_t row)
+{
+	return CTL_WORKSPACE_FLOATS(row * row);
+}
+
+/*
+ * Same as linsolve_chol, with L taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or A is not positive definite
+ */
+uint8_t linsolve_chol_ws(float A[], float x[], float b[], uint16_t row, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < linsolve_chol_workspace_size(row))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	float *L = ctl_workspace_floats(ws, row * row);
+	uint8_t status;
+
+	memcpy(L, A, row * row * sizeof(float));
+	status = chol_factor(L, row);
+	if (status) {
+		memmove(x, b, row * sizeof(float));
+		chol_solve_multi(L, x, row, 1);
+	}
+
+	ctl_workspace_release(ws, mark);
+	return status;
 }
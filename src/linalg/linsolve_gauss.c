@@ -29,17 +29,63 @@ static void tikhonov(float *A, float *b, float *ATA, float *ATb, uint16_t row_a,
  */
 void linsolve_gauss(float *A, float *x, float *b, uint16_t row, uint16_t column, float alpha)
 {
+	CTL_WORKSPACE_ON_STACK(ws, linsolve_gauss_workspace_size(row, column, alpha));
+
+	linsolve_gauss_ws(A, x, b, row, column, alpha, &ws);
+}
+
+size_t linsolve_gauss_workspace_size(uint16_t row, uint16_t column, float alpha)
+{
+	if (alpha <= 0 && row == column)
+		return 0;
+
+	// D of the LDL^T factorization without regularization
+	size_t d = alpha > 0 ? 0 : CTL_WORKSPACE_FLOATS(column);
+
+	return CTL_WORKSPACE_FLOATS(column * column) + CTL_WORKSPACE_FLOATS(column) + d;
+}
+
+/*
+ * Same as linsolve_gauss, with A^T*A and A^T*b taken from the workspace.
+ * The normal equations are solved with the Cholesky factorization of A^T*A + alpha*I,
+ * or with the LDL^T factorization of A^T*A when alpha <= 0 since it can be singular.
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or A^T*A + alpha*I is not positive definite
+ */
+uint8_t linsolve_gauss_ws(float *A, float *x, float *b, uint16_t row, uint16_t column, float alpha,
+			  struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < linsolve_gauss_workspace_size(row, column, alpha))
+		return 0;
+
+	uint8_t status = 1;
+
 	if (alpha <= 0 && row == column) {
 		triu(A, b, row);
 		linsolve_upper_triangular(A, x, b, column);
 	} else {
-		float ATA[column * column];
-		float ATb[column];
+		size_t mark = ctl_workspace_mark(ws);
+		float *ATA = ctl_workspace_floats(ws, column * column);
+		float *ATb = ctl_workspace_floats(ws, column);
 
+		// A^T*A + alpha*I is symmetric positive definite for alpha > 0
 		tikhonov(A, b, ATA, ATb, row, column, alpha);
-		triu(ATA, ATb, column);
-		linsolve_upper_triangular(ATA, x, ATb, column);
+		if (alpha > 0) {
+			status = chol_factor(ATA, column);
+			if (status)
+				chol_solve_multi(ATA, ATb, column, 1);
+		} else {
+			float *d = ctl_workspace_floats(ws, column);
+
+			status = ldl_factor(ATA, d, column);
+			if (status)
+				ldl_solve_multi(ATA, d, ATb, column, 1);
+		}
+		if (status)
+			memcpy(x, ATb, column * sizeof(float));
+		ctl_workspace_release(ws, mark);
 	}
+	return status;
 }
 
 /*
@@ -84,7 +130,7 @@ static void triu(float *A, float *b, uint16_t row)
 /*
  * This is Tikhonov regularization.
  * This function prepare your Ax = b equation to be solved as (A^T*A + alpha*I)*x = A^T*b
- * Use triu and then linsolve_upper_triangular after this function.
+ * Use chol_factor and then chol_solve_multi after this function.
  *
  * A [m*n]
  * b [m]
@@ -97,19 +143,11 @@ static void triu(float *A, float *b, uint16_t row)
 static void tikhonov(float *A, float *b, float *ATA, float *ATb, uint16_t row_a, uint16_t column_a,
 		     float alpha)
 {
-	// AT - Transpose A
-	float AT[column_a * row_a]; // Same dimension as A, just swapped rows and column
-
-	memcpy(AT, A, column_a * row_a * sizeof(float)); // Copy A -> AT
-	tran(AT, row_a, column_a); // Now turn the values of AT to transpose
-
-	// ATb = AT*b
-	memset(ATb, 0, row_a * sizeof(float));
-	mul(AT, b, ATb, column_a, row_a, 1);
+	// ATb = A^T*b, the transpose of A is read in place
+	gemm(true, false, 1.0f, A, b, 0.0f, ATb, column_a, 1, row_a);
 
-	// ATA = AT*A
-	memset(ATA, 0, column_a * column_a * sizeof(float));
-	mul(AT, A, ATA, column_a, row_a, column_a);
+	// ATA = A^T*A
+	gemm(true, false, 1.0f, A, A, 0.0f, ATA, column_a, column_a, row_a);
 
 	// ATA = ATA + alpha*I. Don't need identity matrix here because we only add on diagonal
 	for (uint16_t i = 0; i < column_a; i++)
@@ -7,6 +7,7 @@
  * Training: https://swedishembedded.com/training
  */
 
+#include <string.h>
 #include <control/linalg.h>
 
 /*
@@ -20,32 +21,37 @@
  */
 uint8_t linsolve_lup(float A[], float x[], float b[], uint16_t row)
 {
-	float LU[row * row];
-	uint8_t P[row];
-	uint8_t status = lup(A, LU, P, row);
+	CTL_WORKSPACE_ON_STACK(ws, linsolve_lup_workspace_size(row));
 
-	if (status == 0)
-		return 0;
-
-	// forward substitution with pivoting
-	for (uint16_t i = 0; i < row; ++i) {
-		x[i] = b[P[i]];
+	return linsolve_lup_ws(A, x, b, row, &ws);
+}
 
-		for (uint16_t j = 0; j < i; ++j)
-			x[i] = x[i] - LU[row * P[i] + j] * x[j];
-	}
+size_t linsolve_lup_workspace_size(uint16_t row)
+{
+	return CTL_WORKSPACE_FLOATS(row * row) + CTL_WORKSPACE_BYTES(row * sizeof(uint16_t));
+}
 
-	// backward substitution with pivoting
-	for (uint16_t i = row - 1; i >= 0; --i) {
-		for (uint16_t j = i + 1; j < row; ++j)
-			x[i] = x[i] - LU[row * P[i] + j] * x[j];
+/*
+ * Same as linsolve_lup, with the LU factors taken from the workspace
+ * Returns 0 also when the workspace is too small
+ */
+uint8_t linsolve_lup_ws(float A[], float x[], float b[], uint16_t row, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < linsolve_lup_workspace_size(row))
+		return 0;
 
-		x[i] = x[i] / LU[row * P[i] + i];
+	size_t mark = ctl_workspace_mark(ws);
+	float *LU = ctl_workspace_floats(ws, row * row);
+	uint16_t *P = ctl_workspace_alloc(ws, row * sizeof(uint16_t));
+	uint8_t status;
 
-		// Important because when i = -1, then i will become 65535
-		if (i == 0)
-			break;
+	memcpy(LU, A, row * row * sizeof(float));
+	status = lu_factor(LU, P, row);
+	if (status) {
+		memmove(x, b, row * sizeof(float));
+		lu_solve(LU, P, x, row);
 	}
 
+	ctl_workspace_release(ws, mark);
 	return status;
 }
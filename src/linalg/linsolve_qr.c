@@ -7,6 +7,7 @@
  * Training: https://swedishembedded.com/training
  */
 
+#include <string.h>
 #include <control/linalg.h>
 
 /*
@@ -17,13 +18,40 @@
  */
 void linsolve_qr(float A[], float x[], float b[], uint16_t row, uint16_t column)
 {
-	// QR-decomposition
-	float Q[row * row];
-	float R[row * column];
-	float QTb[row];
-
-	qr(A, Q, R, row, column, false);
-	tran(Q, row, row); // Do transpose Q -> Q^T
-	mul(Q, b, QTb, row, row, 1); // Q^Tb = Q^T*b
+	CTL_WORKSPACE_ON_STACK(ws, linsolve_qr_workspace_size(row, column));
+
+	linsolve_qr_ws(A, x, b, row, column, &ws);
+}
+
+size_t linsolve_qr_workspace_size(uint16_t row, uint16_t column)
+{
+	return CTL_WORKSPACE_FLOATS(row * column) + CTL_WORKSPACE_FLOATS(column) +
+	       CTL_WORKSPACE_FLOATS(row) + qr_factor_workspace_size(row, column);
+}
+
+/*
+ * Same as linsolve_qr, with Q and R taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t linsolve_qr_ws(float A[], float x[], float b[], uint16_t row, uint16_t column,
+		       struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < linsolve_qr_workspace_size(row, column))
+		return 0;
+
+	// QR-decomposition, Q is kept as reflectors below the diagonal of R
+	size_t mark = ctl_workspace_mark(ws);
+	float *R = ctl_workspace_floats(ws, row * column);
+	float *tau = ctl_workspace_floats(ws, column);
+	float *QTb = ctl_workspace_floats(ws, row);
+
+	memcpy(R, A, row * column * sizeof(float));
+	qr_factor_ws(R, tau, row, column, ws);
+	memcpy(QTb, b, row * sizeof(float));
+	qr_apply_qt(R, tau, QTb, row, column, 1); // Q^Tb = Q^T*b
 	linsolve_upper_triangular(R, x, QTb, column);
+
+	ctl_workspace_release(ws, mark);
+	return 1;
 }
@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Copyright 2022 Martin Schröder <info@swedishembedded.com>
+ * Consulting: https://swedishembedded.com/consulting
+ * Simulation: https://swedishembedded.com/simulation
+ * Training: https://swedishembedded.com/training
+ */
+
+#include <float.h>
+#include <math.h>
+
+#include <control/linalg.h>
+
+#include "linalg/dot.h"
+
+/*
+ * LU factorization with partial pivoting, factor once and solve many times with lu_solve
+ * and lu_solve_multi. The rows of LU are swapped in place, so every row of L and U is
+ * contiguous, and P[k] is the row that was swapped with row k at step k.
+ * LU [m*n] // A on entry, the unit lower triangle L below the diagonal and U on and above it
+ * P [m]
+ * n == m
+ * Returns 1 == Success
+ * Returns 0 == Fail, a pivot is not larger than FLT_EPSILON so A is singular
+ */
+uint8_t lu_factor(float LU[], uint16_t P[], uint16_t row)
+{
+	for (uint16_t k = 0; k < row; k++) {
+		uint16_t pivot = k;
+
+		for (uint16_t i = k + 1; i < row; i++)
+			if (fabsf(LU[(uint32_t)i * row + k]) > fabsf(LU[(uint32_t)pivot * row + k]))
+				pivot = i;
+		P[k] = pivot;
+		if (!(fabsf(LU[(uint32_t)pivot * row + k]) > FLT_EPSILON))
+			return 0;
+		if (pivot != k) {
+			for (uint16_t j = 0; j < row; j++) {
+				float swap = LU[(uint32_t)k * row + j];
+
+				LU[(uint32_t)k * row + j] = LU[(uint32_t)pivot * row + j];
+				LU[(uint32_t)pivot * row + j] = swap;
+			}
+		}
+
+		const float *Uk = &LU[(uint32_t)k * row];
+
+		for (uint16_t i = k + 1; i < row; i++) {
+			float *Ai = &LU[(uint32_t)i * row];
+
+			// Rows with a zero here, like the slacks of a simplex basis, are done
+			if (Ai[k] == 0)
+				continue;
+			Ai[k] /= Uk[k];
+
+			float l = Ai[k];
+
+			for (uint16_t j = k + 1; j < row; j++)
+				Ai[j] -= l * Uk[j];
+		}
+	}
+	return 1;
+}
+
+/*
+ * Solve A*x = b with the factorization of lu_factor
+ * b [m] // Right hand side on entry, x on return
+ */
+void lu_solve(const float LU[], const uint16_t P[], float b[], uint16_t row)
+{
+	for (uint16_t k = 0; k < row; k++) {
+		float swap = b[k];
+
+		b[k] = b[P[k]];
+		b[P[k]] = swap;
+	}
+	for (uint16_t i = 1; i < row; i++)
+		b[i] -= ctl_dot(&LU[(uint32_t)i * row], b, i);
+	for (uint16_t i = row; i-- > 0;) {
+		const float *Ui = &LU[(uint32_t)i * row];
+
+		b[i] = (b[i] - ctl_dot(&Ui[i + 1], &b[i + 1], row - i - 1)) / Ui[i];
+	}
+}
+
+/*
+ * Solve A*X = B for all columns of B at once with the factorization of lu_factor.
+ * Every step updates a whole row of B, which is contiguous.
+ * B [m*column] // Right hand sides on entry, X on return
+ */
+void lu_solve_multi(const float LU[], const uint16_t P[], float B[], uint16_t row,
+		    uint16_t column)
+{
+	for (uint16_t k = 0; k < row; k++) {
+		if (P[k] == k)
+			continue;
+		for (uint16_t j = 0; j < column; j++) {
+			float swap = B[(uint32_t)k * column + j];
+
+			B[(uint32_t)k * column + j] = B[(uint32_t)P[k] * column + j];
+			B[(uint32_t)P[k] * column + j] = swap;
+		}
+	}
+
+	// Forward substitution with the unit lower triangle
+	for (uint16_t i = 1; i < row; i++) {
+		float *Bi = &B[(uint32_t)i * column];
+
+		for (uint16_t k = 0; k < i; k++) {
+			float l = LU[(uint32_t)i * row + k];
+			const float *Bk = &B[(uint32_t)k * column];
+
+			if (l == 0)
+				continue;
+			for (uint16_t j = 0; j < column; j++)
+				Bi[j] -= l * Bk[j];
+		}
+	}
+
+	// Backward substitution with the upper triangle
+	for (uint16_t i = row; i-- > 0;) {
+		float *Bi = &B[(uint32_t)i * column];
+
+		for (uint16_t k = i + 1; k < row; k++) {
+			float u = LU[(uint32_t)i * row + k];
+			const float *Bk = &B[(uint32_t)k * column];
+
+			if (u == 0)
+				continue;
+			for (uint16_t j = 0; j < column; j++)
+				Bi[j] -= u * Bk[j];
+		}
+		for (uint16_t j = 0; j < column; j++)
+			Bi[j] /= LU[(uint32_t)i * row + i];
+	}
+}
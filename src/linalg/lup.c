@@ -14,6 +14,8 @@
 
 /*
  * Do LU-decomposition with partial pivoting
+ * The rows are not swapped, P[i] is the row of LU that holds row i of the factors.
+ * lu_factor swaps them in place instead, which the solvers in this library use.
  * A [m*n]
  * LU [m*n]
  * P [n]
@@ -21,7 +23,7 @@
  * Returns 1 == Success
  * Returns 0 == Fail
  */
-uint8_t lup(float A[], float LU[], uint8_t P[], uint16_t row)
+uint8_t lup(float A[], float LU[], uint16_t P[], uint16_t row)
 {
 	// Variables
 	uint16_t ind_max, tmp_int;
@@ -7,34 +7,687 @@
  * Training: https://swedishembedded.com/training
  */
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include <control/linalg.h>
 
+#include "linalg/dot.h"
+
+/*
+ * Vector unit the multiplication is built for, picked from what the compiler targets.
+ * Every variant provides the same handful of operations on VLEN floats.
+ */
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+typedef __m256 vfloat;
+#define VLEN 8
+#define vzero() _mm256_setzero_ps()
+#define vload(p) _mm256_loadu_ps(p)
+#define vstore(p, v) _mm256_storeu_ps(p, v)
+#define vdup(x) _mm256_set1_ps(x)
+#define vadd(a, b) _mm256_add_ps(a, b)
+#define vmul(a, b) _mm256_mul_ps(a, b)
+#define vfma(c, a, b) _mm256_fmadd_ps(a, b, c) // c + a*b
+static inline float vsum(vfloat v)
+{
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+typedef __m128 vfloat;
+#define VLEN 4
+#define vzero() _mm_setzero_ps()
+#define vload(p) _mm_loadu_ps(p)
+#define vstore(p, v) _mm_storeu_ps(p, v)
+#define vdup(x) _mm_set1_ps(x)
+#define vadd(a, b) _mm_add_ps(a, b)
+#define vmul(a, b) _mm_mul_ps(a, b)
+#define vfma(c, a, b) _mm_add_ps(c, _mm_mul_ps(a, b))
+static inline float vsum(vfloat v)
+{
+	__m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+#elif defined(__ARM_FEATURE_MVE) && (__ARM_FEATURE_MVE & 2)
+#include <arm_mve.h>
+typedef float32x4_t vfloat;
+#define VLEN 4
+#define vzero() vdupq_n_f32(0.0f)
+#define vload(p) vld1q_f32(p)
+#define vstore(p, v) vst1q_f32(p, v)
+#define vdup(x) vdupq_n_f32(x)
+#define vadd(a, b) vaddq_f32(a, b)
+#define vmul(a, b) vmulq_f32(a, b)
+#define vfma(c, a, b) vfmaq_f32(c, a, b)
+static inline float vsum(vfloat v)
+{
+	return vgetq_lane_f32(v, 0) + vgetq_lane_f32(v, 1) + vgetq_lane_f32(v, 2) +
+	       vgetq_lane_f32(v, 3);
+}
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+typedef float32x4_t vfloat;
+#define VLEN 4
+#define vzero() vdupq_n_f32(0.0f)
+#define vload(p) vld1q_f32(p)
+#define vstore(p, v) vst1q_f32(p, v)
+#define vdup(x) vdupq_n_f32(x)
+#define vadd(a, b) vaddq_f32(a, b)
+#define vmul(a, b) vmulq_f32(a, b)
+#if defined(__aarch64__) || defined(__ARM_FEATURE_FMA)
+#define vfma(c, a, b) vfmaq_f32(c, a, b)
+#else
+#define vfma(c, a, b) vmlaq_f32(c, a, b)
+#endif
+static inline float vsum(vfloat v)
+{
+	return vgetq_lane_f32(v, 0) + vgetq_lane_f32(v, 1) + vgetq_lane_f32(v, 2) +
+	       vgetq_lane_f32(v, 3);
+}
+#else
+typedef float vfloat;
+#define VLEN 1
+#define vzero() 0.0f
+#define vload(p) (*(p))
+#define vstore(p, v) (*(p) = (v))
+#define vdup(x) (x)
+#define vadd(a, b) ((a) + (b))
+#define vmul(a, b) ((a) * (b))
+#define vfma(c, a, b) ((c) + (a) * (b))
+#define vsum(v) (v)
+#endif
+
+/*
+ * Register tile of the micro kernel is MR rows of C times NR columns.
+ * B is packed KC rows at a time, so the stack holds KC * NR floats for the panel.
+ */
+#define MR 4
+#define NR (2 * VLEN)
+#ifdef CONFIG_CONTROL_GEMM_KC
+#define KC CONFIG_CONTROL_GEMM_KC
+#else
+#define KC 128
+#endif
+
+// Smaller products than this do not pay for packing B
+#define BLOCKED_MIN_FLOPS (16 * 16 * 16)
+
+// Rows or columns of X that trsm solves directly before it updates the rest of B with gemm
+#define TRSM_BLOCK 32
+
+/*
+ * Where element (i, k) of op(A) and element (k, j) of op(B) live:
+ * op(A)(i, k) = A[i * row_stride_a + k * column_stride_a] and the same for B.
+ * Rows of C are row_stride_c apart, which is more than its columns for a block of a matrix.
+ */
+struct gemm_operands {
+	const float *A;
+	const float *B;
+	size_t row_stride_a;
+	size_t column_stride_a;
+	size_t row_stride_b;
+	size_t column_stride_b;
+	size_t row_stride_c;
+	float alpha;
+	float beta;
+};
+
+static void mul_small(const float A[], const float B[], float C[], uint16_t row_a,
+		      uint16_t column_a, uint16_t column_b);
+static void gemv(const struct gemm_operands *op, float C[], uint16_t row_c, uint16_t inner,
+		 bool transpose_a);
+static void gemm_small(const struct gemm_operands *op, float C[], uint16_t row_c,
+		       uint16_t column_c, uint16_t inner);
+static void gemm_blocked(const struct gemm_operands *op, float C[], uint16_t row_c,
+			 uint16_t column_c, uint16_t inner);
+static inline float update(float sum, float c, float alpha, float beta);
+static void solve_rows(const float T[], size_t rst, size_t cst, bool backward, float B[],
+		       uint16_t first, uint16_t size, uint16_t column);
+static void solve_columns(const float T[], size_t rst, size_t cst, bool backward, float B[],
+			  uint16_t first, uint16_t size, uint16_t row, uint16_t column);
+
 /*
  * C = A*B
  * A [row_a*column_a]
  * B [column_a*column_b]
  * C [row_a*column_b]
+ * C must not overlap A or B
  */
 void mul(float A[], float B[], float C[], uint16_t row_a, uint16_t column_a, uint16_t column_b)
 {
-	// Data matrix
-	float *data_a;
-	float *data_b;
+	if (column_b == 1) {
+		// Matrix times vector, every row of A is contiguous
+		for (uint16_t i = 0; i < row_a; i++)
+			C[i] = ctl_dot(&A[(size_t)i * column_a], B, column_a);
+	} else if ((uint32_t)row_a * column_a * column_b < BLOCKED_MIN_FLOPS || row_a < MR ||
+		   column_b < NR) {
+		mul_small(A, B, C, row_a, column_a, column_b);
+	} else {
+		gemm(false, false, 1.0f, A, B, 0.0f, C, row_a, column_b, column_a);
+	}
+}
+
+/*
+ * C = alpha*op(A)*op(B) + beta*C, where op(X) is X or X^T
+ * op(A) [row_c*inner], stored as A [row_c*inner] or, when transpose_a, as A [inner*row_c]
+ * op(B) [inner*column_c], stored as B [inner*column_c] or, when transpose_b, as B [column_c*inner]
+ * C [row_c*column_c]
+ * The transposes are read in place, nothing is copied. When beta is 0, C is only written,
+ * so it may hold garbage on entry. C must not overlap A or B.
+ */
+void gemm(bool transpose_a, bool transpose_b, float alpha, const float A[], const float B[],
+	  float beta, float C[], uint16_t row_c, uint16_t column_c, uint16_t inner)
+{
+	struct gemm_operands op = {
+		.A = A,
+		.B = B,
+		.row_stride_a = transpose_a ? 1 : inner,
+		.column_stride_a = transpose_a ? row_c : 1,
+		.row_stride_b = transpose_b ? 1 : column_c,
+		.column_stride_b = transpose_b ? inner : 1,
+		.row_stride_c = column_c,
+		.alpha = alpha,
+		.beta = beta,
+	};
+
+	if (column_c == 1) {
+		// op(B) is a vector, which is stored the same way transposed or not
+		gemv(&op, C, row_c, inner, transpose_a);
+	} else if ((uint32_t)row_c * column_c * inner < BLOCKED_MIN_FLOPS || row_c < MR ||
+		   column_c < NR) {
+		if (transpose_a || transpose_b || alpha != 1.0f || beta != 0.0f)
+			gemm_small(&op, C, row_c, column_c, inner);
+		else
+			mul_small(A, B, C, row_c, inner, column_c);
+	} else {
+		gemm_blocked(&op, C, row_c, column_c, inner);
+	}
+}
+
+/*
+ * Solve op(A)*X = B when left, or X*op(A) = B when not, for many right hand sides at once.
+ * op(A) is A or A^T and A is upper or lower triangular, only that triangle is read.
+ * A [row*row] when left, A [column*column] when not
+ * B [row*column] // Right hand sides on entry, X on return
+ * TRSM_BLOCK rows (left) or columns (right) of X are solved at a time, and the rest of B
+ * is then updated with the blocked product, so most of the work runs in the micro kernel.
+ */
+void trsm(bool left, bool upper, bool transpose, const float A[], float B[], uint16_t row,
+	  uint16_t column)
+{
+	uint16_t n = left ? row : column;
+	// op(A)(i, k) = A[i * rst + k * cst], it is upper when A is upper and not transposed
+	// or lower and transposed
+	size_t rst = transpose ? 1 : n;
+	size_t cst = transpose ? n : 1;
+	// The last row of X comes first for an upper op(A) on the left, and the last column
+	// for a lower op(A) on the right
+	bool backward = left == (upper != transpose);
 
+	for (uint16_t solved = 0; solved < n; solved += TRSM_BLOCK) {
+		uint16_t size = n - solved < TRSM_BLOCK ? n - solved : TRSM_BLOCK;
+		uint16_t first = backward ? n - solved - size : solved;
+		// Rows or columns of B that still need the block that is solved now
+		uint16_t rest = backward ? 0 : first + size;
+		uint16_t rest_size = backward ? first : n - first - size;
+		struct gemm_operands op = { .row_stride_c = column, .alpha = -1.0f, .beta = 1.0f };
+		uint16_t row_c, column_c;
+		float *C;
+
+		if (left) {
+			solve_rows(A, rst, cst, backward, B, first, size, column);
+			// B(rest, :) -= op(A)(rest, block) * X(block, :)
+			op.A = &A[rest * rst + first * cst];
+			op.row_stride_a = rst;
+			op.column_stride_a = cst;
+			op.B = &B[(size_t)first * column];
+			op.row_stride_b = column;
+			op.column_stride_b = 1;
+			C = &B[(size_t)rest * column];
+			row_c = rest_size;
+			column_c = column;
+		} else {
+			solve_columns(A, rst, cst, backward, B, first, size, row, column);
+			// B(:, rest) -= X(:, block) * op(A)(block, rest)
+			op.A = &B[first];
+			op.row_stride_a = column;
+			op.column_stride_a = 1;
+			op.B = &A[first * rst + rest * cst];
+			op.row_stride_b = rst;
+			op.column_stride_b = cst;
+			C = &B[rest];
+			row_c = row;
+			column_c = rest_size;
+		}
+		if (row_c == 0 || column_c == 0)
+			continue;
+		if ((uint32_t)row_c * column_c * size < BLOCKED_MIN_FLOPS || row_c < MR ||
+		    column_c < NR)
+			gemm_small(&op, C, row_c, column_c, size);
+		else
+			gemm_blocked(&op, C, row_c, column_c, size);
+	}
+}
+
+/*
+ * C = alpha*A*A^T + beta*C on the lower triangle of C, the upper triangle is not touched
+ * A [row*inner]
+ * C [row*row]
+ * The rows of A and C are stride floats apart, so both can be blocks of a larger matrix.
+ * The blocks below the diagonal blocks of TRSM_BLOCK columns run in the micro kernel.
+ */
+void syrk(float alpha, const float A[], float beta, float C[], uint16_t row, uint16_t inner,
+	  uint16_t stride)
+{
+	for (uint16_t first = 0; first < row; first += TRSM_BLOCK) {
+		uint16_t size = row - first < TRSM_BLOCK ? row - first : TRSM_BLOCK;
+		uint16_t below = row - first - size;
+
+		// Diagonal block, its lower triangle only
+		for (uint16_t i = first; i < first + size; i++)
+			for (uint16_t j = first; j <= i; j++) {
+				float *c = &C[(size_t)i * stride + j];
+				float sum = ctl_dot(&A[(size_t)i * stride], &A[(size_t)j * stride],
+						    inner);
+
+				*c = update(sum, *c, alpha, beta);
+			}
+		if (below == 0)
+			continue;
+
+		// C(below, block) = alpha*A(below, :)*A(block, :)' + beta*C(below, block)
+		struct gemm_operands op = {
+			.A = &A[(size_t)(first + size) * stride],
+			.B = &A[(size_t)first * stride],
+			.row_stride_a = stride,
+			.column_stride_a = 1,
+			.row_stride_b = 1,
+			.column_stride_b = stride,
+			.row_stride_c = stride,
+			.alpha = alpha,
+			.beta = beta,
+		};
+		float *block = &C[(size_t)(first + size) * stride + first];
+
+		if ((uint32_t)below * size * inner < BLOCKED_MIN_FLOPS || below < MR || size < NR)
+			gemm_small(&op, block, below, size, inner);
+		else
+			gemm_blocked(&op, block, below, size, inner);
+	}
+}
+
+// alpha*sum + beta*c, where c is not read when beta is 0
+static inline float update(float sum, float c, float alpha, float beta)
+{
+	return beta == 0.0f ? alpha * sum : alpha * sum + beta * c;
+}
+
+static inline vfloat vupdate(vfloat sum, const float c[], float alpha, float beta)
+{
+	sum = vmul(sum, vdup(alpha));
+	return beta == 0.0f ? sum : vfma(sum, vdup(beta), vload(c));
+}
+
+float ctl_dot(const float a[], const float b[], uint32_t length)
+{
+	vfloat s0 = vzero();
+	vfloat s1 = vzero();
+	uint32_t k = 0;
+
+	for (; k + 2u * VLEN <= length; k += 2u * VLEN) {
+		s0 = vfma(s0, vload(&a[k]), vload(&b[k]));
+		s1 = vfma(s1, vload(&a[k + VLEN]), vload(&b[k + VLEN]));
+	}
+	float sum = vsum(vadd(s0, s1));
+
+	for (; k < length; k++)
+		sum += a[k] * b[k];
+	return sum;
+}
+
+float ctl_dot_scaled(const float a[], const float b[], const float d[], uint32_t length)
+{
+	vfloat s0 = vzero();
+	vfloat s1 = vzero();
+	uint32_t k = 0;
+
+	for (; k + 2u * VLEN <= length; k += 2u * VLEN) {
+		s0 = vfma(s0, vmul(vload(&a[k]), vload(&d[k])), vload(&b[k]));
+		s1 = vfma(s1, vmul(vload(&a[k + VLEN]), vload(&d[k + VLEN])), vload(&b[k + VLEN]));
+	}
+	float sum = vsum(vadd(s0, s1));
+
+	for (; k < length; k++)
+		sum += a[k] * d[k] * b[k];
+	return sum;
+}
+
+/*
+ * Matrix times vector. Without transpose every row of A is a dot product with b.
+ * With transpose the rows of A are scaled by b and added up, so A is still read row by row.
+ */
+static void gemv(const struct gemm_operands *op, float C[], uint16_t row_c, uint16_t inner,
+		 bool transpose_a)
+{
+	const float *A = op->A;
+	const float *b = op->B;
+
+	if (!transpose_a) {
+		for (uint16_t i = 0; i < row_c; i++)
+			C[i] = update(ctl_dot(&A[(size_t)i * inner], b, inner), C[i], op->alpha,
+				      op->beta);
+		return;
+	}
+
+	for (uint16_t i = 0; i < row_c; i++)
+		C[i] = op->beta == 0.0f ? 0.0f : op->beta * C[i];
+
+	for (uint16_t k = 0; k < inner; k++) {
+		const float *a = &A[(size_t)k * row_c];
+		float s = op->alpha * b[k];
+		vfloat vs = vdup(s);
+		uint16_t i = 0;
+
+		for (; i + VLEN <= row_c; i += VLEN)
+			vstore(&C[i], vfma(vload(&C[i]), vs, vload(&a[i])));
+		for (; i < row_c; i++)
+			C[i] += s * a[i];
+	}
+}
+
+/*
+ * One row of C at a time, VLEN columns of that row are summed up in a register while
+ * the rows of B are read contiguously. Columns that do not fill a register are summed
+ * one by one.
+ */
+static void mul_small(const float A[], const float B[], float C[], uint16_t row_a,
+		      uint16_t column_a, uint16_t column_b)
+{
 	for (uint16_t i = 0; i < row_a; i++) {
-		// Then we go through every column of b
-		for (uint16_t j = 0; j < column_b; j++) {
-			data_a = &A[i * column_a];
-			data_b = &B[j];
+		const float *a = &A[(size_t)i * column_a];
+		float *c = &C[(size_t)i * column_b];
+		uint16_t j = 0;
+
+		for (; j + VLEN <= column_b; j += VLEN) {
+			const float *b = &B[j];
+			vfloat sum = vzero();
 
-			*C = 0; // Reset
-			// And we multiply rows from a with columns of b
 			for (uint16_t k = 0; k < column_a; k++) {
-				*C += *data_a * *data_b;
-				data_a++;
-				data_b += column_b;
+				sum = vfma(sum, vdup(a[k]), vload(b));
+				b += column_b;
 			}
-			C++; // ;)
+			vstore(&c[j], sum);
+		}
+
+		for (; j < column_b; j++) {
+			const float *b = &B[j];
+			float sum = 0.0f;
+
+			for (uint16_t k = 0; k < column_a; k++) {
+				sum += a[k] * *b;
+				b += column_b;
+			}
+			c[j] = sum;
+		}
+	}
+}
+
+/*
+ * One row of C at a time. When the rows of op(B) are contiguous, VLEN columns of that
+ * row are summed up in a register while op(B) is read row by row. When op(B) is a
+ * transpose its columns are contiguous, so every element of C is a dot product.
+ */
+static void gemm_small(const struct gemm_operands *op, float C[], uint16_t row_c,
+		       uint16_t column_c, uint16_t inner)
+{
+	const size_t rsa = op->row_stride_a;
+	const size_t csa = op->column_stride_a;
+	const size_t rsb = op->row_stride_b;
+	const size_t csb = op->column_stride_b;
+
+	for (uint16_t i = 0; i < row_c; i++) {
+		const float *a = &op->A[i * rsa];
+		float *c = &C[i * op->row_stride_c];
+		uint16_t j = 0;
+
+		if (csb == 1) {
+			for (; j + VLEN <= column_c; j += VLEN) {
+				const float *ak = a;
+				const float *b = &op->B[j];
+				vfloat sum = vzero();
+
+				for (uint16_t k = 0; k < inner; k++) {
+					sum = vfma(sum, vdup(*ak), vload(b));
+					ak += csa;
+					b += rsb;
+				}
+				vstore(&c[j], vupdate(sum, &c[j], op->alpha, op->beta));
+			}
+		}
+
+		for (; j < column_c; j++) {
+			const float *b = &op->B[j * csb];
+			float sum = 0.0f;
+
+			if (csa == 1 && rsb == 1) {
+				sum = ctl_dot(a, b, inner);
+			} else {
+				const float *ak = a;
+
+				for (uint16_t k = 0; k < inner; k++) {
+					sum += *ak * *b;
+					ak += csa;
+					b += rsb;
+				}
+			}
+			c[j] = update(sum, c[j], op->alpha, op->beta);
+		}
+	}
+}
+
+/*
+ * Copy kc rows and nr columns of op(B) into a panel of NR floats per row, zero padded
+ */
+static void pack_b(const float B[], size_t rsb, size_t csb, uint16_t kc, uint16_t nr, float Bp[])
+{
+	for (uint16_t k = 0; k < kc; k++) {
+		uint16_t j = 0;
+
+		for (; j < nr; j++)
+			Bp[j] = B[j * csb];
+		for (; j < NR; j++)
+			Bp[j] = 0.0f;
+		B += rsb;
+		Bp += NR;
+	}
+}
+
+/*
+ * C[MR*NR] = alpha * A[MR*kc] * Bp[kc*NR] + beta * C, the whole tile is kept in registers.
+ * Rows of A are rsa apart and its columns csa apart, so a transposed A is read in place.
+ */
+static void kernel(uint16_t kc, const float A[], size_t rsa, size_t csa, const float Bp[],
+		   float C[], size_t ldc, float alpha, float beta)
+{
+	const float *a0 = A;
+	const float *a1 = a0 + rsa;
+	const float *a2 = a1 + rsa;
+	const float *a3 = a2 + rsa;
+	vfloat c00 = vzero(), c01 = vzero();
+	vfloat c10 = vzero(), c11 = vzero();
+	vfloat c20 = vzero(), c21 = vzero();
+	vfloat c30 = vzero(), c31 = vzero();
+	size_t o = 0;
+
+	for (uint16_t k = 0; k < kc; k++) {
+		vfloat b0 = vload(Bp);
+		vfloat b1 = vload(Bp + VLEN);
+		vfloat a;
+
+		a = vdup(a0[o]);
+		c00 = vfma(c00, a, b0);
+		c01 = vfma(c01, a, b1);
+		a = vdup(a1[o]);
+		c10 = vfma(c10, a, b0);
+		c11 = vfma(c11, a, b1);
+		a = vdup(a2[o]);
+		c20 = vfma(c20, a, b0);
+		c21 = vfma(c21, a, b1);
+		a = vdup(a3[o]);
+		c30 = vfma(c30, a, b0);
+		c31 = vfma(c31, a, b1);
+		Bp += NR;
+		o += csa;
+	}
+
+	vstore(C, vupdate(c00, C, alpha, beta));
+	vstore(C + VLEN, vupdate(c01, C + VLEN, alpha, beta));
+	C += ldc;
+	vstore(C, vupdate(c10, C, alpha, beta));
+	vstore(C + VLEN, vupdate(c11, C + VLEN, alpha, beta));
+	C += ldc;
+	vstore(C, vupdate(c20, C, alpha, beta));
+	vstore(C + VLEN, vupdate(c21, C + VLEN, alpha, beta));
+	C += ldc;
+	vstore(C, vupdate(c30, C, alpha, beta));
+	vstore(C + VLEN, vupdate(c31, C + VLEN, alpha, beta));
+}
+
+/*
+ * C[NR] = alpha * A[kc] * Bp[kc*NR] + beta * C for the rows left over below the last full tile
+ */
+static void kernel_row(uint16_t kc, const float A[], size_t csa, const float Bp[], float C[],
+		       float alpha, float beta)
+{
+	vfloat c0 = vzero();
+	vfloat c1 = vzero();
+	size_t o = 0;
+
+	for (uint16_t k = 0; k < kc; k++) {
+		vfloat a = vdup(A[o]);
+
+		c0 = vfma(c0, a, vload(Bp));
+		c1 = vfma(c1, a, vload(Bp + VLEN));
+		Bp += NR;
+		o += csa;
+	}
+
+	vstore(C, vupdate(c0, C, alpha, beta));
+	vstore(C + VLEN, vupdate(c1, C + VLEN, alpha, beta));
+}
+
+/*
+ * Blocked product. op(B) is packed KC*NR at a time and that panel stays in L1 cache while
+ * the micro kernel sweeps down all rows of op(A). The last panel column and the rows below
+ * the last full tile go through a small buffer so nothing outside C is written.
+ */
+static void gemm_blocked(const struct gemm_operands *op, float C[], uint16_t row_c,
+			 uint16_t column_c, uint16_t inner)
+{
+	const size_t rsa = op->row_stride_a;
+	const size_t csa = op->column_stride_a;
+	const size_t ldc = op->row_stride_c;
+	const float alpha = op->alpha;
+	float Bp[KC * NR];
+	float T[MR * NR];
+
+	for (uint32_t jr = 0; jr < column_c; jr += NR) {
+		uint16_t nr = column_c - jr < NR ? column_c - jr : NR;
+
+		for (uint32_t pc = 0; pc < inner; pc += KC) {
+			uint16_t kc = inner - pc < KC ? inner - pc : KC;
+			// Later panels add to what the first one stored
+			float beta = pc > 0 ? 1.0f : op->beta;
+			uint32_t i = 0;
+
+			pack_b(&op->B[pc * op->row_stride_b + jr * op->column_stride_b],
+			       op->row_stride_b, op->column_stride_b, kc, nr, Bp);
+
+			for (; i + MR <= row_c; i += MR) {
+				const float *a = &op->A[i * rsa + pc * csa];
+				float *c = &C[i * ldc + jr];
+
+				if (nr == NR) {
+					kernel(kc, a, rsa, csa, Bp, c, ldc, alpha, beta);
+					continue;
+				}
+				kernel(kc, a, rsa, csa, Bp, T, NR, 1.0f, 0.0f);
+				for (uint16_t r = 0; r < MR; r++) {
+					float *cr = &c[r * ldc];
+
+					for (uint16_t j = 0; j < nr; j++)
+						cr[j] = update(T[r * NR + j], cr[j], alpha, beta);
+				}
+			}
+
+			for (; i < row_c; i++) {
+				const float *a = &op->A[i * rsa + pc * csa];
+				float *c = &C[i * ldc + jr];
+
+				if (nr == NR) {
+					kernel_row(kc, a, csa, Bp, c, alpha, beta);
+					continue;
+				}
+				kernel_row(kc, a, csa, Bp, T, 1.0f, 0.0f);
+				for (uint16_t j = 0; j < nr; j++)
+					c[j] = update(T[j], c[j], alpha, beta);
+			}
+		}
+	}
+}
+
+/*
+ * op(A)*X = B for the rows first ... first + size - 1 of X, which only depend on each other
+ * once the rest of B is updated. Whole rows of B are subtracted, so they are contiguous.
+ */
+static void solve_rows(const float T[], size_t rst, size_t cst, bool backward, float B[],
+		       uint16_t first, uint16_t size, uint16_t column)
+{
+	for (uint16_t s = 0; s < size; s++) {
+		uint16_t i = backward ? first + size - 1 - s : first + s;
+		uint16_t k = backward ? i + 1 : first;
+		uint16_t end = backward ? first + size : i;
+		float *Bi = &B[(size_t)i * column];
+
+		for (; k < end; k++) {
+			float t = T[i * rst + k * cst];
+			const float *Bk = &B[(size_t)k * column];
+
+			if (t == 0)
+				continue;
+			for (uint16_t j = 0; j < column; j++)
+				Bi[j] -= t * Bk[j];
+		}
+		for (uint16_t j = 0; j < column; j++)
+			Bi[j] /= T[i * rst + i * cst];
+	}
+}
+
+/*
+ * X*op(A) = B for the columns first ... first + size - 1 of X, one row of B at a time.
+ * Every solved element is subtracted from the elements of its row that follow it.
+ */
+static void solve_columns(const float T[], size_t rst, size_t cst, bool backward, float B[],
+			  uint16_t first, uint16_t size, uint16_t row, uint16_t column)
+{
+	for (uint16_t r = 0; r < row; r++) {
+		float *x = &B[(size_t)r * column];
+
+		for (uint16_t s = 0; s < size; s++) {
+			uint16_t j = backward ? first + size - 1 - s : first + s;
+			uint16_t k = backward ? first : j + 1;
+			uint16_t end = backward ? j : first + size;
+
+			x[j] /= T[j * rst + j * cst];
+			for (; k < end; k++)
+				x[k] -= x[j] * T[j * rst + k * cst];
 		}
 	}
 }
@@ -52,3 +705,18 @@ void mul(float A[], float B[], float C[], uint16_t row_a, uint16_t column_a, uin
 	>>
  *
  */
+
+/*
+ * GNU Octave code:
+ *  >> A = [4 23; 2  5];
+	>> B = [1 2; 3 4];
+	>> C = [1 0; 0 1];
+	>> C = 2*A'*B + C
+	C =
+
+	    21    32
+	    76   133
+
+	>>
+ *
+ */
@@ -18,6 +18,30 @@
  */
 float norm(float A[], uint16_t row, uint16_t column, uint8_t l)
 {
+	CTL_WORKSPACE_ON_STACK(ws, norm_workspace_size(row, column, l));
+
+	return norm_ws(A, row, column, l, &ws);
+}
+
+size_t norm_workspace_size(uint16_t row, uint16_t column, uint8_t l)
+{
+	if (l != 2 || row == 1)
+		return 0;
+
+	return CTL_WORKSPACE_FLOATS(row * column) + CTL_WORKSPACE_FLOATS(column) +
+	       CTL_WORKSPACE_FLOATS(column * column) +
+	       svd_golub_reinsch_workspace_size(row, column);
+}
+
+/*
+ * Same as norm, with the SVD matrices of the L2-norm taken from the workspace
+ * Returns 0 when the workspace is too small
+ */
+float norm_ws(float A[], uint16_t row, uint16_t column, uint8_t l, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < norm_workspace_size(row, column, l))
+		return 0;
+
 	if (l == 1) {
 		// Vector
 		if (row == 1) {
@@ -54,19 +78,21 @@ float norm(float A[], uint16_t row, uint16_t column, uint8_t l)
 			return sqrtf(sqrt_sum);
 		}
 		// Matrix
-		float U[row * column];
-		float S[column];
-		float V[column * column];
+		size_t mark = ctl_workspace_mark(ws);
+		float *U = ctl_workspace_floats(ws, row * column);
+		float *S = ctl_workspace_floats(ws, column);
+		float *V = ctl_workspace_floats(ws, column * column);
 
 		if (row == column)
 			svd_jacobi_one_sided(A, row, MAX_ITERATION_COUNT_SVD, U, S, V);
 		else
-			svd_golub_reinsch(A, row, column, U, S, V);
+			svd_golub_reinsch_ws(A, row, column, U, S, V, ws);
 		float max_singular_value = 0;
 
 		for (uint16_t i = 0; i < column; i++)
 			if (S[i] > max_singular_value)
 				max_singular_value = S[i];
+		ctl_workspace_release(ws, mark);
 		return max_singular_value;
 	}
 	return 0;
@@ -18,28 +18,51 @@
  */
 void pinv(float A[], uint16_t row, uint16_t column)
 {
+	CTL_WORKSPACE_ON_STACK(ws, pinv_workspace_size(row, column));
+
+	pinv_ws(A, row, column, &ws);
+}
+
+size_t pinv_workspace_size(uint16_t row, uint16_t column)
+{
+	return CTL_WORKSPACE_FLOATS(row * column) + CTL_WORKSPACE_FLOATS(column) +
+	       CTL_WORKSPACE_FLOATS(column * column) +
+	       svd_golub_reinsch_workspace_size(row, column);
+}
+
+/*
+ * Same as pinv, with U, S and V taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t pinv_ws(float A[], uint16_t row, uint16_t column, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < pinv_workspace_size(row, column))
+		return 0;
+
 	// Use Golub and Reinch if row != column
-	float U[row * column];
-	float S[column];
-	float V[column * column];
+	size_t mark = ctl_workspace_mark(ws);
+	float *U = ctl_workspace_floats(ws, row * column);
+	float *S = ctl_workspace_floats(ws, column);
+	float *V = ctl_workspace_floats(ws, column * column);
 
 	if (row == column)
 		svd_jacobi_one_sided(A, row, MAX_ITERATION_COUNT_SVD, U, S, V);
 	else
-		svd_golub_reinsch(A, row, column, U, S, V);
+		svd_golub_reinsch_ws(A, row, column, U, S, V, ws);
 
 	// Do inv(S)
 	for (uint16_t i = 0; i < column; i++)
 		S[i] = 1.0 / S[i]; // Create inverse diagonal matrix
 
-	// Transpose U'
-	tran(U, row, column);
-
-	// U = S*U'
+	// U = U*S, which is S*U' once transposed
 	for (uint16_t i = 0; i < row; i++)
 		for (uint16_t j = 0; j < column; j++)
-			U[row * j + i] = S[j] * U[row * j + i];
+			U[column * i + j] = S[j] * U[column * i + j];
+
+	// Do pinv now: A = V*U', U' is read in place
+	gemm(false, true, 1.0f, V, U, 0.0f, A, column, row, column);
 
-	// Do pinv now: A = V*U
-	mul(V, U, A, column, column, row);
+	ctl_workspace_release(ws, mark);
+	return 1;
 }
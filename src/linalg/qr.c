@@ -17,80 +17,243 @@
  * A [m*n]
  * Q [m*m]
  * R [m*n]
+ * A is left untouched. Q is not used when only_compute_R is true.
  *
  * Returns 1 == Success
  * Returns 0 == Fail
  */
 uint8_t qr(float *A, float *Q, float *R, uint16_t row_a, uint16_t column_a, bool only_compute_R)
 {
-	// Declare
-	uint16_t row_a_row_a = row_a * row_a;
-	uint16_t l = row_a - 1 < column_a ? row_a - 1 : column_a;
-	float s, Rk, r, W[row_a], WW[row_a_row_a], Hi[row_a_row_a], H[row_a_row_a],
-		HiH[row_a_row_a], HiR[row_a * column_a];
+	CTL_WORKSPACE_ON_STACK(ws, qr_workspace_size(row_a, column_a, only_compute_R));
 
-	// Give A to R
+	return qr_ws(A, Q, R, row_a, column_a, only_compute_R, &ws);
+}
+
+size_t qr_workspace_size(uint16_t row_a, uint16_t column_a, bool only_compute_R)
+{
+	size_t tau = CTL_WORKSPACE_FLOATS(row_a < column_a ? row_a : column_a);
+	size_t nested = qr_factor_workspace_size(row_a, column_a);
+
+	if (!only_compute_R)
+		nested = ctl_workspace_max(nested, qr_q_workspace_size(row_a));
+	return tau + nested;
+}
+
+/*
+ * Same as qr, with tau and the reflector scratch taken from the workspace
+ * Returns 0 also when the workspace is too small
+ */
+uint8_t qr_ws(float *A, float *Q, float *R, uint16_t row_a, uint16_t column_a, bool only_compute_R,
+	      struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < qr_workspace_size(row_a, column_a, only_compute_R))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	float *tau = ctl_workspace_floats(ws, row_a < column_a ? row_a : column_a);
+
+	// Give A to R and factor it in place
 	memcpy(R, A, row_a * column_a * sizeof(float));
+	qr_factor_ws(R, tau, row_a, column_a, ws);
+
+	// Q is accumulated from the reflectors before they are cleared out of R
+	if (!only_compute_R)
+		qr_q_ws(R, tau, Q, row_a, column_a, ws);
+
+	for (uint16_t i = 1; i < row_a; i++)
+		for (uint16_t j = 0; j < i && j < column_a; j++)
+			R[i * column_a + j] = 0.0f;
 
-	// Turn H into identity matrix
-	memset(H, 0, row_a_row_a * sizeof(float));
-	for (uint16_t i = 0; i < row_a; i++)
-		H[row_a * i + i] = 1.0f;
+	ctl_workspace_release(ws, mark);
+	return 1;
+}
+
+/*
+ * In-place Householder QR-decomposition
+ * A [m*n] is overwritten with R on and above the diagonal. Below the diagonal, column k holds
+ * the Householder vector v of step k without its leading 1, so that H_k = I - tau[k]*v*v'.
+ * tau [min(m, n)]
+ * Q = H_0*H_1*...*H_(min(m - 1, n) - 1), use qr_q to form it or qr_apply_qt to apply Q'.
+ * Every reflector is applied to the rest of A as a rank one update, O(m*n^2) in total.
+ */
+void qr_factor(float A[], float tau[], uint16_t row, uint16_t column)
+{
+	CTL_WORKSPACE_ON_STACK(ws, qr_factor_workspace_size(row, column));
+
+	qr_factor_ws(A, tau, row, column, &ws);
+}
+
+size_t qr_factor_workspace_size(uint16_t row, uint16_t column)
+{
+	(void)row;
+	return CTL_WORKSPACE_FLOATS(column);
+}
+
+/*
+ * Same as qr_factor, with the row vector of the rank one update taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t qr_factor_ws(float A[], float tau[], uint16_t row, uint16_t column,
+		     struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < qr_factor_workspace_size(row, column))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	float *w = ctl_workspace_floats(ws, column);
+	uint16_t l = row < column ? row : column;
 
-	// Do house holder transformations
 	for (uint16_t k = 0; k < l; k++) {
-		// Do L2 norm
-		s = 0;
-		for (uint16_t i = k; i < row_a; i++)
-			s += R[i * column_a + k] * R[i * column_a + k];
+		float *Ak = &A[k * column + k];
+		float alpha = *Ak;
+		float s = alpha * alpha;
+
+		// The last row has nothing below the diagonal to eliminate
+		if (k == row - 1) {
+			tau[k] = 0.0f;
+			continue;
+		}
+
+		for (uint16_t i = k + 1; i < row; i++)
+			s += A[i * column + k] * A[i * column + k];
 		s = sqrtf(s);
+		if (s == 0.0f) {
+			tau[k] = 0.0f;
+			continue;
+		}
 
-		// Find Rk
-		Rk = R[k * column_a + k];
+		// R(k, k) = beta gets the opposite sign of alpha, so alpha - beta does not cancel
+		float beta = alpha < 0.0f ? s : -s;
+		float scale = 1.0f / (alpha - beta);
 
-		// Do sign
-		if (Rk < 0.0f)
-			s = -s;
+		tau[k] = (beta - alpha) / beta;
+		*Ak = beta;
+		for (uint16_t i = k + 1; i < row; i++)
+			A[i * column + k] *= scale;
 
-		// Compute r
-		r = sqrtf(2 * s * (Rk + s));
+		// w = v'*A(k:m, k+1:n), then A(k:m, k+1:n) -= tau*v*w
+		uint16_t n = column - k - 1;
 
-		// Fill W
-		memset(W, 0, row_a * sizeof(float));
-		W[k] = (Rk + s) / r;
-		for (uint16_t i = k + 1; i < row_a; i++)
-			W[i] = R[i * column_a + k] / r;
+		memcpy(w, Ak + 1, n * sizeof(float));
+		for (uint16_t i = k + 1; i < row; i++) {
+			const float *a = &A[i * column + k];
+			float v = a[0];
 
-		// WW = W*W'
-		mul(W, W, WW, row_a, 1, row_a);
+			for (uint16_t j = 0; j < n; j++)
+				w[j] += v * a[j + 1];
+		}
+		for (uint16_t j = 0; j < n; j++)
+			w[j] *= tau[k];
+		for (uint16_t j = 0; j < n; j++)
+			Ak[j + 1] -= w[j];
+		for (uint16_t i = k + 1; i < row; i++) {
+			float *a = &A[i * column + k];
+			float v = a[0];
 
-		// Fill Hi matrix
-		for (uint16_t i = 0; i < row_a_row_a; i++)
-			Hi[i] = -2.0f * WW[i];
+			for (uint16_t j = 0; j < n; j++)
+				a[j + 1] -= v * w[j];
+		}
+	}
 
-		// Use identity matrix on Hi
-		for (uint16_t i = 0; i < row_a; i++)
-			Hi[i * row_a + i] += 1.0f;
+	ctl_workspace_release(ws, mark);
+	return 1;
+}
 
-		// HiH = Hi * H -> HiH = H
-		if (!only_compute_R) {
-			mul(Hi, H, HiH, row_a, row_a, row_a);
-			memcpy(H, HiH, row_a_row_a * sizeof(float));
+/*
+ * Form Q [m*m] from the reflectors that qr_factor left in QR [m*n] and tau
+ * The reflectors are applied backwards to the identity matrix, so step k only touches
+ * the trailing (m - k)*(m - k) block of Q.
+ */
+void qr_q(const float QR[], const float tau[], float Q[], uint16_t row, uint16_t column)
+{
+	CTL_WORKSPACE_ON_STACK(ws, qr_q_workspace_size(row));
+
+	qr_q_ws(QR, tau, Q, row, column, &ws);
+}
+
+size_t qr_q_workspace_size(uint16_t row)
+{
+	return CTL_WORKSPACE_FLOATS(row);
+}
+
+/*
+ * Same as qr_q, with the row vector of the rank one update taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t qr_q_ws(const float QR[], const float tau[], float Q[], uint16_t row, uint16_t column,
+		struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < qr_q_workspace_size(row))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	float *w = ctl_workspace_floats(ws, row);
+	uint16_t l = row < column ? row : column;
+
+	memset(Q, 0, row * row * sizeof(float));
+	for (uint16_t i = 0; i < row; i++)
+		Q[i * row + i] = 1.0f;
+
+	for (uint16_t k = l; k-- > 0;) {
+		if (tau[k] == 0.0f)
+			continue;
+
+		// w = v'*Q(k:m, k:m), then Q(k:m, k:m) -= tau*v*w
+		uint16_t n = row - k;
+		float *Qk = &Q[k * row + k];
+
+		memcpy(w, Qk, n * sizeof(float));
+		for (uint16_t i = k + 1; i < row; i++) {
+			const float *q = &Q[i * row + k];
+			float v = QR[i * column + k];
+
+			for (uint16_t j = 0; j < n; j++)
+				w[j] += v * q[j];
 		}
+		for (uint16_t j = 0; j < n; j++)
+			w[j] *= tau[k];
+		for (uint16_t j = 0; j < n; j++)
+			Qk[j] -= w[j];
+		for (uint16_t i = k + 1; i < row; i++) {
+			float *q = &Q[i * row + k];
+			float v = QR[i * column + k];
 
-		// HiR = Hi * R -> HiR = R
-		mul(Hi, R, HiR, row_a, row_a, column_a);
-		memcpy(R, HiR, row_a * column_a * sizeof(float));
+			for (uint16_t j = 0; j < n; j++)
+				q[j] -= v * w[j];
+		}
 	}
 
-	// Do inverse on H and give it to Q
-	uint8_t status = 1;
+	ctl_workspace_release(ws, mark);
+	return 1;
+}
+
+/*
+ * B = Q'*B with the reflectors that qr_factor left in QR [m*n] and tau, without forming Q
+ * B [m*p]
+ */
+void qr_apply_qt(const float QR[], const float tau[], float B[], uint16_t row, uint16_t column,
+		 uint16_t column_b)
+{
+	uint16_t l = row < column ? row : column;
+
+	for (uint16_t k = 0; k < l; k++) {
+		if (tau[k] == 0.0f)
+			continue;
+
+		// B(k:m, :) -= tau*v*(v'*B(k:m, :)), one column of B at a time
+		for (uint16_t j = 0; j < column_b; j++) {
+			float sum = B[k * column_b + j];
 
-	if (!only_compute_R) {
-		status = inv(H, row_a);
-		memcpy(Q, H, row_a_row_a * sizeof(float));
+			for (uint16_t i = k + 1; i < row; i++)
+				sum += QR[i * column + k] * B[i * column_b + j];
+			sum *= tau[k];
+			B[k * column_b + j] -= sum;
+			for (uint16_t i = k + 1; i < row; i++)
+				B[i * column_b + j] -= sum * QR[i * column + k];
+		}
 	}
-	return status;
 }
 
 /*
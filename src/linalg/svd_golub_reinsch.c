@@ -61,16 +61,42 @@ static void Sort_by_Decreasing_Singular_Values(uint16_t nrows, uint16_t ncols,
  */
 uint8_t svd_golub_reinsch(float A[], uint16_t row, uint16_t column, float U[], float S[], float V[])
 {
-	float dummy_array[column];
+	CTL_WORKSPACE_ON_STACK(ws, svd_golub_reinsch_workspace_size(row, column));
+
+	return svd_golub_reinsch_ws(A, row, column, U, S, V, &ws);
+}
+
+size_t svd_golub_reinsch_workspace_size(uint16_t row, uint16_t column)
+{
+	(void)row;
+	return CTL_WORKSPACE_FLOATS(column);
+}
+
+/*
+ * Same as svd_golub_reinsch, with the superdiagonal taken from the workspace
+ * Return 0 also when the workspace is too small
+ */
+uint8_t svd_golub_reinsch_ws(float A[], uint16_t row, uint16_t column, float U[], float S[],
+			     float V[], struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < svd_golub_reinsch_workspace_size(row, column))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	float *dummy_array = ctl_workspace_floats(ws, column);
+	uint8_t status = 0;
 
 	Householders_Reduction_to_Bidiagonal_Form(A, row, column, U, V, S, dummy_array);
 
 	if (Givens_Reduction_to_Diagonal_Form(row, column, U, V, S, dummy_array) < 0)
-		return 0; // Fail
+		goto out; // Fail
 
 	Sort_by_Decreasing_Singular_Values(row, column, S, U, V);
+	status = 1; // Solved
 
-	return 1; // Solved
+out:
+	ctl_workspace_release(ws, mark);
+	return status;
 }
 
 static void Householders_Reduction_to_Bidiagonal_Form(float *A, uint16_t nrows, uint16_t ncols,
@@ -7,29 +7,52 @@
  * Training: https://swedishembedded.com/training
  */
 
-#include <string.h>
 #include <control/linalg.h>
 
 /*
  * Turn A into transponse A^T
+ * This is done in place without a temporary matrix. Element p = i*column + j moves to
+ * j*row + i, which is p*row modulo row*column - 1. Those moves form cycles and every cycle
+ * is rotated once, starting from its smallest index.
  */
 void tran(float A[], uint16_t row, uint16_t column)
 {
-	float B[row * column];
-	float *transpose;
-	float *ptr_A = A;
-
-	for (uint16_t i = 0; i < row; i++) {
-		transpose = &B[i];
-		for (uint16_t j = 0; j < column; j++) {
-			*transpose = *ptr_A;
-			ptr_A++;
-			transpose += row;
+	const uint32_t last = (uint32_t)row * column - 1;
+
+	if (row == column) {
+		for (uint16_t i = 0; i < row; i++) {
+			for (uint16_t j = i + 1; j < column; j++) {
+				float temp = A[(size_t)i * column + j];
+
+				A[(size_t)i * column + j] = A[(size_t)j * column + i];
+				A[(size_t)j * column + i] = temp;
+			}
 		}
+		return;
 	}
+	if (row <= 1 || column <= 1)
+		return; // A vector is stored the same way transposed
+
+	for (uint32_t start = 1; start < last; start++) {
+		uint32_t p = (uint64_t)start * row % last;
+
+		// Only the smallest index of a cycle rotates it
+		while (p > start)
+			p = (uint64_t)p * row % last;
+		if (p < start)
+			continue;
 
-	// Copy!
-	memcpy(A, B, row * column * sizeof(float));
+		float moving = A[start];
+
+		p = start;
+		do {
+			p = (uint64_t)p * row % last;
+			float temp = A[p];
+
+			A[p] = moving;
+			moving = temp;
+		} while (p != start);
+	}
 }
 
 /*
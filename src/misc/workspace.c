@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Copyright 2022 Martin Schröder <info@swedishembedded.com>
+ * Consulting: https://swedishembedded.com/consulting
+ * Simulation: https://swedishembedded.com/simulation
+ * Training: https://swedishembedded.com/training
+ */
+
+#include <control/workspace.h>
+
+/*
+ * Hand the buffer over to the workspace. The start is aligned to CTL_WORKSPACE_ALIGN,
+ * which may cost up to CTL_WORKSPACE_ALIGN - 1 bytes of the buffer.
+ */
+void ctl_workspace_init(struct ctl_workspace *ws, void *buffer, size_t size)
+{
+	uintptr_t address = (uintptr_t)buffer;
+	size_t skip = CTL_WORKSPACE_BYTES(address) - address;
+
+	if (skip > size)
+		skip = size;
+
+	ws->buffer = (uint8_t *)buffer + skip;
+	ws->size = size - skip;
+	ws->used = 0;
+	ws->peak = 0;
+}
+
+/*
+ * Take bytes from the workspace
+ * Returns NULL if the workspace is too small
+ */
+void *ctl_workspace_alloc(struct ctl_workspace *ws, size_t bytes)
+{
+	size_t length = CTL_WORKSPACE_BYTES(bytes);
+	void *memory;
+
+	if (length > ws->size - ws->used)
+		return NULL;
+
+	memory = ws->buffer + ws->used;
+	ws->used += length;
+	if (ws->used > ws->peak)
+		ws->peak = ws->used;
+
+	return memory;
+}
+
+float *ctl_workspace_floats(struct ctl_workspace *ws, size_t count)
+{
+	return ctl_workspace_alloc(ws, count * sizeof(float));
+}
+
+size_t ctl_workspace_available(const struct ctl_workspace *ws)
+{
+	return ws->size - ws->used;
+}
+
+/*
+ * Remember the current allocation level, release everything allocated after it
+ * with ctl_workspace_release
+ */
+size_t ctl_workspace_mark(const struct ctl_workspace *ws)
+{
+	return ws->used;
+}
+
+void ctl_workspace_release(struct ctl_workspace *ws, size_t mark)
+{
+	if (mark < ws->used)
+		ws->used = mark;
+}
@@ -15,7 +15,7 @@
 #include <control/linalg.h>
 
 static void opti(float c[], float A[], float b[], float x[], uint8_t row_a, uint8_t column_a,
-		 uint8_t max_or_min, uint8_t iteration_limit);
+		 uint8_t max_or_min, uint8_t iteration_limit, struct ctl_workspace *ws);
 
 /**
  * This is linear programming with simplex method.
@@ -51,19 +51,43 @@ static void opti(float c[], float A[], float b[], float x[], uint8_t row_a, uint
 void linprog(float c[], float A[], float b[], float x[], uint8_t row_a, uint8_t column_a,
 	     uint8_t max_or_min, uint8_t iteration_limit)
 {
+	CTL_WORKSPACE_ON_STACK(ws, linprog_workspace_size(row_a, column_a, max_or_min));
+
+	linprog_ws(c, A, b, x, row_a, column_a, max_or_min, iteration_limit, &ws);
+}
+
+size_t linprog_workspace_size(uint8_t row_a, uint8_t column_a, uint8_t max_or_min)
+{
+	uint16_t rows = (max_or_min == 0 ? row_a : column_a) + 1;
+
+	return CTL_WORKSPACE_FLOATS(rows * (column_a + row_a + 2));
+}
+
+/*
+ * Same as linprog, with the tableau taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t linprog_ws(float c[], float A[], float b[], float x[], uint8_t row_a, uint8_t column_a,
+		   uint8_t max_or_min, uint8_t iteration_limit, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < linprog_workspace_size(row_a, column_a, max_or_min))
+		return 0;
+
 	if (max_or_min == 0) {
 		// Maximization
-		opti(c, A, b, x, row_a, column_a, max_or_min, iteration_limit);
+		opti(c, A, b, x, row_a, column_a, max_or_min, iteration_limit, ws);
 	} else {
 		// Minimization
 		tran(A, row_a, column_a);
 
-		opti(b, A, c, x, column_a, row_a, max_or_min, iteration_limit);
+		opti(b, A, c, x, column_a, row_a, max_or_min, iteration_limit, ws);
 	}
+	return 1;
 }
 // This is Simplex method with the Dual included
 static void opti(float c[], float A[], float b[], float x[], uint8_t row_a, uint8_t column_a,
-		 uint8_t max_or_min, uint8_t iteration_limit)
+		 uint8_t max_or_min, uint8_t iteration_limit, struct ctl_workspace *ws)
 {
 	// Clear the solution
 	if (max_or_min == 0)
@@ -72,9 +96,9 @@ static void opti(float c[], float A[], float b[], float x[], uint8_t row_a, uint
 		memset(x, 0, row_a * sizeof(float));
 
 	// Create the tableau with space for the slack variables s and p as well
-	float tableau[(row_a + 1) *
-		      (column_a + row_a +
-		       2)]; // +1 because the extra row for objective function and +2 for the b vector and slackvariable for objective function
+	// +1 because the extra row for objective function and +2 for the b vector and slackvariable for objective function
+	size_t mark = ctl_workspace_mark(ws);
+	float *tableau = ctl_workspace_floats(ws, (row_a + 1) * (column_a + row_a + 2));
 
 	memset(tableau, 0, (row_a + 1) * (column_a + row_a + 2) * sizeof(float));
 
@@ -213,4 +237,6 @@ static void opti(float c[], float A[], float b[], float x[], uint8_t row_a, uint
 				       column_a]; // We take only the bottom row at start index column_a
 		}
 	}
+
+	ctl_workspace_release(ws, mark);
 }
@@ -0,0 +1,514 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Copyright 2022 Martin Schröder <info@swedishembedded.com>
+ * Consulting: https://swedishembedded.com/consulting
+ * Simulation: https://swedishembedded.com/simulation
+ * Training: https://swedishembedded.com/training
+ */
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include <control/optimization.h>
+#include <control/linalg.h>
+
+// A constraint counts as violated when its slack is below -QP_TOLERANCE * (1 + |bound|)
+#define QP_TOLERANCE 1e-5f
+
+/*
+ * The constraints of one problem. They are numbered A*x <= b first, then x <= ub and
+ * last lb <= x, and every one of them is handled as n'*x >= bound internally.
+ */
+struct qp_problem {
+	const float *A;
+	const float *b;
+	const float *lb;
+	const float *ub;
+	uint16_t m;
+	uint16_t n;
+};
+
+static bool exists(const struct qp_problem *p, uint16_t index);
+static float slack(const struct qp_problem *p, const float x[], uint16_t index, float *bound);
+static void normal(const struct qp_problem *p, uint16_t index, float np[]);
+static float direction(const float J[], const float R[], const float np[], float d[], float z[],
+		       float r[], uint16_t n, uint16_t q);
+static bool add_constraint(float R[], float J[], float d[], uint16_t n, uint16_t q, float *R_norm);
+static void drop_constraint(float R[], float J[], uint16_t active[], float u[], uint16_t n,
+			    uint16_t q, uint16_t l);
+
+/*
+ * Quadratic programming with the dual active set method of Goldfarb and Idnani
+ * Min 0.5*x'*H*x + f'*x
+ * S.t A*x <= b
+ *     lb <= x <= ub
+ *
+ * H [n*n] // Symmetric positive definite Hessian
+ * f [n]
+ * A [m*n] // Can be NULL when m == 0
+ * b [m]
+ * lb [n] // Lower bounds, NULL for none
+ * ub [n] // Upper bounds, NULL for none
+ * x [n] // Solution
+ * Returns 1 == Success
+ * Returns 0 == Fail, H is not positive definite, the problem is infeasible or the
+ * iteration limit was hit
+ *
+ * Source: D. Goldfarb, A. Idnani, A numerically stable dual method for solving strictly
+ * convex quadratic programs, Mathematical Programming 27, 1983
+ */
+uint8_t quadprog(float H[], float f[], float A[], float b[], float lb[], float ub[], float x[],
+		 uint16_t m, uint16_t n, uint16_t iteration_limit)
+{
+	CTL_WORKSPACE_ON_STACK(ws, quadprog_workspace_size(m, n));
+
+	return quadprog_ws(H, f, A, b, lb, ub, x, m, n, iteration_limit, &ws);
+}
+
+size_t quadprog_workspace_size(uint16_t m, uint16_t n)
+{
+	return qp_init_workspace_size(n) + qp_solve_workspace_size(m, n);
+}
+
+/*
+ * Same as quadprog, with the factorization and the active set taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or quadprog failed
+ */
+uint8_t quadprog_ws(float H[], float f[], float A[], float b[], float lb[], float ub[],
+		    float x[], uint16_t m, uint16_t n, uint16_t iteration_limit,
+		    struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < quadprog_workspace_size(m, n))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	struct qp_ctx ctx;
+	uint8_t status = qp_init(&ctx, H, n, ws);
+
+	if (status)
+		status = qp_solve(&ctx, f, A, b, lb, ub, x, m, iteration_limit, ws);
+
+	ctl_workspace_release(ws, mark);
+	return status;
+}
+
+size_t qp_init_workspace_size(uint16_t n)
+{
+	return 2 * CTL_WORKSPACE_FLOATS(n * n) + CTL_WORKSPACE_BYTES(n * sizeof(uint16_t));
+}
+
+/*
+ * Factorize the Hessian for repeated solves with the same H
+ * J = inv(L') where H = L*L' is kept in ctx together with the active set of the last
+ * solve, which is tried first by the next one. Both stay in the workspace, so it must
+ * not be released past this call while ctx is in use.
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or H is not positive definite
+ */
+uint8_t qp_init(struct qp_ctx *ctx, float H[], uint16_t n, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < qp_init_workspace_size(n))
+		return 0;
+
+	ctx->n = n;
+	ctx->active_count = 0;
+	ctx->iterations = 0;
+	ctx->J = ctl_workspace_floats(ws, n * n);
+	ctx->active = ctl_workspace_alloc(ws, n * sizeof(uint16_t));
+
+	size_t mark = ctl_workspace_mark(ws);
+	float *L = ctl_workspace_floats(ws, n * n);
+	uint8_t status;
+
+	memcpy(L, H, n * n * sizeof(float));
+	status = chol_factor(L, n);
+
+	// Solve L'*J = I, J is upper triangular
+	if (status) {
+		memset(ctx->J, 0, n * n * sizeof(float));
+		for (uint16_t i = 0; i < n; i++)
+			ctx->J[i * n + i] = 1.0f;
+		trsm(true, false, true, L, ctx->J, n, n);
+	}
+
+	ctl_workspace_release(ws, mark);
+	return status;
+}
+
+size_t qp_solve_workspace_size(uint16_t m, uint16_t n)
+{
+	uint32_t constraints = m + 2 * n;
+
+	return 2 * CTL_WORKSPACE_FLOATS(n * n) + 5 * CTL_WORKSPACE_FLOATS(n + 1) +
+	       CTL_WORKSPACE_BYTES((n + 1) * sizeof(uint16_t)) + CTL_WORKSPACE_BYTES(constraints);
+}
+
+/*
+ * Solve the problem of quadprog with the Hessian factorized by qp_init
+ * The solve is warm started from the active set of the previous one: those constraints
+ * are made active first, without searching for them, and when all their multipliers
+ * come out >= 0 the method goes on from there. Typically no other constraint is added
+ * when the problem only changes a little between the calls, as in MPC. Otherwise the
+ * solve starts over from the unconstrained minimum. Clear ctx->active_count when the
+ * layout of the constraints changes.
+ * ctx->iterations tells how many times the active set changed.
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small, the problem is infeasible or the
+ * iteration limit was hit. x then holds the last iterate.
+ */
+uint8_t qp_solve(struct qp_ctx *ctx, float f[], float A[], float b[], float lb[], float ub[],
+		 float x[], uint16_t m, uint16_t iteration_limit, struct ctl_workspace *ws)
+{
+	uint16_t n = ctx->n;
+
+	if (ctl_workspace_available(ws) < qp_solve_workspace_size(m, n))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	struct qp_problem p = { A, b, lb, ub, m, n };
+	uint32_t constraints = m + 2 * n;
+	float *J = ctl_workspace_floats(ws, n * n);
+	float *R = ctl_workspace_floats(ws, n * n);
+	float *d = ctl_workspace_floats(ws, n + 1);
+	float *z = ctl_workspace_floats(ws, n + 1);
+	float *r = ctl_workspace_floats(ws, n + 1);
+	float *u = ctl_workspace_floats(ws, n + 1);
+	float *np = ctl_workspace_floats(ws, n + 1);
+	uint16_t *active = ctl_workspace_alloc(ws, (n + 1) * sizeof(uint16_t));
+	uint8_t *is_active = ctl_workspace_alloc(ws, constraints);
+	bool warm = ctx->active_count > 0;
+	float R_norm;
+	uint16_t q;
+	uint8_t status = 0;
+
+	ctx->iterations = 0;
+
+	for (;;) {
+		R_norm = 1.0f;
+		q = 0;
+		memcpy(J, ctx->J, n * n * sizeof(float));
+		memset(is_active, 0, constraints);
+
+		// Unconstrained minimum x = -inv(H)*f = -J*J'*f
+		gemm(true, false, 1.0f, J, f, 0.0f, d, n, 1, n);
+		gemm(false, false, -1.0f, J, d, 0.0f, x, n, 1, n);
+		if (!warm)
+			break;
+
+		// Make the last active set active as if it were equality constraints
+		for (uint16_t w = 0; w < ctx->active_count; w++) {
+			uint16_t i = ctx->active[w];
+			float bound;
+
+			if (i >= constraints || !exists(&p, i) || is_active[i])
+				continue;
+
+			normal(&p, i, np);
+			float zn = direction(J, R, np, d, z, r, n, q);
+
+			if (fabsf(zn) <= FLT_EPSILON * R_norm)
+				continue;
+
+			float t = -slack(&p, x, i, &bound) / zn;
+
+			for (uint16_t k = 0; k < n; k++)
+				x[k] += t * z[k];
+			for (uint16_t k = 0; k < q; k++)
+				u[k] -= t * r[k];
+			if (!add_constraint(R, J, d, n, q, &R_norm))
+				continue;
+			active[q] = i;
+			u[q] = t;
+			is_active[i] = 1;
+			q++;
+			ctx->iterations++;
+		}
+
+		// That is only a valid start when all the multipliers are >= 0, else start cold
+		bool dual_feasible = true;
+
+		for (uint16_t k = 0; k < q; k++)
+			dual_feasible = dual_feasible && u[k] >= 0.0f;
+		if (dual_feasible)
+			break;
+		warm = false;
+	}
+
+	for (;;) {
+		// Pick the most violated constraint
+		int32_t add = -1;
+		float s = 0.0f, bound;
+
+		for (uint32_t i = 0; i < constraints; i++) {
+			if (is_active[i] || !exists(&p, i))
+				continue;
+
+			float t = slack(&p, x, i, &bound);
+
+			if (t < -QP_TOLERANCE * (1.0f + fabsf(bound)) && t < s) {
+				s = t;
+				add = i;
+			}
+		}
+
+		// All constraints hold
+		if (add < 0) {
+			status = 1;
+			break;
+		}
+		normal(&p, add, np);
+
+		// Multiplier of the constraint that is added
+		float u_add = 0.0f;
+		bool added = false;
+		bool failed = false;
+
+		while (!added) {
+			if (ctx->iterations >= iteration_limit) {
+				failed = true;
+				break;
+			}
+			ctx->iterations++;
+
+			// Step z in the primal space and r of the multipliers
+			float zn = direction(J, R, np, d, z, r, n, q);
+
+			// Partial step that drops constraint l from the active set
+			float t1 = INFINITY;
+			uint16_t l = 0;
+
+			for (uint16_t k = 0; k < q; k++) {
+				if (r[k] > 0.0f && u[k] / r[k] < t1) {
+					t1 = u[k] / r[k];
+					l = k;
+				}
+			}
+
+			// Full step that makes the constraint active
+			float t2 = INFINITY;
+
+			s = slack(&p, x, add, &bound);
+			if (fabsf(zn) > FLT_EPSILON * R_norm)
+				t2 = -s / zn;
+
+			if (isinf(t1) && isinf(t2)) {
+				// Infeasible
+				failed = true;
+				break;
+			}
+
+			float t = t1 < t2 ? t1 : t2;
+
+			for (uint16_t k = 0; k < q; k++)
+				u[k] -= t * r[k];
+			u_add += t;
+
+			if (!isinf(t2)) {
+				for (uint16_t i = 0; i < n; i++)
+					x[i] += t * z[i];
+			}
+
+			if (t2 <= t1) {
+				if (!add_constraint(R, J, d, n, q, &R_norm)) {
+					failed = true;
+					break;
+				}
+				active[q] = add;
+				u[q] = u_add;
+				is_active[add] = 1;
+				q++;
+				added = true;
+			} else {
+				is_active[active[l]] = 0;
+				drop_constraint(R, J, active, u, n, q, l);
+				q--;
+			}
+		}
+		if (failed)
+			break;
+	}
+
+	// Remember the active set for the next solve
+	memcpy(ctx->active, active, q * sizeof(uint16_t));
+	ctx->active_count = q;
+
+	ctl_workspace_release(ws, mark);
+	return status;
+}
+
+/*
+ * d = J'*np, the primal step z = J2*d2 and the step of the multipliers r = inv(R)*d1
+ * where J2, d2 are the last n - q columns and elements and d1 the first q elements
+ * Returns z'*np
+ */
+static float direction(const float J[], const float R[], const float np[], float d[], float z[],
+		       float r[], uint16_t n, uint16_t q)
+{
+	float zn = 0.0f;
+
+	gemm(true, false, 1.0f, J, np, 0.0f, d, n, 1, n);
+	for (uint16_t i = 0; i < n; i++) {
+		float t = 0.0f;
+
+		for (uint16_t j = q; j < n; j++)
+			t += J[i * n + j] * d[j];
+		z[i] = t;
+		zn += t * np[i];
+	}
+
+	for (int32_t i = q - 1; i >= 0; i--) {
+		float t = d[i];
+
+		for (uint16_t j = i + 1; j < q; j++)
+			t -= R[i * n + j] * r[j];
+		r[i] = t / R[i * n + i];
+	}
+
+	return zn;
+}
+
+static bool exists(const struct qp_problem *p, uint16_t index)
+{
+	if (index < p->m)
+		return true;
+	if (index < p->m + p->n)
+		return p->ub != NULL;
+	return p->lb != NULL;
+}
+
+/* n'*x - bound, which is >= 0 when the constraint holds */
+static float slack(const struct qp_problem *p, const float x[], uint16_t index, float *bound)
+{
+	if (index < p->m) {
+		float s = p->b[index];
+
+		for (uint16_t j = 0; j < p->n; j++)
+			s -= p->A[index * p->n + j] * x[j];
+		*bound = p->b[index];
+		return s;
+	}
+	if (index < p->m + p->n) {
+		index -= p->m;
+		*bound = p->ub[index];
+		return p->ub[index] - x[index];
+	}
+	index -= p->m + p->n;
+	*bound = p->lb[index];
+	return x[index] - p->lb[index];
+}
+
+static void normal(const struct qp_problem *p, uint16_t index, float np[])
+{
+	if (index < p->m) {
+		for (uint16_t j = 0; j < p->n; j++)
+			np[j] = -p->A[index * p->n + j];
+		return;
+	}
+	memset(np, 0, p->n * sizeof(float));
+	if (index < p->m + p->n)
+		np[index - p->m] = -1.0f;
+	else
+		np[index - p->m - p->n] = 1.0f;
+}
+
+/*
+ * Rotate d so that it only has q + 1 nonzero elements, with the same Givens rotations
+ * applied to the columns of J, and make it the new last column of R
+ * Returns false when the new constraint is linearly dependent on the active ones
+ */
+static bool add_constraint(float R[], float J[], float d[], uint16_t n, uint16_t q, float *R_norm)
+{
+	for (uint16_t j = n - 1; j > q; j--) {
+		float cc = d[j - 1];
+		float ss = d[j];
+		float h = hypotf(cc, ss);
+
+		if (h == 0.0f)
+			continue;
+		d[j] = 0.0f;
+		cc /= h;
+		ss /= h;
+		if (cc < 0.0f) {
+			cc = -cc;
+			ss = -ss;
+			d[j - 1] = -h;
+		} else {
+			d[j - 1] = h;
+		}
+
+		float xny = ss / (1.0f + cc);
+
+		for (uint16_t k = 0; k < n; k++) {
+			float t1 = J[k * n + j - 1];
+			float t2 = J[k * n + j];
+
+			J[k * n + j - 1] = t1 * cc + t2 * ss;
+			J[k * n + j] = xny * (t1 + J[k * n + j - 1]) - t2;
+		}
+	}
+
+	for (uint16_t i = 0; i <= q; i++)
+		R[i * n + q] = d[i];
+
+	if (fabsf(d[q]) <= FLT_EPSILON * *R_norm)
+		return false;
+	if (fabsf(d[q]) > *R_norm)
+		*R_norm = fabsf(d[q]);
+	return true;
+}
+
+/*
+ * Remove the constraint at position l of the active set and restore the triangular
+ * shape of R with Givens rotations, which are applied to the columns of J as well
+ */
+static void drop_constraint(float R[], float J[], uint16_t active[], float u[], uint16_t n,
+			    uint16_t q, uint16_t l)
+{
+	for (uint16_t i = l; i + 1 < q; i++) {
+		active[i] = active[i + 1];
+		u[i] = u[i + 1];
+		for (uint16_t j = 0; j < n; j++)
+			R[j * n + i] = R[j * n + i + 1];
+	}
+	for (uint16_t j = 0; j < n; j++)
+		R[j * n + q - 1] = 0.0f;
+	q--;
+
+	for (uint16_t j = l; j < q; j++) {
+		float cc = R[j * n + j];
+		float ss = R[(j + 1) * n + j];
+		float h = hypotf(cc, ss);
+
+		if (h == 0.0f)
+			continue;
+		cc /= h;
+		ss /= h;
+		R[(j + 1) * n + j] = 0.0f;
+		if (cc < 0.0f) {
+			R[j * n + j] = -h;
+			cc = -cc;
+			ss = -ss;
+		} else {
+			R[j * n + j] = h;
+		}
+
+		float xny = ss / (1.0f + cc);
+
+		for (uint16_t k = j + 1; k < q; k++) {
+			float t1 = R[j * n + k];
+			float t2 = R[(j + 1) * n + k];
+
+			R[j * n + k] = t1 * cc + t2 * ss;
+			R[(j + 1) * n + k] = xny * (t1 + R[j * n + k]) - t2;
+		}
+		for (uint16_t k = 0; k < n; k++) {
+			float t1 = J[k * n + j];
+			float t2 = J[k * n + j + 1];
+
+			J[k * n + j] = t1 * cc + t2 * ss;
+			J[k * n + j + 1] = xny * (J[k * n + j] + t1) - t2;
+		}
+	}
+}
@@ -0,0 +1,477 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Copyright 2022 Martin Schröder <info@swedishembedded.com>
+ * Consulting: https://swedishembedded.com/consulting
+ * Simulation: https://swedishembedded.com/simulation
+ * Training: https://swedishembedded.com/training
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <control/linalg.h>
+#include <control/optimization.h>
+
+#include "linalg/dot.h"
+
+// Basis changes kept as eta vectors before the basis is factorized again
+#define SIMPLEX_ETAS 64
+// Reduced costs above -SIMPLEX_TOLERANCE are optimal, infeasibilities below it are feasible
+#define SIMPLEX_TOLERANCE 1e-5f
+// Smallest element of the entering column that the ratio test pivots on, relative to the
+// largest one
+#define SIMPLEX_PIVOT 1e-4f
+// Pivots in a row without progress before the pricing switches to Bland's rule
+#define SIMPLEX_DEGENERATE 8
+
+/*
+ * The columns are numbered x[0 ... n - 1] first, then the slacks s[0 ... m - 1] of
+ * A*x + s = b and last the artificials of the rows with b < 0, which enter as -1.
+ */
+struct simplex_problem {
+	const float *A;
+	const float *b;
+	float *LU; // Factorized basis with the rows swapped in place [m*m]
+	uint16_t *pivot; // Row swapped with row k at step k of the factorization [m]
+	float *eta; // Eta vectors of the basis changes since the factorization [SIMPLEX_ETAS*m]
+	uint16_t *eta_row; // Pivot row of every eta vector [SIMPLEX_ETAS]
+	uint32_t *basis; // Column of every basic variable [m]
+	int32_t *position; // Row of every basic column or -1 [n + 2*m]
+	uint16_t *artificial_row; // Row of every artificial [m]
+	float *x_basis; // Value of every basic variable [m]
+	uint16_t etas;
+	uint16_t artificials;
+	uint16_t m;
+	uint16_t n;
+};
+
+static void column(const struct simplex_problem *p, uint32_t j, float a[]);
+static uint8_t factorize(struct simplex_problem *p);
+static void ftran(const struct simplex_problem *p, float x[]);
+static void btran(const struct simplex_problem *p, float y[]);
+static float cost(const struct simplex_problem *p, const float c[], uint8_t phase, uint32_t j);
+static uint8_t iterate(struct simplex_problem *p, const float c[], uint8_t phase, float y[],
+		       float d[], float z[], uint16_t *iterations, uint16_t iteration_limit);
+static uint8_t pivot(struct simplex_problem *p, uint32_t q, uint16_t r, const float d[]);
+static void drive_out_artificials(struct simplex_problem *p, float y[], float d[]);
+static float level(const struct simplex_problem *p, uint16_t i, bool bland);
+
+/*
+ * Linear programming with the revised simplex method
+ * Max c^Tx
+ * S.t Ax <= b
+ *      x >= 0
+ *
+ * b may have negative elements, so Ax >= b is -Ax <= -b, and a minimization is the
+ * maximization of -c^Tx. A Phase I finds a feasible basis first when b has negative elements.
+ * Instead of the tableau of linprog, only the basis is kept, as an LU factorization with
+ * partial pivoting and the basis changes since then as eta vectors, the product form of the
+ * inverse. The basis is factorized again every SIMPLEX_ETAS changes. The pricing takes the
+ * most negative reduced cost and falls back to the smallest index, Bland's rule, after
+ * SIMPLEX_DEGENERATE pivots that did not move, which rules out cycling.
+ * An iteration is not cheaper than a pivot of the tableau. The two solves with the basis and
+ * the pricing over the dense A cost a few times more, so linprog is faster on small problems.
+ * What it gains is an m*m basis in place of the m*(n + m) tableau, sizes past 255 and a
+ * robust start and pivoting.
+ *
+ * A [m*n] // Matrix
+ * b [m] // Constraints
+ * c [n] // Objective function
+ * x [n] // Solution
+ * Returns 1 == Success
+ * Returns 0 == Fail, the problem is infeasible or unbounded, the basis became singular, the
+ * iteration limit was hit or the workspace is too small
+ */
+uint8_t simplex(const float c[], const float A[], const float b[], float x[], uint16_t m,
+		uint16_t n, uint16_t iteration_limit)
+{
+	CTL_WORKSPACE_ON_STACK(ws, simplex_workspace_size(m, n));
+
+	return simplex_ws(c, A, b, x, m, n, iteration_limit, &ws);
+}
+
+size_t simplex_workspace_size(uint16_t m, uint16_t n)
+{
+	uint32_t columns = (uint32_t)n + 2 * m;
+
+	return CTL_WORKSPACE_FLOATS((size_t)m * m) + CTL_WORKSPACE_FLOATS(SIMPLEX_ETAS * m) +
+	       4 * CTL_WORKSPACE_FLOATS(m) + CTL_WORKSPACE_FLOATS(n) +
+	       2 * CTL_WORKSPACE_BYTES(m * sizeof(uint16_t)) +
+	       CTL_WORKSPACE_BYTES(SIMPLEX_ETAS * sizeof(uint16_t)) +
+	       CTL_WORKSPACE_BYTES(m * sizeof(uint32_t)) +
+	       CTL_WORKSPACE_BYTES(columns * sizeof(int32_t));
+}
+
+/*
+ * Same as simplex, with the basis taken from the workspace
+ */
+uint8_t simplex_ws(const float c[], const float A[], const float b[], float x[], uint16_t m,
+		   uint16_t n, uint16_t iteration_limit, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < simplex_workspace_size(m, n))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	uint32_t columns = (uint32_t)n + 2 * m;
+	struct simplex_problem p = {
+		.A = A,
+		.b = b,
+		.LU = ctl_workspace_floats(ws, (size_t)m * m),
+		.pivot = ctl_workspace_alloc(ws, m * sizeof(uint16_t)),
+		.eta = ctl_workspace_floats(ws, SIMPLEX_ETAS * m),
+		.eta_row = ctl_workspace_alloc(ws, SIMPLEX_ETAS * sizeof(uint16_t)),
+		.basis = ctl_workspace_alloc(ws, m * sizeof(uint32_t)),
+		.position = ctl_workspace_alloc(ws, columns * sizeof(int32_t)),
+		.artificial_row = ctl_workspace_alloc(ws, m * sizeof(uint16_t)),
+		.x_basis = ctl_workspace_floats(ws, m),
+		.artificials = 0,
+		.m = m,
+		.n = n,
+	};
+	float *y = ctl_workspace_floats(ws, m);
+	float *d = ctl_workspace_floats(ws, m);
+	float *a = ctl_workspace_floats(ws, m);
+	float *z = ctl_workspace_floats(ws, n);
+	uint16_t iterations = 0;
+	uint8_t status = 1;
+
+	// Start from the slacks, and from an artificial where the slack would be negative
+	for (uint32_t j = 0; j < columns; j++)
+		p.position[j] = -1;
+	for (uint16_t i = 0; i < m; i++) {
+		uint32_t j = (uint32_t)n + i;
+
+		if (b[i] < 0) {
+			p.artificial_row[p.artificials] = i;
+			j = (uint32_t)n + m + p.artificials++;
+		}
+		p.basis[i] = j;
+		p.position[j] = i;
+	}
+	if (!factorize(&p))
+		status = 0;
+
+	// Phase I minimizes the sum of the artificials down to zero
+	if (status && p.artificials > 0) {
+		status = iterate(&p, c, 1, y, d, z, &iterations, iteration_limit);
+
+		float infeasibility = 0;
+
+		for (uint16_t i = 0; i < m; i++)
+			if (p.basis[i] >= (uint32_t)n + m)
+				infeasibility += p.x_basis[i];
+		if (infeasibility > SIMPLEX_TOLERANCE)
+			status = 0;
+		else if (status)
+			drive_out_artificials(&p, a, d);
+	}
+
+	// Phase II maximizes c^Tx, which is minimizing -c^Tx
+	if (status)
+		status = iterate(&p, c, 2, y, d, z, &iterations, iteration_limit);
+
+	memset(x, 0, n * sizeof(float));
+	for (uint16_t i = 0; i < m; i++)
+		if (p.basis[i] < n)
+			x[p.basis[i]] = p.x_basis[i];
+
+	ctl_workspace_release(ws, mark);
+	return status;
+}
+
+/*
+ * Simplex iterations until no reduced cost is negative
+ * Returns 1 == Success
+ * Returns 0 == Fail, unbounded, singular or out of iterations
+ */
+static uint8_t iterate(struct simplex_problem *p, const float c[], uint8_t phase, float y[],
+		       float d[], float z[], uint16_t *iterations, uint16_t iteration_limit)
+{
+	uint16_t m = p->m;
+	uint16_t n = p->n;
+	uint32_t columns = (uint32_t)n + m + (phase == 1 ? p->artificials : 0);
+	uint16_t degenerate = 0;
+
+	for (;;) {
+		// Prices y = B^-T*c_B and the reduced costs c_j - y'*a_j, where z = A'*y is
+		// summed row by row so it runs over contiguous memory
+		for (uint16_t i = 0; i < m; i++)
+			y[i] = cost(p, c, phase, p->basis[i]);
+		btran(p, y);
+
+		memset(z, 0, n * sizeof(float));
+		for (uint16_t i = 0; i < m; i++) {
+			const float *row = &p->A[(size_t)i * n];
+			float yi = y[i];
+
+			for (uint16_t j = 0; j < n; j++)
+				z[j] += yi * row[j];
+		}
+
+		uint32_t q = columns;
+		float best = -SIMPLEX_TOLERANCE;
+		bool bland = degenerate >= SIMPLEX_DEGENERATE;
+
+		for (uint32_t j = 0; j < columns; j++) {
+			if (p->position[j] >= 0)
+				continue;
+
+			float reduced;
+
+			if (j < n)
+				reduced = cost(p, c, phase, j) - z[j];
+			else if (j < (uint32_t)n + m)
+				reduced = -y[j - n];
+			else
+				reduced = cost(p, c, phase, j) + y[p->artificial_row[j - n - m]];
+
+			if (reduced < best) {
+				best = reduced;
+				q = j;
+				if (bland)
+					break;
+			}
+		}
+		if (q == columns)
+			return 1;
+		if (*iterations >= iteration_limit)
+			return 0;
+		(*iterations)++;
+
+		// Entering column d = B^-1*a_q and the ratio test of Harris. The step may let
+		// the basic variables go SIMPLEX_TOLERANCE below zero, and the largest pivot
+		// within that step is taken, or the smallest column under Bland's rule, which
+		// needs the exact step.
+		column(p, q, d);
+		ftran(p, d);
+
+		float slack = bland ? 0 : SIMPLEX_TOLERANCE;
+		float ratio = INFINITY;
+		float tolerance = 0;
+
+		for (uint16_t i = 0; i < m; i++)
+			tolerance = fmaxf(tolerance, fabsf(d[i]));
+		tolerance = SIMPLEX_PIVOT * fmaxf(tolerance, 1);
+		for (uint16_t i = 0; i < m; i++)
+			if (d[i] > tolerance)
+				ratio = fminf(ratio, (level(p, i, bland) + slack) / d[i]);
+		if (ratio == INFINITY)
+			return 0; // Unbounded
+
+		uint16_t r = m;
+
+		for (uint16_t i = 0; i < m; i++) {
+			if (d[i] <= tolerance || level(p, i, bland) / d[i] > ratio)
+				continue;
+			if (r == m || (bland ? p->basis[i] < p->basis[r] : d[i] > d[r]))
+				r = i;
+		}
+
+		if (fmaxf(p->x_basis[r], 0) > SIMPLEX_TOLERANCE * d[r])
+			degenerate = 0;
+		else
+			degenerate++;
+		if (!pivot(p, q, r, d))
+			return 0;
+	}
+}
+
+/*
+ * Basic variable i for the ratio test. The round-off leaves the degenerate ones scattered
+ * around zero, and Bland's rule only sees their ties when they are exactly zero.
+ */
+static float level(const struct simplex_problem *p, uint16_t i, bool bland)
+{
+	float x = p->x_basis[i];
+
+	if (bland)
+		return x > SIMPLEX_TOLERANCE ? x : 0;
+	return fmaxf(x, 0);
+}
+
+/*
+ * Column q enters the basis in row r, d = B^-1*a_q
+ * Returns 0 if the basis became singular
+ */
+static uint8_t pivot(struct simplex_problem *p, uint32_t q, uint16_t r, const float d[])
+{
+	uint16_t m = p->m;
+	float theta = fmaxf(p->x_basis[r], 0) / d[r];
+
+	for (uint16_t i = 0; i < m; i++)
+		p->x_basis[i] -= theta * d[i];
+	p->x_basis[r] = theta;
+
+	p->position[p->basis[r]] = -1;
+	p->basis[r] = q;
+	p->position[q] = r;
+
+	if (p->etas == SIMPLEX_ETAS)
+		return factorize(p);
+
+	// The eta vector turns d into the unit vector e_r
+	float *eta = &p->eta[(size_t)p->etas * m];
+
+	for (uint16_t i = 0; i < m; i++)
+		eta[i] = -d[i] / d[r];
+	eta[r] = 1 / d[r];
+	p->eta_row[p->etas++] = r;
+	return 1;
+}
+
+/*
+ * Swap the artificials that are still basic at zero for columns of the problem, so that
+ * Phase II cannot move them. A row where no such column exists is redundant and its
+ * artificial stays at zero.
+ */
+static void drive_out_artificials(struct simplex_problem *p, float rho[], float d[])
+{
+	uint16_t m = p->m;
+	uint16_t n = p->n;
+
+	for (uint16_t r = 0; r < m; r++) {
+		if (p->basis[r] < (uint32_t)n + m)
+			continue;
+
+		// Row r of B^-1*[A I]
+		memset(rho, 0, m * sizeof(float));
+		rho[r] = 1;
+		btran(p, rho);
+
+		uint32_t q = (uint32_t)n + m;
+		float best = SIMPLEX_PIVOT;
+
+		for (uint32_t j = 0; j < (uint32_t)n + m; j++) {
+			if (p->position[j] >= 0)
+				continue;
+
+			float alpha = 0;
+
+			if (j < n)
+				for (uint16_t i = 0; i < m; i++)
+					alpha += rho[i] * p->A[(size_t)i * n + j];
+			else
+				alpha = rho[j - n];
+			if (fabsf(alpha) > best) {
+				best = fabsf(alpha);
+				q = j;
+			}
+		}
+		if (q == (uint32_t)n + m)
+			continue;
+
+		column(p, q, d);
+		ftran(p, d);
+		p->x_basis[r] = 0;
+		pivot(p, q, r, d);
+	}
+}
+
+/*
+ * Cost of column j that is minimized, the artificials in Phase I and -c in Phase II
+ */
+static float cost(const struct simplex_problem *p, const float c[], uint8_t phase, uint32_t j)
+{
+	if (phase == 1)
+		return j >= (uint32_t)p->n + p->m ? 1 : 0;
+	return j < p->n ? -c[j] : 0;
+}
+
+/*
+ * Column j of [A I -E], where E holds the unit vectors of the rows with artificials
+ */
+static void column(const struct simplex_problem *p, uint32_t j, float a[])
+{
+	uint16_t m = p->m;
+	uint16_t n = p->n;
+
+	if (j < n) {
+		for (uint16_t i = 0; i < m; i++)
+			a[i] = p->A[(size_t)i * n + j];
+		return;
+	}
+	memset(a, 0, m * sizeof(float));
+	if (j < (uint32_t)n + m)
+		a[j - n] = 1;
+	else
+		a[p->artificial_row[j - n - m]] = -1;
+}
+
+/*
+ * LU factorization of the basis with lu_factor, which skips the rows with nothing to
+ * eliminate, so a basis of mostly slacks factorizes in about O(m^2). The basic variables
+ * are computed again from b.
+ * Returns 0 if the basis is singular
+ */
+static uint8_t factorize(struct simplex_problem *p)
+{
+	uint16_t m = p->m;
+	float *LU = p->LU;
+
+	for (uint16_t k = 0; k < m; k++) {
+		column(p, p->basis[k], p->x_basis);
+		for (uint16_t i = 0; i < m; i++)
+			LU[(size_t)i * m + k] = p->x_basis[i];
+	}
+
+	if (!lu_factor(LU, p->pivot, m))
+		return 0;
+
+	p->etas = 0;
+	memcpy(p->x_basis, p->b, m * sizeof(float));
+	ftran(p, p->x_basis);
+	return 1;
+}
+
+/*
+ * x = B^-1*x, through the factorization and then the eta vectors in order
+ */
+static void ftran(const struct simplex_problem *p, float x[])
+{
+	uint16_t m = p->m;
+
+	lu_solve(p->LU, p->pivot, x, m);
+	for (uint16_t e = 0; e < p->etas; e++) {
+		const float *eta = &p->eta[(size_t)e * m];
+		uint16_t r = p->eta_row[e];
+		float xr = x[r];
+
+		if (xr == 0)
+			continue;
+		for (uint16_t i = 0; i < m; i++)
+			x[i] += eta[i] * xr;
+		x[r] = eta[r] * xr;
+	}
+}
+
+/*
+ * y = B^-T*y, through the eta vectors in reverse and then the transposed factorization
+ */
+static void btran(const struct simplex_problem *p, float y[])
+{
+	uint16_t m = p->m;
+	const float *LU = p->LU;
+
+	for (uint16_t e = p->etas; e-- > 0;) {
+		y[p->eta_row[e]] = ctl_dot(&p->eta[(size_t)e * m], y, m);
+	}
+
+	// U'*w = y column by column of U, then L'*v = w
+	for (uint16_t i = 0; i < m; i++) {
+		y[i] /= LU[(size_t)i * m + i];
+		if (y[i] == 0)
+			continue;
+		for (uint16_t j = i + 1; j < m; j++)
+			y[j] -= LU[(size_t)i * m + j] * y[i];
+	}
+	for (uint16_t i = m; i-- > 1;)
+		if (y[i] != 0)
+			for (uint16_t j = 0; j < i; j++)
+				y[j] -= LU[(size_t)i * m + j] * y[i];
+	for (uint16_t k = m; k-- > 0;) {
+		float t = y[k];
+
+		y[k] = y[p->pivot[k]];
+		y[p->pivot[k]] = t;
+	}
+}
@@ -24,26 +24,59 @@
 void era(float u[], float y[], uint16_t row, uint16_t column, float A[], float B[], float C[],
 	 uint8_t row_a, uint8_t inputs_outputs)
 {
+	CTL_WORKSPACE_ON_STACK(ws, era_workspace_size(row, column));
+
+	era_ws(u, y, row, column, A, B, C, row_a, inputs_outputs, &ws);
+}
+
+size_t era_workspace_size(uint16_t row, uint16_t column)
+{
+	uint16_t row_h = row * (column / 2);
+	uint16_t column_h = column / 2;
+
+	size_t realization = 3 * CTL_WORKSPACE_FLOATS(row_h * column_h) +
+			     CTL_WORKSPACE_FLOATS(column_h) +
+			     CTL_WORKSPACE_FLOATS(column_h * column_h) +
+			     svd_golub_reinsch_workspace_size(row_h, column_h);
+
+	// okid is done with its scratch before the Hankel matrices are taken
+	return CTL_WORKSPACE_FLOATS(row * column) +
+	       ctl_workspace_max(okid_workspace_size(row, column), realization);
+}
+
+/*
+ * Same as era, with the Hankel and SVD matrices taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t era_ws(float u[], float y[], uint16_t row, uint16_t column, float A[], float B[],
+	       float C[], uint8_t row_a, uint8_t inputs_outputs, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < era_workspace_size(row, column))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+
 	// Markov parameters - Impulse response
-	float g[row * column];
+	float *g = ctl_workspace_floats(ws, row * column);
 
-	okid(u, y, g, row, column);
+	okid_ws(u, y, g, row, column, ws);
 
 	// Compute the correct dimensions for matrix H
 	uint16_t row_h = row * (column / 2);
 	uint16_t column_h = column / 2;
 
 	// Create Half Hankel matrix
-	float H[row_h * column_h];
+	float *H = ctl_workspace_floats(ws, row_h * column_h);
 
 	hankel(g, H, row, column, row_h, column_h, 1); // Need to have 1 shift for this algorithm
 
 	// Do SVD on the half hankel matrix H
-	float U[row_h * column_h];
-	float S[column_h];
-	float V[column_h * column_h];
+	float *U = ctl_workspace_floats(ws, row_h * column_h);
+	float *S = ctl_workspace_floats(ws, column_h);
+	float *V = ctl_workspace_floats(ws, column_h * column_h);
 
-	svd_golub_reinsch(H, row_h, column_h, U, S, V);
+	svd_golub_reinsch_ws(H, row_h, column_h, U, S, V, ws);
 
 	// Re-create another hankel with shift = 2
 	hankel(g, H, row, column, row_h, column_h, 2); // Need to have 2 shift for this algorithm
@@ -65,20 +98,22 @@ void era(float u[], float y[], uint16_t row, uint16_t column, float A[], float B
 		for (uint16_t j = 0; j < column_h; j++)
 			V[j * column_h + i] = V[j * column_h + i] * sqrtf(1 / S[i]);
 
-	// U = S^(-1/2)*U^T
-	tran(U, row_h, column_h);
+	// U = U*S^(-1/2), it is used transposed below as S^(-1/2)*U^T
 	for (uint16_t i = 0; i < row_h; i++)
 		for (uint16_t j = 0; j < column_h; j++)
-			U[j * row_h + i] = sqrtf(1 / S[j]) * U[j * row_h + i];
+			U[i * column_h + j] = sqrtf(1 / S[j]) * U[i * column_h + j];
 
 	// Create A matrix: T = H*V
-	float Temp[row_h * column_h]; // Temporary
+	float *Temp = ctl_workspace_floats(ws, row_h * column_h); // Temporary
 
 	mul(H, V, Temp, row_h, column_h, column_h);
 
-	// Now, multiply V = U(column_h, row_h)*Temp(row_h, column_h). U is transpose!
-	mul(U, Temp, V, column_h, row_h, column_h);
+	// Now, multiply V = U^T(column_h, row_h)*Temp(row_h, column_h), U^T is read in place
+	gemm(true, false, 1.0f, U, Temp, 0.0f, V, column_h, column_h, row_h);
 
 	// Get the elements of V -> A
 	cut(V, column_h, column_h, A, 0, row_a - 1, 0, row_a - 1);
+
+	ctl_workspace_release(ws, mark);
+	return 1;
 }
@@ -7,9 +7,27 @@
  * Training: https://swedishembedded.com/training
  */
 
+#include <float.h>
+#include <math.h>
 #include <string.h>
+#include <control/linalg.h>
 #include <control/sysid.h>
 
+#include "linalg/dot.h"
+
+// Samples of a Toeplitz block that is solved by substitution instead of split in two
+#define OKID_BLOCK 128
+// Tikhonov regularization of okid_observer relative to the power of u and y, at the rounding
+#define OKID_RIDGE FLT_EPSILON
+
+static uint32_t fft_size(uint32_t length);
+static void fft_twiddles(float w[], uint32_t size);
+static void fft(float z[], uint32_t size, const float w[], uint32_t stride, bool inverse);
+static uint8_t markov(const float u[], const float y[], float g[], uint16_t row, uint16_t column,
+		      float z[], const float w[], uint32_t size_w);
+static void toeplitz_solve(const float u[], float g[], uint32_t first, uint32_t last,
+			   float z[], const float w[], uint32_t size_w);
+
 /*
  * Observer kalman filter identification.
  * This is the basic version, e.g it won't give you the kalman gain K matrix.
@@ -17,11 +35,254 @@
  * First collect your inputs u and outputs y and create impulse response g, called Markov parameters.
  * Then you must use era.c algorithm to convert impulse response g into a linear state space model.
  * Data length need to be the same as the column length n!
+ * It needs no scratch memory and is O(n^2), okid_ws is O(n*log(n)^2) for long records.
  * u [m*n]
  * y [m*n]
  * g [m*n] Markov parameters
  */
 void okid(float u[], float y[], float g[], uint16_t row, uint16_t column)
+{
+	markov(u, y, g, row, column, NULL, NULL, 0);
+}
+
+size_t okid_workspace_size(uint16_t row, uint16_t column)
+{
+	(void)row;
+	if (column <= OKID_BLOCK)
+		return 0;
+
+	// One complex buffer and the twiddle factors of the largest block
+	uint32_t size = fft_size(column);
+
+	return CTL_WORKSPACE_FLOATS(2 * size) + CTL_WORKSPACE_FLOATS(size);
+}
+
+/*
+ * Same as okid, but the Toeplitz system is split in halves and the coupling between them is
+ * a convolution that is done with the FFT, with the FFT buffers taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or a row of u is zero
+ */
+uint8_t okid_ws(float u[], float y[], float g[], uint16_t row, uint16_t column,
+		struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < okid_workspace_size(row, column))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	uint32_t size = column > OKID_BLOCK ? fft_size(column) : 0;
+	float *z = ctl_workspace_floats(ws, 2 * size);
+	float *w = ctl_workspace_floats(ws, size);
+
+	if (size)
+		fft_twiddles(w, size);
+	uint8_t status = markov(u, y, g, row, column, z, w, size);
+
+	ctl_workspace_release(ws, mark);
+	return status;
+}
+
+/*
+ * Regularized deconvolution in the frequency domain, O(n*log(n)) for long experiments.
+ * The spectra of the zero padded u and y give G = conj(U)*Y/(|U|^2 + alpha*mean(|U|^2)),
+ * which does not need u(0) != 0 and damps the frequencies that u does not excite.
+ * The end of the record is taken as the end of the response, so use it on data that is
+ * long compared to the settling time.
+ * The FFT buffers take 6 to 12 floats per sample from the stack, use okid_fft_ws on a small
+ * stack.
+ * u [m*n]
+ * y [m*n]
+ * g [m*n] Markov parameters, same layout as okid
+ * alpha >= 0, 0 is a plain deconvolution
+ */
+uint8_t okid_fft(float u[], float y[], float g[], uint16_t row, uint16_t column, float alpha)
+{
+	CTL_WORKSPACE_ON_STACK(ws, okid_fft_workspace_size(row, column));
+
+	return okid_fft_ws(u, y, g, row, column, alpha, &ws);
+}
+
+size_t okid_fft_workspace_size(uint16_t row, uint16_t column)
+{
+	(void)row;
+
+	// Padded to twice the length, so the circular convolution is a linear one
+	uint32_t size = fft_size(2 * (uint32_t)column);
+
+	return CTL_WORKSPACE_FLOATS(2 * size) + CTL_WORKSPACE_FLOATS(size);
+}
+
+/*
+ * Same as okid_fft, with the FFT buffers taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or a row of u is zero
+ */
+uint8_t okid_fft_ws(float u[], float y[], float g[], uint16_t row, uint16_t column, float alpha,
+		    struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < okid_fft_workspace_size(row, column))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	uint32_t size = fft_size(2 * (uint32_t)column);
+	float *z = ctl_workspace_floats(ws, 2 * size);
+	float *w = ctl_workspace_floats(ws, size);
+	uint8_t status = 1;
+
+	fft_twiddles(w, size);
+	for (uint16_t k = 0; k < row; k++) {
+		// Both real signals in one complex FFT, z = u + i*y
+		memset(z, 0, 2 * size * sizeof(float));
+		for (uint16_t i = 0; i < column; i++) {
+			z[2 * i] = u[k * column + i];
+			z[2 * i + 1] = y[k * column + i];
+		}
+		fft(z, size, w, 1, false);
+
+		// mean(|U|^2) = sum(u^2) by Parseval
+		float power = ctl_dot(&u[k * column], &u[k * column], column);
+		float lambda = alpha * power;
+
+		// U and Y are the even and odd parts of Z, and G is Hermitian like both of them
+		for (uint32_t i = 0; i <= size / 2; i++) {
+			uint32_t j = (size - i) & (size - 1);
+			float ur = (z[2 * i] + z[2 * j]) / 2;
+			float ui = (z[2 * i + 1] - z[2 * j + 1]) / 2;
+			float yr = (z[2 * i + 1] + z[2 * j + 1]) / 2;
+			float yi = (z[2 * j] - z[2 * i]) / 2;
+			float magnitude = ur * ur + ui * ui + lambda;
+			float gr = 0.0f, gi = 0.0f;
+
+			if (magnitude > 0.0f) {
+				gr = (ur * yr + ui * yi) / magnitude;
+				gi = (ur * yi - ui * yr) / magnitude;
+			}
+			z[2 * i] = gr;
+			z[2 * i + 1] = gi;
+			z[2 * j] = gr;
+			z[2 * j + 1] = -gi;
+		}
+		fft(z, size, w, 1, true);
+		for (uint16_t i = 0; i < column; i++)
+			g[k * column + i] = z[2 * i] / size;
+		if (!(power > 0.0f))
+			status = 0;
+	}
+
+	ctl_workspace_release(ws, mark);
+	return status;
+}
+
+/*
+ * Observer kalman filter identification with an observer of order p, for lightly damped
+ * systems whose Markov parameters do not decay within the record.
+ * y(k) = D*u(k) + sum(a(i)*u(k - i) + b(i)*y(k - i), i = 1..p) is fitted with least squares.
+ * The observer Markov parameters D, a and b decay in p steps because the observer is deadbeat,
+ * and the system Markov parameters follow from them by g(0) = D and
+ * g(k) = a(k) + sum(b(i)*g(k - i), i = 1..min(k, p)) with a(k) = 0 for k > p.
+ * u [m*n]
+ * y [m*n]
+ * g [m*n] Markov parameters, same layout as okid
+ * p // Order of the observer, at least the order of the system. n > 3*p + 1
+ */
+uint8_t okid_observer(float u[], float y[], float g[], uint16_t row, uint16_t column, uint8_t p)
+{
+	CTL_WORKSPACE_ON_STACK(ws, okid_observer_workspace_size(p));
+
+	return okid_observer_ws(u, y, g, row, column, p, &ws);
+}
+
+size_t okid_observer_workspace_size(uint8_t p)
+{
+	uint16_t q = 2 * p + 2;
+
+	return CTL_WORKSPACE_FLOATS(q * q) + CTL_WORKSPACE_FLOATS(q);
+}
+
+/*
+ * Same as okid_observer, with the triangular factor of the least squares problem taken from
+ * the workspace. The samples are rotated into it one at a time with cholupdate_k_upper, which is
+ * a QR factorization of the regression matrix that never forms the regression matrix.
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small, n is too short or a row of u and y is zero
+ */
+uint8_t okid_observer_ws(float u[], float y[], float g[], uint16_t row, uint16_t column, uint8_t p,
+			 struct ctl_workspace *ws)
+{
+	// D, a, b and y in the columns of R
+	uint16_t q = 2 * p + 2;
+
+	if (ctl_workspace_available(ws) < okid_observer_workspace_size(p) || column <= 3 * p + 1)
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	float *R = ctl_workspace_floats(ws, q * q);
+	float *x = ctl_workspace_floats(ws, q);
+	uint16_t samples = column - p;
+	uint8_t status = 1;
+
+	for (uint16_t k = 0; k < row && status; k++) {
+		float *uk = &u[k * column];
+		float *yk = &y[k * column];
+		float *gk = &g[k * column];
+
+		// A little ridge, so R starts regular and p may be larger than the order
+		float ridge = ctl_dot(&uk[p], &uk[p], samples) +
+			      ctl_dot(&yk[p], &yk[p], samples);
+
+		ridge = sqrtf(OKID_RIDGE * ridge / 2);
+		if (!(ridge > 0.0f)) {
+			status = 0;
+			break;
+		}
+		memset(R, 0, q * q * sizeof(float));
+		for (uint16_t i = 0; i < q - 1; i++)
+			R[i * q + i] = ridge;
+		R[q * q - 1] = 1.0f;
+
+		// x = [u(s) u(s - 1) .. u(s - p) y(s - 1) .. y(s - p) y(s)]
+		for (uint16_t s = p; s < column && status; s++) {
+			for (uint16_t i = 0; i <= p; i++)
+				x[i] = uk[s - i];
+			for (uint16_t i = 1; i <= p; i++)
+				x[p + i] = yk[s - i];
+			x[q - 1] = yk[s];
+			status = cholupdate_k_upper(R, x, q, 1, true);
+		}
+		if (!status)
+			break;
+
+		// theta = [D a(1) .. a(p) b(1) .. b(p)] solves R(1:q-1, 1:q-1)*theta = R(1:q-1, q)
+		float *theta = x;
+
+		for (uint16_t i = q - 1; i-- > 0;) {
+			float sum = R[i * q + q - 1];
+
+			for (uint16_t j = i + 1; j < q - 1; j++)
+				sum -= R[i * q + j] * theta[j];
+			theta[i] = sum / R[i * q + i];
+		}
+
+		for (uint16_t i = 0; i < column; i++) {
+			float sum = i <= p ? theta[i] : 0.0f;
+
+			for (uint16_t j = 1; j <= p && j <= i; j++)
+				sum += theta[p + j] * gk[i - j];
+			gk[i] = sum;
+		}
+	}
+
+	ctl_workspace_release(ws, mark);
+	return status;
+}
+
+/*
+ * The Markov parameters of every row of u and y. Without FFT buffers, size_w = 0, the
+ * Toeplitz system is solved by substitution.
+ * Returns 0 when a row of u is zero
+ */
+static uint8_t markov(const float u[], const float y[], float g[], uint16_t row, uint16_t column,
+		      float z[], const float w[], uint32_t size_w)
 {
 	/**
 	 * This is just a simple linear solve Ax = b where A is lower toeplitz
@@ -39,17 +300,155 @@ void okid(float u[], float y[], float g[], uint16_t row, uint16_t column)
 	 *
 	 * Where g0 = y0/u0 and g1 = (y1 - u1*g0)/u0 etc..
 	 */
-	memset(g, 0, row * column * sizeof(float));
-	float sum;
+	uint8_t status = 1;
 
 	// If we have more than 1 rows = MIMO system
 	for (uint16_t k = 0; k < row; k++) {
-		for (uint16_t i = 0; i < column; i++) {
-			sum = 0;
-			for (int j = 0; j < i; j = j + 1) {
-				sum = sum + u[k * column + i - j] * g[k * column + j];
+		const float *uk = &u[k * column];
+		float *gk = &g[k * column];
+		float largest = 0.0f;
+		uint16_t delay = 0;
+
+		// Leading inputs that are zero are a delay, y(delay:n) = g*u(delay:n)
+		for (uint16_t i = 0; i < column; i++)
+			largest = fmaxf(largest, fabsf(uk[i]));
+		while (delay < column && !(fabsf(uk[delay]) > FLT_EPSILON * largest))
+			delay++;
+
+		// The Markov parameters that the delay pushes out of the data are zero
+		memmove(gk, &y[k * column + delay], (column - delay) * sizeof(float));
+		memset(&gk[column - delay], 0, delay * sizeof(float));
+		if (delay == column) {
+			status = 0;
+			continue;
+		}
+		toeplitz_solve(&uk[delay], gk, 0, column - delay, z, w, size_w);
+	}
+	return status;
+}
+
+/*
+ * Solve the rows first to last of T(u)*g = y where g holds y on entry. The rows before first
+ * are solved and already subtracted from these rows.
+ */
+static void toeplitz_solve(const float u[], float g[], uint32_t first, uint32_t last,
+			   float z[], const float w[], uint32_t size_w)
+{
+	if (last - first <= OKID_BLOCK || size_w == 0) {
+		for (uint32_t i = first; i < last; i++) {
+			float sum = 0;
+
+			for (uint32_t j = first; j < i; j++)
+				sum = sum + u[i - j] * g[j];
+			g[i] = (g[i] - sum) / u[0];
+		}
+		return;
+	}
+
+	uint32_t middle = first + (last - first) / 2;
+
+	toeplitz_solve(u, g, first, middle, z, w, size_w);
+
+	/*
+	 * y(i) -= sum(u(i - j)*g(j), j = first..middle - 1) for i = middle..last - 1 is the
+	 * convolution c = g(first:middle)*u(1:last - first) at c(i - first - 1). A circular
+	 * convolution of last - first points only folds the elements of c that are not needed.
+	 */
+	uint32_t size = fft_size(last - first);
+
+	memset(z, 0, 2 * size * sizeof(float));
+	for (uint32_t j = first; j < middle; j++)
+		z[2 * (j - first)] = g[j];
+	for (uint32_t i = 1; i < last - first; i++)
+		z[2 * (i - 1) + 1] = u[i];
+	fft(z, size, w, size_w / size, false);
+
+	// The product of the spectra of the even and the odd part of z
+	for (uint32_t i = 0; i <= size / 2; i++) {
+		uint32_t j = (size - i) & (size - 1);
+		float ar = (z[2 * i] + z[2 * j]) / 2, ai = (z[2 * i + 1] - z[2 * j + 1]) / 2;
+		float br = (z[2 * i + 1] + z[2 * j + 1]) / 2, bi = (z[2 * j] - z[2 * i]) / 2;
+		float cr = ar * br - ai * bi, ci = ar * bi + ai * br;
+
+		z[2 * i] = cr;
+		z[2 * i + 1] = ci;
+		z[2 * j] = cr;
+		z[2 * j + 1] = -ci;
+	}
+	fft(z, size, w, size_w / size, true);
+	for (uint32_t i = middle; i < last; i++)
+		g[i] -= z[2 * (i - first - 1)] / size;
+
+	toeplitz_solve(u, g, middle, last, z, w, size_w);
+}
+
+/*
+ * Smallest power of two that is at least length
+ */
+static uint32_t fft_size(uint32_t length)
+{
+	uint32_t size = 1;
+
+	while (size < length)
+		size *= 2;
+	return size;
+}
+
+/*
+ * w(2*k) + i*w(2*k + 1) = exp(-2*pi*i*k/size) for k = 0..size/2 - 1
+ */
+static void fft_twiddles(float w[], uint32_t size)
+{
+	double pi = acos(-1.0);
+
+	for (uint32_t k = 0; k < size / 2; k++) {
+		double angle = -2.0 * pi * k / size;
+
+		w[2 * k] = (float)cos(angle);
+		w[2 * k + 1] = (float)sin(angle);
+	}
+}
+
+/*
+ * Radix 2 FFT in place of size complex numbers z(2*k) + i*z(2*k + 1), without the 1/size
+ * of the inverse. The twiddle factors are every stride:th of a table of a larger size.
+ */
+static void fft(float z[], uint32_t size, const float w[], uint32_t stride, bool inverse)
+{
+	// Bit reversed order
+	for (uint32_t i = 1, j = 0; i < size; i++) {
+		uint32_t bit = size >> 1;
+
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j) {
+			float re = z[2 * i], im = z[2 * i + 1];
+
+			z[2 * i] = z[2 * j];
+			z[2 * i + 1] = z[2 * j + 1];
+			z[2 * j] = re;
+			z[2 * j + 1] = im;
+		}
+	}
+
+	float sign = inverse ? -1.0f : 1.0f;
+
+	for (uint32_t half = 1; half < size; half *= 2) {
+		uint32_t step = stride * (size / (2 * half));
+
+		for (uint32_t start = 0; start < size; start += 2 * half) {
+			for (uint32_t j = 0; j < half; j++) {
+				float wr = w[2 * j * step], wi = sign * w[2 * j * step + 1];
+				float *a = &z[2 * (start + j)];
+				float *b = &z[2 * (start + j + half)];
+				float tr = wr * b[0] - wi * b[1], ti = wr * b[1] + wi * b[0];
+
+				b[0] = a[0] - tr;
+				b[1] = a[1] - ti;
+				a[0] += tr;
+				a[1] += ti;
 			}
-			g[k * column + i] = (y[k * column + i] - sum) / u[k * column + 0];
 		}
 	}
 }
@@ -7,13 +7,22 @@
  * Training: https://swedishembedded.com/training
  */
 
+#include <stdbool.h>
 #include <string.h>
 
 #include <control/linalg.h>
 #include <control/sysid.h>
 
+#include "linalg/dot.h"
+
+static bool regressor(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], uint8_t *count,
+		      float *past_e, float *past_y, float *past_u, float phi[]);
 static void recursive(uint8_t NP, uint8_t NZ, uint8_t NZE, float y, float phi[], float theta[],
-		      float P[], float *past_e, float forgetting);
+		      float P[], float *past_e, float forgetting, struct ctl_workspace *ws);
+static void recursive_ud(uint16_t n, float y, float phi[], float theta[], float UD[],
+			 float *past_e, float forgetting, float b[]);
+static void recursive_packed(uint16_t n, float y, float phi[], float theta[], float P[],
+			     float *past_e, float forgetting, float Pphi[]);
 
 /*
  * Recursive least square. We estimate A(q)y(t) = B(q) + C(q)e(t)
@@ -26,6 +35,159 @@ static void recursive(uint8_t NP, uint8_t NZ, uint8_t NZE, float y, float phi[],
 void rls(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], float u, float y, uint8_t *count,
 	 float *past_e, float *past_y, float *past_u, float phi[], float P[], float Pq,
 	 float forgetting)
+{
+	CTL_WORKSPACE_ON_STACK(ws, rls_workspace_size(NP, NZ, NZE));
+
+	rls_ws(NP, NZ, NZE, theta, u, y, count, past_e, past_y, past_u, phi, P, Pq, forgetting,
+	       &ws);
+}
+
+size_t rls_workspace_size(uint8_t NP, uint8_t NZ, uint8_t NZE)
+{
+	uint16_t n = NP + NZ + NZE;
+
+	return 2 * CTL_WORKSPACE_FLOATS(n);
+}
+
+/*
+ * Same as rls, with the temporary vectors taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t rls_ws(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], float u, float y,
+	       uint8_t *count, float *past_e, float *past_y, float *past_u, float phi[], float P[],
+	       float Pq, float forgetting, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < rls_workspace_size(NP, NZ, NZE))
+		return 0;
+
+	if (regressor(NP, NZ, NZE, theta, count, past_e, past_y, past_u, phi)) {
+		// Init P with zeros and then create P as an identify matrix with q as diagonal
+		memset(P, 0,
+		       (NP + NZ + NZE) * (NP + NZ + NZE) * sizeof(float)); // Initial P with zeros
+		for (uint8_t i = 0; i < NP + NZ + NZE; i++) {
+			P[i * (NP + NZ + NZE) + i] = Pq;
+		}
+	}
+	// Call recursive
+	recursive(NP, NZ, NZE, y, phi, theta, P, past_e, forgetting, ws);
+
+	// Set the past values
+	*past_y = -y;
+	*past_u = u;
+	return 1;
+}
+
+/*
+ * Same as rls, but P is kept factorized as P = U*D*U' and updated with Bierman's algorithm,
+ * so it stays symmetric and positive definite however long it runs
+ * UD [(NP + NZ + NZE)*(NP + NZ + NZE + 1)/2], upper triangle packed by columns: element
+ * (i, j), i <= j, is at i + j*(j + 1)/2. The diagonal holds D, above it is the unit upper
+ * triangular U
+ */
+void rls_ud(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], float u, float y, uint8_t *count,
+	    float *past_e, float *past_y, float *past_u, float phi[], float UD[], float Pq,
+	    float forgetting)
+{
+	CTL_WORKSPACE_ON_STACK(ws, rls_ud_workspace_size(NP, NZ, NZE));
+
+	rls_ud_ws(NP, NZ, NZE, theta, u, y, count, past_e, past_y, past_u, phi, UD, Pq,
+		  forgetting, &ws);
+}
+
+size_t rls_ud_workspace_size(uint8_t NP, uint8_t NZ, uint8_t NZE)
+{
+	return CTL_WORKSPACE_FLOATS(NP + NZ + NZE);
+}
+
+/*
+ * Same as rls_ud, with the gain vector taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t rls_ud_ws(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], float u, float y,
+		  uint8_t *count, float *past_e, float *past_y, float *past_u, float phi[],
+		  float UD[], float Pq, float forgetting, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < rls_ud_workspace_size(NP, NZ, NZE))
+		return 0;
+
+	uint16_t n = NP + NZ + NZE;
+
+	if (regressor(NP, NZ, NZE, theta, count, past_e, past_y, past_u, phi)) {
+		// U = I and D = Pq*I
+		memset(UD, 0, n * (n + 1) / 2 * sizeof(float));
+		for (uint16_t j = 0; j < n; j++)
+			UD[j + j * (j + 1) / 2] = Pq;
+	}
+
+	size_t mark = ctl_workspace_mark(ws);
+
+	recursive_ud(n, y, phi, theta, UD, past_e, forgetting, ctl_workspace_floats(ws, n));
+	ctl_workspace_release(ws, mark);
+
+	*past_y = -y;
+	*past_u = u;
+	return 1;
+}
+
+/*
+ * Same as rls, but only the upper triangle of the symmetric P is stored and updated
+ * P [(NP + NZ + NZE)*(NP + NZ + NZE + 1)/2], packed by columns: element (i, j), i <= j,
+ * is at i + j*(j + 1)/2
+ */
+void rls_packed(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], float u, float y,
+		uint8_t *count, float *past_e, float *past_y, float *past_u, float phi[], float P[],
+		float Pq, float forgetting)
+{
+	CTL_WORKSPACE_ON_STACK(ws, rls_packed_workspace_size(NP, NZ, NZE));
+
+	rls_packed_ws(NP, NZ, NZE, theta, u, y, count, past_e, past_y, past_u, phi, P, Pq,
+		      forgetting, &ws);
+}
+
+size_t rls_packed_workspace_size(uint8_t NP, uint8_t NZ, uint8_t NZE)
+{
+	return CTL_WORKSPACE_FLOATS(NP + NZ + NZE);
+}
+
+/*
+ * Same as rls_packed, with P*phi taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t rls_packed_ws(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], float u, float y,
+		      uint8_t *count, float *past_e, float *past_y, float *past_u, float phi[],
+		      float P[], float Pq, float forgetting, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < rls_packed_workspace_size(NP, NZ, NZE))
+		return 0;
+
+	uint16_t n = NP + NZ + NZE;
+
+	if (regressor(NP, NZ, NZE, theta, count, past_e, past_y, past_u, phi)) {
+		memset(P, 0, n * (n + 1) / 2 * sizeof(float));
+		for (uint16_t j = 0; j < n; j++)
+			P[j + j * (j + 1) / 2] = Pq;
+	}
+
+	size_t mark = ctl_workspace_mark(ws);
+
+	recursive_packed(n, y, phi, theta, P, past_e, forgetting, ctl_workspace_floats(ws, n));
+	ctl_workspace_release(ws, mark);
+
+	*past_y = -y;
+	*past_u = u;
+	return 1;
+}
+
+/*
+ * This shifts the regressor phi one step and inserts the past values
+ * Returns true when count was 0 and the estimator was reset, then the caller
+ * initializes its covariance
+ */
+static bool regressor(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], uint8_t *count,
+		      float *past_e, float *past_y, float *past_u, float phi[])
 {
 	// Static values that belongs to this function - OLD CODE, but they have the same size
 	//static float past_e = 0; // The past e
@@ -38,13 +200,6 @@ void rls(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], float u, float y, u
 		// Nothing here - Leave phi with only zeros - Important to have phi as zeros
 		memset(phi, 0, (NP + NZ + NZE) * sizeof(float));
 
-		// Init P with zeros and then create P as an identify matrix with q as diagonal
-		memset(P, 0,
-		       (NP + NZ + NZE) * (NP + NZ + NZE) * sizeof(float)); // Initial P with zeros
-		for (uint8_t i = 0; i < NP + NZ + NZE; i++) {
-			P[i * (NP + NZ + NZE) + i] = Pq;
-		}
-
 		// Reset the past
 		*past_y = 0;
 		*past_u = 0;
@@ -56,11 +211,9 @@ void rls(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], float u, float y, u
 
 		// Count - We only count to 2
 		*count = 1;
+		return true;
 	} else if (*count == 1) {
-		// Insert the first values
-		phi[0] = *past_y;
-		phi[NP] = *past_u;
-		phi[NP + NZ] = *past_e;
+		// The first values are inserted below, there is nothing to shift yet
 		*count = 2; // No more - Every time when we start rls again from rest, we set k = 0
 	} else {
 		/*
@@ -68,43 +221,32 @@ void rls(uint8_t NP, uint8_t NZ, uint8_t NZE, float theta[], float u, float y, u
 		 * From [-y(t-1), -y(t-2), -y(t-3), -y(t-4), -y(t-5)...]
 		 * To [-y(t-1), -y(t-1), -y(t-2), -y(t-3), -y(t-4)...]
 		 */
-		// Shift 1 step for y
-		for (uint8_t i = NP - 2; i >= 0; i--) {
-			phi[i + 1] = phi[i];
-			if (i == 0)
-				break;
-		}
+		// Shift 1 step for y, counting down from the end so that an order of 0 or 1 is no shift
+		for (uint8_t i = NP; i > 1; i--)
+			phi[i - 1] = phi[i - 2];
 		// Shift 1 step for u
-		for (uint8_t i = NZ - 2; i >= 0; i--) {
-			phi[i + NP + 1] = phi[i + NP];
-			if (i == 0)
-				break;
-		}
+		for (uint8_t i = NZ; i > 1; i--)
+			phi[i - 1 + NP] = phi[i - 2 + NP];
 		// Shift 1 step for e
-		for (uint8_t i = NZE - 2; i >= 0; i--) {
-			phi[i + NP + NZ + 1] = phi[i + NP + NZ];
-			if (i == 0)
-				break;
-		}
+		for (uint8_t i = NZE; i > 1; i--)
+			phi[i - 1 + NP + NZ] = phi[i - 2 + NP + NZ];
+	}
 
-		// Insert the values at first e.g y(t) = -y(t-1)
+	// Insert the values at first e.g y(t) = -y(t-1), a part of order 0 has no value to insert
+	if (NP > 0)
 		phi[0] = *past_y;
+	if (NZ > 0)
 		phi[0 + NP] = *past_u;
+	if (NZE > 0)
 		phi[0 + NP + NZ] = *past_e;
-	}
-	// Call recursive
-	recursive(NP, NZ, NZE, y, phi, theta, P, past_e, forgetting);
-
-	// Set the past values
-	*past_y = -y;
-	*past_u = u;
+	return false;
 }
 
 /*
  * This function is the updater for theta, P and past_e
  */
 static void recursive(uint8_t NP, uint8_t NZ, uint8_t NZE, float y, float phi[], float theta[],
-		      float P[], float *past_e, float forgetting)
+		      float P[], float *past_e, float forgetting, struct ctl_workspace *ws)
 {
 	// Compute error = y - phi'*theta;
 	float sum = 0;
@@ -116,37 +258,136 @@ static void recursive(uint8_t NP, uint8_t NZ, uint8_t NZE, float y, float phi[],
 	/* Compute: P = 1/l*(P - P*phi*phi'*P/(l + phi'*P*phi)); */
 
 	// Step 1: phiTP = phi'*P - > 1 row matrix
-	float phiTP[NP + NZ + NZE];
+	size_t mark = ctl_workspace_mark(ws);
+	uint16_t n = NP + NZ + NZE;
+	float *phiTP = ctl_workspace_floats(ws, n);
 
-	mul(phi, P, phiTP, 1, NP + NZ + NZE, NP + NZ + NZE); // We pretend that phi is transpose
+	mul(phi, P, phiTP, 1, n, n); // We pretend that phi is transpose
 
 	// Step 2: Pphi = P*phi -> Vector
-	float Pphi[NP + NZ + NZE];
+	float *Pphi = ctl_workspace_floats(ws, n);
 
-	mul(P, phi, Pphi, NP + NZ + NZE, NP + NZ + NZE, 1);
+	mul(P, phi, Pphi, n, n, 1);
 
 	// Step 3: l + phiTP*phi = l + phi'*P*phi
 	sum = 0;
-	for (uint8_t i = 0; i < NP + NZ + NZE; i++)
+	for (uint16_t i = 0; i < n; i++)
 		sum += phiTP[i] * phi[i];
 	sum += forgetting; // Our LAMBDA
 
-	// Step 4: Pphi*phiTP = P*phi*phi'*P -> Matrix
-	float PphiphiTP[(NP + NZ + NZE) * (NP + NZ + NZE)];
+	// Step 4: Compute P = 1/l*(P - 1/sum*Pphi*phiTP) row by row, without forming Pphi*phiTP
+	for (uint16_t i = 0; i < n; i++) {
+		float *row = &P[i * n];
 
-	mul(Pphi, phiTP, PphiphiTP, NP + NZ + NZE, 1, NP + NZ + NZE);
-
-	// Step 5: Compute P = 1/l*(P - 1/sum*PphiphiTP);
-	for (int i = 0; i < (NP + NZ + NZE) * (NP + NZ + NZE); i++)
-		P[i] = 1 / forgetting * (P[i] - 1 / sum * PphiphiTP[i]);
+		for (uint16_t j = 0; j < n; j++)
+			row[j] = 1 / forgetting * (row[j] - 1 / sum * (Pphi[i] * phiTP[j]));
+	}
 
 	// Compute theta = theta + P*phi*error;
-	mul(P, phi, Pphi, NP + NZ + NZE, NP + NZ + NZE, 1);
+	mul(P, phi, Pphi, n, n, 1);
 
 	// Compute theta = theta + Pphi*error
-	for (int i = 0; i < NP + NZ + NZE; i++) {
+	for (uint16_t i = 0; i < n; i++) {
 		theta[i] = theta[i] + Pphi[i] * *past_e;
 	}
+
+	ctl_workspace_release(ws, mark);
+}
+
+/*
+ * Bierman's UD measurement update with measurement variance l, followed by D = D/l
+ * f = U'*phi, v = D*f, then column by column
+ * a_j = a_(j-1) + f_j*v_j, d_j = d_j*a_(j-1)/a_j, U(:, j) = U(:, j) - f_j/a_(j-1)*b,
+ * b = b + U_old(:, j)*v_j, b_j = v_j. The gain is b/a_n
+ * b [n]
+ */
+static void recursive_ud(uint16_t n, float y, float phi[], float theta[], float UD[],
+			 float *past_e, float forgetting, float b[])
+{
+	// Compute error = y - phi'*theta;
+	float sum = 0;
+
+	for (uint16_t i = 0; i < n; i++)
+		sum += phi[i] * theta[i];
+	*past_e = y - sum;
+
+	float alpha = forgetting;
+
+	for (uint16_t j = 0; j < n; j++) {
+		float *column = &UD[j * (j + 1) / 2];
+
+		// f_j = (U'*phi)_j, only column j of U is used and it is not updated yet
+		float f = ctl_dot(column, phi, j) + phi[j];
+
+		float v = column[j] * f;
+		float alpha_past = alpha;
+
+		alpha += f * v;
+		column[j] *= alpha_past / (alpha * forgetting);
+
+		float lambda = -f / alpha_past;
+
+		for (uint16_t i = 0; i < j; i++) {
+			float U = column[i];
+
+			column[i] = U + b[i] * lambda;
+			b[i] += U * v;
+		}
+		b[j] = v;
+	}
+
+	// Compute theta = theta + b/a*error
+	float gain = *past_e / alpha;
+
+	for (uint16_t i = 0; i < n; i++)
+		theta[i] += b[i] * gain;
+}
+
+/*
+ * P = 1/l*(P - P*phi*phi'*P/(l + phi'*P*phi)) on the upper triangle only,
+ * theta = theta + P*phi/(l + phi'*P*phi)*error, which is the new P times phi times the error
+ * Pphi [n]
+ */
+static void recursive_packed(uint16_t n, float y, float phi[], float theta[], float P[],
+			     float *past_e, float forgetting, float Pphi[])
+{
+	// Compute error = y - phi'*theta;
+	float sum = 0;
+
+	for (uint16_t i = 0; i < n; i++)
+		sum += phi[i] * theta[i];
+	*past_e = y - sum;
+
+	// Pphi = P*phi from the upper triangle
+	memset(Pphi, 0, n * sizeof(float));
+	for (uint16_t j = 0; j < n; j++) {
+		float *column = &P[j * (j + 1) / 2];
+		float dot = ctl_dot(column, phi, j);
+
+		for (uint16_t i = 0; i < j; i++)
+			Pphi[i] += column[i] * phi[j];
+		Pphi[j] += dot + column[j] * phi[j];
+	}
+
+	// l + phi'*P*phi
+	sum = forgetting;
+	for (uint16_t i = 0; i < n; i++)
+		sum += phi[i] * Pphi[i];
+
+	float scale = 1 / forgetting;
+	float gain = 1 / sum;
+
+	for (uint16_t j = 0; j < n; j++) {
+		float *column = &P[j * (j + 1) / 2];
+		float k = Pphi[j] * gain;
+
+		for (uint16_t i = 0; i <= j; i++)
+			column[i] = scale * (column[i] - Pphi[i] * k);
+	}
+
+	gain *= *past_e;
+	for (uint16_t i = 0; i < n; i++)
+		theta[i] += Pphi[i] * gain;
 }
 
 /*
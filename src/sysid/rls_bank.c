@@ -0,0 +1,213 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Copyright 2022 Martin Schröder <info@swedishembedded.com>
+ * Consulting: https://swedishembedded.com/consulting
+ * Simulation: https://swedishembedded.com/simulation
+ * Training: https://swedishembedded.com/training
+ */
+
+#include <string.h>
+
+#include <control/sysid.h>
+
+static void reset(struct rls_bank *bank);
+static void shift(float phi[], uint8_t order, uint16_t channels);
+
+/*
+ * A bank of rls_packed estimators with the same NP, NZ and NZE, one per channel.
+ * Every array is stored channel fastest (structure of arrays): parameter k of channel c
+ * is theta[k*channels + c] and element (i, j), i <= j, of the packed P of channel c is
+ * P[(i + j*(j + 1)/2)*channels + c]. So every step of the update is the same operation on
+ * all channels at once, which the compiler turns into SIMD lanes across the channels.
+ * Everything, including the scratch of the update, lives in ws for as long as the bank
+ * is used.
+ * Pq > 0
+ * 0 < forgetting <= 1
+ */
+size_t rls_bank_workspace_size(uint8_t NP, uint8_t NZ, uint8_t NZE, uint16_t channels)
+{
+	uint16_t n = NP + NZ + NZE;
+	size_t packed = (size_t)n * (n + 1) / 2;
+
+	return 3 * CTL_WORKSPACE_FLOATS((size_t)n * channels) +
+	       CTL_WORKSPACE_FLOATS(packed * channels) + 5 * CTL_WORKSPACE_FLOATS(channels);
+}
+
+/*
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small
+ */
+uint8_t rls_bank_init(struct rls_bank *bank, uint8_t NP, uint8_t NZ, uint8_t NZE,
+		      uint16_t channels, float Pq, float forgetting, struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < rls_bank_workspace_size(NP, NZ, NZE, channels))
+		return 0;
+
+	uint16_t n = NP + NZ + NZE;
+
+	bank->theta = ctl_workspace_floats(ws, (size_t)n * channels);
+	bank->phi = ctl_workspace_floats(ws, (size_t)n * channels);
+	bank->Pphi = ctl_workspace_floats(ws, (size_t)n * channels);
+	bank->P = ctl_workspace_floats(ws, (size_t)n * (n + 1) / 2 * channels);
+	bank->past_e = ctl_workspace_floats(ws, channels);
+	bank->past_y = ctl_workspace_floats(ws, channels);
+	bank->past_u = ctl_workspace_floats(ws, channels);
+	bank->sum = ctl_workspace_floats(ws, channels);
+	bank->gain = ctl_workspace_floats(ws, channels);
+	bank->Pq = Pq;
+	bank->forgetting = forgetting;
+	bank->channels = channels;
+	bank->NP = NP;
+	bank->NZ = NZ;
+	bank->NZE = NZE;
+	bank->count = 0;
+	return 1;
+}
+
+/*
+ * One sample of every channel, the same as calling rls_packed once per channel
+ * u [channels]
+ * y [channels]
+ * Setting bank->count = 0 starts all estimators over, like count does for rls
+ */
+void rls_bank_update(struct rls_bank *bank, const float u[], const float y[])
+{
+	uint16_t N = bank->channels;
+	uint8_t NP = bank->NP;
+	uint8_t NZ = bank->NZ;
+	uint16_t n = NP + NZ + bank->NZE;
+	float *phi = bank->phi;
+	float *theta = bank->theta;
+	float *Pphi = bank->Pphi;
+	float *sum = bank->sum;
+	float *gain = bank->gain;
+	float *e = bank->past_e;
+
+	if (bank->count == 0) {
+		reset(bank);
+		bank->count = 1;
+	} else {
+		if (bank->count == 1)
+			bank->count = 2;
+		else {
+			shift(phi, NP, N);
+			shift(&phi[(size_t)NP * N], NZ, N);
+			shift(&phi[(size_t)(NP + NZ) * N], bank->NZE, N);
+		}
+		// A part of order 0 has no value to insert
+		if (NP > 0)
+			memcpy(phi, bank->past_y, N * sizeof(float));
+		if (NZ > 0)
+			memcpy(&phi[(size_t)NP * N], bank->past_u, N * sizeof(float));
+		if (bank->NZE > 0)
+			memcpy(&phi[(size_t)(NP + NZ) * N], e, N * sizeof(float));
+	}
+
+	// e = y - phi'*theta
+	memcpy(e, y, N * sizeof(float));
+	for (uint16_t k = 0; k < n; k++) {
+		const float *phi_k = &phi[(size_t)k * N];
+		const float *theta_k = &theta[(size_t)k * N];
+
+		for (uint16_t c = 0; c < N; c++)
+			e[c] -= phi_k[c] * theta_k[c];
+	}
+
+	// Pphi = P*phi from the upper triangle
+	memset(Pphi, 0, (size_t)n * N * sizeof(float));
+	for (uint16_t j = 0; j < n; j++) {
+		const float *column = &bank->P[(size_t)j * (j + 1) / 2 * N];
+		const float *phi_j = &phi[(size_t)j * N];
+		float *Pphi_j = &Pphi[(size_t)j * N];
+
+		for (uint16_t i = 0; i < j; i++) {
+			const float *Pij = &column[(size_t)i * N];
+			const float *phi_i = &phi[(size_t)i * N];
+			float *Pphi_i = &Pphi[(size_t)i * N];
+
+			for (uint16_t c = 0; c < N; c++) {
+				Pphi_i[c] += Pij[c] * phi_j[c];
+				Pphi_j[c] += Pij[c] * phi_i[c];
+			}
+		}
+		for (uint16_t c = 0; c < N; c++)
+			Pphi_j[c] += column[(size_t)j * N + c] * phi_j[c];
+	}
+
+	// sum = l + phi'*P*phi
+	for (uint16_t c = 0; c < N; c++)
+		sum[c] = bank->forgetting;
+	for (uint16_t k = 0; k < n; k++) {
+		const float *phi_k = &phi[(size_t)k * N];
+		const float *Pphi_k = &Pphi[(size_t)k * N];
+
+		for (uint16_t c = 0; c < N; c++)
+			sum[c] += phi_k[c] * Pphi_k[c];
+	}
+	for (uint16_t c = 0; c < N; c++)
+		gain[c] = 1 / sum[c];
+
+	// P = 1/l*(P - P*phi*phi'*P/sum)
+	float scale = 1 / bank->forgetting;
+
+	for (uint16_t j = 0; j < n; j++) {
+		float *column = &bank->P[(size_t)j * (j + 1) / 2 * N];
+		const float *Pphi_j = &Pphi[(size_t)j * N];
+
+		for (uint16_t i = 0; i <= j; i++) {
+			float *Pij = &column[(size_t)i * N];
+			const float *Pphi_i = &Pphi[(size_t)i * N];
+
+			for (uint16_t c = 0; c < N; c++)
+				Pij[c] = scale * (Pij[c] - Pphi_i[c] * (Pphi_j[c] * gain[c]));
+		}
+	}
+
+	// theta = theta + P*phi/sum*e
+	for (uint16_t c = 0; c < N; c++)
+		gain[c] *= e[c];
+	for (uint16_t k = 0; k < n; k++) {
+		float *theta_k = &theta[(size_t)k * N];
+		const float *Pphi_k = &Pphi[(size_t)k * N];
+
+		for (uint16_t c = 0; c < N; c++)
+			theta_k[c] += Pphi_k[c] * gain[c];
+	}
+
+	// Set the past values
+	for (uint16_t c = 0; c < N; c++) {
+		bank->past_y[c] = -y[c];
+		bank->past_u[c] = u[c];
+	}
+}
+
+/*
+ * theta = 0, phi = 0, the past = 0 and P = Pq*I on every channel
+ */
+static void reset(struct rls_bank *bank)
+{
+	uint16_t N = bank->channels;
+	uint16_t n = bank->NP + bank->NZ + bank->NZE;
+
+	memset(bank->theta, 0, (size_t)n * N * sizeof(float));
+	memset(bank->phi, 0, (size_t)n * N * sizeof(float));
+	memset(bank->P, 0, (size_t)n * (n + 1) / 2 * N * sizeof(float));
+	for (uint16_t j = 0; j < n; j++) {
+		float *Pjj = &bank->P[((size_t)j * (j + 1) / 2 + j) * N];
+
+		for (uint16_t c = 0; c < N; c++)
+			Pjj[c] = bank->Pq;
+	}
+	memset(bank->past_e, 0, N * sizeof(float));
+	memset(bank->past_y, 0, N * sizeof(float));
+	memset(bank->past_u, 0, N * sizeof(float));
+}
+
+/*
+ * Move the rows 0 ... order - 2 of one regressor block one row down
+ */
+static void shift(float phi[], uint8_t order, uint16_t channels)
+{
+	if (order > 1)
+		memmove(&phi[channels], phi, (size_t)(order - 1) * channels * sizeof(float));
+}
@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Copyright 2022 Martin Schröder <info@swedishembedded.com>
+ * Consulting: https://swedishembedded.com/consulting
+ * Simulation: https://swedishembedded.com/simulation
+ * Training: https://swedishembedded.com/training
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <control/sysid.h>
+
+#include "linalg/dot.h"
+
+// Error feedback gains of the stabilized FTF (Slock & Kailath 1991), for the backward
+// prediction error that updates the backward predictor and its error energy
+#define FTF_FEEDBACK_PREDICTOR 1.5f
+#define FTF_FEEDBACK_ENERGY 2.5f
+
+static void restart(struct rls_ftf *ctx);
+
+/*
+ * Recursive least square for a FIR model y(t) = b_1*u(t - 1) + ... + b_n*u(t - n) with the
+ * stabilized fast transversal filter. The regressor is the u part of rls()'s phi, which only
+ * shifts by one sample, so the RLS gain follows from a forward and a backward linear
+ * predictor of u instead of from P. That is O(n) per sample and O(n) memory instead of
+ * O(n^2), for long impulse responses.
+ * The backward prediction error is computed both from the gain and directly, and their
+ * difference is fed back into the recursions, which keeps the round-off from growing.
+ * If the conversion factor still leaves (0, 1], the regressor and the predictors are
+ * restarted and theta is kept.
+ * Pq > 0, the initial covariance like for rls
+ * 1 - 1/(2*n) < forgetting < 1, the error feedback only damps the round-off in that range
+ */
+size_t rls_ftf_workspace_size(uint16_t n)
+{
+	return 5 * CTL_WORKSPACE_FLOATS(n) + CTL_WORKSPACE_FLOATS(n + 1);
+}
+
+/*
+ * Returns 1 == Success
+ * Returns 0 == Fail, n is 0 or the workspace is too small
+ */
+uint8_t rls_ftf_init(struct rls_ftf *ctx, uint16_t n, float Pq, float forgetting,
+		     struct ctl_workspace *ws)
+{
+	if (n == 0 || ctl_workspace_available(ws) < rls_ftf_workspace_size(n))
+		return 0;
+
+	ctx->theta = ctl_workspace_floats(ws, n);
+	ctx->wf = ctl_workspace_floats(ws, n);
+	ctx->wb = ctl_workspace_floats(ws, n);
+	ctx->k = ctl_workspace_floats(ws, n);
+	ctx->k1 = ctl_workspace_floats(ws, n);
+	ctx->x = ctl_workspace_floats(ws, n + 1);
+	ctx->Pq = Pq;
+	ctx->forgetting = forgetting;
+	ctx->n = n;
+	ctx->restarts = 0;
+	ctx->past_u = 0;
+
+	memset(ctx->theta, 0, n * sizeof(float));
+	restart(ctx);
+	return 1;
+}
+
+/*
+ * One sample of the input u(t) and the output y(t)
+ * Returns 1 == Success
+ * Returns 0 == Fail, the predictors lost positivity and were restarted
+ */
+uint8_t rls_ftf_update(struct rls_ftf *ctx, float u, float y)
+{
+	uint16_t n = ctx->n;
+	float l = ctx->forgetting;
+	float *x = ctx->x;
+	float *k = ctx->k;
+	float *k1 = ctx->k1;
+	float *wf = ctx->wf;
+	float *wb = ctx->wb;
+	float v = ctx->past_u;
+
+	ctx->past_u = u;
+
+	// Forward prediction of v(t) = u(t - 1) from x(t - 1), which is still x[0 ... n - 1]
+	float ef = v - ctl_dot(wf, x, n);
+	float scale = ef / (l * ctx->alpha_f);
+
+	// Extended gain [k1; c] = [0; k] + [1; -wf]*ef/(l*alpha_f), k1 is its first n elements
+	float k10 = scale;
+	float c = k[n - 1] - wf[n - 1] * scale;
+
+	for (uint16_t i = n - 1; i > 0; i--)
+		k1[i] = k[i - 1] - wf[i - 1] * scale;
+	k1[0] = k10;
+
+	float gamma1_inv = 1 / ctx->gamma + ef * k10;
+
+	ctx->alpha_f = l * ctx->alpha_f + ef * ef * ctx->gamma;
+	for (uint16_t i = 0; i < n; i++)
+		wf[i] += k[i] * (ef * ctx->gamma);
+
+	// x(t) = [v(t); x(t - 1)], x[n] = v(t - n) drops out of the regressor
+	memmove(&x[1], x, n * sizeof(float));
+	x[0] = v;
+
+	// Backward prediction error from the gain and computed directly
+	float la_b = l * ctx->alpha_b;
+	float eb_gain = la_b * c;
+	float eb = x[n] - ctl_dot(wb, x, n);
+	float eb1 = eb_gain + FTF_FEEDBACK_PREDICTOR * (eb - eb_gain);
+	float eb2 = eb_gain + FTF_FEEDBACK_ENERGY * (eb - eb_gain);
+
+	// The gain and the conversion factor take the direct one
+	c = eb / la_b;
+	for (uint16_t i = 0; i < n; i++)
+		k[i] = k1[i] + c * wb[i];
+
+	float gamma = 1 / (gamma1_inv - c * eb);
+
+	if (!(gamma > 0 && gamma <= 1)) {
+		restart(ctx);
+		ctx->restarts++;
+		return 0;
+	}
+	ctx->gamma = gamma;
+	ctx->alpha_b = la_b + eb2 * eb2 * gamma;
+	for (uint16_t i = 0; i < n; i++)
+		wb[i] += k[i] * (eb1 * gamma);
+
+	// theta = theta + k*gamma*e
+	float e = (y - ctl_dot(ctx->theta, x, n)) * gamma;
+
+	for (uint16_t i = 0; i < n; i++)
+		ctx->theta[i] += k[i] * e;
+	return 1;
+}
+
+/*
+ * Zero regressor, predictors and gain, which is an RLS that starts with P = Pq*I
+ */
+static void restart(struct rls_ftf *ctx)
+{
+	uint16_t n = ctx->n;
+
+	memset(ctx->x, 0, (n + 1) * sizeof(float));
+	memset(ctx->wf, 0, n * sizeof(float));
+	memset(ctx->wb, 0, n * sizeof(float));
+	memset(ctx->k, 0, n * sizeof(float));
+	ctx->gamma = 1;
+	ctx->alpha_f = 1 / ctx->Pq;
+	ctx->alpha_b = powf(ctx->forgetting, -(float)n) / ctx->Pq;
+}
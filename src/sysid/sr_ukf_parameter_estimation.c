@@ -17,16 +17,17 @@ static void scale_Sw_with_lambda_rls_factor(float Sw[], float lambda_rls, uint8_
 static void create_sigma_point_matrix(float W[], float what[], float Sw[], float alpha, float kappa,
 				      uint8_t L);
 static void compute_transistion_function(float D[], float W[], float x[],
-					 void (*G)(float[], float[], float[]), uint8_t L);
+					 void (*G)(float[], float[], float[]), uint8_t L,
+					 struct ctl_workspace *ws);
 static void multiply_sigma_point_matrix_to_weights(float dhat[], float D[], float Wm[], uint8_t L);
-static void create_state_estimation_error_covariance_matrix(float Sd[], float Wc[], float D[],
-							    float dhat[], float Re[], uint8_t L);
+static uint8_t create_state_estimation_error_covariance_matrix(float Sd[], float Wc[], float D[],
+							      float dhat[], float Re[], uint8_t L,
+							      struct ctl_workspace *ws);
 static void create_state_cross_covariance_matrix(float Pwd[], float Wc[], float W[], float D[],
 						 float what[], float dhat[], uint8_t L);
-static void update_state_covarariance_matrix_and_state_estimation_vector(float Sw[], float what[],
-									 float dhat[], float d[],
-									 float Sd[], float Pwd[],
-									 uint8_t L);
+static uint8_t update_state_covarariance_matrix_and_state_estimation_vector(
+	float Sw[], float what[], float dhat[], float d[], float Sd[], float Pwd[], uint8_t L,
+	struct ctl_workspace *ws);
 
 /*
  * Square Root Unscented Kalman Filter For Parameter Estimation (A better version than regular UKF)
@@ -46,12 +47,50 @@ void sr_ukf_parameter_estimation(float d[], float what[], float Re[], float x[],
 				 void (*G)(float[], float[], float[]), float lambda_rls, float Sw[],
 				 float alpha, float beta, uint8_t L)
 {
+	CTL_WORKSPACE_ON_STACK(ws, sr_ukf_parameter_estimation_workspace_size(L));
+
+	sr_ukf_parameter_estimation_ws(d, what, Re, x, G, lambda_rls, Sw, alpha, beta, L, &ws);
+}
+
+size_t sr_ukf_parameter_estimation_workspace_size(uint8_t L)
+{
+	uint8_t N = 2 * L + 1;
+	uint8_t M = 2 * L + L;
+
+	/* The largest of the private functions, they run one after the other */
+	size_t transition = 2 * CTL_WORKSPACE_FLOATS(L);
+	size_t covariance = CTL_WORKSPACE_FLOATS(M * L) + 2 * CTL_WORKSPACE_FLOATS(L) +
+			    qr_factor_workspace_size(M, L);
+	size_t update = 2 * CTL_WORKSPACE_FLOATS(L * L) + 2 * CTL_WORKSPACE_FLOATS(L);
+	size_t nested = ctl_workspace_max(ctl_workspace_max(transition, covariance), update);
+
+	return 2 * CTL_WORKSPACE_FLOATS(N) + 2 * CTL_WORKSPACE_FLOATS(L * N) +
+	       CTL_WORKSPACE_FLOATS(L) + 2 * CTL_WORKSPACE_FLOATS(L * L) + nested;
+}
+
+/*
+ * Same as sr_ukf_parameter_estimation, with all matrices taken from the workspace
+ * Returns 1 == Success
+ * Returns 0 == Fail, the workspace is too small or a Cholesky downdate made the square
+ * root covariance indefinite, which is then not usable
+ */
+uint8_t sr_ukf_parameter_estimation_ws(float d[], float what[], float Re[], float x[],
+				       void (*G)(float[], float[], float[]), float lambda_rls,
+				       float Sw[], float alpha, float beta, uint8_t L,
+				       struct ctl_workspace *ws)
+{
+	if (ctl_workspace_available(ws) < sr_ukf_parameter_estimation_workspace_size(L))
+		return 0;
+
+	size_t mark = ctl_workspace_mark(ws);
+	uint8_t status;
+
 	/* Create the size N */
 	uint8_t N = 2 * L + 1;
 
 	/* Predict: Create the weights */
-	float Wc[N];
-	float Wm[N];
+	float *Wc = ctl_workspace_floats(ws, N);
+	float *Wm = ctl_workspace_floats(ws, N);
 	float kappa = 3.0f - L; /* kappa is 3 - L for parameter estimation */
 
 	create_weights(Wc, Wm, alpha, beta, kappa, L);
@@ -60,32 +99,39 @@ void sr_ukf_parameter_estimation(float d[], float what[], float Re[], float x[],
 	scale_Sw_with_lambda_rls_factor(Sw, lambda_rls, L);
 
 	/* Predict: Create sigma point matrix for G function  */
-	float W[L * N];
+	float *W = ctl_workspace_floats(ws, L * N);
 
 	create_sigma_point_matrix(W, what, Sw, alpha, kappa, L);
 
 	/* Predict: Compute the model G */
-	float D[L * N];
+	float *D = ctl_workspace_floats(ws, L * N);
 
-	compute_transistion_function(D, W, x, G, L);
+	compute_transistion_function(D, W, x, G, L, ws);
 
 	/* Predict: Multiply sigma points to weights for dhat */
-	float dhat[L];
+	float *dhat = ctl_workspace_floats(ws, L);
 
 	multiply_sigma_point_matrix_to_weights(dhat, D, Wm, L);
 
 	/* Update: Create measurement covariance matrix */
-	float Sd[L * L];
+	float *Sd = ctl_workspace_floats(ws, L * L);
 
-	create_state_estimation_error_covariance_matrix(Sd, Wc, D, dhat, Re, L);
+	status = create_state_estimation_error_covariance_matrix(Sd, Wc, D, dhat, Re, L, ws);
+	if (status == 0)
+		goto out; // The downdate of a negative weight made it indefinite
 
 	/* Update: Create parameter covariance matrix */
-	float Pwd[L * L];
+	float *Pwd = ctl_workspace_floats(ws, L * L);
 
 	create_state_cross_covariance_matrix(Pwd, Wc, W, D, what, dhat, L);
 
 	/* Update: Perform parameter update and covariance update */
-	update_state_covarariance_matrix_and_state_estimation_vector(Sw, what, dhat, d, Sd, Pwd, L);
+	status = update_state_covarariance_matrix_and_state_estimation_vector(Sw, what, dhat, d, Sd,
+									      Pwd, L, ws);
+
+out:
+	ctl_workspace_release(ws, mark);
+	return status;
 }
 
 static void create_weights(float Wc[], float Wm[], float alpha, float beta, float kappa, uint8_t L)
@@ -144,14 +190,16 @@ static void create_sigma_point_matrix(float W[], float what[], float Sw[], float
 }
 
 static void compute_transistion_function(float D[], float W[], float x[],
-					 void (*G)(float[], float[], float[]), uint8_t L)
+					 void (*G)(float[], float[], float[]), uint8_t L,
+					 struct ctl_workspace *ws)
 {
 	/* Create the size N */
 	uint8_t N = 2 * L + 1;
 
 	/* Create the derivative state and state vector */
-	float dw[L];
-	float w[L];
+	size_t mark = ctl_workspace_mark(ws);
+	float *dw = ctl_workspace_floats(ws, L);
+	float *w = ctl_workspace_floats(ws, L);
 
 	/* Call the F transition function with W matrix */
 	for (uint8_t j = 0; j < N; j++) {
@@ -166,6 +214,8 @@ static void compute_transistion_function(float D[], float W[], float x[],
 		for (uint8_t i = 0; i < L; i++)
 			D[i * N + j] = dw[i];
 	}
+
+	ctl_workspace_release(ws, mark);
 }
 
 static void multiply_sigma_point_matrix_to_weights(float dhat[], float D[], float Wm[], uint8_t L)
@@ -182,8 +232,9 @@ static void multiply_sigma_point_matrix_to_weights(float dhat[], float D[], floa
 			dhat[i] += Wm[j] * D[i * N + j];
 }
 
-static void create_state_estimation_error_covariance_matrix(float Sd[], float Wc[], float D[],
-							    float dhat[], float Re[], uint8_t L)
+static uint8_t create_state_estimation_error_covariance_matrix(float Sd[], float Wc[], float D[],
+							      float dhat[], float Re[], uint8_t L,
+							      struct ctl_workspace *ws)
 {
 	/* Create the size N, M and K */
 	uint8_t N = 2 * L + 1;
@@ -194,100 +245,80 @@ static void create_state_estimation_error_covariance_matrix(float Sd[], float Wc
 	float weight1 = sqrtf(fabsf(Wc[1]));
 
 	/* Create [Q, R_] = qr(A') */
-	float AT[L * M];
-	float Q[M * M];
-	float R[M * L];
+	size_t mark = ctl_workspace_mark(ws);
+	float *AT = ctl_workspace_floats(ws, M * L);
+	float *tau = ctl_workspace_floats(ws, L);
 
+	/* We need to do transpose on A according to the SR-UKF paper, so A' is filled directly */
 	for (uint8_t j = 0; j < K; j++) {
 		for (uint8_t i = 0; i < L; i++) {
-			AT[i * M + j] = weight1 * (D[i * N + j + 1] - dhat[i]);
+			AT[j * L + i] = weight1 * (D[i * N + j + 1] - dhat[i]);
 		}
 	}
 	for (uint8_t j = K; j < M; j++)
 		for (uint8_t i = 0; i < L; i++)
-			AT[i * M + j] = sqrtf(Re[i * L + j - K]);
+			AT[j * L + i] = sqrtf(Re[i * L + j - K]);
 
-	/* We need to do transpose on A according to the SR-UKF paper */
-	tran(AT, L, M);
-
-	/* Solve [Q, R] = qr(A') but we only need R matrix */
-	qr(AT, Q, R, M, L, true);
+	/* Solve [Q, R] = qr(A') but we only need R matrix, so A' is factored in place */
+	qr_factor_ws(AT, tau, M, L, ws);
 
 	/* Get the upper triangular of R according to the SR-UKF paper */
-	memcpy(Sd, R, L * L * sizeof(float));
+	for (uint8_t i = 0; i < L; i++)
+		for (uint8_t j = 0; j < L; j++)
+			Sd[i * L + j] = j < i ? 0.0f : AT[i * L + j];
 
 	/* Perform cholesky update on Sd */
-	float b[L];
+	float *b = ctl_workspace_floats(ws, L);
 
 	for (uint8_t i = 0; i < L; i++)
 		b[i] = D[i * N] - dhat[i];
 
 	bool rank_one_update = Wc[0] < 0.0f ? false : true;
 
-	cholupdate(Sd, b, L, rank_one_update);
+	uint8_t status = cholupdate_upper(Sd, b, L, rank_one_update);
+
+	ctl_workspace_release(ws, mark);
+	return status;
 }
 
 static void create_state_cross_covariance_matrix(float Pwd[], float Wc[], float W[], float D[],
 						 float what[], float dhat[], uint8_t L)
 {
-	/* Create the size N and K */
+	/* Create the size N */
 	uint8_t N = 2 * L + 1;
-	uint8_t K = 2 * L;
 
-	/* clear P */
-	memset(Pwd, 0, K * sizeof(float));
-
-	/* Subtract the matrices */
+	/* Subtract the matrices and weight the columns of W, W = (W - what)*diagonal_W */
 	for (uint8_t j = 0; j < N; j++) {
 		for (uint8_t i = 0; i < L; i++) {
-			W[i * N + j] -= what[i];
+			W[i * N + j] = Wc[j] * (W[i * N + j] - what[i]);
 			D[i * N + j] -= dhat[i];
 		}
 	}
 
-	/* Create diagonal matrix */
-	float diagonal_W[N * N];
-
-	memset(diagonal_W, 0, N * N * sizeof(float));
-	for (uint8_t i = 0; i < N; i++)
-		diagonal_W[i * N + i] = Wc[i];
-
-	/* Do Pwd = W*diagonal_W*D' */
-	tran(D, L, N);
-	float diagonal_WD[N * L];
-
-	mul(diagonal_W, D, diagonal_WD, N, N, L);
-	mul(W, diagonal_WD, Pwd, L, N, L);
+	/* Do Pwd = W*diagonal_W*D', D' is read in place */
+	gemm(false, true, 1.0f, W, D, 0.0f, Pwd, L, L, N);
 }
 
 // Sw, what, dhat, d, Sd, Pwd, L
-static void update_state_covarariance_matrix_and_state_estimation_vector(float Sw[], float what[],
-									 float dhat[], float d[],
-									 float Sd[], float Pwd[],
-									 uint8_t L)
+static uint8_t update_state_covarariance_matrix_and_state_estimation_vector(
+	float Sw[], float what[], float dhat[], float d[], float Sd[], float Pwd[], uint8_t L,
+	struct ctl_workspace *ws)
 {
-	/* Transpose of Sd */
-	float SdT[L * L];
-
-	memcpy(SdT, Sd, L * L * sizeof(float));
-	tran(SdT, L, L);
-
-	/* Multiply Sd and Sd' to Sd'Sd */
-	float SdTSd[L * L];
+	size_t mark = ctl_workspace_mark(ws);
 
-	mul(SdT, Sd, SdTSd, L, L, L);
+	/*
+	 * Compute kalman gain K from K * Sd'Sd = Pwd. Sd is upper triangular, so
+	 * K = Pwd * inv(Sd) * inv(Sd') is two triangular solves without forming Sd'Sd
+	 */
+	float *K = ctl_workspace_floats(ws, L * L);
 
-	/* Take inverse of Sd'Sd - Inverse is using LUP-decomposition */
-	inv(SdTSd, L);
-
-	/* Compute kalman gain K from Sd'Sd * K = Pwd => K = Pwd * inv(SdTSd) */
-	float K[L * L];
-
-	mul(Pwd, SdTSd, K, L, L, L);
+	memcpy(K, Pwd, L * L * sizeof(float));
+	trsm(false, true, false, Sd, K, L, L);
+	trsm(false, true, true, Sd, K, L, L);
 
 	/* Compute what = what + K*(d - dhat) */
-	float ddhat[L];
-	float Kd[L];
+	float *ddhat = ctl_workspace_floats(ws, L);
+	float *Kd = ctl_workspace_floats(ws, L);
 
 	for (uint8_t i = 0; i < L; i++)
 		ddhat[i] = d[i] - dhat[i];
@@ -295,17 +326,14 @@ static void update_state_covarariance_matrix_and_state_estimation_vector(float S
 	for (uint8_t i = 0; i < L; i++)
 		what[i] = what[i] + Kd[i];
 
-	/* Compute U = K*Sd */
-	float U[L * L];
+	/* Compute U = K*Sd, stored as U' = Sd'*K' so that the columns of U are rows */
+	float *UT = ctl_workspace_floats(ws, L * L);
 
-	mul(K, Sd, U, L, L, L);
+	gemm(true, true, 1.0f, Sd, K, 0.0f, UT, L, L, L);
 
-	/* Compute Sw = cholupdate(Sw, Uk, -1) because Uk is a vector and U is a matrix */
-	float Uk[L];
+	/* Compute Sw = cholupdate(Sw, U, -1) with all columns of U in one pass over Sw */
+	uint8_t status = cholupdate_k_upper(Sw, UT, L, L, false);
 
-	for (uint8_t j = 0; j < L; j++) {
-		for (uint8_t i = 0; i < L; i++)
-			Uk[i] = U[i * L + j];
-		cholupdate(Sw, Uk, L, false);
-	}
+	ctl_workspace_release(ws, mark);
+	return status;
 }
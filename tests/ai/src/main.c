@@ -9,7 +9,10 @@
  */
 
 #include <unity.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <control/ai.h>
 
 #define height_map 15
@@ -124,6 +127,204 @@ void test_astar_search(void)
 		printf("x = %d, y = %d\n", path_x[i], path_y[i]);
 }
 
+void test_astar_ws(void)
+{
+	// A wall with one gap, the shortest way around it is known
+	enum { height = 7, width = 9 };
+	int map[height * width] = { 0 };
+	int copy[height * width];
+	int path_x[height * width];
+	int path_y[height * width];
+	int steps = 0;
+	static uint8_t pool[4096];
+	struct ctl_workspace ws;
+
+	for (int y = 0; y < height - 1; y++)
+		map[y * width + 4] = -1;
+	memcpy(copy, map, sizeof(map));
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_EQUAL(1, astar_ws(map, path_x, path_y, 1, 1, 7, 1, height, width, 4, &steps,
+				      &ws));
+	TEST_ASSERT_EQUAL_INT_ARRAY(copy, map, height * width);
+
+	// Start, 5 steps down to the gap, 6 across and 5 up again
+	TEST_ASSERT_EQUAL(17, steps);
+	TEST_ASSERT_EQUAL(1, path_x[0]);
+	TEST_ASSERT_EQUAL(1, path_y[0]);
+	TEST_ASSERT_EQUAL(7, path_x[steps - 1]);
+	TEST_ASSERT_EQUAL(1, path_y[steps - 1]);
+	for (int i = 1; i < steps; i++) {
+		int dx = abs(path_x[i] - path_x[i - 1]);
+		int dy = abs(path_y[i] - path_y[i - 1]);
+
+		TEST_ASSERT_EQUAL(1, dx + dy);
+		TEST_ASSERT_NOT_EQUAL(-1, map[path_y[i] * width + path_x[i]]);
+	}
+
+	// 5 steps to (3, 6), through the gap to (5, 6) without cutting its corners and 5 up
+	TEST_ASSERT_EQUAL(1, astar_ws(map, path_x, path_y, 1, 1, 7, 1, height, width, 8, &steps,
+				      &ws));
+	TEST_ASSERT_EQUAL(13, steps);
+	for (int i = 1; i < steps; i++) {
+		TEST_ASSERT_LESS_OR_EQUAL(1, abs(path_x[i] - path_x[i - 1]));
+		TEST_ASSERT_LESS_OR_EQUAL(1, abs(path_y[i] - path_y[i - 1]));
+	}
+
+	// Close the gap
+	map[(height - 1) * width + 4] = -1;
+	TEST_ASSERT_EQUAL(0, astar_ws(map, path_x, path_y, 1, 1, 7, 1, height, width, 8, &steps,
+				      &ws));
+	TEST_ASSERT_EQUAL(0, steps);
+
+	// Too small workspace
+	ctl_workspace_init(&ws, pool, 16);
+	TEST_ASSERT_EQUAL(0, astar_ws(map, path_x, path_y, 1, 1, 7, 1, height, width, 4, &steps,
+				      &ws));
+}
+
+/*
+ * Cost of a path in tenths of a step, 10 straight and 14 diagonally
+ */
+static int path_cost(int path_x[], int path_y[], int steps)
+{
+	int cost = 0;
+
+	for (int i = 1; i < steps; i++)
+		cost += path_x[i] != path_x[i - 1] && path_y[i] != path_y[i - 1] ? 14 : 10;
+	return cost;
+}
+
+void test_jps(void)
+{
+	// Shelves with a few random obstacles in the aisles
+	enum { height = 40, width = 45 };
+	int map[height * width] = { 0 };
+	int copy[height * width];
+	int path_x[height * width];
+	int path_y[height * width];
+	int astar_x[height * width];
+	int astar_y[height * width];
+	int steps = 0;
+	int astar_steps = 0;
+	uint32_t seed = 1;
+	static uint8_t pool[65536];
+	struct ctl_workspace ws;
+
+	for (int y = 3; y < height - 3; y += 4)
+		for (int x = 2; x < width - 2; x++)
+			if (x % 10 < 7)
+				map[y * width + x] = -1;
+	for (int i = 0; i < 60; i++) {
+		seed = seed * 1664525 + 1013904223;
+		map[(seed >> 8) % (height * width)] = -1;
+	}
+	map[0] = 0;
+	map[height * width - 1] = 0;
+	memcpy(copy, map, sizeof(map));
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_EQUAL(1, jps_ws(map, path_x, path_y, 0, 0, width - 1, height - 1, height, width,
+				    &steps, &ws));
+	TEST_ASSERT_EQUAL(1, astar_ws(map, astar_x, astar_y, 0, 0, width - 1, height - 1, height,
+				      width, 8, &astar_steps, &ws));
+	TEST_ASSERT_EQUAL_INT_ARRAY(copy, map, height * width);
+
+	// A path as short as the one of A*, cell by cell around the obstacles
+	TEST_ASSERT_EQUAL(path_cost(astar_x, astar_y, astar_steps),
+			  path_cost(path_x, path_y, steps));
+	TEST_ASSERT_EQUAL(0, path_x[0]);
+	TEST_ASSERT_EQUAL(0, path_y[0]);
+	TEST_ASSERT_EQUAL(width - 1, path_x[steps - 1]);
+	TEST_ASSERT_EQUAL(height - 1, path_y[steps - 1]);
+	for (int i = 1; i < steps; i++) {
+		TEST_ASSERT_LESS_OR_EQUAL(1, abs(path_x[i] - path_x[i - 1]));
+		TEST_ASSERT_LESS_OR_EQUAL(1, abs(path_y[i] - path_y[i - 1]));
+		TEST_ASSERT_NOT_EQUAL(-1, map[path_y[i] * width + path_x[i]]);
+		TEST_ASSERT_NOT_EQUAL(-1, map[path_y[i - 1] * width + path_x[i]]);
+		TEST_ASSERT_NOT_EQUAL(-1, map[path_y[i] * width + path_x[i - 1]]);
+	}
+
+	// Wall off the stop
+	map[(height - 2) * width + width - 1] = -1;
+	map[(height - 2) * width + width - 2] = -1;
+	map[(height - 1) * width + width - 2] = -1;
+	TEST_ASSERT_EQUAL(0, jps_ws(map, path_x, path_y, 0, 0, width - 1, height - 1, height, width,
+				    &steps, &ws));
+	TEST_ASSERT_EQUAL(0, steps);
+
+	// Too small workspace
+	ctl_workspace_init(&ws, pool, 16);
+	TEST_ASSERT_EQUAL(0, jps_ws(map, path_x, path_y, 0, 0, width - 1, height - 1, height, width,
+				    &steps, &ws));
+}
+
+void test_dstar_lite(void)
+{
+	// The wall with one gap of test_astar_ws, then the gap moves while the robot drives
+	enum { height = 7, width = 9 };
+	int map[height * width] = { 0 };
+	int path_x[height * width];
+	int path_y[height * width];
+	int astar_x[height * width];
+	int astar_y[height * width];
+	int steps = 0;
+	int astar_steps = 0;
+	static uint8_t pool[4096];
+	static uint8_t astar_pool[4096];
+	struct ctl_workspace ws;
+	struct ctl_workspace astar;
+	struct dstar_lite planner;
+
+	for (int y = 0; y < height - 1; y++)
+		map[y * width + 4] = -1;
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	ctl_workspace_init(&astar, astar_pool, sizeof(astar_pool));
+	TEST_ASSERT_EQUAL(1, dstar_lite_init(&planner, map, height, width, 8, 1, 1, 7, 1, &ws));
+	TEST_ASSERT_EQUAL(1, dstar_lite_plan(&planner, path_x, path_y, &steps));
+	TEST_ASSERT_EQUAL(13, steps);
+
+	// Close the gap, there is no way through
+	map[(height - 1) * width + 4] = -1;
+	dstar_lite_update_cell(&planner, 4, height - 1);
+	TEST_ASSERT_EQUAL(0, dstar_lite_plan(&planner, path_x, path_y, &steps));
+	TEST_ASSERT_EQUAL(0, steps);
+
+	// Open a wider one at the top and drive two steps towards it
+	for (int y = 0; y < 3; y++) {
+		map[y * width + 4] = 0;
+		dstar_lite_update_cell(&planner, 4, y);
+	}
+	TEST_ASSERT_EQUAL(1, dstar_lite_plan(&planner, path_x, path_y, &steps));
+	dstar_lite_move(&planner, path_x[2], path_y[2]);
+	TEST_ASSERT_EQUAL(1, dstar_lite_plan(&planner, path_x, path_y, &steps));
+	TEST_ASSERT_EQUAL(1, astar_ws(map, astar_x, astar_y, path_x[0], path_y[0], 7, 1, height,
+				      width, 8, &astar_steps, &astar));
+	TEST_ASSERT_EQUAL(path_cost(astar_x, astar_y, astar_steps),
+			  path_cost(path_x, path_y, steps));
+
+	// Block the next cell of the path, the repaired path goes around it
+	int x = path_x[2];
+	int y = path_y[2];
+
+	map[y * width + x] = -1;
+	dstar_lite_update_cell(&planner, x, y);
+	TEST_ASSERT_EQUAL(1, dstar_lite_plan(&planner, path_x, path_y, &steps));
+	TEST_ASSERT_EQUAL(1, astar_ws(map, astar_x, astar_y, path_x[0], path_y[0], 7, 1, height,
+				      width, 8, &astar_steps, &astar));
+	TEST_ASSERT_EQUAL(path_cost(astar_x, astar_y, astar_steps),
+			  path_cost(path_x, path_y, steps));
+	TEST_ASSERT_EQUAL(7, path_x[steps - 1]);
+	TEST_ASSERT_EQUAL(1, path_y[steps - 1]);
+	for (int i = 0; i < steps; i++)
+		TEST_ASSERT_NOT_EQUAL(-1, map[path_y[i] * width + path_x[i]]);
+
+	// Too small workspace
+	ctl_workspace_init(&ws, pool, 16);
+	TEST_ASSERT_EQUAL(0, dstar_lite_init(&planner, map, height, width, 8, 1, 1, 7, 1, &ws));
+}
+
 void test_inpoly_inside_polygon(void)
 {
 	/* Create the polygon coordinates */
@@ -152,3 +353,127 @@ void test_inpoly_inside_polygon(void)
 	ans = 1
 	>>
  */
+
+void test_inpolygon_many(void)
+{
+	float px[12] = { 47.3364, 59.7788, 65.0323, 62.5438, 51.4839, 38.7650,
+			 36.5530, 36.5530, 37.1060, 40.1475, 46.5069, 47.3364 };
+	float py[12] = { -3.2484, 6.8953, 22.4731, 32.2546,  39.5001,  33.3414,
+			 18.8504, 5.4462, -3.9730, -11.9430, -12.3053, -3.2484 };
+	static float pool[4096];
+	static float x[3000];
+	static float y[3000];
+	static uint8_t inside[3000];
+	struct ctl_workspace ws;
+	struct polygon polygon;
+
+	ctl_workspace_init(&ws, pool, 16);
+	TEST_ASSERT_FALSE(polygon_prepare(&polygon, px, py, 12, &ws));
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_TRUE(polygon_prepare(&polygon, px, py, 12, &ws));
+
+	/* The points of the Octave example above */
+	TEST_ASSERT_FALSE(inpolygon_prepared(&polygon, 65.034, 22.473));
+	TEST_ASSERT_TRUE(inpolygon_prepared(&polygon, 65.032, 22.473));
+
+	/* A grid around the bounding box, which is not a whole number of blocks */
+	for (int i = 0; i < 3000; i++) {
+		x[i] = 34.0f + 0.7f * (i % 50);
+		y[i] = -15.0f + 0.9f * (i / 50);
+	}
+	inpolygon_many(&polygon, x, y, inside, 3000);
+
+	int count = 0;
+
+	for (int i = 0; i < 3000; i++) {
+		TEST_ASSERT_EQUAL(inpolygon(x[i], y[i], px, py, 12), inside[i]);
+		TEST_ASSERT_EQUAL(inpolygon_prepared(&polygon, x[i], y[i]), inside[i]);
+		count += inside[i];
+	}
+	TEST_ASSERT_TRUE(count > 500);
+
+	/* A unit circle with 1000 points */
+	static float cx[1000];
+	static float cy[1000];
+
+	for (int i = 0; i < 1000; i++) {
+		cx[i] = cosf(2 * (float)M_PI * i / 1000);
+		cy[i] = sinf(2 * (float)M_PI * i / 1000);
+	}
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_TRUE(polygon_prepare(&polygon, cx, cy, 1000, &ws));
+	TEST_ASSERT_EQUAL(1000, polygon.edges);
+
+	for (int i = 0; i < 3000; i++) {
+		float r = i % 2 ? 0.99f : 1.01f;
+
+		x[i] = r * cosf(0.37f * i);
+		y[i] = r * sinf(0.37f * i);
+	}
+	inpolygon_many(&polygon, x, y, inside, 3000);
+	for (int i = 0; i < 3000; i++)
+		TEST_ASSERT_EQUAL(i % 2, inside[i]);
+}
+
+void test_geofence(void)
+{
+	/* 200 regular polygons of 3 to 10 points, some of them overlapping */
+	static float px[2000];
+	static float py[2000];
+	static uint32_t points[200];
+	static float pool[65536];
+	static uint32_t copy[16384];
+	struct ctl_workspace ws;
+	struct geofence *index;
+	uint32_t total = 0;
+
+	srand(3);
+	for (int z = 0; z < 200; z++) {
+		float cx = 100.0f * rand() / RAND_MAX;
+		float cy = 100.0f * rand() / RAND_MAX;
+		float r = 1.0f + 9.0f * rand() / RAND_MAX;
+
+		points[z] = 3 + z % 8;
+		for (uint32_t i = 0; i < points[z]; i++) {
+			px[total] = cx + r * cosf(2 * (float)M_PI * i / points[z]);
+			py[total] = cy + r * sinf(2 * (float)M_PI * i / points[z]);
+			total++;
+		}
+	}
+
+	ctl_workspace_init(&ws, pool, 64);
+	TEST_ASSERT_FALSE(geofence_build(&index, px, py, points, 200, 16, 16, &ws));
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_TRUE(geofence_workspace_size(px, py, points, 200, 16, 16) <= sizeof(pool));
+	TEST_ASSERT_TRUE(geofence_build(&index, px, py, points, 200, 16, 16, &ws));
+	TEST_ASSERT_TRUE(index->size <= sizeof(copy));
+
+	/* The index works the same after it was copied somewhere else */
+	memcpy(copy, index, index->size);
+
+	for (int k = 0; k < 2000; k++) {
+		float x = -5.0f + 110.0f * rand() / RAND_MAX;
+		float y = -5.0f + 110.0f * rand() / RAND_MAX;
+		uint32_t zones[200];
+		uint32_t copied[200];
+		uint32_t found = geofence_query(index, x, y, zones, 200);
+		uint32_t expected = 0;
+		uint32_t first = 0;
+
+		TEST_ASSERT_EQUAL(found,
+				  geofence_query((struct geofence *)copy, x, y, copied, 200));
+		for (uint32_t z = 0; z < 200; first += points[z++]) {
+			if (!inpolygon(x, y, &px[first], &py[first], points[z]))
+				continue;
+			TEST_ASSERT_TRUE(expected < found);
+			TEST_ASSERT_EQUAL(z, zones[expected]);
+			TEST_ASSERT_EQUAL(z, copied[expected]);
+			expected++;
+		}
+		TEST_ASSERT_EQUAL(expected, found);
+		if (found > 1)
+			TEST_ASSERT_EQUAL(1, geofence_query(index, x, y, zones, 1));
+	}
+}
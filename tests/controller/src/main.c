@@ -8,8 +8,10 @@
  ============================================================================
  */
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unity.h>
 #include <control/controller.h>
 #include <control/misc.h>
@@ -105,6 +107,76 @@ void test_control_lqi_regulator(void)
 #undef ADIM
 }
 
+void test_lqi_kalman_ctx(void)
+{
+#define ADIM 2
+#define RDIM 1
+#define YDIM 1
+
+	float A[ADIM * ADIM] = { 0.89559, 0.37735, -0.37735, 0.51825 };
+	float B[ADIM * RDIM] = { 0.20881, 0.75469 };
+	float C[YDIM * ADIM] = { 1, 0 };
+	float K[ADIM * YDIM] = { 0.58006, -0.22391 };
+	float L[RDIM * ADIM] = { 1.56766, 0.85103 };
+	float Li[RDIM] = { 0.50135 };
+	float qi = 0.1;
+	float r[RDIM] = { 25 };
+	float x[ADIM] = { 0 };
+	float xi[1] = { 0 };
+	float u[RDIM] = { 0 };
+	float x_ctx[ADIM] = { 0 };
+	float u_ctx[RDIM] = { 0 };
+	float x_fused[ADIM] = { 0 };
+	float u_fused[RDIM] = { 0 };
+	float plant[ADIM] = { 0 };
+	float y[YDIM] = { 0 };
+	struct kalman_ctx observer[2];
+	struct lqi_ctx regulator[2];
+	static uint8_t pool[1024];
+	struct ctl_workspace ws;
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	for (uint8_t i = 0; i < 2; i++) {
+		TEST_ASSERT_EQUAL(1, kalman_init(&observer[i], A, B, C, K, ADIM, YDIM, RDIM, &ws));
+		TEST_ASSERT_EQUAL(1, lqi_init(&regulator[i], L, Li, qi, ADIM, YDIM, RDIM, 0, &ws));
+	}
+
+	// The fused steps and the combined step match lqi and kalman
+	for (uint8_t k = 0; k < 100; k++) {
+		y[0] = C[0] * plant[0] + C[1] * plant[1];
+
+		lqi(y, u, qi, r, L, Li, x, xi, ADIM, YDIM, RDIM, 0);
+		kalman(A, B, C, K, u, x, y, ADIM, YDIM, RDIM);
+		lqi_step(&regulator[0], y, u_ctx, r, x_ctx);
+		kalman_step(&observer[0], u_ctx, x_ctx, y);
+		lqi_kalman_step(&regulator[1], &observer[1], y, u_fused, r, x_fused);
+
+		TEST_ASSERT_FLOAT_WITHIN(1e-3f, u[0], u_ctx[0]);
+		TEST_ASSERT_FLOAT_WITHIN(1e-3f, u[0], u_fused[0]);
+		for (uint8_t i = 0; i < ADIM; i++) {
+			TEST_ASSERT_FLOAT_WITHIN(1e-3f, x[i], x_ctx[i]);
+			TEST_ASSERT_FLOAT_WITHIN(1e-3f, x[i], x_fused[i]);
+		}
+
+		float next[ADIM];
+
+		for (uint8_t i = 0; i < ADIM; i++)
+			next[i] = A[i * ADIM] * plant[0] + A[i * ADIM + 1] * plant[1] + B[i] * u[0];
+		memcpy(plant, next, sizeof(plant));
+	}
+
+	// The output settles at the reference
+	TEST_ASSERT_FLOAT_WITHIN(0.1f, r[0], y[0]);
+
+	// Too small workspace
+	ctl_workspace_init(&ws, pool, 16);
+	TEST_ASSERT_EQUAL(0, kalman_init(&observer[0], A, B, C, K, ADIM, YDIM, RDIM, &ws));
+	TEST_ASSERT_EQUAL(0, lqi_init(&regulator[0], L, Li, qi, ADIM, YDIM, RDIM, 0, &ws));
+#undef RDIM
+#undef YDIM
+#undef ADIM
+}
+
 void test_mpi_controller(void)
 {
 #define ADIM 2
@@ -152,6 +224,184 @@ void test_mpi_controller(void)
 #undef ITERATION_LIMIT
 }
 
+void test_mpc_ctx(void)
+{
+#define ADIM 2
+#define RDIM 1
+#define YDIM 1
+#define HORIZON 20
+#define ITERATION_LIMIT 200
+
+	float A[ADIM * ADIM] = { 1.71653, 1.00000, -0.71653, 0.00000 };
+	float B[ADIM * RDIM] = { 0.18699, 0.16734 };
+	float C[YDIM * ADIM] = { 1, 0 };
+	float x[ADIM] = { 0, 0 };
+	float x_ctx[ADIM] = { 0, 0 };
+	float u[RDIM] = { 0 };
+	float u_ctx[RDIM] = { 0 };
+	float r[YDIM] = { 12.5 };
+	float K[ADIM] = { 0, 0 };
+	float y[YDIM] = { 0 };
+	struct mpc_ctx ctx;
+	static uint8_t pool[32 * 1024];
+	struct ctl_workspace ws;
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_EQUAL(1, mpc_init(&ctx, A, B, C, ADIM, YDIM, RDIM, HORIZON, ITERATION_LIMIT,
+				      true, &ws));
+
+	// The cached prediction matrices give the same inputs as building them every time
+	for (uint8_t i = 0; i < 50; i++) {
+		mpc(A, B, C, x, u, r, ADIM, YDIM, RDIM, HORIZON, ITERATION_LIMIT, true);
+		kalman(A, B, C, K, u, x, y, ADIM, YDIM, RDIM);
+		TEST_ASSERT_EQUAL(1, mpc_step(&ctx, x_ctx, u_ctx, r, &ws));
+		kalman(A, B, C, K, u_ctx, x_ctx, y, ADIM, YDIM, RDIM);
+		TEST_ASSERT_FLOAT_WITHIN(1e-3f, u[0], u_ctx[0]);
+	}
+#undef ADIM
+#undef RDIM
+#undef YDIM
+#undef HORIZON
+#undef ITERATION_LIMIT
+}
+
+void test_mpc_qp(void)
+{
+#define ADIM 2
+#define RDIM 1
+#define YDIM 1
+#define HORIZON 20
+#define ITERATION_LIMIT 100
+
+	float A[ADIM * ADIM] = { 1.71653, 1.00000, -0.71653, 0.00000 };
+	float B[ADIM * RDIM] = { 0.18699, 0.16734 };
+	float C[YDIM * ADIM] = { 1, 0 };
+	float x[ADIM] = { 0, 0 };
+	float u[RDIM] = { 0 };
+	float r[YDIM] = { 12.5 };
+	float K[ADIM] = { 0, 0 };
+	float y[YDIM] = { 0 };
+	float umin[RDIM] = { -1 };
+	float umax[RDIM] = { 1 };
+	float du_max[RDIM] = { 0.2 };
+	float u_last = 0;
+	struct mpc_ctx ctx;
+	static uint8_t pool[64 * 1024];
+	struct ctl_workspace ws;
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_EQUAL(1, mpc_init(&ctx, A, B, C, ADIM, YDIM, RDIM, HORIZON, ITERATION_LIMIT,
+				      true, &ws));
+	TEST_ASSERT_EQUAL(1, mpc_constrain(&ctx, umin, umax, du_max, 0.1f, &ws));
+
+	// The input stays in its bounds and changes slowly, the output reaches the reference
+	for (uint8_t i = 0; i < 200; i++) {
+		TEST_ASSERT_EQUAL(1, mpc_step(&ctx, x, u, r, &ws));
+		kalman(A, B, C, K, u, x, y, ADIM, YDIM, RDIM);
+		TEST_ASSERT_TRUE(u[0] >= umin[0] - 1e-4f && u[0] <= umax[0] + 1e-4f);
+		TEST_ASSERT_FLOAT_WITHIN(du_max[0] + 1e-4f, u_last, u[0]);
+		u_last = u[0];
+	}
+	printf("y = %f, u = %f\n", x[0], u[0]);
+	TEST_ASSERT_FLOAT_WITHIN(0.1f, r[0], x[0]);
+#undef ADIM
+#undef RDIM
+#undef YDIM
+#undef HORIZON
+#undef ITERATION_LIMIT
+}
+
+void test_mpc_riccati(void)
+{
+#define ADIM 2
+#define RDIM 1
+#define YDIM 1
+#define HORIZON 20
+
+	float A[ADIM * ADIM] = { 1.71653, 1.00000, -0.71653, 0.00000 };
+	float B[ADIM * RDIM] = { 0.18699, 0.16734 };
+	float C[YDIM * ADIM] = { 1, 0 };
+	float x[ADIM] = { 0, 0 };
+	float x_qp[ADIM] = { 0, 0 };
+	float u[RDIM] = { 0 };
+	float u_qp[RDIM] = { 0 };
+	float r[YDIM] = { 12.5 };
+	float K[ADIM] = { 0, 0 };
+	float y[YDIM] = { 0 };
+	float umin[RDIM] = { -1 };
+	float umax[RDIM] = { 1 };
+	float du_max[RDIM] = { 0.2 };
+	struct mpc_riccati_ctx ctx;
+	struct mpc_ctx qp;
+	static uint8_t pool[64 * 1024];
+	struct ctl_workspace ws;
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+
+	// Without constraints one pass of the recursion solves the QP of the condensed form
+	TEST_ASSERT_EQUAL(1, mpc_riccati_init(&ctx, A, B, C, ADIM, YDIM, RDIM, HORIZON, 0.1f, NULL,
+					      NULL, NULL, 1.0f, 200, &ws));
+	TEST_ASSERT_EQUAL(1, mpc_init(&qp, A, B, C, ADIM, YDIM, RDIM, HORIZON, 200, true, &ws));
+	TEST_ASSERT_EQUAL(1, mpc_constrain(&qp, NULL, NULL, NULL, 0.1f, &ws));
+	for (uint8_t i = 0; i < 20; i++) {
+		TEST_ASSERT_EQUAL(1, mpc_riccati_step(&ctx, x, u, r, &ws));
+		TEST_ASSERT_EQUAL(1, mpc_step(&qp, x_qp, u_qp, r, &ws));
+		TEST_ASSERT_FLOAT_WITHIN(1e-2f, u_qp[0], u[0]);
+		kalman(A, B, C, K, u, x, y, ADIM, YDIM, RDIM);
+		kalman(A, B, C, K, u_qp, x_qp, y, ADIM, YDIM, RDIM);
+	}
+
+	// With constraints ADMM gets close to the active set solution of the condensed form
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	memset(x, 0, sizeof(x));
+	memset(x_qp, 0, sizeof(x_qp));
+	TEST_ASSERT_EQUAL(1, mpc_riccati_init(&ctx, A, B, C, ADIM, YDIM, RDIM, HORIZON, 0.1f, umin,
+					      umax, du_max, 1.0f, 200, &ws));
+	TEST_ASSERT_EQUAL(1, mpc_init(&qp, A, B, C, ADIM, YDIM, RDIM, HORIZON, 200, true, &ws));
+	TEST_ASSERT_EQUAL(1, mpc_constrain(&qp, umin, umax, du_max, 0.1f, &ws));
+	for (uint8_t i = 0; i < 200; i++) {
+		mpc_riccati_step(&ctx, x, u, r, &ws);
+		mpc_step(&qp, x_qp, u_qp, r, &ws);
+		TEST_ASSERT_FLOAT_WITHIN(2e-2f, u_qp[0], u[0]);
+		TEST_ASSERT_TRUE(u[0] >= umin[0] && u[0] <= umax[0]);
+		kalman(A, B, C, K, u, x, y, ADIM, YDIM, RDIM);
+		kalman(A, B, C, K, u_qp, x_qp, y, ADIM, YDIM, RDIM);
+	}
+	printf("y = %f, u = %f, ADMM iterations %u\n", x[0], u[0], ctx.iterations);
+	TEST_ASSERT_FLOAT_WITHIN(0.1f, r[0], x[0]);
+#undef ADIM
+#undef RDIM
+#undef YDIM
+#undef HORIZON
+}
+
+void test_c2d(void)
+{
+	// First order system dx = -2x + u
+	float A[1] = { -2 };
+	float B[1] = { 1 };
+
+	c2d(A, B, 1, 1, 0.1f);
+	TEST_ASSERT_FLOAT_WITHIN(1e-6f, expf(-0.2f), A[0]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-6f, (1 - expf(-0.2f)) / 2, B[0]);
+
+	// Mass with a damper and two inputs, the sample time is long enough to need scaling
+	float M[4] = { 0, 1, 0, -0.5f };
+	float N[4] = { 0, 0, 1, 2 };
+	float h = 20;
+	float e = expf(-0.5f * h);
+
+	c2d(M, N, 2, 2, h);
+	TEST_ASSERT_FLOAT_WITHIN(1e-5f, 1.0f, M[0]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-5f, 2 * (1 - e), M[1]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-5f, 0.0f, M[2]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-5f, e, M[3]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-4f, 2 * (h - 2 * (1 - e)), N[0]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-4f, 4 * (h - 2 * (1 - e)), N[1]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-5f, 2 * (1 - e), N[2]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-5f, 4 * (1 - e), N[3]);
+}
+
 void test_mrac_controller(void)
 {
 #define RDIM 1
@@ -196,3 +196,28 @@ void test_ukf_filter(void)
 	printf("Measurement:\n");
 	print(Y, 200, 3);
 }
+
+void test_sr_ukf_indefinite(void)
+{
+	// A negative weight Wc0 with alpha = 0.9 and beta = 0 turns the center sigma point into a
+	// downdate that takes the quadratic state below zero
+	uint8_t L = 2;
+	float Rv[2 * 2] = { 0, 0, 0, 0 };
+	float Rn[2 * 2] = { 1, 0, 0, 1 };
+	float S[2 * 2] = { 1, 0, 0, 1 };
+	float xhat[2] = { 0, 0 };
+	float y[2] = { 0, 0 };
+	float u[2] = { 0, 0 };
+	static uint8_t pool[8192];
+	struct ctl_workspace ws;
+
+	void F(float dx[], float x[], float u[])
+	{
+		dx[0] = x[0] * x[0];
+		dx[1] = x[1];
+	}
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_EQUAL(0, sr_ukf_state_estimation_ws(y, xhat, Rn, Rv, u, F, S, 0.9f, 0.0f, L,
+							 &ws));
+}
@@ -8,8 +8,10 @@
  ============================================================================
  */
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unity.h>
 #include <control/linalg.h>
 #include <control/misc.h>
@@ -38,6 +40,7 @@ void test_balance(void)
 
 void test_cholupdate(void)
 {
+	// The lower triangular factor of pascal(4)
 	float L[4 * 4] = { 1, 0, 0, 0, 1, 1, 0, 0, 1, 2, 1, 0, 1, 3, 3, 1 };
 
 	float x[4] = { 0.1, 0.2, 0.3, -1 / sqrtf(2) };
@@ -47,6 +50,21 @@ void test_cholupdate(void)
 
 	/* Result */
 	print(L, 4, 4);
+
+	float expected[4 * 4] = { 1.004988, 0,	      0, 0, 1.014938, 1.004938, 0, 0,
+				  1.024888, 2.009877, 1, 0, 0.924677, 2.905739, 3, 1.483797 };
+
+	for (uint8_t i = 0; i < 16; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-5, expected[i], L[i]);
+
+	// The upper triangular factor R = L' gives R' of the same result
+	float R[4 * 4] = { 1, 1, 1, 1, 0, 1, 2, 3, 0, 0, 1, 3, 0, 0, 0, 1 };
+	float y[4] = { 0.1, 0.2, 0.3, -1 / sqrtf(2) };
+
+	TEST_ASSERT_EQUAL_UINT8(1, cholupdate_upper(R, y, 4, rank_one_update));
+	for (uint8_t i = 0; i < 4; i++)
+		for (uint8_t j = 0; j < 4; j++)
+			TEST_ASSERT_FLOAT_WITHIN(1e-5, expected[j * 4 + i], R[i * 4 + j]);
 }
 
 /* GNU Octave code:
@@ -54,8 +72,75 @@ void test_cholupdate(void)
 	A = pascal(4);
 	A = chol(A, 'lower');
 	x =  [0.1;0.2;0.3;-1/sqrt(2)];
-	cholupdate2(A, x, '-')  % or '-' (see the MATLAB code in cholupdate function)
+	cholupdate(A', x, '+')'
  */
+
+void test_cholupdate_k(void)
+{
+	// The lower triangular factor of pascal(4) and the factor after adding x*x' and y*y'
+	float L[4 * 4] = { 1, 0, 0, 0, 1, 1, 0, 0, 1, 2, 1, 0, 1, 3, 3, 1 };
+	float updated[4 * 4];
+	float X[2 * 4] = { 0.1, 0.2, 0.3, -1 / sqrtf(2), 0.5, -0.25, 0, 0.75 };
+	float X1[2 * 4];
+
+	memcpy(updated, L, sizeof(L));
+	memcpy(X1, X, sizeof(X));
+	cholupdate(updated, &X1[0], 4, true);
+	cholupdate(updated, &X1[4], 4, true);
+
+	// Both rows at once give the same factor as one row at a time
+	float S[4 * 4];
+
+	memcpy(S, L, sizeof(L));
+	memcpy(X1, X, sizeof(X));
+	TEST_ASSERT_EQUAL_UINT8(1, cholupdate_k(S, X1, 4, 2, true));
+	for (uint8_t i = 0; i < 16; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-5, updated[i], S[i]);
+
+	// The same on the transposed factor
+	float R[4 * 4];
+
+	for (uint8_t i = 0; i < 4; i++)
+		for (uint8_t j = 0; j < 4; j++)
+			R[i * 4 + j] = L[j * 4 + i];
+	memcpy(X1, X, sizeof(X));
+	TEST_ASSERT_EQUAL_UINT8(1, cholupdate_k_upper(R, X1, 4, 2, true));
+	for (uint8_t i = 0; i < 4; i++)
+		for (uint8_t j = 0; j < 4; j++)
+			TEST_ASSERT_FLOAT_WITHIN(1e-5, updated[j * 4 + i], R[i * 4 + j]);
+
+	// The downdate takes the rows out again
+	memcpy(X1, X, sizeof(X));
+	TEST_ASSERT_EQUAL_UINT8(1, cholupdate_k(S, X1, 4, 2, false));
+	for (uint8_t i = 0; i < 16; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-5, L[i], S[i]);
+
+	// Downdating the identity by a unit vector leaves a singular matrix
+	float I[2 * 2] = { 1, 0, 0, 1 };
+	float e[2] = { 1, 0 };
+
+	TEST_ASSERT_EQUAL_UINT8(0, cholupdate_k(I, e, 2, 1, false));
+}
+
+void test_cholupdate_chol(void)
+{
+	// The factor of chol goes into cholupdate_k and gives chol(A + x*x')
+	float A[3 * 3] = { 4, 2, 0.4, 2, 5, 1, 0.4, 1, 3 };
+	float x[3] = { 0.5, -1, 0.25 };
+	float Ax[3 * 3];
+	float L[3 * 3];
+	float Lx[3 * 3];
+
+	for (uint8_t i = 0; i < 3; i++)
+		for (uint8_t j = 0; j < 3; j++)
+			Ax[i * 3 + j] = A[i * 3 + j] + x[i] * x[j];
+	TEST_ASSERT_EQUAL_UINT8(1, chol(A, L, 3));
+	TEST_ASSERT_EQUAL_UINT8(1, chol(Ax, Lx, 3));
+	TEST_ASSERT_EQUAL_UINT8(1, cholupdate_k(L, x, 3, 1, true));
+	for (uint8_t i = 0; i < 9; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-5, Lx[i], L[i]);
+}
+
 void test_det(void)
 {
 	// Matrix A
@@ -104,6 +189,87 @@ void test_dlyap(void)
 	P = dlyap(A, Q) % Using Matavecontrol package
  */
 
+void test_dlyap_residual(void)
+{
+	// Larger than one panel so that the symmetric path is blocked
+	enum { n = 20 };
+	float A[n * n];
+	float Q[n * n];
+	float P[n * n];
+	float R[n * n];
+	float T[n * n];
+
+	for (uint16_t i = 0; i < n; i++) {
+		for (uint16_t j = 0; j < n; j++) {
+			A[i * n + j] = ((i * 7 + j * 13) % 17 - 8) * (0.9f / (8 * n));
+			Q[i * n + j] = (i == j ? n : 0) + 1.0f / (1 + i + j);
+		}
+	}
+
+	// The first pass has a symmetric Q, the second one does not
+	for (uint8_t pass = 0; pass < 2; pass++) {
+		if (pass == 1)
+			Q[1] += 1.0f;
+		dlyap(A, P, Q, n);
+
+		// A * P * A' - P + Q = 0
+		memcpy(R, Q, sizeof(Q));
+		mul(A, P, T, n, n, n);
+		gemm(false, true, 1.0f, T, A, 1.0f, R, n, n, n);
+		for (uint16_t i = 0; i < n * n; i++)
+			TEST_ASSERT_FLOAT_WITHIN(1e-3f, R[i], P[i]);
+	}
+
+	// There is no solution when A is not Schur stable
+	CTL_WORKSPACE_ON_STACK(ws, dlyap_workspace_size(n));
+
+	for (uint16_t i = 0; i < n; i++)
+		A[i * n + i] += 1.0f;
+	TEST_ASSERT_EQUAL(0, dlyap_ws(A, P, Q, n, &ws));
+}
+
+void test_expm(void)
+{
+	// Every degree of the approximant and the scaled path, expm([0 t; -t 0]) is a rotation
+	const float t[] = { 0.3f, 1.0f, 3.0f, 5.0f, 20.0f };
+
+	for (uint8_t k = 0; k < sizeof(t) / sizeof(t[0]); k++) {
+		float A[4] = { 0, t[k], -t[k], 0 };
+
+		expm(A, 2);
+		TEST_ASSERT_FLOAT_WITHIN(1e-5f, cosf(t[k]), A[0]);
+		TEST_ASSERT_FLOAT_WITHIN(1e-5f, sinf(t[k]), A[1]);
+		TEST_ASSERT_FLOAT_WITHIN(1e-5f, -sinf(t[k]), A[2]);
+		TEST_ASSERT_FLOAT_WITHIN(1e-5f, cosf(t[k]), A[3]);
+	}
+
+	// Large norm with a hump, the Taylor series is useless here
+	float B[4] = { -49, 24, -64, 31 };
+	const float E[4] = { -0.7357588f, 0.5518191f, -1.4715175f, 1.1036381f };
+
+	expm(B, 2);
+	for (uint8_t i = 0; i < 4; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-3f, E[i], B[i]);
+
+	// expm([A B; 0 0]) of a double integrator
+	float C[4] = { 0, 1, 0, 0 };
+	float D[2] = { 0, 1 };
+
+	expm_augmented(C, D, 2, 1);
+	TEST_ASSERT_FLOAT_WITHIN(1e-6f, 1.0f, C[0]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-6f, 1.0f, C[1]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0.0f, C[2]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-6f, 1.0f, C[3]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0.5f, D[0]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-6f, 1.0f, D[1]);
+
+	// Not finite
+	float F[4] = { 0, NAN, 0, 0 };
+	CTL_WORKSPACE_ON_STACK(ws, expm_workspace_size(2));
+
+	TEST_ASSERT_EQUAL(0, expm_ws(F, 2, &ws));
+}
+
 void test_eig(void)
 {
 	// Matrix A
@@ -200,6 +366,48 @@ void test_eig_sym(void)
 	[t, d] = eig(A)
  */
 
+void test_gemm(void)
+{
+	float A[2 * 2] = { 4, 23, 2, 5 };
+	float B[2 * 2] = { 1, 2, 3, 4 };
+	float C[2 * 2] = { 1, 0, 0, 1 };
+	float expected[2 * 2] = { 21, 32, 76, 133 };
+
+	// C = 2*A'*B + C without forming A'
+	gemm(true, false, 2.0f, A, B, 1.0f, C, 2, 2, 2);
+	TEST_ASSERT_EQUAL_FLOAT_ARRAY(expected, C, 2 * 2);
+
+	// Every combination of transposes matches mul() on explicitly transposed copies
+	enum { M = 9, N = 17, K = 6 };
+	float X[M * K], Y[K * N], XT[K * M], YT[N * K], R[M * N], G[M * N];
+
+	for (uint16_t i = 0; i < M * K; i++)
+		X[i] = (float)((i * 3) % 7) - 3.0f;
+	for (uint16_t i = 0; i < K * N; i++)
+		Y[i] = (float)((i * 5) % 9) * 0.5f - 2.0f;
+	memcpy(XT, X, sizeof(X));
+	tran(XT, M, K);
+	memcpy(YT, Y, sizeof(Y));
+	tran(YT, K, N);
+	mul(X, Y, R, M, K, N);
+
+	gemm(false, false, 1.0f, X, Y, 0.0f, G, M, N, K);
+	TEST_ASSERT_EQUAL_FLOAT_ARRAY(R, G, M * N);
+	gemm(true, false, 1.0f, XT, Y, 0.0f, G, M, N, K);
+	TEST_ASSERT_EQUAL_FLOAT_ARRAY(R, G, M * N);
+	gemm(false, true, 1.0f, X, YT, 0.0f, G, M, N, K);
+	TEST_ASSERT_EQUAL_FLOAT_ARRAY(R, G, M * N);
+	gemm(true, true, 1.0f, XT, YT, 0.0f, G, M, N, K);
+	TEST_ASSERT_EQUAL_FLOAT_ARRAY(R, G, M * N);
+}
+
+/*
+ * GNU Octave code:
+ * A = [4 23; 2 5];
+ * B = [1 2; 3 4];
+ * C = 2*A'*B + eye(2)
+ */
+
 void test_hankel(void)
 {
 	// Output
@@ -400,6 +608,74 @@ void test_linsolve_lup(void)
  *
  */
 
+void test_lu_factor(void)
+{
+	float A[4 * 4] = { 0.47462, 0.74679, 0.31008, 0.63073, 0.32540, 0.49584, 0.50932, 0.21492,
+			   0.43855, 0.98844, 0.54041, 0.24647, 0.62808, 0.72591, 0.20244, 0.96743 };
+	float b[4] = { 1.588964, 0.901248, 0.062029, 0.142180 };
+	float LU[4 * 4];
+	float X[4 * 2];
+	uint16_t P[4];
+
+	// Factor once, then solve for b alone and for [b 2*b]
+	memcpy(LU, A, sizeof(A));
+	TEST_ASSERT_EQUAL(1, lu_factor(LU, P, 4));
+	for (uint16_t i = 0; i < 4; i++) {
+		X[i * 2] = b[i];
+		X[i * 2 + 1] = 2 * b[i];
+	}
+	lu_solve(LU, P, b, 4);
+	lu_solve_multi(LU, P, X, 4, 2);
+
+	float x[4] = { -44.155083, 6.136269, 15.125890, 21.044046 };
+
+	for (uint16_t i = 0; i < 4; i++) {
+		TEST_ASSERT_FLOAT_WITHIN(1e-3, x[i], b[i]);
+		TEST_ASSERT_FLOAT_WITHIN(1e-3, x[i], X[i * 2]);
+		TEST_ASSERT_FLOAT_WITHIN(2e-3, 2 * x[i], X[i * 2 + 1]);
+	}
+
+	// More than 255 rows, the largest element of every column is 150 rows further down
+	// so the pivots go past row 255
+	static float big[300 * 300], big_lu[300 * 300];
+	static float y[300];
+	static uint16_t big_p[300];
+	const uint16_t n = 300;
+
+	for (uint16_t i = 0; i < n; i++)
+		for (uint16_t j = 0; j < n; j++)
+			big[i * n + j] = 1.0f / (1 + i + j);
+	for (uint16_t i = 0; i < n; i++)
+		big[((i + 150) % n) * n + i] += n;
+	for (uint16_t i = 0; i < n; i++) {
+		y[i] = 0;
+		for (uint16_t j = 0; j < n; j++)
+			y[i] += big[i * n + j] * (j % 7 - 3);
+	}
+	memcpy(big_lu, big, sizeof(big));
+	TEST_ASSERT_EQUAL(1, lu_factor(big_lu, big_p, n));
+	TEST_ASSERT_EQUAL(299, big_p[149]);
+	lu_solve(big_lu, big_p, y, n);
+	for (uint16_t i = 0; i < n; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-3, i % 7 - 3, y[i]);
+
+	// A singular matrix is refused
+	float S[2 * 2] = { 1, 2, 2, 4 };
+
+	TEST_ASSERT_EQUAL(0, lu_factor(S, P, 2));
+}
+
+/*
+ * GNU Octave code:
+ * A = [0.47462,   0.74679,   0.31008,   0.63073,
+		0.32540,   0.49584,   0.50932,   0.21492,
+		0.43855,   0.98844,   0.54041,   0.24647,
+		0.62808,   0.72591,   0.20244,   0.96743];
+	b = [1.588964; 0.901248; 0.062029; 0.142180];
+	[L, U, P] = lu(A);
+	x = U \ (L \ (P*b))
+ */
+
 void test_linsolve_qr(void)
 {
 	// Matrix A
@@ -489,6 +765,43 @@ void _mul_at_bc(void)
  * D = A'*B*C
  */
 
+void test_mul(void)
+{
+	// Odd sizes so that the blocked path also runs its edge tiles
+	enum { M = 19, N = 21, P = 23 };
+	float A[M * N];
+	float B[N * P];
+	float C[M * P];
+
+	for (uint16_t i = 0; i < M * N; i++)
+		A[i] = (float)((i * 7) % 11) - 5.0f;
+	for (uint16_t i = 0; i < N * P; i++)
+		B[i] = (float)((i * 5) % 13) * 0.25f - 1.5f;
+
+	mul(A, B, C, M, N, P);
+
+	// Small integers and quarters are exact in float, so the sums must match exactly
+	for (uint16_t i = 0; i < M; i++) {
+		for (uint16_t j = 0; j < P; j++) {
+			float sum = 0;
+
+			for (uint16_t k = 0; k < N; k++)
+				sum += A[i * N + k] * B[k * P + j];
+			TEST_ASSERT_EQUAL_FLOAT(sum, C[i * P + j]);
+		}
+	}
+
+	// A matrix-vector product takes its own path
+	mul(A, B, C, M, N, 1);
+	for (uint16_t i = 0; i < M; i++) {
+		float sum = 0;
+
+		for (uint16_t k = 0; k < N; k++)
+			sum += A[i * N + k] * B[k];
+		TEST_ASSERT_EQUAL_FLOAT(sum, C[i]);
+	}
+}
+
 void test_nonlinsolve(void)
 {
 	// Initial parameters
@@ -597,6 +910,35 @@ void test_qr(void)
 	print(R, 9, 3);
 }
 
+void test_qr_factor(void)
+{
+	float A[4 * 3] = { 2, -1, 0, 1, 3, 1, 0, 1, 4, 1, 0, 1 };
+	float QR[4 * 3];
+	float tau[3];
+	float Q[4 * 4];
+	float R[4 * 3] = { 0 };
+	float QRA[4 * 3];
+	float b[4] = { 1, 2, 3, 4 };
+	float QTb[4];
+
+	// The reflectors stay in the lower triangle, Q is only formed on request
+	memcpy(QR, A, sizeof(A));
+	qr_factor(QR, tau, 4, 3);
+	qr_q(QR, tau, Q, 4, 3);
+	for (uint8_t i = 0; i < 3; i++)
+		for (uint8_t j = i; j < 3; j++)
+			R[i * 3 + j] = QR[i * 3 + j];
+	mul(Q, R, QRA, 4, 4, 3);
+	for (uint8_t i = 0; i < 4 * 3; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-5f, A[i], QRA[i]);
+
+	// Applying Q' from the reflectors gives the same as multiplying with Q'
+	gemm(true, false, 1.0f, Q, b, 0.0f, QTb, 4, 1, 4);
+	qr_apply_qt(QR, tau, b, 4, 3, 1);
+	for (uint8_t i = 0; i < 4; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-5f, QTb[i], b[i]);
+}
+
 void test_golub_reinsch(void)
 {
 	// Matrix A
@@ -680,3 +1022,166 @@ void test_jacobi_one_sided(void)
 
    [U, S, V] = svd(A)
  */
+
+void test_trsm(void)
+{
+	// Larger than one block of trsm in both directions and not a multiple of it
+	enum { M = 70, N = 45 };
+	static float A[M * M], T[M * M], X[M * N], B[M * N];
+
+	for (uint8_t c = 0; c < 8; c++) {
+		bool left = c & 1, upper = c & 2, transpose = c & 4;
+		uint16_t n = left ? M : N;
+
+		// T is the triangle of A, the other triangle of A is garbage that must not be read
+		for (uint16_t i = 0; i < n; i++)
+			for (uint16_t j = 0; j < n; j++) {
+				bool inside = upper ? j >= i : j <= i;
+				float value = (float)((i * 7 + j * 3) % 11) * 0.1f - 0.5f;
+
+				if (i == j)
+					value += 4.0f;
+				T[i * n + j] = inside ? value : 0.0f;
+				A[i * n + j] = inside ? value : 1e6f;
+			}
+		for (uint16_t i = 0; i < M * N; i++)
+			X[i] = (float)((i * 5) % 13) * 0.25f - 1.5f;
+
+		// B = op(T)*X or X*op(T), then solve it back to X
+		if (left)
+			gemm(transpose, false, 1.0f, T, X, 0.0f, B, M, N, M);
+		else
+			gemm(false, transpose, 1.0f, X, T, 0.0f, B, M, N, N);
+		trsm(left, upper, transpose, A, B, M, N);
+		for (uint16_t i = 0; i < M * N; i++)
+			TEST_ASSERT_FLOAT_WITHIN(1e-4, X[i], B[i]);
+	}
+
+	// A vector on the left is linsolve_upper_triangular
+	float U[3 * 3] = { 2, 1, -1, 0, 3, 2, 0, 0, 4 };
+	float b[3] = { 3, 13, 8 };
+	float x[3];
+	float expected[3] = { 1, 3, 2 };
+
+	linsolve_upper_triangular(U, x, b, 3);
+	TEST_ASSERT_EQUAL_FLOAT_ARRAY(expected, x, 3);
+}
+
+void test_chol_factor(void)
+{
+	// Larger than one block of chol_factor and not a multiple of it
+	enum { M = 75, N = 9 };
+	static float G[M * M], A[M * M], L[M * M], LLT[M * M], X[M * N], B[M * N];
+
+	// A = G*G' + M*I is positive definite
+	for (uint16_t i = 0; i < M * M; i++)
+		G[i] = (float)((i * 7) % 17) * 0.125f - 1.0f;
+	gemm(false, true, 1.0f, G, G, 0.0f, A, M, M, M);
+	for (uint16_t i = 0; i < M; i++)
+		A[i * M + i] += M;
+	for (uint16_t i = 0; i < M * N; i++)
+		X[i] = (float)((i * 5) % 13) * 0.25f - 1.5f;
+	gemm(false, false, 1.0f, A, X, 0.0f, B, M, N, M);
+
+	// L*L' == A and the upper triangle of L is zero
+	memcpy(L, A, sizeof(A));
+	TEST_ASSERT_EQUAL_UINT8(1, chol_factor(L, M));
+	for (uint16_t i = 0; i < M; i++)
+		for (uint16_t j = i + 1; j < M; j++)
+			L[i * M + j] = 0.0f;
+	gemm(false, true, 1.0f, L, L, 0.0f, LLT, M, M, M);
+	for (uint16_t i = 0; i < M * M; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-3, A[i], LLT[i]);
+
+	chol_solve_multi(L, B, M, N);
+	for (uint16_t i = 0; i < M * N; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-4, X[i], B[i]);
+
+	// chol returns the lower triangle with zeros above it
+	float S[3 * 3] = { 4, 2, -2, 2, 10, 1, -2, 1, 6 };
+	float Lc[3 * 3];
+	float expected[3 * 3] = { 2, 0, 0, 1, 3, 0, -1, 2.0f / 3.0f, sqrtf(5.0f - 4.0f / 9.0f) };
+
+	TEST_ASSERT_EQUAL_UINT8(1, chol(S, Lc, 3));
+	for (uint8_t i = 0; i < 9; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-6, expected[i], Lc[i]);
+
+	// Indefinite and semidefinite matrices fail
+	float I[2 * 2] = { 1, 2, 2, 1 };
+	float D[2 * 2] = { 1, 1, 1, 1 };
+
+	TEST_ASSERT_EQUAL_UINT8(0, chol_factor(I, 2));
+	TEST_ASSERT_EQUAL_UINT8(0, chol_factor(D, 2));
+}
+
+void test_ldl_factor(void)
+{
+	// A = G*G' has rank 2
+	float G[4 * 2] = { 1, 0, 2, 1, 0, 3, 1, 1 };
+	float A[4 * 4], LD[4 * 4], d[4];
+
+	gemm(false, true, 1.0f, G, G, 0.0f, A, 4, 4, 2);
+	memcpy(LD, A, sizeof(A));
+	TEST_ASSERT_EQUAL_UINT8(1, ldl_factor(LD, d, 4));
+	TEST_ASSERT_EQUAL_FLOAT(0.0f, d[3]);
+
+	// B = A*y is in the range of A, so A*X == B even though A is singular
+	float y[4 * 2] = { 1, -1, 2, 0, -1, 3, 0.5f, 1 };
+	float B[4 * 2], X[4 * 2], AX[4 * 2];
+
+	gemm(false, false, 1.0f, A, y, 0.0f, B, 4, 2, 4);
+	memcpy(X, B, sizeof(B));
+	ldl_solve_multi(LD, d, X, 4, 2);
+	gemm(false, false, 1.0f, A, X, 0.0f, AX, 4, 2, 4);
+	for (uint8_t i = 0; i < 4 * 2; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-4, B[i], AX[i]);
+
+	// A symmetric indefinite matrix fails
+	float I[2 * 2] = { 1, 2, 2, 1 };
+
+	TEST_ASSERT_EQUAL_UINT8(0, ldl_factor(I, d, 2));
+}
+
+void test_tran(void)
+{
+	float A[2 * 3] = { 4, 23, 5, 2, 45, 5 };
+	float AT[3 * 2] = { 4, 2, 23, 45, 5, 5 };
+
+	tran(A, 2, 3);
+	TEST_ASSERT_EQUAL_FLOAT_ARRAY(AT, A, 3 * 2);
+	tran(A, 3, 2);
+	tran(A, 2, 3);
+	TEST_ASSERT_EQUAL_FLOAT_ARRAY(AT, A, 3 * 2);
+}
+
+/*
+ * GNU Octave code:
+ * A = [4 23 5; 2 45 5];
+ * A'
+ */
+
+void test_workspace(void)
+{
+	float A[4 * 4] = { 0.018142, 0.968856, 0.151740, 0.757174, 0.017829, 0.474323,
+			   0.358832, 0.970854, 0.184523, 0.063063, 0.680511, 0.191901,
+			   0.806877, 0.830208, 0.977169, 0.222291 };
+	float B[4 * 4];
+	static uint8_t pool[1024];
+	struct ctl_workspace ws;
+
+	memcpy(B, A, sizeof(A));
+	inv(A, 4);
+
+	// The _ws variant gives the same result and stays within the size it reports
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_EQUAL(1, inv_ws(B, 4, &ws));
+	TEST_ASSERT_EQUAL(0, ws.used);
+	TEST_ASSERT_LESS_OR_EQUAL(inv_workspace_size(4), ws.peak);
+	TEST_ASSERT_EQUAL_FLOAT_ARRAY(A, B, 4 * 4);
+
+	// A workspace that is too small is refused before anything is touched
+	ctl_workspace_init(&ws, pool, inv_workspace_size(4) - 1);
+	TEST_ASSERT_EQUAL(0, inv_ws(B, 4, &ws));
+	TEST_ASSERT_EQUAL_FLOAT_ARRAY(A, B, 4 * 4);
+	printf("inv_workspace_size(4) = %u bytes\n", (unsigned int)inv_workspace_size(4));
+}
@@ -11,6 +11,7 @@
 #include <unity.h>
 #include <stdio.h>
 #include <control/misc.h>
+#include <control/workspace.h>
 
 void test_cat(void)
 {
@@ -70,3 +71,34 @@ void test_randn(void)
 	Mean = Mean / 1000;
 	printf("Mean = %f\n", Mean);
 }
+
+void test_workspace(void)
+{
+	static uint8_t pool[256];
+	struct ctl_workspace ws;
+
+	ctl_workspace_init(&ws, pool + 1, sizeof(pool) - 1);
+	TEST_ASSERT_EQUAL(0, (uintptr_t)ws.buffer % CTL_WORKSPACE_ALIGN);
+
+	// Every allocation is aligned and rounded up
+	float *a = ctl_workspace_floats(&ws, 3);
+	size_t mark = ctl_workspace_mark(&ws);
+	float *b = ctl_workspace_floats(&ws, 5);
+
+	TEST_ASSERT_NOT_NULL(a);
+	TEST_ASSERT_NOT_NULL(b);
+	TEST_ASSERT_EQUAL(0, (uintptr_t)b % CTL_WORKSPACE_ALIGN);
+	TEST_ASSERT_EQUAL(CTL_WORKSPACE_FLOATS(3) + CTL_WORKSPACE_FLOATS(5), ws.used);
+
+	// Release gives the memory back in LIFO order, the peak is kept
+	ctl_workspace_release(&ws, mark);
+	TEST_ASSERT_EQUAL(CTL_WORKSPACE_FLOATS(3), ws.used);
+	TEST_ASSERT_EQUAL(CTL_WORKSPACE_FLOATS(3) + CTL_WORKSPACE_FLOATS(5), ws.peak);
+	TEST_ASSERT_TRUE(ctl_workspace_floats(&ws, 5) == b);
+
+	// Too large allocations fail without changing the workspace
+	size_t used = ws.used;
+
+	TEST_ASSERT_NULL(ctl_workspace_alloc(&ws, ctl_workspace_available(&ws) + 1));
+	TEST_ASSERT_EQUAL(used, ws.used);
+}
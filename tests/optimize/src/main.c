@@ -9,6 +9,7 @@
  */
 
 #include <unity.h>
+#include <math.h>
 #include <stdio.h>
 #include <control/optimization.h>
 #include <control/misc.h>
@@ -151,3 +152,143 @@ void test_linprog(void)
   	  y = glpk(C2', A2, B2, [0;0], [], "LLL", "CC", 1)
  *
  */
+
+void test_quadprog(void)
+{
+	// Min 0.5*x'*H*x + f'*x, S.t A*x <= b, x >= 0
+	float H[2 * 2] = { 1, -1, -1, 2 };
+	float f[2] = { -2, -6 };
+	float A[3 * 2] = { 1, 1, -1, 2, 2, 1 };
+	float b[3] = { 2, 2, 3 };
+	float lb[2] = { 0, 0 };
+	float x[2];
+
+	TEST_ASSERT_EQUAL(1, quadprog(H, f, A, b, lb, NULL, x, 3, 2, 20));
+	TEST_ASSERT_FLOAT_WITHIN(1e-4f, 2.0f / 3.0f, x[0]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-4f, 4.0f / 3.0f, x[1]);
+
+	// Only the upper bounds are active
+	float ub[2] = { 0.5f, 0.5f };
+
+	TEST_ASSERT_EQUAL(1, quadprog(H, f, A, b, lb, ub, x, 3, 2, 20));
+	TEST_ASSERT_FLOAT_WITHIN(1e-4f, 0.5f, x[0]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-4f, 0.5f, x[1]);
+
+	// x >= 1 and x1 + x2 <= 2 leaves only x = [1 1], x1 >= 1.5 makes it infeasible
+	float lb_tight[2] = { 1.5f, 1 };
+
+	TEST_ASSERT_EQUAL(0, quadprog(H, f, A, b, lb_tight, NULL, x, 3, 2, 20));
+}
+
+/*
+ * GNU Octave code:
+ *
+   H = [1 -1; -1 2];
+   f = [-2; -6];
+   A = [1 1; -1 2; 2 1];
+   b = [2; 2; 3];
+   x = quadprog(H, f, A, b, [], [], [0; 0], [])
+ */
+
+void test_qp_warm_start(void)
+{
+	// Box constrained least squares that moves a little between the solves
+	enum { n = 8 };
+	float H[n * n];
+	float f[n];
+	float lb[n];
+	float ub[n];
+	float x[n];
+	float x_cold[n];
+	static uint8_t pool[8 * 1024];
+	struct ctl_workspace ws;
+	struct qp_ctx ctx;
+	struct qp_ctx cold;
+
+	for (uint8_t i = 0; i < n; i++) {
+		for (uint8_t j = 0; j < n; j++)
+			H[i * n + j] = (i == j ? 4.0f : 0.0f) + 1.0f / (1 + i + j);
+		lb[i] = -1;
+		ub[i] = 1;
+	}
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_EQUAL(1, qp_init(&ctx, H, n, &ws));
+	TEST_ASSERT_EQUAL(1, qp_init(&cold, H, n, &ws));
+
+	for (uint8_t k = 0; k < 10; k++) {
+		for (uint8_t i = 0; i < n; i++)
+			f[i] = (i % 2 ? 8.0f : -8.0f) + 0.05f * k * i;
+
+		// Forget the active set of the last solve
+		cold.active_count = 0;
+		TEST_ASSERT_EQUAL(1, qp_solve(&cold, f, NULL, NULL, lb, ub, x_cold, 0, 100, &ws));
+		TEST_ASSERT_EQUAL(1, qp_solve(&ctx, f, NULL, NULL, lb, ub, x, 0, 100, &ws));
+		for (uint8_t i = 0; i < n; i++)
+			TEST_ASSERT_FLOAT_WITHIN(1e-4f, x_cold[i], x[i]);
+
+		// The last active set is still optimal, so nothing is searched for or dropped
+		TEST_ASSERT_TRUE(ctx.iterations <= cold.iterations);
+		if (k > 0)
+			TEST_ASSERT_EQUAL(ctx.active_count, ctx.iterations);
+	}
+}
+
+void test_simplex(void)
+{
+	// The minimization of test_linprog written as max -c'*x, -A*x <= -b, which needs Phase I
+	float c[2] = { -9, -4 };
+	float A[3 * 2] = { -22, -13, -1, -5, -1, -20 };
+	float b[3] = { -25, -7, -7 };
+	float x[4];
+
+	TEST_ASSERT_EQUAL(1, simplex(c, A, b, x, 3, 2, 100));
+	TEST_ASSERT_FLOAT_WITHIN(1e-4f, 0.0f, x[0]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-4f, 25.0f / 13.0f, x[1]);
+
+	// Beale's example, which cycles with the most negative reduced cost alone
+	float c_beale[4] = { 0.75f, -20, 0.5f, -6 };
+	float A_beale[3 * 4] = { 0.25f, -8, -1, 9, 0.5f, -12, -0.5f, 3, 0, 0, 1, 0 };
+	float b_beale[3] = { 0, 0, 1 };
+
+	TEST_ASSERT_EQUAL(1, simplex(c_beale, A_beale, b_beale, x, 3, 4, 100));
+	TEST_ASSERT_FLOAT_WITHIN(1e-4f, 1.25f,
+				 0.75f * x[0] - 20 * x[1] + 0.5f * x[2] - 6 * x[3]);
+
+	// x1 <= -1 is infeasible and max x1 with x1 - x2 <= 1 is unbounded
+	float c_one[2] = { 1, 0 };
+	float A_one[2] = { 1, -1 };
+	float b_infeasible[1] = { -1 };
+	float b_unbounded[1] = { 1 };
+	float c_unbounded[2] = { 0, 1 };
+
+	TEST_ASSERT_EQUAL(0, simplex(c_one, A_one, b_infeasible, x, 1, 2, 100));
+	TEST_ASSERT_EQUAL(0, simplex(c_unbounded, A_one, b_unbounded, x, 1, 2, 100));
+}
+
+void test_simplex_many_constraints(void)
+{
+	// Max x1 + x2 inside a polygon of 300 tangents to the unit circle, more rows than
+	// linprog takes
+	enum { m = 300 };
+	static float A[m * 2];
+	static float b[m];
+	static uint8_t pool[512 * 1024];
+	float c[2] = { 1, 1 };
+	float x[2];
+	struct ctl_workspace ws;
+
+	for (uint16_t i = 0; i < m; i++) {
+		float angle = 0.5f * (float)M_PI * i / (m - 1);
+
+		A[2 * i] = cosf(angle);
+		A[2 * i + 1] = sinf(angle);
+		b[i] = 1;
+	}
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_TRUE(simplex_workspace_size(m, 2) <= sizeof(pool));
+	TEST_ASSERT_EQUAL(1, simplex_ws(c, A, b, x, m, 2, 1000, &ws));
+	TEST_ASSERT_FLOAT_WITHIN(1e-3f, sqrtf(2), x[0] + x[1]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-2f, x[0], x[1]);
+}
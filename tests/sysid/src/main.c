@@ -10,7 +10,10 @@
 
 #include <unity.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
+#include <math.h>
+#include <string.h>
 #include <control/sysid.h>
 #include <control/controller.h>
 #include <control/misc.h>
@@ -158,6 +161,118 @@ void test_okid(void)
 	print(s, 2, 10);
 }
 
+/*
+ * y = u*h for a decaying h, the response of the input up to sample i is all of y(i)
+ */
+static void convolve(const float u[], const float h[], float y[], uint16_t n)
+{
+	for (uint16_t i = 0; i < n; i++) {
+		double sum = 0;
+
+		for (uint16_t j = 0; j <= i; j++)
+			sum += (double)u[i - j] * h[j];
+		y[i] = sum;
+	}
+}
+
+void test_okid_long(void)
+{
+	// Longer than one Toeplitz block of okid, with the first two inputs zero
+	enum { N = 1000 };
+	static float u[N], y[N], g[N], h[N];
+
+	srand(1);
+	for (uint16_t i = 0; i < N; i++) {
+		u[i] = 0.1f * rand() / RAND_MAX - 0.05f;
+		h[i] = powf(0.9f, i) * cosf(0.3f * i);
+	}
+	u[0] = 0.0f;
+	u[1] = 0.0f;
+	u[2] = 1.0f;
+	convolve(u, h, y, N);
+
+	// The FFT buffers of the long blocks do not fit in a small workspace
+	uint8_t pool[16];
+	struct ctl_workspace ws;
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_EQUAL_UINT8(0, okid_ws(u, y, g, 1, N, &ws));
+
+	// Substitution without scratch memory and the FFT with a workspace give the same
+	static uint8_t large[16384];
+	static float g_ws[N];
+
+	ctl_workspace_init(&ws, large, sizeof(large));
+	TEST_ASSERT_EQUAL_UINT8(1, okid_ws(u, y, g_ws, 1, N, &ws));
+	okid(u, y, g, 1, N);
+	for (uint16_t i = 0; i < N - 2; i++) {
+		TEST_ASSERT_FLOAT_WITHIN(1e-5, h[i], g[i]);
+		TEST_ASSERT_FLOAT_WITHIN(1e-5, h[i], g_ws[i]);
+	}
+
+	// The delay leaves nothing to identify the last Markov parameters from
+	TEST_ASSERT_EQUAL_FLOAT(0.0f, g[N - 2]);
+	TEST_ASSERT_EQUAL_FLOAT(0.0f, g[N - 1]);
+	TEST_ASSERT_EQUAL_FLOAT(0.0f, g_ws[N - 2]);
+	TEST_ASSERT_EQUAL_FLOAT(0.0f, g_ws[N - 1]);
+}
+
+void test_okid_fft(void)
+{
+	// The input stops half way, so the response has settled at the end of the record
+	enum { N = 512 };
+	static float u[N], y[N], g[N], h[N];
+
+	srand(2);
+	for (uint16_t i = 0; i < N; i++) {
+		u[i] = i < N / 2 ? (float)rand() / RAND_MAX - 0.5f : 0.0f;
+		h[i] = powf(0.9f, i) * cosf(0.3f * i);
+	}
+	u[0] = 0.0f;
+	convolve(u, h, y, N);
+
+	TEST_ASSERT_EQUAL_UINT8(1, okid_fft(u, y, g, 1, N, 0.0f));
+	for (uint16_t i = 0; i < N / 2; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-4, h[i], g[i]);
+
+	// Regularization only biases the estimate a little
+	TEST_ASSERT_EQUAL_UINT8(1, okid_fft(u, y, g, 1, N, 1e-4f));
+	for (uint16_t i = 0; i < N / 2; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-2, h[i], g[i]);
+
+	memset(u, 0, sizeof(u));
+	TEST_ASSERT_EQUAL_UINT8(0, okid_fft(u, y, g, 1, N, 0.0f));
+}
+
+void test_okid_observer(void)
+{
+	/*
+	 * A lightly damped system y(k) = a1*y(k - 1) + a2*y(k - 2) + u(k - 1), whose Markov
+	 * parameters are far from zero at the end of the record
+	 */
+	enum { N = 600 };
+	static float u[N], y[N], g[N], h[N];
+	float a1 = 2 * 0.995f * cosf(0.2f), a2 = -0.995f * 0.995f;
+
+	srand(3);
+	for (uint16_t i = 0; i < N; i++)
+		u[i] = (float)rand() / RAND_MAX - 0.5f;
+	for (uint16_t i = 0; i < N; i++) {
+		y[i] = i > 0 ? a1 * y[i - 1] + u[i - 1] : 0.0f;
+		y[i] += i > 1 ? a2 * y[i - 2] : 0.0f;
+		h[i] = i > 0 ? a1 * h[i - 1] + (i == 1) : 0.0f;
+		h[i] += i > 1 ? a2 * h[i - 2] : 0.0f;
+	}
+
+	// An observer of higher order than the system
+	TEST_ASSERT_EQUAL_UINT8(1, okid_observer(u, y, g, 1, N, 4));
+	for (uint16_t i = 0; i < N; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-2, h[i], g[i]);
+
+	// Too short for the observer
+	TEST_ASSERT_EQUAL_UINT8(0, okid_observer(u, y, g, 1, 12, 4));
+}
+
 // Dimensions for input and output
 #define YDIM 1
 #define RDIM 1
@@ -235,6 +350,231 @@ void test_rls(void)
 	print(K, NP, YDIM);
 }
 
+void test_rls_ud_packed(void)
+{
+	// Exact model order, so that the parameters are unique
+	enum { np = 2, nz = 1, nze = 1, n = np + nz + nze };
+	float past[3][3];
+	float phi[3][n];
+	float theta[3][n];
+	float P[n * n];
+	float UD[n * (n + 1) / 2];
+	float Pp[n * (n + 1) / 2];
+	uint8_t count[3] = { 0 };
+	float y = 0, y1 = 0;
+
+	// Second order system y(k) = 1.5y(k-1) - 0.7y(k-2) + u(k-1) with a pseudo random input
+	float u = 0;
+
+	for (uint16_t k = 0; k < 500; k++) {
+		float next = 1.5f * y - 0.7f * y1 + u;
+
+		y1 = y;
+		y = next;
+		u = (k * 7919 % 13) / 6.0f - 1.0f;
+		rls(np, nz, nze, theta[0], u, y, &count[0], &past[0][0], &past[0][1], &past[0][2],
+		    phi[0], P, Pq, forgetting);
+		rls_ud(np, nz, nze, theta[1], u, y, &count[1], &past[1][0], &past[1][1],
+		       &past[1][2], phi[1], UD, Pq, forgetting);
+		rls_packed(np, nz, nze, theta[2], u, y, &count[2], &past[2][0], &past[2][1],
+			   &past[2][2], phi[2], Pp, Pq, forgetting);
+	}
+
+	// All three give the same parameters
+	for (uint8_t i = 0; i < n; i++) {
+		TEST_ASSERT_FLOAT_WITHIN(1e-2f, theta[0][i], theta[1][i]);
+		TEST_ASSERT_FLOAT_WITHIN(1e-2f, theta[0][i], theta[2][i]);
+	}
+	TEST_ASSERT_FLOAT_WITHIN(1e-2f, -1.5f, theta[1][0]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-2f, 0.7f, theta[1][1]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-2f, 1.0f, theta[1][np]);
+
+	// U*D*U' is the packed P
+	for (uint8_t j = 0; j < n; j++) {
+		for (uint8_t i = 0; i <= j; i++) {
+			float sum = 0;
+
+			for (uint8_t k = j; k < n; k++) {
+				float Uik = i == k ? 1 : UD[i + k * (k + 1) / 2];
+				float Ujk = j == k ? 1 : UD[j + k * (k + 1) / 2];
+
+				sum += Uik * UD[k + k * (k + 1) / 2] * Ujk;
+			}
+			TEST_ASSERT_FLOAT_WITHIN(1e-3f * (1 + fabsf(sum)), sum,
+						 Pp[i + j * (j + 1) / 2]);
+		}
+	}
+}
+
+void test_rls_arx(void)
+{
+	// No noise model, NZE = 0, so the regressor ends with the inputs
+	enum { np = 2, nz = 1, nze = 0, n = np + nz + nze };
+	float past_e = 0, past_y = 0, past_u = 0;
+	float phi[n];
+	float theta[n];
+	float P[n * n];
+	float UD[n * (n + 1) / 2];
+	float Pp[n * (n + 1) / 2];
+	uint8_t count = 0;
+	float y = 0, y1 = 0;
+	float u = 0;
+
+	for (uint16_t k = 0; k < 500; k++) {
+		float next = 1.5f * y - 0.7f * y1 + u;
+
+		y1 = y;
+		y = next;
+		u = (k * 7919 % 13) / 6.0f - 1.0f;
+		rls(np, nz, nze, theta, u, y, &count, &past_e, &past_y, &past_u, phi, P, Pq,
+		    forgetting);
+	}
+	TEST_ASSERT_FLOAT_WITHIN(1e-2f, -1.5f, theta[0]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-2f, 0.7f, theta[1]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-2f, 1.0f, theta[np]);
+
+	// The factorized variants share the regressor
+	count = 0;
+	y = y1 = u = 0;
+	for (uint16_t k = 0; k < 500; k++) {
+		float next = 1.5f * y - 0.7f * y1 + u;
+
+		y1 = y;
+		y = next;
+		u = (k * 7919 % 13) / 6.0f - 1.0f;
+		rls_ud(np, nz, nze, theta, u, y, &count, &past_e, &past_y, &past_u, phi, UD, Pq,
+		       forgetting);
+	}
+	TEST_ASSERT_FLOAT_WITHIN(1e-2f, -1.5f, theta[0]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-2f, 1.0f, theta[np]);
+
+	count = 0;
+	y = y1 = u = 0;
+	for (uint16_t k = 0; k < 500; k++) {
+		float next = 1.5f * y - 0.7f * y1 + u;
+
+		y1 = y;
+		y = next;
+		u = (k * 7919 % 13) / 6.0f - 1.0f;
+		rls_packed(np, nz, nze, theta, u, y, &count, &past_e, &past_y, &past_u, phi, Pp,
+			   Pq, forgetting);
+	}
+	TEST_ASSERT_FLOAT_WITHIN(1e-2f, -1.5f, theta[0]);
+	TEST_ASSERT_FLOAT_WITHIN(1e-2f, 1.0f, theta[np]);
+}
+
+void test_rls_bank(void)
+{
+	// One channel per axis, every axis has its own second order system
+	enum { np = 2, nz = 2, nze = 1, n = np + nz + nze, channels = 5 };
+	float a1[channels] = { 1.5f, 1.2f, 0.5f, 1.8f, 0.3f };
+	float a2[channels] = { -0.7f, -0.4f, 0.2f, -0.9f, -0.5f };
+	float past[channels][3];
+	float phi[channels][n];
+	float theta[channels][n];
+	float P[channels][n * (n + 1) / 2];
+	uint8_t count[channels] = { 0 };
+	float y[channels] = { 0 }, y1[channels] = { 0 }, u[channels] = { 0 };
+	struct rls_bank bank;
+	static uint8_t pool[2048];
+	struct ctl_workspace ws;
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_EQUAL(1, rls_bank_init(&bank, np, nz, nze, channels, Pq, forgetting, &ws));
+
+	for (uint16_t k = 0; k < 300; k++) {
+		for (uint8_t c = 0; c < channels; c++) {
+			float next = a1[c] * y[c] + a2[c] * y1[c] + u[c];
+
+			y1[c] = y[c];
+			y[c] = next;
+			u[c] = ((k + 3 * c) * 7919 % 13) / 6.0f - 1.0f;
+			rls_packed(np, nz, nze, theta[c], u[c], y[c], &count[c], &past[c][0],
+				   &past[c][1], &past[c][2], phi[c], P[c], Pq, forgetting);
+		}
+		rls_bank_update(&bank, u, y);
+	}
+
+	// Every channel of the bank is the same estimator as rls_packed
+	for (uint8_t c = 0; c < channels; c++) {
+		for (uint8_t i = 0; i < n; i++)
+			TEST_ASSERT_FLOAT_WITHIN(1e-3f, theta[c][i], bank.theta[i * channels + c]);
+		TEST_ASSERT_FLOAT_WITHIN(1e-2f, -a1[c], bank.theta[c]);
+		TEST_ASSERT_FLOAT_WITHIN(1e-2f, 1.0f, bank.theta[np * channels + c]);
+	}
+
+	// Too small workspace
+	ctl_workspace_init(&ws, pool, 16);
+	TEST_ASSERT_EQUAL(0, rls_bank_init(&bank, np, nz, nze, channels, Pq, forgetting, &ws));
+}
+
+void test_rls_ftf(void)
+{
+	// A decaying impulse response of 16 taps driven by a pseudo random input
+	enum { n = 16 };
+	float b[n];
+	float past[n] = { 0 };
+	uint32_t seed = 12345;
+	struct rls_ftf ftf;
+	static uint8_t pool[1024];
+	struct ctl_workspace ws;
+
+	for (uint8_t i = 0; i < n; i++)
+		b[i] = powf(0.8f, i) * (i % 2 ? -1.0f : 1.0f);
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_EQUAL(1, rls_ftf_init(&ftf, n, 1000, 0.999f, &ws));
+
+	for (uint16_t k = 0; k < 3000; k++) {
+		float y = 0;
+
+		for (uint8_t i = 0; i < n; i++)
+			y += b[i] * past[i];
+		seed = seed * 1664525 + 1013904223;
+		float u = (seed >> 8) / 8388608.0f - 1.0f;
+
+		TEST_ASSERT_EQUAL(1, rls_ftf_update(&ftf, u, y));
+		memmove(&past[1], past, (n - 1) * sizeof(float));
+		past[0] = u;
+	}
+	TEST_ASSERT_EQUAL(0, ftf.restarts);
+	for (uint8_t i = 0; i < n; i++)
+		TEST_ASSERT_FLOAT_WITHIN(1e-3f, b[i], ftf.theta[i]);
+
+	// Too small workspace
+	ctl_workspace_init(&ws, pool, 16);
+	TEST_ASSERT_EQUAL(0, rls_ftf_init(&ftf, n, 1000, 0.999f, &ws));
+
+	// A model without taps
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_EQUAL(0, rls_ftf_init(&ftf, 0, 1000, 0.999f, &ws));
+}
+
+void test_ukf_param_estimation_indefinite(void)
+{
+	// With L = 4 and alpha = 1 the weight Wc0 is -1/3, a downdate that makes the quadratic
+	// parameter indefinite
+	uint8_t L = 4;
+	float Re[4 * 4] = { 0 };
+	float Sw[4 * 4] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+	float what[4] = { 0 };
+	float d[4] = { 0 };
+	float x[4] = { 0 };
+	static uint8_t pool[16384];
+	struct ctl_workspace ws;
+
+	void G(float dw[], float x[], float w[])
+	{
+		dw[0] = w[0] * w[0];
+		for (uint8_t i = 1; i < 4; i++)
+			dw[i] = w[i];
+	}
+
+	ctl_workspace_init(&ws, pool, sizeof(pool));
+	TEST_ASSERT_EQUAL(0, sr_ukf_parameter_estimation_ws(d, what, Re, x, G, 1.0f, Sw, 1.0f, 0.0f,
+							     L, &ws));
+}
+
 /* Octave code:
 
 	%% Example made by Daniel Mårtensson - 2019-10-08